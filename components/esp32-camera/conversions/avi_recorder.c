@@ -0,0 +1,564 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "avi_recorder.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#define TAG ""
+#else
+#include "esp_log.h"
+static const char* TAG = "avi_recorder";
+#endif
+
+// RIFF/hdrl/movi headers of a single MJPEG stream, the movi fourcc is the
+// base of the idx1 offsets
+#define AVI_HEADER_LEN      224
+#define AVI_MOVI_POS        220
+#define AVI_IDX_ENTRY_LEN   16
+#define AVIF_HASINDEX       0x10
+#define AVIIF_KEYFRAME      0x10
+
+#define INDEX_BUFFER_LEN    (256 * AVI_IDX_ENTRY_LEN)
+#define COPY_BUFFER_LEN     1024
+#define JOB_QUEUE_LEN       8
+#define WRITER_STACK        3072
+#define PATH_LEN            64
+
+typedef enum {
+    JOB_OPEN,
+    JOB_DATA,
+    JOB_INDEX,
+    JOB_CLOSE,
+    JOB_EXIT,
+} job_type_t;
+
+typedef struct {
+    uint32_t number;
+    uint16_t width, height;
+    uint32_t frames;
+    uint32_t max_frame;
+    uint32_t movi_len;      // chunks after the movi fourcc
+    int64_t first_us, last_us;
+} avi_segment_t;
+
+typedef struct {
+    job_type_t type;
+    uint8_t *buf;           // DATA and INDEX buffers go back to their free queue
+    size_t len;
+    avi_segment_t segment;  // OPEN and CLOSE
+} job_t;
+
+struct avi_recorder {
+    avi_recorder_config_t config;
+    char dir[PATH_LEN / 2];
+    char prefix[16];
+    QueueHandle_t jobs;
+    QueueHandle_t free_data;
+    QueueHandle_t free_index;
+    SemaphoreHandle_t done;
+    uint8_t *data_bufs[2];
+    uint8_t *index_bufs[2];
+    uint8_t *copy_buf;
+
+    // capture side
+    uint8_t *data;          // buffer being filled, NULL if none is held
+    size_t data_len;
+    uint8_t *index;
+    size_t index_len;
+    bool open;
+    volatile bool split;
+    avi_segment_t segment;
+    uint32_t next_number;
+
+    // writer side
+    FILE *file;
+    FILE *index_file;
+    char path[PATH_LEN];
+    char index_path[PATH_LEN];
+
+    avi_recorder_stats_t stats;
+};
+
+static void *_malloc(size_t size)
+{
+    // check if SPIRAM is enabled and allocate on SPIRAM if allocatable
+#if ((CONFIG_SPIRAM || CONFIG_SPIRAM_SUPPORT) && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
+    void *res = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (res) {
+        return res;
+    }
+#endif
+    return malloc(size);
+}
+
+static inline void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v);
+    put_le16(p + 2, v >> 16);
+}
+
+static inline void put_chunk(uint8_t *p, const char *fourcc, uint32_t len)
+{
+    memcpy(p, fourcc, 4);
+    put_le32(p + 4, len);
+}
+
+static uint32_t segment_file_len(const avi_segment_t *seg)
+{
+    return AVI_HEADER_LEN + seg->movi_len + 8 + seg->frames * AVI_IDX_ENTRY_LEN;
+}
+
+// written with zero counts when the segment is opened and again when it is closed
+static void build_header(uint8_t *h, const avi_segment_t *seg)
+{
+    uint32_t us_per_frame = seg->frames > 1 ? (seg->last_us - seg->first_us) / (seg->frames - 1) : 100000;
+    if (!us_per_frame) {
+        us_per_frame = 1;
+    }
+    memset(h, 0, AVI_HEADER_LEN);
+    put_chunk(h, "RIFF", segment_file_len(seg) - 8);
+    memcpy(h + 8, "AVI ", 4);
+    put_chunk(h + 12, "LIST", AVI_HEADER_LEN - 12 - 8 - 12);
+    memcpy(h + 20, "hdrl", 4);
+
+    uint8_t *avih = h + 24;
+    put_chunk(avih, "avih", 56);
+    put_le32(avih + 8, us_per_frame);
+    put_le32(avih + 12, (uint64_t)seg->max_frame * 1000000 / us_per_frame);
+    put_le32(avih + 20, AVIF_HASINDEX);
+    put_le32(avih + 24, seg->frames);
+    put_le32(avih + 32, 1);
+    put_le32(avih + 36, seg->max_frame + 8);
+    put_le32(avih + 40, seg->width);
+    put_le32(avih + 44, seg->height);
+
+    put_chunk(h + 88, "LIST", 4 + 64 + 48);
+    memcpy(h + 96, "strl", 4);
+    uint8_t *strh = h + 100;
+    put_chunk(strh, "strh", 56);
+    memcpy(strh + 8, "vids", 4);
+    memcpy(strh + 12, "MJPG", 4);
+    put_le32(strh + 28, us_per_frame);
+    put_le32(strh + 32, 1000000);
+    put_le32(strh + 40, seg->frames);
+    put_le32(strh + 44, seg->max_frame + 8);
+    put_le32(strh + 48, 0xFFFFFFFF);
+    put_le16(strh + 60, seg->width);
+    put_le16(strh + 62, seg->height);
+
+    uint8_t *strf = h + 164;
+    put_chunk(strf, "strf", 40);
+    put_le32(strf + 8, 40);
+    put_le32(strf + 12, seg->width);
+    put_le32(strf + 16, seg->height);
+    put_le16(strf + 20, 1);
+    put_le16(strf + 22, 24);
+    memcpy(strf + 24, "MJPG", 4);
+    put_le32(strf + 28, (uint32_t)seg->width * seg->height * 3);
+
+    put_chunk(h + 212, "LIST", 4 + seg->movi_len);
+    memcpy(h + AVI_MOVI_POS, "movi", 4);
+}
+
+/*
+ * Writer task
+ */
+
+static bool write_file(avi_recorder_handle_t rec, FILE *f, const void *buf, size_t len)
+{
+    int64_t t = esp_timer_get_time();
+    bool ok = fwrite(buf, 1, len, f) == len;
+    uint32_t us = esp_timer_get_time() - t;
+    rec->stats.write_us += us;
+    if (us > rec->stats.max_write_us) {
+        rec->stats.max_write_us = us;
+    }
+    if (!ok && !rec->stats.failed) {
+        ESP_LOGE(TAG, "Write to %s failed", rec->path);
+        rec->stats.failed = true;
+    }
+    return ok;
+}
+
+static void close_files(avi_recorder_handle_t rec)
+{
+    if (rec->file) {
+        fclose(rec->file);
+        rec->file = NULL;
+    }
+    if (rec->index_file) {
+        fclose(rec->index_file);
+        rec->index_file = NULL;
+        remove(rec->index_path);
+    }
+}
+
+static void open_segment_files(avi_recorder_handle_t rec, const avi_segment_t *seg)
+{
+    snprintf(rec->path, sizeof(rec->path), "%s/%s%04u.avi", rec->dir, rec->prefix, (unsigned)seg->number);
+    snprintf(rec->index_path, sizeof(rec->index_path), "%s/%s%04u.idx", rec->dir, rec->prefix, (unsigned)seg->number);
+    rec->file = fopen(rec->path, "wb");
+    rec->index_file = fopen(rec->index_path, "wb+");
+    if (!rec->file || !rec->index_file) {
+        ESP_LOGE(TAG, "Failed to create %s", rec->path);
+        rec->stats.failed = true;
+        close_files(rec);
+        return;
+    }
+    // the buffers are the batching, stdio would only copy them again
+    setvbuf(rec->file, NULL, _IONBF, 0);
+    setvbuf(rec->index_file, NULL, _IONBF, 0);
+    ESP_LOGI(TAG, "Recording to %s", rec->path);
+}
+
+// append idx1 from the side file and rewrite the header with the final counts
+static void close_segment_files(avi_recorder_handle_t rec, const avi_segment_t *seg)
+{
+    uint8_t *buf = rec->copy_buf;
+    put_chunk(buf, "idx1", seg->frames * AVI_IDX_ENTRY_LEN);
+    bool ok = write_file(rec, rec->file, buf, 8);
+    rewind(rec->index_file);
+    size_t len;
+    while (ok && (len = fread(buf, 1, COPY_BUFFER_LEN, rec->index_file)) > 0) {
+        ok = write_file(rec, rec->file, buf, len);
+    }
+    if (ok) {
+        build_header(buf, seg);
+        ok = fseek(rec->file, 0, SEEK_SET) == 0 && write_file(rec, rec->file, buf, AVI_HEADER_LEN);
+    }
+    if (ok) {
+        rec->stats.bytes += 8 + seg->frames * AVI_IDX_ENTRY_LEN;
+        rec->stats.segments++;
+        ESP_LOGI(TAG, "Closed %s, %u frames, %u bytes", rec->path, (unsigned)seg->frames, (unsigned)segment_file_len(seg));
+    } else if (!rec->stats.failed) {
+        ESP_LOGE(TAG, "Failed to finish %s", rec->path);
+        rec->stats.failed = true;
+    }
+    close_files(rec);
+}
+
+static void writer_task(void *arg)
+{
+    avi_recorder_handle_t rec = (avi_recorder_handle_t)arg;
+    job_t job;
+    while (true) {
+        xQueueReceive(rec->jobs, &job, portMAX_DELAY);
+        switch (job.type) {
+        case JOB_OPEN:
+            if (!rec->stats.failed) {
+                open_segment_files(rec, &job.segment);
+            }
+            break;
+        case JOB_DATA:
+            if (rec->file && write_file(rec, rec->file, job.buf, job.len)) {
+                rec->stats.bytes += job.len;
+            }
+            xQueueSend(rec->free_data, &job.buf, 0);
+            break;
+        case JOB_INDEX:
+            if (rec->index_file) {
+                write_file(rec, rec->index_file, job.buf, job.len);
+            }
+            xQueueSend(rec->free_index, &job.buf, 0);
+            break;
+        case JOB_CLOSE:
+            if (rec->file && rec->index_file && !rec->stats.failed) {
+                close_segment_files(rec, &job.segment);
+            }
+            close_files(rec);
+            break;
+        case JOB_EXIT:
+            xSemaphoreGive(rec->done);
+            vTaskDelete(NULL);
+            return;
+        }
+    }
+}
+
+/*
+ * Capture side, never waits
+ */
+
+static void post(avi_recorder_handle_t rec, const job_t *job)
+{
+    // the queue holds more jobs than there are buffers and segments in flight
+    if (xQueueSend(rec->jobs, job, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Job queue full");
+    }
+}
+
+static void flush_data(avi_recorder_handle_t rec)
+{
+    if (rec->data && rec->data_len) {
+        job_t job = { .type = JOB_DATA, .buf = rec->data, .len = rec->data_len };
+        post(rec, &job);
+        rec->data = NULL;
+        rec->data_len = 0;
+    }
+}
+
+static void flush_index(avi_recorder_handle_t rec)
+{
+    if (rec->index && rec->index_len) {
+        job_t job = { .type = JOB_INDEX, .buf = rec->index, .len = rec->index_len };
+        post(rec, &job);
+        rec->index = NULL;
+        rec->index_len = 0;
+    }
+}
+
+// the caller made sure that enough free buffers are queued
+static void append(avi_recorder_handle_t rec, const void *src, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)src;
+    while (len) {
+        if (!rec->data) {
+            xQueueReceive(rec->free_data, &rec->data, 0);
+        }
+        size_t n = rec->config.buffer_size - rec->data_len;
+        n = n < len ? n : len;
+        memcpy(rec->data + rec->data_len, p, n);
+        rec->data_len += n;
+        p += n;
+        len -= n;
+        if (rec->data_len == rec->config.buffer_size) {
+            flush_data(rec);
+        }
+    }
+}
+
+static void close_segment(avi_recorder_handle_t rec)
+{
+    flush_data(rec);
+    flush_index(rec);
+    job_t job = { .type = JOB_CLOSE, .segment = rec->segment };
+    post(rec, &job);
+    rec->open = false;
+}
+
+static bool segment_full(avi_recorder_handle_t rec, const camera_fb_t *fb, size_t chunk, int64_t now)
+{
+    const avi_segment_t *seg = &rec->segment;
+    if (fb->width != seg->width || fb->height != seg->height) {
+        return true;
+    }
+    if (rec->config.segment_bytes
+        && segment_file_len(seg) + chunk + AVI_IDX_ENTRY_LEN > rec->config.segment_bytes) {
+        return true;
+    }
+    return rec->config.segment_sec && now - seg->first_us >= (int64_t)rec->config.segment_sec * 1000000;
+}
+
+esp_err_t avi_recorder_add_frame(avi_recorder_handle_t rec, const camera_fb_t *fb)
+{
+    if (rec->stats.failed) {
+        return ESP_FAIL;
+    }
+    if (fb->format != PIXFORMAT_JPEG) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    const size_t chunk = 8 + fb->len + (fb->len & 1);
+    if (AVI_HEADER_LEN + chunk > 2 * rec->config.buffer_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int64_t now = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    if (rec->open && (rec->split || segment_full(rec, fb, chunk, now))) {
+        close_segment(rec);
+    }
+    rec->split = false;
+
+    size_t need = chunk + (rec->open ? 0 : AVI_HEADER_LEN);
+    size_t space = (rec->data ? rec->config.buffer_size - rec->data_len : 0)
+                   + uxQueueMessagesWaiting(rec->free_data) * rec->config.buffer_size;
+    bool index_space = (rec->index && rec->index_len < INDEX_BUFFER_LEN) || uxQueueMessagesWaiting(rec->free_index);
+    if (need > space || !index_space) {
+        rec->stats.dropped++;
+        return ESP_ERR_NO_MEM;
+    }
+
+    avi_segment_t *seg = &rec->segment;
+    if (!rec->open) {
+        memset(seg, 0, sizeof(*seg));
+        seg->number = rec->next_number++;
+        seg->width = fb->width;
+        seg->height = fb->height;
+        seg->first_us = now;
+        job_t job = { .type = JOB_OPEN, .segment = *seg };
+        post(rec, &job);
+        uint8_t header[AVI_HEADER_LEN];
+        build_header(header, seg);
+        append(rec, header, AVI_HEADER_LEN);
+        rec->open = true;
+    }
+
+    uint8_t chunk_header[8];
+    put_chunk(chunk_header, "00dc", fb->len);
+    append(rec, chunk_header, sizeof(chunk_header));
+    append(rec, fb->buf, fb->len);
+    if (fb->len & 1) {
+        append(rec, "", 1);
+    }
+
+    uint8_t entry[AVI_IDX_ENTRY_LEN];
+    put_chunk(entry, "00dc", AVIIF_KEYFRAME);
+    put_le32(entry + 8, seg->movi_len + 4);
+    put_le32(entry + 12, fb->len);
+    if (!rec->index) {
+        xQueueReceive(rec->free_index, &rec->index, 0);
+    }
+    memcpy(rec->index + rec->index_len, entry, AVI_IDX_ENTRY_LEN);
+    rec->index_len += AVI_IDX_ENTRY_LEN;
+    if (rec->index_len == INDEX_BUFFER_LEN) {
+        flush_index(rec);
+    }
+
+    seg->movi_len += chunk;
+    seg->frames++;
+    seg->last_us = now;
+    if (fb->len > seg->max_frame) {
+        seg->max_frame = fb->len;
+    }
+    rec->stats.frames++;
+    return ESP_OK;
+}
+
+void avi_recorder_split(avi_recorder_handle_t handle)
+{
+    handle->split = true;
+}
+
+void avi_recorder_get_stats(avi_recorder_handle_t handle, avi_recorder_stats_t *stats)
+{
+    *stats = handle->stats;
+}
+
+// highest segment number in the directory plus one, so nothing is overwritten
+static uint32_t next_segment_number(avi_recorder_handle_t rec)
+{
+    uint32_t next = 0;
+    DIR *dir = opendir(rec->dir);
+    if (!dir) {
+        return next;
+    }
+    size_t prefix_len = strlen(rec->prefix);
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        unsigned number;
+        if (!strncmp(de->d_name, rec->prefix, prefix_len)
+            && sscanf(de->d_name + prefix_len, "%u.avi", &number) == 1 && number >= next) {
+            next = number + 1;
+        }
+    }
+    closedir(dir);
+    return next;
+}
+
+static void free_recorder(avi_recorder_handle_t rec)
+{
+    for (int i = 0; i < 2; i++) {
+        free(rec->data_bufs[i]);
+        free(rec->index_bufs[i]);
+    }
+    free(rec->copy_buf);
+    if (rec->jobs) {
+        vQueueDelete(rec->jobs);
+    }
+    if (rec->free_data) {
+        vQueueDelete(rec->free_data);
+    }
+    if (rec->free_index) {
+        vQueueDelete(rec->free_index);
+    }
+    if (rec->done) {
+        vSemaphoreDelete(rec->done);
+    }
+    free(rec);
+}
+
+esp_err_t avi_recorder_start(const avi_recorder_config_t *config, avi_recorder_handle_t *handle)
+{
+    if (!config || !handle || !config->dir || !config->prefix || config->buffer_size < AVI_HEADER_LEN
+        || strlen(config->dir) >= sizeof(((struct avi_recorder *)0)->dir)
+        || strlen(config->prefix) >= sizeof(((struct avi_recorder *)0)->prefix)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    avi_recorder_handle_t rec = calloc(1, sizeof(struct avi_recorder));
+    if (!rec) {
+        return ESP_ERR_NO_MEM;
+    }
+    rec->config = *config;
+    strcpy(rec->dir, config->dir);
+    strcpy(rec->prefix, config->prefix);
+    rec->config.dir = rec->dir;
+    rec->config.prefix = rec->prefix;
+
+    rec->jobs = xQueueCreate(JOB_QUEUE_LEN, sizeof(job_t));
+    rec->free_data = xQueueCreate(2, sizeof(uint8_t *));
+    rec->free_index = xQueueCreate(2, sizeof(uint8_t *));
+    rec->done = xSemaphoreCreateBinary();
+    rec->copy_buf = malloc(COPY_BUFFER_LEN);
+    bool ok = rec->jobs && rec->free_data && rec->free_index && rec->done && rec->copy_buf;
+    for (int i = 0; ok && i < 2; i++) {
+        rec->data_bufs[i] = _malloc(config->buffer_size);
+        rec->index_bufs[i] = _malloc(INDEX_BUFFER_LEN);
+        ok = rec->data_bufs[i] && rec->index_bufs[i];
+        if (ok) {
+            xQueueSend(rec->free_data, &rec->data_bufs[i], 0);
+            xQueueSend(rec->free_index, &rec->index_bufs[i], 0);
+        }
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to allocate %u byte write buffers", (unsigned)config->buffer_size);
+        free_recorder(rec);
+        return ESP_ERR_NO_MEM;
+    }
+    rec->next_number = next_segment_number(rec);
+    if (xTaskCreatePinnedToCore(writer_task, "avi_writer", WRITER_STACK, rec, config->task_priority, NULL, config->task_core) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the writer task");
+        free_recorder(rec);
+        return ESP_ERR_NO_MEM;
+    }
+    *handle = rec;
+    return ESP_OK;
+}
+
+esp_err_t avi_recorder_stop(avi_recorder_handle_t rec)
+{
+    if (rec->open) {
+        close_segment(rec);
+    }
+    job_t job = { .type = JOB_EXIT };
+    xQueueSend(rec->jobs, &job, portMAX_DELAY);
+    xSemaphoreTake(rec->done, portMAX_DELAY);
+    esp_err_t err = rec->stats.failed ? ESP_FAIL : ESP_OK;
+    free_recorder(rec);
+    return err;
+}
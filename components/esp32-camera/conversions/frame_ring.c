@@ -0,0 +1,306 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "frame_ring.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#define TAG ""
+#else
+#include "esp_log.h"
+static const char* TAG = "frame_ring";
+#endif
+
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+    int64_t timestamp;
+    uint32_t seq;
+    uint16_t width;
+    uint16_t height;
+} ring_entry_t;
+
+struct frame_ring {
+    frame_ring_config_t config;
+    SemaphoreHandle_t lock;
+    uint8_t *data;
+    ring_entry_t *entries;      // circular, max_frames long
+    uint16_t first;             // entry of the oldest frame
+    uint16_t count;
+    uint32_t first_seq;         // sequence number of the oldest frame
+    size_t head;                // where the newest frame ends
+    size_t bytes;
+
+    frame_ring_state_t state;
+    int64_t trigger_us;
+    uint32_t clip_first;        // sequence numbers of the clip, clip_end is
+    uint32_t clip_end;          // exclusive and follows the newest frame while triggered
+    uint16_t readers;           // holds on the clip
+
+    uint32_t frames;
+    uint32_t dropped;
+};
+
+static void *_malloc(size_t size)
+{
+    // check if SPIRAM is enabled and allocate on SPIRAM if allocatable
+#if ((CONFIG_SPIRAM || CONFIG_SPIRAM_SUPPORT) && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
+    void *res = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (res) {
+        return res;
+    }
+#endif
+    return malloc(size);
+}
+
+static ring_entry_t *get_entry(struct frame_ring *ring, uint32_t seq)
+{
+    return &ring->entries[(ring->first + (seq - ring->first_seq)) % ring->config.max_frames];
+}
+
+// The frames occupy [tail, head) or, once wrapped, [tail, end) and [0, head).
+// A frame that does not fit behind the newest one starts over at 0, leaving
+// the rest of the buffer unused until the ring wraps again.
+static bool find_space(struct frame_ring *ring, size_t len, size_t *offset)
+{
+    if (!ring->count) {
+        *offset = 0;
+        return true;
+    }
+    if (ring->count == ring->config.max_frames) {
+        return false;
+    }
+    size_t tail = ring->entries[ring->first].offset;
+    if (ring->head > tail) {
+        if (len <= ring->config.size - ring->head) {
+            *offset = ring->head;
+            return true;
+        }
+        if (len <= tail) {
+            *offset = 0;
+            return true;
+        }
+        return false;
+    }
+    if (len <= tail - ring->head) {
+        *offset = ring->head;
+        return true;
+    }
+    return false;
+}
+
+static void drop_oldest(struct frame_ring *ring)
+{
+    ring->bytes -= ring->entries[ring->first].len;
+    ring->first = (ring->first + 1) % ring->config.max_frames;
+    ring->first_seq++;
+    ring->count--;
+}
+
+esp_err_t frame_ring_create(const frame_ring_config_t *config, frame_ring_handle_t *handle)
+{
+    if (!config || !handle || !config->size || !config->max_frames) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct frame_ring *ring = calloc(1, sizeof(struct frame_ring));
+    if (!ring) {
+        return ESP_ERR_NO_MEM;
+    }
+    ring->config = *config;
+    ring->lock = xSemaphoreCreateMutex();
+    ring->entries = calloc(config->max_frames, sizeof(ring_entry_t));
+    ring->data = _malloc(config->size);
+    if (!ring->lock || !ring->entries || !ring->data) {
+        ESP_LOGE(TAG, "Ring malloc failed (%u bytes, %u frames)", (unsigned)config->size, config->max_frames);
+        frame_ring_delete(ring);
+        return ESP_ERR_NO_MEM;
+    }
+    *handle = ring;
+    return ESP_OK;
+}
+
+void frame_ring_delete(frame_ring_handle_t handle)
+{
+    if (!handle) {
+        return;
+    }
+    if (handle->lock) {
+        vSemaphoreDelete(handle->lock);
+    }
+    free(handle->entries);
+    free(handle->data);
+    free(handle);
+}
+
+esp_err_t frame_ring_add(frame_ring_handle_t handle, const camera_fb_t *fb)
+{
+    struct frame_ring *ring = handle;
+    if (fb->format != PIXFORMAT_JPEG) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (!fb->len || fb->len > ring->config.size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int64_t timestamp = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    if (ring->state == FRAME_RING_TRIGGERED && timestamp > ring->trigger_us + (int64_t)ring->config.post_ms * 1000) {
+        ring->state = FRAME_RING_CLIP_READY;
+    }
+    size_t offset;
+    while (!find_space(ring, fb->len, &offset)) {
+        if (ring->state != FRAME_RING_IDLE && ring->first_seq == ring->clip_first) {
+            ret = ESP_ERR_NO_MEM;
+            break;
+        }
+        drop_oldest(ring);
+    }
+    if (ret == ESP_OK) {
+        memcpy(ring->data + offset, fb->buf, fb->len);
+        ring_entry_t *e = &ring->entries[(ring->first + ring->count) % ring->config.max_frames];
+        e->offset = offset;
+        e->len = fb->len;
+        e->timestamp = timestamp;
+        e->seq = fb->seq;
+        e->width = fb->width;
+        e->height = fb->height;
+        ring->count++;
+        ring->head = offset + fb->len;
+        ring->bytes += fb->len;
+        ring->frames++;
+        if (ring->state == FRAME_RING_TRIGGERED) {
+            ring->clip_end = ring->first_seq + ring->count;
+        }
+    } else {
+        ring->dropped++;
+        if (ring->state == FRAME_RING_TRIGGERED) {
+            ESP_LOGW(TAG, "Clip cut short, it fills the ring");
+            ring->state = FRAME_RING_CLIP_READY;
+        }
+    }
+    xSemaphoreGive(ring->lock);
+    return ret;
+}
+
+esp_err_t frame_ring_trigger(frame_ring_handle_t handle, int64_t time_us)
+{
+    struct frame_ring *ring = handle;
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    if (ring->state != FRAME_RING_IDLE) {
+        xSemaphoreGive(ring->lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    int64_t start = time_us - (int64_t)ring->config.pre_ms * 1000;
+    int64_t end = time_us + (int64_t)ring->config.post_ms * 1000;
+    uint32_t last = ring->first_seq + ring->count;
+    uint32_t seq = ring->first_seq;
+    while (seq != last && get_entry(ring, seq)->timestamp < start) {
+        seq++;
+    }
+    ring->clip_first = seq;
+    while (seq != last && get_entry(ring, seq)->timestamp <= end) {
+        seq++;
+    }
+    ring->clip_end = seq;
+    ring->trigger_us = time_us;
+    // an event far enough in the past has its post-roll in the ring already
+    ring->state = seq == last ? FRAME_RING_TRIGGERED : FRAME_RING_CLIP_READY;
+    xSemaphoreGive(ring->lock);
+    return ESP_OK;
+}
+
+frame_ring_state_t frame_ring_get_clip(frame_ring_handle_t handle, frame_ring_clip_t *clip)
+{
+    struct frame_ring *ring = handle;
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    frame_ring_state_t state = ring->state;
+    if (clip) {
+        memset(clip, 0, sizeof(frame_ring_clip_t));
+        clip->state = state;
+        if (state != FRAME_RING_IDLE) {
+            clip->trigger_us = ring->trigger_us;
+            clip->frames = ring->clip_end - ring->clip_first;
+            for (uint32_t seq = ring->clip_first; seq != ring->clip_end; seq++) {
+                clip->bytes += get_entry(ring, seq)->len;
+            }
+        }
+    }
+    xSemaphoreGive(ring->lock);
+    return state;
+}
+
+esp_err_t frame_ring_get_clip_frame(frame_ring_handle_t handle, uint32_t index, frame_ring_frame_t *frame)
+{
+    struct frame_ring *ring = handle;
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    if (ring->state == FRAME_RING_IDLE) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else if (index >= ring->clip_end - ring->clip_first) {
+        ret = ESP_ERR_NOT_FOUND;
+    } else {
+        const ring_entry_t *e = get_entry(ring, ring->clip_first + index);
+        frame->buf = ring->data + e->offset;
+        frame->len = e->len;
+        frame->timestamp = e->timestamp;
+        frame->seq = e->seq;
+        frame->width = e->width;
+        frame->height = e->height;
+    }
+    xSemaphoreGive(ring->lock);
+    return ret;
+}
+
+esp_err_t frame_ring_hold(frame_ring_handle_t handle)
+{
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    if (handle->state == FRAME_RING_IDLE) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        handle->readers++;
+    }
+    xSemaphoreGive(handle->lock);
+    return ret;
+}
+
+void frame_ring_release(frame_ring_handle_t handle)
+{
+    xSemaphoreTake(handle->lock, portMAX_DELAY);
+    if (handle->readers) {
+        handle->readers--;
+    }
+    if (!handle->readers) {
+        handle->state = FRAME_RING_IDLE;
+    }
+    xSemaphoreGive(handle->lock);
+}
+
+void frame_ring_get_stats(frame_ring_handle_t handle, frame_ring_stats_t *stats)
+{
+    struct frame_ring *ring = handle;
+    xSemaphoreTake(ring->lock, portMAX_DELAY);
+    stats->frames = ring->frames;
+    stats->dropped = ring->dropped;
+    stats->count = ring->count;
+    stats->bytes = ring->bytes;
+    stats->oldest_us = ring->count ? ring->entries[ring->first].timestamp : 0;
+    xSemaphoreGive(ring->lock);
+}
@@ -0,0 +1,110 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stddef.h>
+#include <stdlib.h>
+#include "img_converters.h"
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#define TAG ""
+#else
+#include "esp_log.h"
+static const char* TAG = "img_arena";
+#endif
+
+#define ARENA_ALIGN 4
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t used;
+} arena_region_t;
+
+struct img_arena {
+    arena_region_t region[2];   // indexed by img_arena_mem_t
+};
+
+static void *_malloc_bulk(size_t size)
+{
+    // check if SPIRAM is enabled and allocate on SPIRAM if allocatable
+#if ((CONFIG_SPIRAM || CONFIG_SPIRAM_SUPPORT) && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
+    void *res = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (res) {
+        return res;
+    }
+#endif
+    return malloc(size);
+}
+
+img_arena_t *img_arena_create(size_t internal_size, size_t bulk_size)
+{
+    img_arena_t *arena = calloc(1, sizeof(img_arena_t));
+    if (!arena) {
+        return NULL;
+    }
+    arena_region_t *internal = &arena->region[IMG_ARENA_INTERNAL];
+    arena_region_t *bulk = &arena->region[IMG_ARENA_BULK];
+    if (internal_size) {
+        internal->buf = heap_caps_malloc(internal_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        internal->size = internal_size;
+    }
+    if (bulk_size) {
+        bulk->buf = _malloc_bulk(bulk_size);
+        bulk->size = bulk_size;
+    }
+    if ((internal_size && !internal->buf) || (bulk_size && !bulk->buf)) {
+        ESP_LOGE(TAG, "Arena malloc failed (%u internal, %u bulk)", (unsigned)internal_size, (unsigned)bulk_size);
+        img_arena_free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+void img_arena_free(img_arena_t *arena)
+{
+    if (!arena) {
+        return;
+    }
+    free(arena->region[IMG_ARENA_INTERNAL].buf);
+    free(arena->region[IMG_ARENA_BULK].buf);
+    free(arena);
+}
+
+void img_arena_reset(img_arena_t *arena)
+{
+    arena->region[IMG_ARENA_INTERNAL].used = 0;
+    arena->region[IMG_ARENA_BULK].used = 0;
+}
+
+void *img_arena_alloc(img_arena_t *arena, img_arena_mem_t mem, size_t size)
+{
+    arena_region_t *r = &arena->region[mem];
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size > r->size - r->used) {
+        ESP_LOGE(TAG, "%s region exhausted: %u bytes requested, %u free", mem == IMG_ARENA_INTERNAL ? "Internal" : "Bulk",
+                 (unsigned)size, (unsigned)(r->size - r->used));
+        return NULL;
+    }
+    void *p = r->buf + r->used;
+    r->used += size;
+    return p;
+}
+
+size_t img_arena_available(const img_arena_t *arena, img_arena_mem_t mem)
+{
+    // rounded down so that all of it can be passed to img_arena_alloc()
+    return (arena->region[mem].size - arena->region[mem].used) & ~(size_t)(ARENA_ALIGN - 1);
+}
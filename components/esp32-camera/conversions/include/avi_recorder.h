@@ -0,0 +1,132 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef _AVI_RECORDER_H_
+#define _AVI_RECORDER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+
+/*
+ * MJPEG AVI recorder.
+ *
+ * JPEG frames are appended to one of two write buffers by the capturing task,
+ * which only copies memory and never waits for the file system. Full buffers
+ * are written in one piece by a writer task, so the file grows in whole
+ * buffers. The idx1 entries are collected the same way into a side file next
+ * to the segment and copied behind the movi list when the segment is closed,
+ * so the index needs constant memory however long the segment is. A frame
+ * that finds no free buffer is dropped and counted.
+ *
+ * Segments are named <dir>/<prefix>NNNN.avi, numbered on from the highest
+ * existing segment, and any file system mounted in the VFS can hold them
+ * (FAT on SPI flash or SD card, LittleFS, SPIFFS).
+ */
+
+typedef struct {
+    const char *dir;            /*!< Directory of the segments, e.g. the mount point */
+    const char *prefix;         /*!< File name prefix of the segments */
+    size_t segment_bytes;       /*!< A new segment is started before this size is exceeded, 0 for no limit */
+    uint32_t segment_sec;       /*!< A new segment is started after this many seconds, 0 for no limit */
+    size_t buffer_size;         /*!< Size of each of the two write buffers, ideally a multiple of the sector size */
+    uint8_t task_priority;      /*!< Priority of the writer task */
+    BaseType_t task_core;       /*!< Core of the writer task, tskNO_AFFINITY for any */
+} avi_recorder_config_t;
+
+#define AVI_RECORDER_CONFIG_DEFAULT() { \
+    .dir = "/storage",              \
+    .prefix = "rec",                \
+    .segment_bytes = 4 * 1024 * 1024, \
+    .segment_sec = 300,             \
+    .buffer_size = 32 * 1024,       \
+    .task_priority = 3,             \
+    .task_core = tskNO_AFFINITY,    \
+}
+
+typedef struct {
+    uint32_t frames;            /*!< Frames accepted */
+    uint32_t dropped;           /*!< Frames dropped because no buffer was free */
+    uint32_t segments;          /*!< Segments completed */
+    uint64_t bytes;             /*!< Bytes written, including headers and indexes */
+    uint64_t write_us;          /*!< Time spent in file system writes */
+    uint32_t max_write_us;      /*!< Longest single buffer write */
+    bool failed;                /*!< A file system error stopped the recording */
+} avi_recorder_stats_t;
+
+typedef struct avi_recorder *avi_recorder_handle_t;
+
+/**
+ * @brief Allocate the buffers and start the writer task
+ *
+ * The first segment is opened with the first frame.
+ *
+ * @param config    Recorder configuration
+ * @param handle    Returned recorder handle
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *     - ESP_ERR_NO_MEM if the buffers or the task could not be allocated
+ */
+esp_err_t avi_recorder_start(const avi_recorder_config_t *config, avi_recorder_handle_t *handle);
+
+/**
+ * @brief Append a frame, without blocking
+ *
+ * The frame is copied and can be returned right after the call. Its
+ * timestamp sets the frame rate in the header of the segment.
+ *
+ * @param handle    Recorder handle
+ * @param fb        JPEG frame
+ *
+ * @return
+ *     - ESP_OK if the frame was added
+ *     - ESP_ERR_NOT_SUPPORTED if the frame is not a JPEG
+ *     - ESP_ERR_INVALID_SIZE if the frame is larger than both buffers
+ *     - ESP_ERR_NO_MEM if the frame was dropped because no buffer was free
+ *     - ESP_FAIL if the recording stopped after a file system error
+ */
+esp_err_t avi_recorder_add_frame(avi_recorder_handle_t handle, const camera_fb_t *fb);
+
+/**
+ * @brief Close the current segment and start the next one with the next frame
+ */
+void avi_recorder_split(avi_recorder_handle_t handle);
+
+/**
+ * @brief Read the recorder statistics
+ */
+void avi_recorder_get_stats(avi_recorder_handle_t handle, avi_recorder_stats_t *stats);
+
+/**
+ * @brief Finish the last segment, wait for the writer and release everything
+ *
+ * @return
+ *     - ESP_OK if all segments were written
+ *     - ESP_FAIL if a file system error stopped the recording
+ */
+esp_err_t avi_recorder_stop(avi_recorder_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVI_RECORDER_H_ */
@@ -0,0 +1,186 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef _FRAME_RING_H_
+#define _FRAME_RING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+
+/*
+ * Pre-event ring of JPEG frames.
+ *
+ * Frames are copied back to back into one buffer, preferably in PSRAM, each
+ * taking its JPEG length rather than a fixed slot. The oldest frames are
+ * dropped to make room for new ones, so the ring holds as many of the latest
+ * frames as fit and appending costs one copy of the frame.
+ *
+ * A trigger marks an event. The frames from pre_ms before the event up to
+ * post_ms after it form a clip, which the ring keeps until it is released:
+ * older frames can still be dropped, but new frames only take the space the
+ * clip leaves free and are dropped once it is full. The clip frames can be
+ * read while the post-roll is still being added. Each reader holds the clip,
+ * it is released when the last of them is done.
+ */
+
+typedef struct {
+    size_t size;            /*!< Bytes of JPEG data the ring holds */
+    uint16_t max_frames;    /*!< Frames the ring holds at most */
+    uint32_t pre_ms;        /*!< Clips start this long before the trigger */
+    uint32_t post_ms;       /*!< Clips end this long after the trigger */
+} frame_ring_config_t;
+
+#define FRAME_RING_CONFIG_DEFAULT() { \
+    .size = 2 * 1024 * 1024,    \
+    .max_frames = 256,          \
+    .pre_ms = 1500,             \
+    .post_ms = 1000,            \
+}
+
+typedef enum {
+    FRAME_RING_IDLE,        /*!< No clip, frames are recorded as pre-roll */
+    FRAME_RING_TRIGGERED,   /*!< The post-roll of a clip is being added */
+    FRAME_RING_CLIP_READY,  /*!< The clip is complete and kept until released */
+} frame_ring_state_t;
+
+typedef struct {
+    frame_ring_state_t state;
+    int64_t trigger_us;     /*!< Time of the trigger */
+    uint32_t frames;        /*!< Frames in the clip so far */
+    size_t bytes;           /*!< JPEG bytes in the clip so far */
+} frame_ring_clip_t;
+
+typedef struct {
+    const uint8_t *buf;     /*!< JPEG data in the ring */
+    size_t len;
+    int64_t timestamp;      /*!< Capture time in microseconds since boot */
+    uint32_t seq;           /*!< Sequence number of the camera frame */
+    uint16_t width;
+    uint16_t height;
+} frame_ring_frame_t;
+
+typedef struct {
+    uint32_t frames;        /*!< Frames added */
+    uint32_t dropped;       /*!< Frames dropped because a clip filled the ring */
+    uint16_t count;         /*!< Frames in the ring */
+    size_t bytes;           /*!< JPEG bytes in the ring */
+    int64_t oldest_us;      /*!< Capture time of the oldest frame, the pre-roll reaches back to it */
+} frame_ring_stats_t;
+
+typedef struct frame_ring *frame_ring_handle_t;
+
+/**
+ * @brief Create a frame ring
+ *
+ * @param config    Ring configuration
+ * @param handle    Returned ring handle
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *     - ESP_ERR_NO_MEM if the ring could not be allocated
+ */
+esp_err_t frame_ring_create(const frame_ring_config_t *config, frame_ring_handle_t *handle);
+
+/**
+ * @brief Delete a frame ring and release its memory
+ */
+void frame_ring_delete(frame_ring_handle_t handle);
+
+/**
+ * @brief Copy a frame into the ring, dropping the oldest frames if needed
+ *
+ * @param handle    Ring handle
+ * @param fb        JPEG frame
+ *
+ * @return
+ *     - ESP_OK if the frame was added
+ *     - ESP_ERR_NOT_SUPPORTED if the frame is not a JPEG
+ *     - ESP_ERR_INVALID_SIZE if the frame is larger than the ring
+ *     - ESP_ERR_NO_MEM if the frame was dropped because a clip fills the ring
+ */
+esp_err_t frame_ring_add(frame_ring_handle_t handle, const camera_fb_t *fb);
+
+/**
+ * @brief Start a clip around an event
+ *
+ * Frames already in the ring from pre_ms before the event on become the
+ * pre-roll, frames added up to post_ms after it the post-roll.
+ *
+ * @param handle    Ring handle
+ * @param time_us   Time of the event in microseconds since boot, on the clock
+ *                  of the frame timestamps, e.g. esp_timer_get_time()
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_STATE if a clip is held
+ */
+esp_err_t frame_ring_trigger(frame_ring_handle_t handle, int64_t time_us);
+
+/**
+ * @brief Read the state of the clip
+ *
+ * @return The state, also stored in clip if it is not NULL
+ */
+frame_ring_state_t frame_ring_get_clip(frame_ring_handle_t handle, frame_ring_clip_t *clip);
+
+/**
+ * @brief Read a frame of the clip
+ *
+ * The frame data stays valid until the clip is released.
+ *
+ * @param handle    Ring handle
+ * @param index     Frame of the clip, 0 is the first of the pre-roll
+ * @param frame     Returned frame
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_STATE if there is no clip
+ *     - ESP_ERR_NOT_FOUND if the clip has no such frame (yet)
+ */
+esp_err_t frame_ring_get_clip_frame(frame_ring_handle_t handle, uint32_t index, frame_ring_frame_t *frame);
+
+/**
+ * @brief Keep the clip for a reader until it calls frame_ring_release()
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_STATE if there is no clip
+ */
+esp_err_t frame_ring_hold(frame_ring_handle_t handle);
+
+/**
+ * @brief Drop a hold on the clip
+ *
+ * The last hold, or a call without any, releases the clip and its frames
+ * become pre-roll again.
+ */
+void frame_ring_release(frame_ring_handle_t handle);
+
+/**
+ * @brief Read the ring statistics
+ */
+void frame_ring_get_stats(frame_ring_handle_t handle, frame_ring_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FRAME_RING_H_ */
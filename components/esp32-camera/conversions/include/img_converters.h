@@ -83,6 +83,143 @@ bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixf
  */
 bool frame2jpg(camera_fb_t * fb, uint8_t quality, uint8_t ** out, size_t * out_len);
 
+/**
+ * @brief Scratch memory for conversions, see img_arena_create()
+ */
+typedef struct img_arena img_arena_t;
+
+/**
+ * @brief Arena region, selects where a buffer is placed
+ */
+typedef enum {
+    IMG_ARENA_INTERNAL,     /*!< Internal RAM, for the line and MCU buffers the inner loops work on */
+    IMG_ARENA_BULK,         /*!< PSRAM if available, for output buffers */
+} img_arena_mem_t;
+
+/**
+ * @brief Create an arena that conversions take their buffers from instead of the heap
+ *
+ * Both regions are allocated once. Buffers are never freed one by one, the
+ * whole arena is reset with img_arena_reset(), typically once per frame.
+ * A region that is too small makes the conversion fail, it never falls back
+ * to another kind of memory.
+ *
+ * @param internal_size Size of the internal RAM region. fmt2jpg_arena() needs
+ *                      width * 3 * 17 bytes for color images, width * 9 for GRAYSCALE,
+ *                      with the width rounded up to 16
+ * @param bulk_size     Size of the bulk region
+ *
+ * @return the arena, or NULL if out of memory
+ */
+img_arena_t *img_arena_create(size_t internal_size, size_t bulk_size);
+
+/**
+ * @brief Free an arena and its regions
+ */
+void img_arena_free(img_arena_t *arena);
+
+/**
+ * @brief Release all buffers taken from the arena
+ */
+void img_arena_reset(img_arena_t *arena);
+
+/**
+ * @brief Take a buffer from a region of the arena
+ *
+ * @return the 4 byte aligned buffer, or NULL if the region is exhausted
+ */
+void *img_arena_alloc(img_arena_t *arena, img_arena_mem_t mem, size_t size);
+
+/**
+ * @brief Free bytes left in a region of the arena
+ */
+size_t img_arena_available(const img_arena_t *arena, img_arena_mem_t mem);
+
+/**
+ * @brief Convert image buffer to JPEG buffer without touching the heap
+ *
+ * Same output as fmt2jpg(). The line and MCU buffers come from the internal
+ * region and the JPEG is written to the rest of the bulk region.
+ *
+ * @param arena     Arena for all buffers
+ * @param src       Source buffer in RGB565, RGB888, YUYV or GRAYSCALE format
+ * @param src_len   Length in bytes of the source buffer
+ * @param width     Width in pixels of the source image
+ * @param height    Height in pixels of the source image
+ * @param format    Format of the source image
+ * @param quality   JPEG quality of the resulting image
+ * @param out       Pointer to be populated with the address of the JPEG, valid until the arena is reset
+ * @param out_len   Pointer to be populated with the length of the JPEG
+ *
+ * @return true on success, false if a region is too small
+ */
+bool fmt2jpg_arena(img_arena_t *arena, uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality,
+                   uint8_t ** out, size_t * out_len);
+
+/**
+ * @brief Convert camera frame buffer to JPEG buffer without touching the heap, see fmt2jpg_arena()
+ */
+bool frame2jpg_arena(img_arena_t *arena, camera_fb_t * fb, uint8_t quality, uint8_t ** out, size_t * out_len);
+
+/**
+ * @brief Line by line JPEG encoder, see jpg_stream_create()
+ */
+typedef struct jpg_stream jpg_stream_t;
+
+/**
+ * @brief Create an encoder that takes the source image in pieces, e.g. while it is captured
+ *
+ * Every MCU row (8 or 16 lines) is encoded as soon as its last line has been
+ * written, so the JPEG is complete right after the last line and the source
+ * never has to be held in memory as a whole. The encoder is reused for any
+ * number of frames of the same size and format.
+ *
+ * @param width     Width in pixels of the source image
+ * @param height    Height in pixels of the source image
+ * @param format    Format of the source image: RGB565, RGB888, YUV422 or GRAYSCALE
+ * @param quality   JPEG quality of the resulting image
+ *
+ * @return the encoder, or NULL if out of memory or the format is not supported
+ */
+jpg_stream_t *jpg_stream_create(uint16_t width, uint16_t height, pixformat_t format, uint8_t quality);
+
+/**
+ * @brief Free an encoder created by jpg_stream_create()
+ */
+void jpg_stream_free(jpg_stream_t *stream);
+
+/**
+ * @brief Start encoding a frame
+ *
+ * @param stream    Encoder
+ * @param out       Output buffer for the JPEG
+ * @param out_len   Size of the output buffer
+ *
+ * @return true on success
+ */
+bool jpg_stream_begin(jpg_stream_t *stream, uint8_t *out, size_t out_len);
+
+/**
+ * @brief Add source data to the frame
+ *
+ * @param stream    Encoder
+ * @param src       Pixel data, continuing where the previous call stopped. Lines may be split between calls
+ * @param len       Length in bytes of the data
+ *
+ * @return false if the output buffer is full, the frame has more lines than expected or the frame already failed
+ */
+bool jpg_stream_write(jpg_stream_t *stream, const uint8_t *src, size_t len);
+
+/**
+ * @brief Finish the frame
+ *
+ * @param stream    Encoder
+ * @param out_len   Pointer to be populated with the length of the JPEG
+ *
+ * @return true if all lines of the frame were written and the JPEG fit into the output buffer
+ */
+bool jpg_stream_end(jpg_stream_t *stream, size_t *out_len);
+
 /**
  * @brief Convert image buffer to BMP buffer
  *
@@ -129,6 +266,212 @@ bool fmt2rgb888(const uint8_t *src_buf, size_t src_len, pixformat_t format, uint
 #define JPG_SCALE_MAX  JPEG_IMAGE_SCALE_1_8
 bool jpg2rgb565(const uint8_t *src, size_t src_len, uint8_t * out, esp_jpeg_image_scale_t scale);
 
+/**
+ * @brief JPEG decoder context
+ *
+ * Holds the decoder work buffer, the BMP output buffer and the header layout
+ * of the last frame. Decodes using different contexts can run concurrently;
+ * a single context must not be used by two tasks at the same time.
+ */
+typedef struct jpg_dec_ctx jpg_dec_ctx_t;
+
+/**
+ * @brief Create a JPEG decoder context
+ *
+ * @param work_buf  Caller owned work buffer of at least 3100 bytes, or NULL to allocate one in internal RAM
+ * @param work_size Size of work_buf
+ *
+ * @return the context, or NULL if out of memory
+ */
+jpg_dec_ctx_t *jpg_dec_ctx_create(uint8_t *work_buf, size_t work_size);
+
+/**
+ * @brief Free a JPEG decoder context and the buffers it allocated
+ */
+void jpg_dec_ctx_free(jpg_dec_ctx_t *ctx);
+
+/**
+ * @brief Decode JPEG to RGB565 using a decoder context
+ *
+ * @param ctx       Decoder context
+ * @param src       JPEG data
+ * @param src_len   Length of the JPEG data
+ * @param out       Output buffer
+ * @param out_len   Size of the output buffer
+ * @param scale     Output scale
+ *
+ * @return true on success
+ */
+bool jpg2rgb565_ctx(jpg_dec_ctx_t *ctx, const uint8_t *src, size_t src_len, uint8_t *out, size_t out_len, esp_jpeg_image_scale_t scale);
+
+/**
+ * @brief Decode JPEG to RGB888 (BGR byte order) using a decoder context
+ *
+ * @see jpg2rgb565_ctx
+ */
+bool jpg2rgb888_ctx(jpg_dec_ctx_t *ctx, const uint8_t *src, size_t src_len, uint8_t *out, size_t out_len, esp_jpeg_image_scale_t scale);
+
+/**
+ * @brief Decode JPEG to BMP using a decoder context
+ *
+ * The BMP is written to a buffer owned by the context, which is reused (and
+ * grown when needed) by the next call. Do not free it.
+ *
+ * @param ctx       Decoder context
+ * @param src       JPEG data
+ * @param src_len   Length of the JPEG data
+ * @param out       Pointer to be populated with the address of the BMP
+ * @param out_len   Pointer to be populated with the length of the BMP
+ *
+ * @return true on success
+ */
+bool jpg2bmp_ctx(jpg_dec_ctx_t *ctx, const uint8_t *src, size_t src_len, uint8_t ** out, size_t * out_len);
+
+/**
+ * @brief Decode the luma of a JPEG to a GRAYSCALE buffer
+ *
+ * Chroma is entropy decoded but never transformed or colour converted, which
+ * makes this much cheaper than a colour decode when only brightness is needed.
+ * JPEG_IMAGE_SCALE_1_8 takes the block means straight from the DC coefficients
+ * and runs no IDCT at all.
+ *
+ * Only baseline and extended sequential JPEGs (as produced by the sensors
+ * and by jpge) are supported.
+ *
+ * @param src       JPEG data
+ * @param src_len   Length of the JPEG data
+ * @param out       Output buffer, or NULL to only return the output size
+ * @param out_len   Size of the output buffer
+ * @param scale     Output scale, JPEG_IMAGE_SCALE_0 to JPEG_IMAGE_SCALE_1_8
+ * @param width     Optional, populated with the output width (source width / scale, rounded up)
+ * @param height    Optional, populated with the output height (source height / scale, rounded up)
+ *
+ * @return true on success
+ */
+bool jpg2gray(const uint8_t *src, size_t src_len, uint8_t *out, size_t out_len, esp_jpeg_image_scale_t scale,
+              uint16_t *width, uint16_t *height);
+
+/**
+ * @brief Lossless JPEG transforms, see jpg_transform()
+ */
+typedef enum {
+    JPG_TRANSFORM_NONE = 0,         /*!< Only crop */
+    JPG_TRANSFORM_HFLIP = 1,        /*!< Mirror left to right */
+    JPG_TRANSFORM_VFLIP = 2,        /*!< Mirror top to bottom */
+    JPG_TRANSFORM_ROT_180 = 3,      /*!< Rotate by 180 degrees */
+    JPG_TRANSFORM_TRANSPOSE = 4,    /*!< Mirror across the top left to bottom right diagonal */
+    JPG_TRANSFORM_ROT_90 = 5,       /*!< Rotate by 90 degrees clockwise */
+    JPG_TRANSFORM_ROT_270 = 6,      /*!< Rotate by 90 degrees counterclockwise */
+    JPG_TRANSFORM_TRANSVERSE = 7,   /*!< Mirror across the top right to bottom left diagonal */
+} jpg_transform_t;
+
+/**
+ * @brief Crop rectangle in pixels of the transformed image
+ */
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+} jpg_crop_t;
+
+/**
+ * @brief Flip, rotate and/or crop a JPEG without decoding it
+ *
+ * The quantized DCT coefficients are rearranged and entropy coded again, so
+ * the result has exactly the quality of the source and costs a fraction of
+ * a decode and encode. Works on baseline JPEGs with 1x1 sampled chroma that
+ * shares one quantization table, as produced by the sensors and by jpge.
+ *
+ * Transforms work on whole MCUs (8 or 16 pixels per side depending on the
+ * chroma subsampling): when a flipped edge is not MCU aligned the partial
+ * MCU is dropped, and the crop origin is moved to the MCU grid, growing the
+ * crop so that its right and bottom edges stay in place.
+ *
+ * @param src       JPEG data
+ * @param src_len   Length of the JPEG data
+ * @param transform Transform to apply
+ * @param crop      Optional crop of the transformed image, NULL for the whole image
+ * @param out       Pointer to be populated with the address of the resulting buffer.
+ *                  You MUST free the pointer once you are done with it.
+ * @param out_len   Pointer to be populated with the length of the output buffer
+ *
+ * @return true on success
+ */
+bool jpg_transform(const uint8_t *src, size_t src_len, jpg_transform_t transform, const jpg_crop_t *crop, uint8_t **out, size_t *out_len);
+
+/**
+ * @brief Lower the quality of a JPEG without decoding it
+ *
+ * The quantized DCT coefficients are rescaled to the quantization tables
+ * fmt2jpg() uses for the given quality and entropy coded again, which costs
+ * about as much as two entropy decodes and lets one capture be served at
+ * several bitrates. Coefficients are never quantized finer than in the
+ * source. Same source requirements as jpg_transform().
+ *
+ * @param src       JPEG data
+ * @param src_len   Length of the JPEG data
+ * @param quality   JPEG quality of the resulting image, 1 to 100, or 0 to keep
+ *                  the coefficients of the source and only code them again
+ * @param out       Pointer to be populated with the address of the resulting buffer.
+ *                  You MUST free the pointer once you are done with it.
+ * @param out_len   Pointer to be populated with the length of the output buffer
+ *
+ * @return true on success
+ */
+bool jpg_requantize(const uint8_t *src, size_t src_len, uint8_t quality, uint8_t **out, size_t *out_len);
+
+/**
+ * @brief Turn a JPEG into a progressive JPEG without decoding it
+ *
+ * The first scan holds the DC coefficient of every block, a full frame
+ * preview at 1/8 of the resolution that a browser shows after about a tenth
+ * of the bytes; the following scans add the low frequencies, the chroma and
+ * the remaining bits. Each scan is coded with its own Huffman tables, which
+ * usually makes the result smaller than the source. All the coefficients
+ * are kept until the end of the image, in a store in PSRAM when available
+ * that takes about three times the size of the result, and the encode costs
+ * about three times a baseline one. Same source requirements as jpg_transform().
+ *
+ * @param src       JPEG data
+ * @param src_len   Length of the JPEG data
+ * @param quality   JPEG quality of the resulting image like jpg_requantize(),
+ *                  or 0 to keep the coefficients of the source
+ * @param out       Pointer to be populated with the address of the resulting buffer.
+ *                  You MUST free the pointer once you are done with it.
+ * @param out_len   Pointer to be populated with the length of the output buffer
+ *
+ * @return true on success
+ */
+bool jpg_progressive(const uint8_t *src, size_t src_len, uint8_t quality, uint8_t **out, size_t *out_len);
+
+/**
+ * @brief Downscale a JPEG to a smaller JPEG, e.g. a preview of a snapshot
+ *
+ * Every block of the source goes through a scaled IDCT that only produces
+ * the (8 / scale) x (8 / scale) pixels its low frequency coefficients can
+ * carry, which is much cheaper than a full decode followed by a resize.
+ * JPEG_IMAGE_SCALE_1_8 uses the DC coefficients alone. The small image is
+ * then encoded like fmt2jpg() does, with the chroma subsampling of the source.
+ *
+ * Only baseline and extended sequential JPEGs (as produced by the sensors
+ * and by jpge) are supported.
+ *
+ * @param src       JPEG data
+ * @param src_len   Length of the JPEG data
+ * @param scale     JPEG_IMAGE_SCALE_1_2, JPEG_IMAGE_SCALE_1_4 or JPEG_IMAGE_SCALE_1_8,
+ *                  the output is (source size / scale) rounded up
+ * @param quality   JPEG quality of the resulting image, 1 to 100. The image is
+ *                  encoded again, so 0 cannot keep the source quality and is
+ *                  taken as 1 like in fmt2jpg()
+ * @param out       Pointer to be populated with the address of the resulting buffer.
+ *                  You MUST free the pointer once you are done with it.
+ * @param out_len   Pointer to be populated with the length of the output buffer
+ *
+ * @return true on success
+ */
+bool jpg_scale(const uint8_t *src, size_t src_len, esp_jpeg_image_scale_t scale, uint8_t quality, uint8_t **out, size_t *out_len);
+
 #ifdef __cplusplus
 }
 #endif
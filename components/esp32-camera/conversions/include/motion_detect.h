@@ -0,0 +1,178 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef _MOTION_DETECT_H_
+#define _MOTION_DETECT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+
+/*
+ * Motion detection on downscaled luma tiles.
+ *
+ * Every frame is reduced to one mean luma value per tile: directly from the
+ * pixels for GRAYSCALE, YUV422, RGB565 and RGB888 frames, and from the DC
+ * coefficients of the entropy coded data (no IDCT) for JPEG frames. Each tile
+ * keeps a running background average; tiles that differ from it by more than
+ * the threshold are grouped into 4-connected regions and reported.
+ *
+ * The same tile signatures can also be compared with an explicit reference
+ * frame instead of the background, e.g. the last frame sent to a client, to
+ * find out whether a new frame is worth sending at all.
+ */
+
+#define MOTION_DETECT_MAX_REGIONS   8
+
+typedef struct {
+    uint16_t x;             /*!< Left edge of the bounding box in pixels */
+    uint16_t y;             /*!< Top edge of the bounding box in pixels */
+    uint16_t w;             /*!< Width of the bounding box in pixels */
+    uint16_t h;             /*!< Height of the bounding box in pixels */
+    uint16_t tiles;         /*!< Number of changed tiles in the region */
+} motion_region_t;
+
+typedef struct {
+    int64_t timestamp;      /*!< Capture time of the frame in microseconds since boot */
+    uint32_t frame;         /*!< Number of frames processed since the model was (re)started */
+    uint16_t width;         /*!< Width of the frame in pixels */
+    uint16_t height;        /*!< Height of the frame in pixels */
+    uint16_t changed_tiles; /*!< Tiles over the threshold, including those of dropped small regions */
+    uint16_t total_tiles;   /*!< Tiles in the frame */
+    uint8_t region_count;   /*!< Valid entries in regions, largest first */
+    motion_region_t regions[MOTION_DETECT_MAX_REGIONS];
+} motion_event_t;
+
+/**
+ * @brief Called from motion_detect_process() for every frame with motion
+ */
+typedef void (*motion_detect_cb_t)(const motion_event_t *event, void *arg);
+
+typedef struct {
+    uint8_t tile_size;          /*!< Tile edge in pixels, multiple of 8 */
+    uint8_t threshold;          /*!< Luma difference from the background that marks a tile as changed */
+    uint8_t learn_shift;        /*!< Background follows each frame by 1/2^learn_shift */
+    uint16_t min_region_tiles;  /*!< Smaller regions are ignored */
+    uint8_t queue_len;          /*!< Events kept for motion_detect_get_event(), 0 to disable the queue */
+    motion_detect_cb_t cb;      /*!< Optional event callback */
+    void *cb_arg;               /*!< Argument passed to cb */
+} motion_detect_config_t;
+
+#define MOTION_DETECT_CONFIG_DEFAULT() { \
+    .tile_size = 16,            \
+    .threshold = 12,            \
+    .learn_shift = 4,           \
+    .min_region_tiles = 2,      \
+    .queue_len = 4,             \
+    .cb = NULL,                 \
+    .cb_arg = NULL,             \
+}
+
+typedef struct {
+    uint16_t changed_tiles; /*!< Tiles that differ from the reference by more than the threshold */
+    uint16_t total_tiles;   /*!< Tiles in the frame */
+    uint8_t max_diff;       /*!< Largest luma difference of a tile from the reference */
+} motion_compare_t;
+
+typedef struct motion_detect *motion_detect_handle_t;
+
+/**
+ * @brief Create a motion detector
+ *
+ * @param config    Detector configuration
+ * @param handle    Returned detector handle
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *     - ESP_ERR_NO_MEM if the detector could not be allocated
+ */
+esp_err_t motion_detect_create(const motion_detect_config_t *config, motion_detect_handle_t *handle);
+
+/**
+ * @brief Delete a motion detector and release its buffers
+ */
+void motion_detect_delete(motion_detect_handle_t handle);
+
+/**
+ * @brief Run the detector on a frame and update the background model
+ *
+ * The first frame, and the first frame after a change of resolution, only
+ * seeds the background. Frames with motion are also passed to the callback
+ * and the event queue.
+ *
+ * @param handle    Detector handle
+ * @param fb        Frame in JPEG, GRAYSCALE, YUV422, RGB565 or RGB888 format
+ * @param event     Optional result, region_count is 0 if there was no motion
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NOT_SUPPORTED for other pixel formats or JPEG processes
+ *     - ESP_ERR_INVALID_SIZE if the JPEG data is corrupt
+ *     - ESP_ERR_NO_MEM if the tile buffers could not be allocated
+ */
+esp_err_t motion_detect_process(motion_detect_handle_t handle, const camera_fb_t *fb, motion_event_t *event);
+
+/**
+ * @brief Wait for the next queued motion event
+ *
+ * @param handle    Detector handle
+ * @param event     Returned event
+ * @param timeout   Ticks to wait
+ *
+ * @return
+ *     - ESP_OK if an event was returned
+ *     - ESP_ERR_TIMEOUT if no event arrived in time
+ *     - ESP_ERR_INVALID_STATE if the detector has no queue
+ */
+esp_err_t motion_detect_get_event(motion_detect_handle_t handle, motion_event_t *event, TickType_t timeout);
+
+/**
+ * @brief Compare a frame with the reference frame
+ *
+ * Neither the background model nor the reference are updated and no event is
+ * raised. Global brightness changes are not compensated, they count as change.
+ * Without a reference, e.g. after a change of resolution, all tiles count as
+ * changed.
+ *
+ * @param handle    Detector handle
+ * @param fb        Frame in JPEG, GRAYSCALE, YUV422, RGB565 or RGB888 format
+ * @param result    Returned difference from the reference
+ *
+ * @return same as motion_detect_process()
+ */
+esp_err_t motion_detect_compare(motion_detect_handle_t handle, const camera_fb_t *fb, motion_compare_t *result);
+
+/**
+ * @brief Make the frame last passed to motion_detect_compare() or
+ *        motion_detect_process() the reference for motion_detect_compare()
+ */
+void motion_detect_set_reference(motion_detect_handle_t handle);
+
+/**
+ * @brief Drop the background model, the next frame seeds it again
+ */
+void motion_detect_reset(motion_detect_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MOTION_DETECT_H_ */
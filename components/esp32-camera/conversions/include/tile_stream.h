@@ -0,0 +1,135 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef _TILE_STREAM_H_
+#define _TILE_STREAM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+
+/*
+ * Conditional replenishment of JPEG frames.
+ *
+ * The first frame is sent whole as a keyframe. For each later frame, only
+ * the 16x16 tiles whose luma changed since they were last sent are packed
+ * into a mosaic JPEG, in the coefficient domain: the MCUs of those tiles are
+ * copied from the sensor JPEG and entropy coded again by jpge, without any
+ * IDCT, DCT or generation loss. A tile changes when one of its 4x4 pixel
+ * means, computed from the DCT coefficients, moves by more than the
+ * threshold from the last sent value.
+ *
+ * Wire format, one message per frame, all fields little endian:
+ *
+ *   offset  size  field
+ *   0       1     type, tile_stream_type_t
+ *   1       1     tile size in pixels (TILE_STREAM_TILE_SIZE)
+ *   2       2     frame width in pixels
+ *   4       2     frame height in pixels
+ *   6       2     tile count n, 0 for keyframes
+ *   8       4     frame sequence number
+ *   12      4     JPEG length
+ *   16      2n    column and row of each tile, in tiles, one byte each
+ *   16+2n         JPEG data
+ *
+ * A keyframe JPEG is the whole frame. The JPEG of a delta is a mosaic of
+ * ceil(width / tile size) tiles per row, tile i is at column i % per_row and
+ * row i / per_row of the mosaic and goes to the listed position in the frame.
+ * Tiles on the right and bottom edge can extend beyond the frame and are
+ * clipped by the client.
+ */
+
+#define TILE_STREAM_TILE_SIZE   16
+#define TILE_STREAM_HEADER_LEN  16
+
+typedef enum {
+    TILE_STREAM_KEYFRAME = 0,
+    TILE_STREAM_DELTA = 1,
+} tile_stream_type_t;
+
+typedef struct {
+    uint8_t threshold;          /*!< Change of a 4x4 pixel luma mean that marks its tile as changed */
+    uint8_t keyframe_percent;   /*!< A keyframe is sent instead of a delta with more changed tiles */
+} tile_stream_config_t;
+
+#define TILE_STREAM_CONFIG_DEFAULT() { \
+    .threshold = 10,            \
+    .keyframe_percent = 50,     \
+}
+
+typedef struct {
+    tile_stream_type_t type;
+    uint16_t tiles;             /*!< Tiles in a delta, 0 if nothing changed and there is nothing to send */
+    const uint8_t *header;      /*!< Message header and tile list */
+    size_t header_len;
+    const uint8_t *jpg;         /*!< The frame itself for keyframes, a mosaic owned by the stream for deltas */
+    size_t jpg_len;
+} tile_stream_msg_t;
+
+typedef struct tile_stream *tile_stream_handle_t;
+
+/**
+ * @brief Create a tile stream encoder
+ *
+ * @param config    Encoder configuration
+ * @param handle    Returned encoder handle
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *     - ESP_ERR_NO_MEM if the encoder could not be allocated
+ */
+esp_err_t tile_stream_create(const tile_stream_config_t *config, tile_stream_handle_t *handle);
+
+/**
+ * @brief Delete a tile stream encoder and release its buffers
+ */
+void tile_stream_delete(tile_stream_handle_t handle);
+
+/**
+ * @brief Send the next frame as a keyframe, e.g. to bound the time a late
+ *        joining client waits for a complete picture
+ */
+void tile_stream_request_keyframe(tile_stream_handle_t handle);
+
+/**
+ * @brief Encode the next message of the stream
+ *
+ * The message points into the frame and into buffers of the encoder, it is
+ * valid until the frame is returned or the next call, whichever is first.
+ * Changed tiles count as sent once the message is returned.
+ *
+ * @param handle    Encoder handle
+ * @param fb        Baseline JPEG frame with 1x1 sampled chroma sharing one
+ *                  quantization table, as the sensors and jpge produce them
+ * @param msg       Returned message
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NOT_SUPPORTED if the frame is not a supported JPEG
+ *     - ESP_ERR_INVALID_SIZE if the JPEG data is corrupt
+ *     - ESP_ERR_NO_MEM if the buffers could not be allocated
+ */
+esp_err_t tile_stream_encode(tile_stream_handle_t handle, const camera_fb_t *fb, tile_stream_msg_t *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TILE_STREAM_H_ */
@@ -0,0 +1,601 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stddef.h>
+#include <string.h>
+#include "jpeg_coef.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#define TAG ""
+#else
+#include "esp_log.h"
+static const char* TAG = "jpeg_coef";
+#endif
+
+#define M_SOF0  0xC0
+#define M_SOF1  0xC1
+#define M_SOF2  0xC2
+#define M_DHT   0xC4
+#define M_RST0  0xD0
+#define M_RST7  0xD7
+#define M_SOI   0xD8
+#define M_EOI   0xD9
+#define M_SOS   0xDA
+#define M_DQT   0xDB
+#define M_DRI   0xDD
+
+const uint8_t jpeg_coef_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static inline uint16_t read_u16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static bool build_huff(jpeg_coef_huff_t *t, const uint8_t *counts, const uint8_t *symbols, size_t total)
+{
+    memset(t->fast, 0, sizeof(t->fast));
+    memcpy(t->vals, symbols, total);
+    int32_t code = 0;
+    int k = 0;
+    for (int l = 1; l <= 16; l++) {
+        int n = counts[l - 1];
+        // more codes than the length has room for would run past fast[]
+        if (code + n > (1 << l)) {
+            return false;
+        }
+        t->valoffset[l] = k - code;
+        for (int i = 0; i < n; i++, k++, code++) {
+            if (l <= JPEG_COEF_HUFF_FAST_BITS) {
+                int shift = JPEG_COEF_HUFF_FAST_BITS - l;
+                for (int j = 0; j < (1 << shift); j++) {
+                    t->fast[(code << shift) | j] = (l << 8) | t->vals[k];
+                }
+            }
+        }
+        t->maxcode[l] = n ? code - 1 : -1;
+        code <<= 1;
+    }
+    t->present = true;
+    return true;
+}
+
+static bool parse_dht(jpeg_coef_dec_t *dec, const uint8_t *p, size_t len)
+{
+    while (len >= 17) {
+        uint8_t tc = p[0] >> 4, th = p[0] & 0x0F;
+        size_t total = 0;
+        for (int i = 1; i <= 16; i++) {
+            total += p[i];
+        }
+        if (tc > 1 || th > 1 || total > 256 || len < 17 + total) {
+            return false;
+        }
+        jpeg_coef_huff_t *t = tc ? &dec->ac[th] : &dec->dc[th];
+        if (!build_huff(t, p + 1, p + 17, total)) {
+            return false;
+        }
+        p += 17 + total;
+        len -= 17 + total;
+    }
+    return len == 0;
+}
+
+static bool parse_dqt(jpeg_coef_dec_t *dec, const uint8_t *p, size_t len)
+{
+    while (len) {
+        uint8_t pq = p[0] >> 4, tq = p[0] & 0x0F;
+        size_t size = 1 + (pq ? 128 : 64);
+        if (pq > 1 || tq > 3 || len < size) {
+            return false;
+        }
+        for (int i = 0; i < 64; i++) {
+            dec->qt[tq][i] = pq ? read_u16(p + 1 + 2 * i) : p[1 + i];
+        }
+        p += size;
+        len -= size;
+    }
+    return true;
+}
+
+static bool parse_sof(jpeg_coef_dec_t *dec, const uint8_t *p, size_t len)
+{
+    if (len < 6 || p[0] != 8) {
+        return false;
+    }
+    dec->height = read_u16(p + 1);
+    dec->width = read_u16(p + 3);
+    dec->num_components = p[5];
+    if (!dec->width || !dec->height || (dec->num_components != 1 && dec->num_components != 3)
+        || len < 6 + 3 * (size_t)dec->num_components) {
+        return false;
+    }
+    dec->max_h = 1;
+    dec->max_v = 1;
+    for (int i = 0; i < dec->num_components; i++) {
+        jpeg_coef_comp_t *c = &dec->comp[i];
+        c->id = p[6 + 3 * i];
+        c->h = p[7 + 3 * i] >> 4;
+        c->v = p[7 + 3 * i] & 0x0F;
+        c->tq = p[8 + 3 * i] & 0x03;
+        if (c->h < 1 || c->h > 2 || c->v < 1 || c->v > 2) {
+            return false;
+        }
+        if (dec->num_components == 1) {
+            // a single component scan is never interleaved, one block per MCU
+            c->h = c->v = 1;
+        }
+        dec->max_h = c->h > dec->max_h ? c->h : dec->max_h;
+        dec->max_v = c->v > dec->max_v ? c->v : dec->max_v;
+    }
+    dec->mcus_x = (dec->width + 8 * dec->max_h - 1) / (8 * dec->max_h);
+    dec->mcus_y = (dec->height + 8 * dec->max_v - 1) / (8 * dec->max_v);
+    return true;
+}
+
+static bool parse_sos(jpeg_coef_dec_t *dec, const uint8_t *p, size_t len)
+{
+    if (len < 1 || p[0] != dec->num_components || len < 4 + 2 * (size_t)p[0]) {
+        ESP_LOGE(TAG, "Only single interleaved scans are supported");
+        return false;
+    }
+    for (int i = 0; i < p[0]; i++) {
+        jpeg_coef_comp_t *c = NULL;
+        for (int j = 0; j < dec->num_components; j++) {
+            if (dec->comp[j].id == p[1 + 2 * i]) {
+                c = &dec->comp[j];
+            }
+        }
+        if (!c) {
+            return false;
+        }
+        c->td = p[2 + 2 * i] >> 4;
+        c->ta = p[2 + 2 * i] & 0x0F;
+        if (c->td > 1 || c->ta > 1 || !dec->dc[c->td].present || !dec->ac[c->ta].present) {
+            return false;
+        }
+        c->dc_pred = 0;
+    }
+    return true;
+}
+
+bool jpeg_coef_start(jpeg_coef_dec_t *dec, const uint8_t *src, size_t src_len)
+{
+    memset(dec, 0, offsetof(jpeg_coef_dec_t, qt));
+    dec->dc[0].present = dec->dc[1].present = false;
+    dec->ac[0].present = dec->ac[1].present = false;
+    dec->data = src;
+    dec->len = src_len;
+    dec->bit_buf = 0;
+    dec->bit_count = 0;
+    dec->marker_hit = false;
+    dec->mcu_count = 0;
+
+    if (src_len < 4 || src[0] != 0xFF || src[1] != M_SOI) {
+        ESP_LOGE(TAG, "Not a JPEG");
+        return false;
+    }
+    size_t pos = 2;
+    bool have_sof = false;
+    while (pos + 4 <= src_len) {
+        if (src[pos] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = src[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        size_t seg_len = read_u16(src + pos + 2);
+        if (seg_len < 2 || pos + 2 + seg_len > src_len) {
+            return false;
+        }
+        const uint8_t *p = src + pos + 4;
+        size_t len = seg_len - 2;
+        bool ok = true;
+        switch (marker) {
+        case M_SOF0:
+        case M_SOF1:
+            ok = parse_sof(dec, p, len);
+            have_sof = ok;
+            break;
+        case M_DHT:
+            ok = parse_dht(dec, p, len);
+            break;
+        case M_DQT:
+            ok = parse_dqt(dec, p, len);
+            break;
+        case M_DRI:
+            ok = len >= 2;
+            dec->restart_interval = ok ? read_u16(p) : 0;
+            break;
+        case M_SOS:
+            if (!have_sof || !parse_sos(dec, p, len)) {
+                return false;
+            }
+            dec->scan_start = dec->pos = pos + 2 + seg_len;
+            return true;
+        case M_EOI:
+            return false;
+        default:
+            if (marker >= M_SOF2 && marker <= 0xCF && marker != M_DHT && marker != 0xC8 && marker != 0xCC) {
+                ESP_LOGE(TAG, "Unsupported JPEG process 0x%02x", marker);
+                return false;
+            }
+            break;
+        }
+        if (!ok) {
+            ESP_LOGE(TAG, "Bad marker segment 0x%02x", marker);
+            return false;
+        }
+        pos += 2 + seg_len;
+    }
+    return false;
+}
+
+static inline void fill_bits(jpeg_coef_dec_t *dec)
+{
+    while (dec->bit_count <= 24) {
+        uint32_t byte = 0;
+        if (!dec->marker_hit && dec->pos < dec->len) {
+            byte = dec->data[dec->pos];
+            if (byte == 0xFF) {
+                uint8_t next = dec->pos + 1 < dec->len ? dec->data[dec->pos + 1] : 0xD9;
+                if (next == 0x00) {
+                    dec->pos += 2;
+                } else {
+                    // never consume a marker, pad with zeros instead
+                    dec->marker_hit = true;
+                    byte = 0;
+                }
+            } else {
+                dec->pos++;
+            }
+        }
+        dec->bit_buf |= byte << (24 - dec->bit_count);
+        dec->bit_count += 8;
+    }
+}
+
+static inline void skip_bits(jpeg_coef_dec_t *dec, int n)
+{
+    dec->bit_buf <<= n;
+    dec->bit_count -= n;
+}
+
+static inline int huff_decode(jpeg_coef_dec_t *dec, const jpeg_coef_huff_t *t)
+{
+    fill_bits(dec);
+    uint16_t e = t->fast[dec->bit_buf >> (32 - JPEG_COEF_HUFF_FAST_BITS)];
+    if (e) {
+        skip_bits(dec, e >> 8);
+        return e & 0xFF;
+    }
+    for (int l = JPEG_COEF_HUFF_FAST_BITS + 1; l <= 16; l++) {
+        int32_t code = dec->bit_buf >> (32 - l);
+        if (code <= t->maxcode[l]) {
+            skip_bits(dec, l);
+            return t->vals[t->valoffset[l] + code];
+        }
+    }
+    return -1;
+}
+
+static inline int receive_extend(jpeg_coef_dec_t *dec, int s)
+{
+    if (!s) {
+        return 0;
+    }
+    fill_bits(dec);
+    int v = dec->bit_buf >> (32 - s);
+    skip_bits(dec, s);
+    return v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+}
+
+bool jpeg_coef_next_mcu(jpeg_coef_dec_t *dec)
+{
+    if (dec->restart_interval && dec->mcu_count && (dec->mcu_count % dec->restart_interval) == 0) {
+        // drop the padding bits and look for the RSTn marker the reader stopped at
+        dec->bit_buf = 0;
+        dec->bit_count = 0;
+        dec->marker_hit = false;
+        while (dec->pos + 1 < dec->len
+               && !(dec->data[dec->pos] == 0xFF && dec->data[dec->pos + 1] >= M_RST0 && dec->data[dec->pos + 1] <= M_RST7)) {
+            dec->pos++;
+        }
+        if (dec->pos + 1 >= dec->len) {
+            return false;
+        }
+        dec->pos += 2;
+        for (int i = 0; i < dec->num_components; i++) {
+            dec->comp[i].dc_pred = 0;
+        }
+    }
+    dec->mcu_count++;
+    return true;
+}
+
+void jpeg_coef_mark(const jpeg_coef_dec_t *dec, jpeg_coef_mark_t *mark)
+{
+    mark->pos = dec->pos;
+    mark->bit_buf = dec->bit_buf;
+    mark->bit_count = dec->bit_count;
+    mark->marker_hit = dec->marker_hit;
+    for (int i = 0; i < JPEG_COEF_MAX_COMPONENTS; i++) {
+        mark->dc_pred[i] = dec->comp[i].dc_pred;
+    }
+}
+
+void jpeg_coef_seek(jpeg_coef_dec_t *dec, const jpeg_coef_mark_t *mark)
+{
+    dec->pos = mark->pos;
+    dec->bit_buf = mark->bit_buf;
+    dec->bit_count = mark->bit_count;
+    dec->marker_hit = mark->marker_hit;
+    for (int i = 0; i < JPEG_COEF_MAX_COMPONENTS; i++) {
+        dec->comp[i].dc_pred = mark->dc_pred[i];
+    }
+}
+
+bool jpeg_coef_decode_block(jpeg_coef_dec_t *dec, uint8_t ci, int16_t *zz)
+{
+    jpeg_coef_comp_t *c = &dec->comp[ci];
+    int s = huff_decode(dec, &dec->dc[c->td]);
+    if (s < 0 || s > 11) {
+        return false;
+    }
+    c->dc_pred += receive_extend(dec, s);
+    if (zz) {
+        memset(zz, 0, 64 * sizeof(int16_t));
+        zz[0] = c->dc_pred;
+    }
+    const jpeg_coef_huff_t *ac = &dec->ac[c->ta];
+    for (int k = 1; k < 64;) {
+        int rs = huff_decode(dec, ac);
+        if (rs < 0) {
+            return false;
+        }
+        int r = rs >> 4;
+        s = rs & 0x0F;
+        if (s) {
+            k += r;
+            if (k > 63) {
+                return false;
+            }
+            int v = receive_extend(dec, s);
+            if (zz) {
+                zz[k] = v;
+            }
+            k++;
+        } else if (r == 15) {
+            k += 16;
+        } else {
+            break;
+        }
+    }
+    return true;
+}
+
+static inline uint8_t clamp_u8(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+#define FIX(x)  ((int32_t)((x) * 4096 + 0.5))
+
+// one pass of the 8 point integer IDCT (Loeffler/Ligtenberg/Moschytz as in
+// the libjpeg "islow" method), results are scaled by 1 << 12
+#define IDCT_1D(s0, s1, s2, s3, s4, s5, s6, s7) \
+    int32_t t0, t1, t2, t3, p1, p2, p3, p4, p5, x0, x1, x2, x3; \
+    p1 = ((s2) + (s6)) * FIX(0.541196100); \
+    t2 = p1 + (s6) * FIX(-1.847759065); \
+    t3 = p1 + (s2) * FIX(0.765366865); \
+    t0 = ((s0) + (s4)) * 4096; \
+    t1 = ((s0) - (s4)) * 4096; \
+    x0 = t0 + t3; \
+    x3 = t0 - t3; \
+    x1 = t1 + t2; \
+    x2 = t1 - t2; \
+    t0 = (s7); \
+    t1 = (s5); \
+    t2 = (s3); \
+    t3 = (s1); \
+    p3 = t0 + t2; \
+    p4 = t1 + t3; \
+    p1 = t0 + t3; \
+    p2 = t1 + t2; \
+    p5 = (p3 + p4) * FIX(1.175875602); \
+    t0 *= FIX(0.298631336); \
+    t1 *= FIX(2.053119869); \
+    t2 *= FIX(3.072711026); \
+    t3 *= FIX(1.501321110); \
+    p1 = p5 + p1 * FIX(-0.899976223); \
+    p2 = p5 + p2 * FIX(-2.562915447); \
+    p3 *= FIX(-1.961570560); \
+    p4 *= FIX(-0.390180644); \
+    t3 += p1 + p4; \
+    t2 += p2 + p3; \
+    t1 += p2 + p4; \
+    t0 += p1 + p3;
+
+// blk: dequantized coefficients in natural order, out: 8x8 pixels
+static void idct_8x8(const int32_t *blk, uint8_t *out)
+{
+    int32_t tmp[64];
+    // columns, keeping 2 extra bits of precision
+    for (int i = 0; i < 8; i++) {
+        const int32_t *d = blk + i;
+        int32_t *v = tmp + i;
+        if (!(d[8] | d[16] | d[24] | d[32] | d[40] | d[48] | d[56])) {
+            int32_t dc = d[0] * 4;
+            v[0] = v[8] = v[16] = v[24] = v[32] = v[40] = v[48] = v[56] = dc;
+            continue;
+        }
+        IDCT_1D(d[0], d[8], d[16], d[24], d[32], d[40], d[48], d[56])
+        x0 += 512; x1 += 512; x2 += 512; x3 += 512;
+        v[0]  = (x0 + t3) >> 10;
+        v[56] = (x0 - t3) >> 10;
+        v[8]  = (x1 + t2) >> 10;
+        v[48] = (x1 - t2) >> 10;
+        v[16] = (x2 + t1) >> 10;
+        v[40] = (x2 - t1) >> 10;
+        v[24] = (x3 + t0) >> 10;
+        v[32] = (x3 - t0) >> 10;
+    }
+    // rows, removing 1 << 12 of the constants, 1 << 2 from the columns and
+    // 1 << 3 of the two sqrt(8) normalizations, with rounding and level shift
+    for (int i = 0; i < 8; i++) {
+        const int32_t *v = tmp + i * 8;
+        uint8_t *o = out + i * 8;
+        IDCT_1D(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7])
+        x0 += (1 << 16) + (128 << 17);
+        x1 += (1 << 16) + (128 << 17);
+        x2 += (1 << 16) + (128 << 17);
+        x3 += (1 << 16) + (128 << 17);
+        o[0] = clamp_u8((x0 + t3) >> 17);
+        o[7] = clamp_u8((x0 - t3) >> 17);
+        o[1] = clamp_u8((x1 + t2) >> 17);
+        o[6] = clamp_u8((x1 - t2) >> 17);
+        o[2] = clamp_u8((x2 + t1) >> 17);
+        o[5] = clamp_u8((x2 - t1) >> 17);
+        o[3] = clamp_u8((x3 + t0) >> 17);
+        o[4] = clamp_u8((x3 - t0) >> 17);
+    }
+}
+
+/*
+ * Reduced size IDCT: each output pixel is the mean of a (8 / n) x (8 / n)
+ * pixel group of the full IDCT, which is linear in the coefficients.
+ * idct_box_n[x][u] = mean over the pixels p of group x of
+ * C(u) / 2 * cos((2p + 1) * u * pi / 16), scaled by 1 << 12. The u = 4 basis
+ * averages out over every group and is skipped.
+ */
+static const int16_t idct_box_4[4][8] = {
+    { 1448,  1856,  1338,   652,     0,  -435,  -554,  -369 },
+    { 1448,   769, -1338, -1573,     0,  1051,   554,  -153 },
+    { 1448,  -769, -1338,  1573,     0, -1051,   554,   153 },
+    { 1448, -1856,  1338,  -652,     0,   435,  -554,   369 },
+};
+
+static const int16_t idct_box_2[2][8] = {
+    { 1448,  1312,     0,  -461,     0,   308,     0,  -261 },
+    { 1448, -1312,     0,   461,     0,  -308,     0,   261 },
+};
+
+static void idct_reduced(const int32_t *blk, int n, uint8_t *out)
+{
+    const int16_t *basis = n == 4 ? &idct_box_4[0][0] : &idct_box_2[0][0];
+    int32_t tmp[8 * 4];
+    // rows, dropping 10 of the 12 fraction bits to stay within 32 bits
+    for (int v = 0; v < 8; v++) {
+        const int32_t *d = blk + v * 8;
+        int32_t *t = tmp + v * n;
+        if (!(d[0] | d[1] | d[2] | d[3] | d[4] | d[5] | d[6] | d[7])) {
+            memset(t, 0, n * sizeof(int32_t));
+            continue;
+        }
+        for (int x = 0; x < n; x++) {
+            const int16_t *b = basis + x * 8;
+            int32_t sum = d[0] * b[0] + d[1] * b[1] + d[2] * b[2] + d[3] * b[3]
+                          + d[5] * b[5] + d[6] * b[6] + d[7] * b[7];
+            t[x] = (sum + (1 << 9)) >> 10;
+        }
+    }
+    for (int y = 0; y < n; y++) {
+        const int16_t *b = basis + y * 8;
+        for (int x = 0; x < n; x++) {
+            const int32_t *t = tmp + x;
+            int32_t sum = t[0] * b[0] + t[n] * b[1] + t[2 * n] * b[2] + t[3 * n] * b[3]
+                          + t[5 * n] * b[5] + t[6 * n] * b[6] + t[7 * n] * b[7];
+            out[y * n + x] = clamp_u8(((sum + (1 << 13)) >> 14) + 128);
+        }
+    }
+}
+
+void jpeg_coef_idct(const int16_t *zz, const uint16_t *qt, uint8_t shift, uint8_t *out)
+{
+    if (shift >= 3) {
+        // the DC term is 8x the level shifted block mean
+        out[0] = clamp_u8(((zz[0] * qt[0] + 4) >> 3) + 128);
+        return;
+    }
+    int32_t blk[64];
+    for (int k = 0; k < 64; k++) {
+        blk[jpeg_coef_zigzag[k]] = zz[k] * qt[k];
+    }
+    if (shift == 0) {
+        idct_8x8(blk, out);
+    } else {
+        idct_reduced(blk, 8 >> shift, out);
+    }
+}
+
+bool jpeg_coef_luma(jpeg_coef_dec_t *dec, uint8_t shift, uint8_t *out, size_t stride)
+{
+    if (shift > 3) {
+        return false;
+    }
+    const jpeg_coef_comp_t *y = &dec->comp[0];
+    const uint16_t *qt = dec->qt[y->tq];
+    int n = 8 >> shift;         // output pixels per block edge
+    int out_w = (dec->width + (1 << shift) - 1) >> shift;
+    int out_h = (dec->height + (1 << shift) - 1) >> shift;
+    int16_t zz[64];
+    uint8_t pix[64];
+
+    for (int my = 0; my < dec->mcus_y; my++) {
+        for (int mx = 0; mx < dec->mcus_x; mx++) {
+            if (!jpeg_coef_next_mcu(dec)) {
+                return false;
+            }
+            for (int ci = 0; ci < dec->num_components; ci++) {
+                const jpeg_coef_comp_t *c = &dec->comp[ci];
+                for (int by = 0; by < c->v; by++) {
+                    for (int bx = 0; bx < c->h; bx++) {
+                        int ox = (mx * c->h + bx) * n;
+                        int oy = (my * c->v + by) * n;
+                        // chroma and padding blocks are only entropy decoded
+                        bool keep = ci == 0 && ox < out_w && oy < out_h;
+                        if (!jpeg_coef_decode_block(dec, ci, keep && n > 1 ? zz : NULL)) {
+                            return false;
+                        }
+                        if (!keep) {
+                            continue;
+                        }
+                        if (n == 1) {
+                            // the DC term is 8x the level shifted block mean
+                            out[oy * stride + ox] = clamp_u8(((y->dc_pred * qt[0] + 4) >> 3) + 128);
+                            continue;
+                        }
+                        jpeg_coef_idct(zz, qt, shift, pix);
+                        int w = out_w - ox < n ? out_w - ox : n;
+                        int h = out_h - oy < n ? out_h - oy : n;
+                        for (int r = 0; r < h; r++) {
+                            memcpy(out + (oy + r) * stride + ox, pix + r * n, w);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
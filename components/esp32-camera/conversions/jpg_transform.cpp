@@ -0,0 +1,515 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include "esp_heap_caps.h"
+#include "img_converters.h"
+#include "jpeg_coef.h"
+#include "jpge.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#define TAG ""
+#else
+#include "esp_log.h"
+static const char* TAG = "jpg_transform";
+#endif
+
+/*
+ * JPEG to JPEG conversions in the coefficient domain.
+ *
+ * The source is entropy decoded with jpeg_coef, the quantized blocks are
+ * rearranged and the result is entropy coded again by jpge, so no IDCT or
+ * DCT runs and no generation loss is added. Downscaling is the exception:
+ * each block is reduced to its low frequency pixels by a scaled IDCT and
+ * the small image is encoded by jpge as usual.
+ */
+
+#define TRANSFORM_HFLIP     0x01
+#define TRANSFORM_VFLIP     0x02
+#define TRANSFORM_TRANSPOSE 0x04
+
+static void *_malloc(size_t size)
+{
+    void * res = malloc(size);
+    if(res) {
+        return res;
+    }
+
+    // check if SPIRAM is enabled and is allocatable
+#if ((CONFIG_SPIRAM || CONFIG_SPIRAM_SUPPORT) && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
+    return heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#endif
+    return NULL;
+}
+
+// fixed size output buffer, fails instead of truncating the image
+class buffer_stream : public jpge::output_stream {
+protected:
+    uint8_t *out_buf;
+    size_t max_len, index;
+
+public:
+    buffer_stream(uint8_t *buf, size_t buf_size) : out_buf(buf), max_len(buf_size), index(0) { }
+    virtual ~buffer_stream() { }
+
+    virtual bool put_buf(const void* pBuf, int len)
+    {
+        if (!pBuf) {
+            return true;
+        }
+        if ((size_t)len > max_len - index) {
+            ESP_LOGE(TAG, "Output buffer full");
+            return false;
+        }
+        memcpy(out_buf + index, pBuf, len);
+        index += len;
+        return true;
+    }
+
+    virtual jpge::uint get_size() const
+    {
+        return index;
+    }
+};
+
+static jpeg_coef_dec_t *source_open(const uint8_t *src, size_t src_len)
+{
+    jpeg_coef_dec_t *dec = (jpeg_coef_dec_t *)malloc(sizeof(jpeg_coef_dec_t));
+    if (!dec) {
+        ESP_LOGE(TAG, "dec malloc failed");
+        return NULL;
+    }
+    if (!jpeg_coef_start(dec, src, src_len)) {
+        ESP_LOGE(TAG, "Unsupported JPEG");
+        free(dec);
+        return NULL;
+    }
+    // jpge writes one luma table and one chroma table, with 1x1 sampled chroma
+    bool ok = true;
+    if (dec->num_components == 3) {
+        ok = dec->comp[1].h == 1 && dec->comp[1].v == 1 && dec->comp[2].h == 1 && dec->comp[2].v == 1
+             && dec->comp[1].tq == dec->comp[2].tq;
+    }
+    for (int c = 0; ok && c < dec->num_components; c++) {
+        for (int k = 0; k < 64; k++) {
+            ok = ok && dec->qt[dec->comp[c].tq][k] <= 255;
+        }
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "Unsupported sampling or quantization");
+        free(dec);
+        return NULL;
+    }
+    return dec;
+}
+
+// position of every MCU, so they can be decoded in any order
+static jpeg_coef_mark_t *source_index(jpeg_coef_dec_t *dec)
+{
+    size_t count = (size_t)dec->mcus_x * dec->mcus_y;
+    jpeg_coef_mark_t *marks = (jpeg_coef_mark_t *)_malloc(count * sizeof(jpeg_coef_mark_t));
+    if (!marks) {
+        ESP_LOGE(TAG, "MCU index malloc failed");
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        bool ok = jpeg_coef_next_mcu(dec);
+        if (ok) {
+            jpeg_coef_mark(dec, &marks[i]);
+        }
+        for (int c = 0; ok && c < dec->num_components; c++) {
+            for (int b = 0; ok && b < dec->comp[c].h * dec->comp[c].v; b++) {
+                ok = jpeg_coef_decode_block(dec, c, NULL);
+            }
+        }
+        if (!ok) {
+            ESP_LOGE(TAG, "Corrupt JPEG data in MCU %u", (unsigned)i);
+            free(marks);
+            return NULL;
+        }
+    }
+    return marks;
+}
+
+static bool transform_image(jpeg_coef_dec_t *dec, const jpeg_coef_mark_t *marks, int op, const jpg_crop_t *crop, jpge::output_stream *stream)
+{
+    const bool hflip = op & TRANSFORM_HFLIP;
+    const bool vflip = op & TRANSFORM_VFLIP;
+    const bool transpose = op & TRANSFORM_TRANSPOSE;
+
+    // output coefficient k is sign[k] * source coefficient map[k], both in zigzag order
+    uint8_t unzag[64];
+    uint8_t map[64];
+    int8_t sign[64];
+    for (int k = 0; k < 64; k++) {
+        unzag[jpeg_coef_zigzag[k]] = k;
+    }
+    for (int k = 0; k < 64; k++) {
+        int u = jpeg_coef_zigzag[k] & 7, v = jpeg_coef_zigzag[k] >> 3;
+        map[k] = unzag[transpose ? u * 8 + v : v * 8 + u];
+        sign[k] = ((hflip && (u & 1)) != (vflip && (v & 1))) ? -1 : 1;
+    }
+    uint8_t qt[2][64];
+    for (int t = 0; t < 2; t++) {
+        const uint16_t *src_qt = dec->qt[dec->comp[dec->num_components == 3 ? t : 0].tq];
+        for (int k = 0; k < 64; k++) {
+            qt[t][k] = src_qt[map[k]];
+        }
+    }
+
+    // geometry after the transpose; flipped axes are trimmed to whole MCUs,
+    // the partial edge MCU would otherwise end up inside the image
+    int mcu_w = 8 * (transpose ? dec->max_v : dec->max_h);
+    int mcu_h = 8 * (transpose ? dec->max_h : dec->max_v);
+    int width = transpose ? dec->height : dec->width;
+    int height = transpose ? dec->width : dec->height;
+    int mcus_x = transpose ? dec->mcus_y : dec->mcus_x;
+    int mcus_y = transpose ? dec->mcus_x : dec->mcus_y;
+    if (hflip && width % mcu_w) {
+        mcus_x = width / mcu_w;
+        width = mcus_x * mcu_w;
+    }
+    if (vflip && height % mcu_h) {
+        mcus_y = height / mcu_h;
+        height = mcus_y * mcu_h;
+    }
+
+    int first_x = 0, first_y = 0;
+    if (crop) {
+        if (!crop->w || !crop->h || crop->x >= width || crop->y >= height) {
+            ESP_LOGE(TAG, "Crop outside of the image");
+            return false;
+        }
+        first_x = crop->x / mcu_w;
+        first_y = crop->y / mcu_h;
+        int right = crop->x + crop->w < width ? crop->x + crop->w : width;
+        int bottom = crop->y + crop->h < height ? crop->y + crop->h : height;
+        width = right - first_x * mcu_w;
+        height = bottom - first_y * mcu_h;
+    }
+    if (width < 1 || height < 1) {
+        ESP_LOGE(TAG, "Image smaller than one MCU");
+        return false;
+    }
+    int out_mcus_x = (width + mcu_w - 1) / mcu_w;
+    int out_mcus_y = (height + mcu_h - 1) / mcu_h;
+
+    jpge::jpeg_encoder enc;
+    if (!enc.init_coefficients(stream, width, height, dec->num_components, mcu_w / 8, mcu_h / 8, qt[0], qt[1])) {
+        ESP_LOGE(TAG, "JPG encoder init failed");
+        return false;
+    }
+
+    int16_t blocks[6][64];
+    int16_t out[64];
+    for (int oy = 0; oy < out_mcus_y; oy++) {
+        for (int ox = 0; ox < out_mcus_x; ox++) {
+            int ix = first_x + ox, iy = first_y + oy;
+            if (hflip) {
+                ix = mcus_x - 1 - ix;
+            }
+            if (vflip) {
+                iy = mcus_y - 1 - iy;
+            }
+            int sx = transpose ? iy : ix;
+            int sy = transpose ? ix : iy;
+            jpeg_coef_seek(dec, &marks[sy * dec->mcus_x + sx]);
+            int n = 0;
+            for (int c = 0; c < dec->num_components; c++) {
+                for (int b = 0; b < dec->comp[c].h * dec->comp[c].v; b++, n++) {
+                    if (!jpeg_coef_decode_block(dec, c, blocks[n])) {
+                        return false;
+                    }
+                }
+            }
+
+            const int16_t *comp_blocks = blocks[0];
+            for (int c = 0; c < dec->num_components; c++) {
+                int src_h = dec->comp[c].h;
+                int out_h = transpose ? dec->comp[c].v : src_h;
+                int out_v = transpose ? src_h : dec->comp[c].v;
+                for (int by = 0; by < out_v; by++) {
+                    for (int bx = 0; bx < out_h; bx++) {
+                        int ibx = hflip ? out_h - 1 - bx : bx;
+                        int iby = vflip ? out_v - 1 - by : by;
+                        const int16_t *zz = comp_blocks + 64 * (transpose ? ibx * src_h + iby : iby * src_h + ibx);
+                        for (int k = 0; k < 64; k++) {
+                            out[k] = sign[k] * zz[map[k]];
+                        }
+                        if (!enc.code_coefficients(c, out)) {
+                            return false;
+                        }
+                    }
+                }
+                comp_blocks += 64 * dec->comp[c].h * dec->comp[c].v;
+            }
+        }
+    }
+    return enc.finish_coefficients();
+}
+
+// quality 0 keeps the quantization of the source
+static bool requantize_image(jpeg_coef_dec_t *dec, uint8_t quality, bool progressive, jpge::output_stream *stream)
+{
+    // never quantize finer than the source, that only costs bits
+    uint8_t qt[2][64];
+    if (quality) {
+        jpge::get_quantization_tables(quality, qt[0], qt[1]);
+    } else {
+        memset(qt, 0, sizeof(qt));
+    }
+    const uint16_t *src_qt[JPEG_COEF_MAX_COMPONENTS];
+    for (int c = 0; c < dec->num_components; c++) {
+        src_qt[c] = dec->qt[dec->comp[c].tq];
+        uint8_t *dst_qt = qt[c > 0];
+        for (int k = 0; k < 64; k++) {
+            if (src_qt[c][k] > dst_qt[k]) {
+                dst_qt[k] = src_qt[c][k];
+            }
+        }
+    }
+
+    jpge::jpeg_encoder enc;
+    if (!enc.init_coefficients(stream, dec->width, dec->height, dec->num_components, dec->max_h, dec->max_v, qt[0], qt[1], progressive)) {
+        ESP_LOGE(TAG, "JPG encoder init failed");
+        return false;
+    }
+
+    int16_t zz[64];
+    for (int m = 0; m < dec->mcus_x * dec->mcus_y; m++) {
+        if (!jpeg_coef_next_mcu(dec)) {
+            return false;
+        }
+        for (int c = 0; c < dec->num_components; c++) {
+            const uint16_t *from = src_qt[c];
+            const uint8_t *to = qt[c > 0];
+            for (int b = 0; b < dec->comp[c].h * dec->comp[c].v; b++) {
+                if (!jpeg_coef_decode_block(dec, c, zz)) {
+                    ESP_LOGE(TAG, "Corrupt JPEG data in MCU %d", m);
+                    return false;
+                }
+                for (int k = 0; k < 64; k++) {
+                    if (zz[k] && from[k] != to[k]) {
+                        // round to nearest, as jpge quantizes
+                        int32_t v = zz[k] * from[k];
+                        zz[k] = v < 0 ? -((-v + (to[k] >> 1)) / to[k]) : (v + (to[k] >> 1)) / to[k];
+                    }
+                }
+                if (!enc.code_coefficients(c, zz)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return enc.finish_coefficients();
+}
+
+// keep the chroma resolution of the source, so that it is not resampled twice
+static jpge::subsampling_t source_subsampling(const jpeg_coef_dec_t *dec)
+{
+    if (dec->num_components == 1) {
+        return jpge::Y_ONLY;
+    }
+    if (dec->comp[0].h == 2 && dec->comp[0].v == 2) {
+        return jpge::H2V2;
+    }
+    if (dec->comp[0].h == 2 && dec->comp[0].v == 1) {
+        return jpge::H2V1;
+    }
+    return jpge::H1V1;
+}
+
+static bool scale_image(jpeg_coef_dec_t *dec, uint8_t shift, uint8_t quality, jpge::output_stream *stream)
+{
+    int nc = dec->num_components;
+    int n = 8 >> shift;                 // output pixels per block edge
+    int out_w = (dec->width + (1 << shift) - 1) >> shift;
+    int out_h = (dec->height + (1 << shift) - 1) >> shift;
+    // one MCU row of interleaved YCbCr, with subsampled components replicated
+    int strip_w = dec->mcus_x * dec->max_h * n;
+    int strip_h = dec->max_v * n;
+    uint8_t *strip = (uint8_t *)_malloc(strip_w * strip_h * nc);
+    if (!strip) {
+        ESP_LOGE(TAG, "Strip malloc failed");
+        return false;
+    }
+
+    jpge::params comp_params = jpge::params();
+    // the image is encoded again, 0 is taken as 1 like fmt2jpg() does
+    comp_params.m_quality = quality ? quality : 1;
+    comp_params.m_subsampling = source_subsampling(dec);
+    jpge::jpeg_encoder enc;
+    if (!enc.init(stream, out_w, out_h, nc, comp_params)) {
+        ESP_LOGE(TAG, "JPG encoder init failed");
+        free(strip);
+        return false;
+    }
+
+    int16_t zz[64];
+    uint8_t pix[64];
+    bool ok = true;
+    for (int my = 0; ok && my < dec->mcus_y; my++) {
+        for (int mx = 0; ok && mx < dec->mcus_x; mx++) {
+            ok = jpeg_coef_next_mcu(dec);
+            for (int c = 0; ok && c < nc; c++) {
+                const jpeg_coef_comp_t *comp = &dec->comp[c];
+                int sx = dec->max_h / comp->h;
+                int sy = dec->max_v / comp->v;
+                for (int b = 0; ok && b < comp->h * comp->v; b++) {
+                    ok = jpeg_coef_decode_block(dec, c, zz);
+                    if (!ok) {
+                        ESP_LOGE(TAG, "Corrupt JPEG data in MCU %d", my * dec->mcus_x + mx);
+                        break;
+                    }
+                    jpeg_coef_idct(zz, dec->qt[comp->tq], shift, pix);
+                    int x0 = (mx * dec->max_h + (b % comp->h) * sx) * n;
+                    int y0 = (b / comp->h) * sy * n;
+                    for (int y = 0; y < n * sy; y++) {
+                        const uint8_t *p = pix + (y / sy) * n;
+                        uint8_t *d = strip + ((y0 + y) * strip_w + x0) * nc + c;
+                        for (int x = 0; x < n * sx; x++) {
+                            d[x * nc] = p[x / sx];
+                        }
+                    }
+                }
+            }
+        }
+        int rows = out_h - my * strip_h < strip_h ? out_h - my * strip_h : strip_h;
+        for (int y = 0; ok && y < rows; y++) {
+            ok = enc.process_ycc_scanline(strip + y * strip_w * nc);
+        }
+    }
+    free(strip);
+    return ok && enc.process_ycc_scanline(NULL);
+}
+
+bool jpg_transform(const uint8_t *src, size_t src_len, jpg_transform_t transform, const jpg_crop_t *crop, uint8_t **out, size_t *out_len)
+{
+    if ((unsigned)transform > JPG_TRANSFORM_TRANSVERSE) {
+        return false;
+    }
+    jpeg_coef_dec_t *dec = source_open(src, src_len);
+    if (!dec) {
+        return false;
+    }
+    jpeg_coef_mark_t *marks = source_index(dec);
+    if (!marks) {
+        free(dec);
+        return false;
+    }
+
+    // the coefficients are unchanged, only restart markers and Huffman
+    // table differences can change the size
+    size_t buf_len = src_len + src_len / 4 + 1024;
+    uint8_t *buf = (uint8_t *)_malloc(buf_len);
+    if (!buf) {
+        ESP_LOGE(TAG, "JPG buffer malloc failed");
+        free(marks);
+        free(dec);
+        return false;
+    }
+    buffer_stream stream(buf, buf_len);
+    bool ret = transform_image(dec, marks, transform, crop, &stream);
+    free(marks);
+    free(dec);
+    if (!ret) {
+        free(buf);
+        return false;
+    }
+    *out = buf;
+    *out_len = stream.get_size();
+    return true;
+}
+
+static bool requantize(const uint8_t *src, size_t src_len, uint8_t quality, bool progressive, uint8_t **out, size_t *out_len)
+{
+    jpeg_coef_dec_t *dec = source_open(src, src_len);
+    if (!dec) {
+        return false;
+    }
+    // progressive scans carry a Huffman table each
+    size_t buf_len = src_len + src_len / 4 + (progressive ? 4096 : 1024);
+    uint8_t *buf = (uint8_t *)_malloc(buf_len);
+    if (!buf) {
+        ESP_LOGE(TAG, "JPG buffer malloc failed");
+        free(dec);
+        return false;
+    }
+    buffer_stream stream(buf, buf_len);
+    bool ret = requantize_image(dec, quality, progressive, &stream);
+    free(dec);
+    if (!ret) {
+        free(buf);
+        return false;
+    }
+    *out = buf;
+    *out_len = stream.get_size();
+    return true;
+}
+
+bool jpg_requantize(const uint8_t *src, size_t src_len, uint8_t quality, uint8_t **out, size_t *out_len)
+{
+    return requantize(src, src_len, quality, false, out, out_len);
+}
+
+bool jpg_progressive(const uint8_t *src, size_t src_len, uint8_t quality, uint8_t **out, size_t *out_len)
+{
+    return requantize(src, src_len, quality, true, out, out_len);
+}
+
+bool jpg_scale(const uint8_t *src, size_t src_len, esp_jpeg_image_scale_t scale, uint8_t quality, uint8_t **out, size_t *out_len)
+{
+    uint8_t shift;
+    switch (scale) {
+    case JPEG_IMAGE_SCALE_1_2: shift = 1; break;
+    case JPEG_IMAGE_SCALE_1_4: shift = 2; break;
+    case JPEG_IMAGE_SCALE_1_8: shift = 3; break;
+    default:
+        ESP_LOGE(TAG, "Unsupported scale %d", (int)scale);
+        return false;
+    }
+    jpeg_coef_dec_t *dec = (jpeg_coef_dec_t *)malloc(sizeof(jpeg_coef_dec_t));
+    if (!dec) {
+        ESP_LOGE(TAG, "dec malloc failed");
+        return false;
+    }
+    if (!jpeg_coef_start(dec, src, src_len)) {
+        ESP_LOGE(TAG, "Unsupported JPEG");
+        free(dec);
+        return false;
+    }
+
+    // a downscaled image at the same quality has more detail per pixel but
+    // far fewer pixels, so it stays well below the size of the source
+    size_t out_px = (size_t)((dec->width + (1 << shift) - 1) >> shift) * ((dec->height + (1 << shift) - 1) >> shift);
+    size_t buf_len = (out_px * 3 / 2 < src_len ? out_px * 3 / 2 : src_len) + 1024;
+    uint8_t *buf = (uint8_t *)_malloc(buf_len);
+    if (!buf) {
+        ESP_LOGE(TAG, "JPG buffer malloc failed");
+        free(dec);
+        return false;
+    }
+    buffer_stream stream(buf, buf_len);
+    bool ret = scale_image(dec, shift, quality, &stream);
+    free(dec);
+    if (!ret) {
+        free(buf);
+        return false;
+    }
+    *out = buf;
+    *out_len = stream.get_size();
+    return true;
+}
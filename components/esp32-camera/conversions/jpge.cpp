@@ -36,10 +36,20 @@ namespace jpge {
         return NULL;
 #endif
     }
+    // the other way around, for large buffers that are written once and read a few times
+    static inline void *jpge_malloc_bulk(size_t nSize) {
+#if ((CONFIG_SPIRAM || CONFIG_SPIRAM_SUPPORT) && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
+        void * b = heap_caps_malloc(nSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if(b){
+            return b;
+        }
+#endif
+        return malloc(nSize);
+    }
     static inline void jpge_free(void *p) { free(p); }
 
     // Various JPEG enums and tables.
-    enum { M_SOF0 = 0xC0, M_DHT = 0xC4, M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_APP0 = 0xE0 };
+    enum { M_SOF0 = 0xC0, M_SOF2 = 0xC2, M_DHT = 0xC4, M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_APP0 = 0xE0 };
     enum { DC_LUM_CODES = 12, AC_LUM_CODES = 256, DC_CHROMA_CODES = 12, AC_CHROMA_CODES = 256, MAX_HUFF_SYMBOLS = 257, MAX_HUFF_CODESIZE = 32 };
 
     static const uint8 s_zag[64] = { 0,1,8,16,9,2,3,10,17,24,32,25,18,11,4,5,12,19,26,33,40,48,41,34,27,20,13,6,7,14,21,28,35,42,49,56,57,50,43,36,29,22,15,23,30,37,44,51,58,59,52,45,38,31,39,46,53,60,61,54,47,55,62,63 };
@@ -68,10 +78,34 @@ namespace jpge {
         0xf9,0xfa
     };
 
-    const int YR = 19595, YG = 38470, YB = 7471, CB_R = -11059, CB_G = -21709, CB_B = 32768, CR_R = 32768, CR_G = -27439, CR_B = -5329;
+    // Progressive scan script, the one libjpeg uses by default: a full frame
+    // DC preview first, the low luma frequencies and the chroma at reduced
+    // precision next, then the remaining bits. comp = SCAN_ALL_COMPONENTS for
+    // the interleaved DC scans.
+    enum { SCAN_ALL_COMPONENTS = 0xFF };
+    struct scan_info { uint8 comp, ss, se, ah, al; };
+    static const scan_info s_color_scans[] = {
+        { SCAN_ALL_COMPONENTS, 0, 0, 0, 1 },
+        { 0, 1, 5, 0, 2 },
+        { 2, 1, 63, 0, 1 },
+        { 1, 1, 63, 0, 1 },
+        { 0, 6, 63, 0, 2 },
+        { 0, 1, 63, 2, 1 },
+        { SCAN_ALL_COMPONENTS, 0, 0, 1, 0 },
+        { 2, 1, 63, 1, 0 },
+        { 1, 1, 63, 1, 0 },
+        { 0, 1, 63, 1, 0 },
+    };
+    static const scan_info s_grey_scans[] = {
+        { SCAN_ALL_COMPONENTS, 0, 0, 0, 1 },
+        { 0, 1, 5, 0, 2 },
+        { 0, 6, 63, 0, 2 },
+        { 0, 1, 63, 2, 1 },
+        { SCAN_ALL_COMPONENTS, 0, 0, 1, 0 },
+        { 0, 1, 63, 1, 0 },
+    };
 
-    static int32 m_last_quality = 0;
-    static int32 m_quantization_tables[2][64];
+    const int YR = 19595, YG = 38470, YB = 7471, CB_R = -11059, CB_G = -21709, CB_B = 32768, CR_R = 32768, CR_G = -27439, CR_B = -5329;
 
     static bool m_huff_initialized = false;
     static uint m_huff_codes[4][256];
@@ -111,6 +145,10 @@ namespace jpge {
         }
     }
 
+    static void Y_to_Y(uint8* pDst, const uint8* pSrc, int num_pixels) {
+        memcpy(pDst, pSrc, num_pixels);
+    }
+
     // Forward DCT - DCT derived from jfdctint.
     enum { CONST_BITS = 13, ROW_BITS = 2 };
 #define DCT_DESCALE(x, n) (((x) + (((int32)1) << ((n) - 1))) >> (n))
@@ -251,14 +289,14 @@ namespace jpge {
             emit_word(64 + 1 + 2);
             emit_byte(static_cast<uint8>(i));
             for (int j = 0; j < 64; j++)
-                emit_byte(static_cast<uint8>(m_quantization_tables[i][j]));
+                emit_byte(m_coef_qt[0] ? m_coef_qt[i][j] : static_cast<uint8>(m_quantization_tables[i][j]));
         }
     }
 
     // Emit start of frame marker
     void jpeg_encoder::emit_sof()
     {
-        emit_marker(M_SOF0);                           /* baseline */
+        emit_marker(m_progressive ? M_SOF2 : M_SOF0);  /* progressive or baseline */
         emit_word(3 * m_num_components + 2 + 5 + 1);
         emit_byte(8);                                  /* precision */
         emit_word(m_image_y);
@@ -303,12 +341,12 @@ namespace jpge {
     }
 
     // emit start of scan
-    void jpeg_encoder::emit_sos()
+    void jpeg_encoder::emit_sos(int first_comp, int num_comps, int ss, int se, int ah, int al)
     {
         emit_marker(M_SOS);
-        emit_word(2 * m_num_components + 2 + 1 + 3);
-        emit_byte(m_num_components);
-        for (int i = 0; i < m_num_components; i++)
+        emit_word(2 * num_comps + 2 + 1 + 3);
+        emit_byte(static_cast<uint8>(num_comps));
+        for (int i = first_comp; i < first_comp + num_comps; i++)
         {
             emit_byte(static_cast<uint8>(i + 1));
             if (i == 0)
@@ -316,9 +354,17 @@ namespace jpge {
             else
                 emit_byte((1 << 4) + 1);
         }
-        emit_byte(0);     /* spectral selection */
-        emit_byte(63);
-        emit_byte(0);
+        emit_byte(static_cast<uint8>(ss));     /* spectral selection */
+        emit_byte(static_cast<uint8>(se));
+        emit_byte(static_cast<uint8>((ah << 4) + al));  /* successive approximation */
+    }
+
+    // pads the last byte of a scan with 1 bits
+    void jpeg_encoder::flush_bits()
+    {
+        put_bits(0x7F, 7);
+        m_bit_buffer = 0;
+        m_bits_in = 0;
     }
 
     void jpeg_encoder::load_block_8_8_grey(int x)
@@ -381,48 +427,28 @@ namespace jpge {
         }
     }
 
-    void jpeg_encoder::load_quantized_coefficients(int component_num)
+    template<int table>
+    void jpeg_encoder::load_quantized_coefficients()
     {
-        int32 *q = m_quantization_tables[component_num > 0];
+        const int32 *q = m_quantization_tables[table];
         int16 *pDst = m_coefficient_array;
         for (int i = 0; i < 64; i++)
         {
+            // round the magnitude to nearest, sign restored without branching
             sample_array_t j = m_sample_array[s_zag[i]];
-            if (j < 0)
-            {
-                if ((j = -j + (*q >> 1)) < *q)
-                    *pDst++ = 0;
-                else
-                    *pDst++ = static_cast<int16>(-(j / *q));
-            }
-            else
-            {
-                if ((j = j + (*q >> 1)) < *q)
-                    *pDst++ = 0;
-                else
-                    *pDst++ = static_cast<int16>((j / *q));
-            }
-            q++;
+            const sample_array_t sign = j >> 31;
+            j = (((j ^ sign) - sign) + (q[i] >> 1)) / q[i];
+            pDst[i] = static_cast<int16>((j ^ sign) - sign);
         }
     }
 
+    template<int table>
     void jpeg_encoder::code_coefficients_pass_two(int component_num)
     {
         int i, j, run_len, nbits, temp1, temp2;
         int16 *pSrc = m_coefficient_array;
-        uint *codes[2];
-        uint8 *code_sizes[2];
-
-        if (component_num == 0)
-        {
-            codes[0] = m_huff_codes[0 + 0]; codes[1] = m_huff_codes[2 + 0];
-            code_sizes[0] = m_huff_code_sizes[0 + 0]; code_sizes[1] = m_huff_code_sizes[2 + 0];
-        }
-        else
-        {
-            codes[0] = m_huff_codes[0 + 1]; codes[1] = m_huff_codes[2 + 1];
-            code_sizes[0] = m_huff_code_sizes[0 + 1]; code_sizes[1] = m_huff_code_sizes[2 + 1];
-        }
+        const uint *codes[2] = { m_huff_codes[0 + table], m_huff_codes[2 + table] };
+        const uint8 *code_sizes[2] = { m_huff_code_sizes[0 + table], m_huff_code_sizes[2 + table] };
 
         temp1 = temp2 = pSrc[0] - m_last_dc_val[component_num];
         m_last_dc_val[component_num] = pSrc[0];
@@ -470,64 +496,487 @@ namespace jpge {
             put_bits(codes[1][0], code_sizes[1][0]);
     }
 
+    template<int table>
     void jpeg_encoder::code_block(int component_num)
     {
         DCT2D(m_sample_array);
-        load_quantized_coefficients(component_num);
-        code_coefficients_pass_two(component_num);
+        load_quantized_coefficients<table>();
+        if (m_progressive)
+            store_block();
+        else
+            code_coefficients_pass_two<table>(component_num);
     }
 
-    void jpeg_encoder::process_mcu_row()
+    // Progressive scans are entropy coded twice: once to count the symbols,
+    // then with Huffman tables built for the scan, which also have the EOB
+    // run symbols the standard tables lack.
+    struct jpeg_encoder::progressive_state {
+        enum { MAX_CORRECTIONS = 1000 };
+        bool counting;
+        uint eobrun;                    // blocks ending in a pending EOB run
+        uint num_corrections;           // refinement bits sent after that EOB run
+        uint32 counts[2][257];
+        uint codes[2][256];
+        uint8 code_sizes[2][256];
+        uint8 bits[2][17];
+        uint8 val[2][256];
+        uint8 corrections[MAX_CORRECTIONS];
+    };
+
+    // Progressive mode. Every block is stored as a record in MCU order:
+    // a byte with the number of nonzero AC coefficients, 0x80 set when their
+    // values take 16 bits, the DC as 16 bits, the zigzag positions of the AC
+    // coefficients, then their values. 0xFF moves on to the next chunk.
+    bool jpeg_encoder::store_open(int mcus_x, int mcus_y)
     {
-        if (m_num_components == 1)
-        {
-            for (int i = 0; i < m_mcus_per_row; i++)
-            {
-                load_block_8_8_grey(i); code_block(0);
+        m_blocks_per_mcu = m_comp_h_samp[0] * m_comp_v_samp[0] + m_num_components - 1;
+        m_store_mcus_x = mcus_x;
+        m_store_mcus_y = mcus_y;
+        const uint num_mcus = mcus_x * mcus_y;
+        m_store_max_chunks = (num_mcus * m_blocks_per_mcu * STORE_MAX_RECORD) / (STORE_CHUNK_SIZE - STORE_MAX_RECORD - 1) + 1;
+        m_store_chunks = static_cast<uint8**>(jpge_malloc((m_store_max_chunks + 1) * sizeof(uint8*)));
+        m_store_mcu_ofs = static_cast<uint32*>(jpge_malloc(num_mcus * sizeof(uint32)));
+        m_prog = static_cast<progressive_state*>(jpge_malloc(sizeof(progressive_state)));
+        if (!m_store_chunks || !m_store_mcu_ofs || !m_prog) {
+            return false;
+        }
+        memset(m_store_chunks, 0, (m_store_max_chunks + 1) * sizeof(uint8*));
+        m_store_num_chunks = 0;
+        m_store_pos = STORE_CHUNK_SIZE;
+        m_store_blocks = 0;
+        return true;
+    }
+
+    void jpeg_encoder::store_free()
+    {
+        if (m_store_chunks) {
+            for (uint i = 0; i < m_store_num_chunks; i++)
+                jpge_free(m_store_chunks[i]);
+            jpge_free(m_store_chunks);
+        }
+        jpge_free(m_store_mcu_ofs);
+        jpge_free(m_prog);
+        m_store_chunks = NULL;
+        m_store_mcu_ofs = NULL;
+        m_prog = NULL;
+        m_store_num_chunks = 0;
+    }
+
+    void jpeg_encoder::store_block()
+    {
+        if (m_store_blocks == (uint)(m_store_mcus_x * m_store_mcus_y * m_blocks_per_mcu)) {
+            m_all_stream_writes_succeeded = false;
+            return;
+        }
+        if (m_store_pos + STORE_MAX_RECORD >= STORE_CHUNK_SIZE) {
+            uint8 *pChunk = NULL;
+            if (m_store_num_chunks == m_store_max_chunks || (pChunk = static_cast<uint8*>(jpge_malloc_bulk(STORE_CHUNK_SIZE))) == NULL) {
+                m_all_stream_writes_succeeded = false;
+                return;
             }
+            if (m_store_num_chunks)
+                m_store_chunks[m_store_num_chunks - 1][m_store_pos] = 0xFF;
+            m_store_chunks[m_store_num_chunks++] = pChunk;
+            m_store_pos = 0;
         }
-        else if ((m_comp_h_samp[0] == 1) && (m_comp_v_samp[0] == 1))
-        {
-            for (int i = 0; i < m_mcus_per_row; i++)
-            {
-                load_block_8_8(i, 0, 0); code_block(0); load_block_8_8(i, 0, 1); code_block(1); load_block_8_8(i, 0, 2); code_block(2);
+        if (m_store_blocks % m_blocks_per_mcu == 0)
+            m_store_mcu_ofs[m_store_blocks / m_blocks_per_mcu] = ((m_store_num_chunks - 1) << 16) | m_store_pos;
+        m_store_blocks++;
+
+        const int16 *pSrc = m_coefficient_array;
+        int n = 0;
+        bool wide = false;
+        for (int i = 1; i < 64; i++) {
+            if (pSrc[i]) {
+                n++;
+                wide = wide || pSrc[i] < -128 || pSrc[i] > 127;
             }
         }
-        else if ((m_comp_h_samp[0] == 2) && (m_comp_v_samp[0] == 1))
-        {
-            for (int i = 0; i < m_mcus_per_row; i++)
-            {
-                load_block_8_8(i * 2 + 0, 0, 0); code_block(0); load_block_8_8(i * 2 + 1, 0, 0); code_block(0);
-                load_block_16_8_8(i, 1); code_block(1); load_block_16_8_8(i, 2); code_block(2);
+        uint8 *pDst = m_store_chunks[m_store_num_chunks - 1] + m_store_pos;
+        pDst[0] = static_cast<uint8>(n | (wide ? 0x80 : 0));
+        pDst[1] = static_cast<uint8>(pSrc[0] & 0xFF);
+        pDst[2] = static_cast<uint8>(pSrc[0] >> 8);
+        uint8 *pPos = pDst + 3, *pVal = pPos + n;
+        for (int i = 1; i < 64; i++) {
+            if (pSrc[i]) {
+                *pPos++ = static_cast<uint8>(i);
+                *pVal++ = static_cast<uint8>(pSrc[i] & 0xFF);
+                if (wide)
+                    *pVal++ = static_cast<uint8>(pSrc[i] >> 8);
+            }
+        }
+        m_store_pos += static_cast<uint>(pVal - pDst);
+    }
+
+    static inline uint stored_block_size(const uint8 *pRecord)
+    {
+        return 3 + (pRecord[0] & 0x7F) * ((pRecord[0] & 0x80) ? 3 : 2);
+    }
+
+    // record of block index (in MCU order) of an MCU
+    const uint8 *jpeg_encoder::store_seek(int mcu, int index) const
+    {
+        uint32 ofs = m_store_mcu_ofs[mcu];
+        uint chunk = ofs >> 16;
+        const uint8 *p = m_store_chunks[chunk] + (ofs & 0xFFFF);
+        for ( ; index; index--) {
+            p += stored_block_size(p);
+            if (*p == 0xFF)
+                p = m_store_chunks[++chunk];
+        }
+        return p;
+    }
+
+    void jpeg_encoder::load_stored_block(const uint8 *pRecord)
+    {
+        const int n = pRecord[0] & 0x7F;
+        const uint8 *pPos = pRecord + 3, *pVal = pPos + n;
+        memset(m_coefficient_array, 0, sizeof(m_coefficient_array));
+        m_coefficient_array[0] = static_cast<int16>(pRecord[1] | (pRecord[2] << 8));
+        if (pRecord[0] & 0x80) {
+            for (int i = 0; i < n; i++, pVal += 2)
+                m_coefficient_array[pPos[i]] = static_cast<int16>(pVal[0] | (pVal[1] << 8));
+        } else {
+            for (int i = 0; i < n; i++)
+                m_coefficient_array[pPos[i]] = static_cast<signed char>(pVal[i]);
+        }
+    }
+
+    // Length limited optimal Huffman code for the symbol counts, JPEG Annex K.2.
+    static void optimize_huffman_table(const uint32 *counts, uint8 *pBits, uint8 *pVal)
+    {
+        uint32 freq[257];
+        int code_size[257], others[257];
+        uint8 bits[33];
+        memcpy(freq, counts, 256 * sizeof(freq[0]));
+        freq[256] = 1;  // reserved so that no code is all 1 bits
+        for (int i = 0; i < 257; i++) {
+            code_size[i] = 0;
+            others[i] = -1;
+        }
+        for (;;) {
+            int c1 = -1, c2 = -1;
+            uint32 v = 0xFFFFFFFF;
+            for (int i = 0; i < 257; i++) {
+                if (freq[i] && freq[i] <= v) {
+                    v = freq[i];
+                    c1 = i;
+                }
+            }
+            v = 0xFFFFFFFF;
+            for (int i = 0; i < 257; i++) {
+                if (freq[i] && freq[i] <= v && i != c1) {
+                    v = freq[i];
+                    c2 = i;
+                }
+            }
+            if (c2 < 0)
+                break;
+            freq[c1] += freq[c2];
+            freq[c2] = 0;
+            code_size[c1]++;
+            while (others[c1] >= 0) {
+                c1 = others[c1];
+                code_size[c1]++;
+            }
+            others[c1] = c2;
+            code_size[c2]++;
+            while (others[c2] >= 0) {
+                c2 = others[c2];
+                code_size[c2]++;
             }
         }
-        else if ((m_comp_h_samp[0] == 2) && (m_comp_v_samp[0] == 2))
+
+        memset(bits, 0, sizeof(bits));
+        for (int i = 0; i < 257; i++) {
+            if (code_size[i])
+                bits[JPGE_MIN(code_size[i], 32)]++;
+        }
+        int i;
+        for (i = 32; i > 16; i--) {
+            while (bits[i]) {
+                int j = i - 2;
+                while (!bits[j])
+                    j--;
+                bits[i] -= 2;
+                bits[i - 1]++;
+                bits[j + 1] += 2;
+                bits[j]--;
+            }
+        }
+        while (!bits[i])
+            i--;
+        bits[i]--;      // the reserved code
+        memcpy(pBits, bits, 17);
+        int p = 0;
+        for (i = 1; i <= 32; i++) {
+            for (int j = 0; j < 256; j++) {
+                if (code_size[j] == i)
+                    pVal[p++] = static_cast<uint8>(j);
+            }
+        }
+    }
+
+    void jpeg_encoder::put_symbol(int table, uint symbol)
+    {
+        if (m_prog->counting)
+            m_prog->counts[table][symbol]++;
+        else
+            put_bits(m_prog->codes[table][symbol], m_prog->code_sizes[table][symbol]);
+    }
+
+    void jpeg_encoder::put_scan_bits(uint bits, uint len)
+    {
+        if (!m_prog->counting)
+            put_bits(bits, len);
+    }
+
+    void jpeg_encoder::put_eobrun(int table)
+    {
+        progressive_state *s = m_prog;
+        if (!s->eobrun)
+            return;
+        int nbits = 0;
+        for (uint temp = s->eobrun; temp >>= 1; )
+            nbits++;
+        put_symbol(table, nbits << 4);
+        if (nbits)
+            put_scan_bits(s->eobrun & ((1 << nbits) - 1), nbits);
+        for (uint i = 0; i < s->num_corrections; i++)
+            put_scan_bits(s->corrections[i], 1);
+        s->eobrun = 0;
+        s->num_corrections = 0;
+    }
+
+    void jpeg_encoder::code_dc_first(int component_num, int al)
+    {
+        const int table = component_num > 0;
+        // arithmetic shift, the point transform of the DC
+        const int dc = m_coefficient_array[0] >> al;
+        int temp1, temp2, nbits = 0;
+        temp1 = temp2 = dc - m_last_dc_val[component_num];
+        m_last_dc_val[component_num] = dc;
+        if (temp1 < 0) {
+            temp1 = -temp1; temp2--;
+        }
+        while (temp1) {
+            nbits++; temp1 >>= 1;
+        }
+        put_symbol(table, nbits);
+        if (nbits) put_scan_bits(temp2 & ((1 << nbits) - 1), nbits);
+    }
+
+    void jpeg_encoder::code_dc_refine(int al)
+    {
+        put_bits((m_coefficient_array[0] >> al) & 1, 1);
+    }
+
+    void jpeg_encoder::code_ac_first(int table, int ss, int se, int al)
+    {
+        int run_len = 0;
+        for (int k = ss; k <= se; k++) {
+            // the AC point transform shifts the magnitude
+            int temp1 = m_coefficient_array[k], temp2;
+            if (temp1 < 0) {
+                temp1 = -temp1 >> al;
+                temp2 = ~temp1;
+            } else {
+                temp1 >>= al;
+                temp2 = temp1;
+            }
+            if (!temp1) {
+                run_len++;
+                continue;
+            }
+            put_eobrun(table);
+            while (run_len >= 16) {
+                put_symbol(table, 0xF0);
+                run_len -= 16;
+            }
+            int nbits = 1;
+            while (temp1 >>= 1)
+                nbits++;
+            put_symbol(table, (run_len << 4) + nbits);
+            put_scan_bits(temp2 & ((1 << nbits) - 1), nbits);
+            run_len = 0;
+        }
+        if (run_len && ++m_prog->eobrun == 0x7FFF)
+            put_eobrun(table);
+    }
+
+    // Coefficients that are already nonzero get their next bit as a
+    // correction bit, sent after the next symbol; newly nonzero ones are
+    // coded as a run of zeros and a sign.
+    void jpeg_encoder::code_ac_refine(int table, int ss, int se, int al)
+    {
+        progressive_state *s = m_prog;
+        int abs_values[64];
+        int eob = 0, run_len = 0;
+        for (int k = ss; k <= se; k++) {
+            int temp = m_coefficient_array[k];
+            abs_values[k] = (temp < 0 ? -temp : temp) >> al;
+            if (abs_values[k] == 1)
+                eob = k;
+        }
+        // the bits of this block follow those of the pending EOB run
+        uint8 *corrections = s->corrections + s->num_corrections;
+        uint num_corrections = 0;
+        for (int k = ss; k <= se; k++) {
+            const int temp = abs_values[k];
+            if (!temp) {
+                run_len++;
+                continue;
+            }
+            while (run_len > 15 && k <= eob) {
+                put_eobrun(table);
+                put_symbol(table, 0xF0);
+                run_len -= 16;
+                for (uint i = 0; i < num_corrections; i++)
+                    put_scan_bits(corrections[i], 1);
+                corrections = s->corrections;
+                num_corrections = 0;
+            }
+            if (temp > 1) {
+                corrections[num_corrections++] = temp & 1;
+                continue;
+            }
+            put_eobrun(table);
+            put_symbol(table, (run_len << 4) + 1);
+            put_scan_bits(m_coefficient_array[k] < 0 ? 0 : 1, 1);
+            for (uint i = 0; i < num_corrections; i++)
+                put_scan_bits(corrections[i], 1);
+            corrections = s->corrections;
+            num_corrections = 0;
+            run_len = 0;
+        }
+        if (run_len || num_corrections) {
+            s->eobrun++;
+            s->num_corrections += num_corrections;
+            if (s->eobrun == 0x7FFF || s->num_corrections > progressive_state::MAX_CORRECTIONS - 64)
+                put_eobrun(table);
+        }
+    }
+
+    void jpeg_encoder::code_scan(int comp, int ss, int se, int ah, int al)
+    {
+        memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
+        m_prog->eobrun = 0;
+        m_prog->num_corrections = 0;
+        if (comp == SCAN_ALL_COMPONENTS) {
+            // interleaved, or a single component whose MCUs are its blocks: the store order
+            const int luma_blocks = m_comp_h_samp[0] * m_comp_v_samp[0];
+            uint chunk = 0;
+            const uint8 *p = m_store_chunks[0];
+            for (uint i = 0; i < m_store_blocks; i++) {
+                const int b = i % m_blocks_per_mcu;
+                load_stored_block(p);
+                if (ah)
+                    code_dc_refine(al);
+                else
+                    code_dc_first(b < luma_blocks ? 0 : b - luma_blocks + 1, al);
+                p += stored_block_size(p);
+                if (*p == 0xFF)
+                    p = m_store_chunks[++chunk];
+            }
+            return;
+        }
+
+        // a single component in raster order, only the blocks that cover its pixels
+        const int h = m_comp_h_samp[comp], v = m_comp_v_samp[comp];
+        const int blocks_x = ((m_image_x * h + m_comp_h_samp[0] - 1) / m_comp_h_samp[0] + 7) >> 3;
+        const int blocks_y = ((m_image_y * v + m_comp_v_samp[0] - 1) / m_comp_v_samp[0] + 7) >> 3;
+        const int first = comp ? m_comp_h_samp[0] * m_comp_v_samp[0] + comp - 1 : 0;
+        for (int by = 0; by < blocks_y; by++) {
+            for (int bx = 0; bx < blocks_x; bx++) {
+                load_stored_block(store_seek((by / v) * m_store_mcus_x + bx / h, first + (by % v) * h + bx % h));
+                if (ah)
+                    code_ac_refine(comp > 0, ss, se, al);
+                else
+                    code_ac_first(comp > 0, ss, se, al);
+            }
+        }
+        put_eobrun(comp > 0);
+    }
+
+    void jpeg_encoder::emit_scans()
+    {
+        progressive_state *s = m_prog;
+        if (m_store_blocks != (uint)(m_store_mcus_x * m_store_mcus_y * m_blocks_per_mcu)) {
+            m_all_stream_writes_succeeded = false;
+            return;
+        }
+        if (m_store_num_chunks)
+            m_store_chunks[m_store_num_chunks - 1][m_store_pos] = 0xFF;
+        const scan_info *scans = (m_num_components == 3) ? s_color_scans : s_grey_scans;
+        const int num_scans = (m_num_components == 3) ? sizeof(s_color_scans) / sizeof(s_color_scans[0]) : sizeof(s_grey_scans) / sizeof(s_grey_scans[0]);
+        for (int i = 0; i < num_scans && m_all_stream_writes_succeeded; i++) {
+            const scan_info &scan = scans[i];
+            const bool dc = scan.comp == SCAN_ALL_COMPONENTS;
+            // DC refinement bits are sent as they are
+            if (!dc || !scan.ah) {
+                memset(s->counts, 0, sizeof(s->counts));
+                s->counting = true;
+                code_scan(scan.comp, scan.ss, scan.se, scan.ah, scan.al);
+                s->counting = false;
+                const int first_table = dc ? 0 : (scan.comp > 0);
+                const int num_tables = dc ? ((m_num_components == 3) ? 2 : 1) : 1;
+                for (int t = first_table; t < first_table + num_tables; t++) {
+                    optimize_huffman_table(s->counts[t], s->bits[t], s->val[t]);
+                    uint code = 0;
+                    for (int l = 1, p = 0; l <= 16; l++, code <<= 1) {
+                        for (int j = 0; j < s->bits[t][l]; j++, p++) {
+                            s->codes[t][s->val[t][p]] = code++;
+                            s->code_sizes[t][s->val[t][p]] = static_cast<uint8>(l);
+                        }
+                    }
+                    emit_dht(s->bits[t], s->val[t], t, !dc);
+                }
+            }
+            if (dc)
+                emit_sos(0, m_num_components, scan.ss, scan.se, scan.ah, scan.al);
+            else
+                emit_sos(scan.comp, 1, scan.ss, scan.se, scan.ah, scan.al);
+            code_scan(scan.comp, scan.ss, scan.se, scan.ah, scan.al);
+            flush_bits();
+        }
+    }
+
+    template<subsampling_t subsampling>
+    void jpeg_encoder::process_mcu_row()
+    {
+        for (int i = 0; i < m_mcus_per_row; i++)
         {
-            for (int i = 0; i < m_mcus_per_row; i++)
+            switch (subsampling)
             {
-                load_block_8_8(i * 2 + 0, 0, 0); code_block(0); load_block_8_8(i * 2 + 1, 0, 0); code_block(0);
-                load_block_8_8(i * 2 + 0, 1, 0); code_block(0); load_block_8_8(i * 2 + 1, 1, 0); code_block(0);
-                load_block_16_8(i, 1); code_block(1); load_block_16_8(i, 2); code_block(2);
+                case Y_ONLY:
+                    load_block_8_8_grey(i); code_block<0>(0);
+                    break;
+                case H1V1:
+                    load_block_8_8(i, 0, 0); code_block<0>(0); load_block_8_8(i, 0, 1); code_block<1>(1); load_block_8_8(i, 0, 2); code_block<1>(2);
+                    break;
+                case H2V1:
+                    load_block_8_8(i * 2 + 0, 0, 0); code_block<0>(0); load_block_8_8(i * 2 + 1, 0, 0); code_block<0>(0);
+                    load_block_16_8_8(i, 1); code_block<1>(1); load_block_16_8_8(i, 2); code_block<1>(2);
+                    break;
+                case H2V2:
+                    load_block_8_8(i * 2 + 0, 0, 0); code_block<0>(0); load_block_8_8(i * 2 + 1, 0, 0); code_block<0>(0);
+                    load_block_8_8(i * 2 + 0, 1, 0); code_block<0>(0); load_block_8_8(i * 2 + 1, 1, 0); code_block<0>(0);
+                    load_block_16_8(i, 1); code_block<1>(1); load_block_16_8(i, 2); code_block<1>(2);
+                    break;
             }
         }
     }
 
-    void jpeg_encoder::load_mcu(const void *pSrc)
+    void jpeg_encoder::load_mcu(const void *pSrc, bool ycc)
     {
         const uint8* Psrc = reinterpret_cast<const uint8*>(pSrc);
 
         uint8* pDst = m_mcu_lines[m_mcu_y_ofs]; // OK to write up to m_image_bpl_xlt bytes to pDst
 
-        if (m_num_components == 1) {
-            if (m_image_bpp == 3)
-                RGB_to_Y(pDst, Psrc, m_image_x);
-            else
-                memcpy(pDst, Psrc, m_image_x);
+        if (ycc) {
+            memcpy(pDst, Psrc, m_image_bpl_xlt);
         } else {
-            if (m_image_bpp == 3)
-                RGB_to_YCC(pDst, Psrc, m_image_x);
-            else
-                Y_to_YCC(pDst, Psrc, m_image_x);
+            m_load_line(pDst, Psrc, m_image_x);
         }
 
         // Possibly duplicate pixels at end of scanline if not a multiple of 8 or 16
@@ -545,19 +994,19 @@ namespace jpge {
 
         if (++m_mcu_y_ofs == m_mcu_y)
         {
-            process_mcu_row();
+            (this->*m_process_mcu_row)();
             m_mcu_y_ofs = 0;
         }
     }
 
     // Quantization table generation.
-    void jpeg_encoder::compute_quant_table(int32 *pDst, const int16 *pSrc)
+    static void scale_quant_table(int quality, int32 *pDst, const int16 *pSrc)
     {
         int32 q;
-        if (m_params.m_quality < 50)
-            q = 5000 / m_params.m_quality;
+        if (quality < 50)
+            q = 5000 / quality;
         else
-            q = 200 - m_params.m_quality * 2;
+            q = 200 - quality * 2;
         for (int i = 0; i < 64; i++)
         {
             int32 j = *pSrc++; j = (j * q + 50L) / 100L;
@@ -565,8 +1014,32 @@ namespace jpge {
         }
     }
 
+    void jpeg_encoder::compute_quant_table(int32 *pDst, const int16 *pSrc)
+    {
+        scale_quant_table(m_params.m_quality, pDst, pSrc);
+    }
+
+    void get_quantization_tables(int quality, uint8 *pLuma, uint8 *pChroma)
+    {
+        int32 table[64];
+        quality = JPGE_MIN(JPGE_MAX(quality, 1), 100);
+        scale_quant_table(quality, table, s_std_lum_quant);
+        for (int i = 0; i < 64; i++)
+            pLuma[i] = static_cast<uint8>(table[i]);
+        scale_quant_table(quality, table, s_std_croma_quant);
+        for (int i = 0; i < 64; i++)
+            pChroma[i] = static_cast<uint8>(table[i]);
+    }
+
     // Higher-level methods.
-    bool jpeg_encoder::jpg_open(int p_x_res, int p_y_res, int src_channels)
+    uint jpeg_encoder::mcu_buffer_size(int width, subsampling_t subsampling)
+    {
+        const int mcu_x = (subsampling >= H2V1) ? 16 : 8, mcu_y = (subsampling == H2V2) ? 16 : 8;
+        const int num_components = (subsampling == Y_ONLY) ? 1 : 3;
+        return ((width + mcu_x - 1) & (~(mcu_x - 1))) * num_components * mcu_y;
+    }
+
+    bool jpeg_encoder::jpg_open(int p_x_res, int p_y_res, int src_channels, uint8 *pMCU_buf)
     {
         m_num_components = 3;
         switch (m_params.m_subsampling)
@@ -576,6 +1049,7 @@ namespace jpge {
                 m_num_components = 1;
                 m_comp_h_samp[0] = 1; m_comp_v_samp[0] = 1;
                 m_mcu_x          = 8; m_mcu_y          = 8;
+                m_process_mcu_row = &jpeg_encoder::process_mcu_row<Y_ONLY>;
                 break;
             }
             case H1V1:
@@ -584,6 +1058,7 @@ namespace jpge {
                 m_comp_h_samp[1] = 1; m_comp_v_samp[1] = 1;
                 m_comp_h_samp[2] = 1; m_comp_v_samp[2] = 1;
                 m_mcu_x          = 8; m_mcu_y          = 8;
+                m_process_mcu_row = &jpeg_encoder::process_mcu_row<H1V1>;
                 break;
             }
             case H2V1:
@@ -592,6 +1067,7 @@ namespace jpge {
                 m_comp_h_samp[1] = 1; m_comp_v_samp[1] = 1;
                 m_comp_h_samp[2] = 1; m_comp_v_samp[2] = 1;
                 m_mcu_x          = 16; m_mcu_y         = 8;
+                m_process_mcu_row = &jpeg_encoder::process_mcu_row<H2V1>;
                 break;
             }
             case H2V2:
@@ -600,9 +1076,15 @@ namespace jpge {
                 m_comp_h_samp[1] = 1; m_comp_v_samp[1] = 1;
                 m_comp_h_samp[2] = 1; m_comp_v_samp[2] = 1;
                 m_mcu_x          = 16; m_mcu_y         = 16;
+                m_process_mcu_row = &jpeg_encoder::process_mcu_row<H2V2>;
             }
         }
 
+        if (m_num_components == 1)
+            m_load_line = (src_channels == 3) ? RGB_to_Y : Y_to_Y;
+        else
+            m_load_line = (src_channels == 3) ? RGB_to_YCC : Y_to_YCC;
+
         m_image_x        = p_x_res; m_image_y = p_y_res;
         m_image_bpp      = src_channels;
         m_image_bpl      = m_image_x * src_channels;
@@ -612,7 +1094,15 @@ namespace jpge {
         m_image_bpl_mcu  = m_image_x_mcu * m_num_components;
         m_mcus_per_row   = m_image_x_mcu / m_mcu_x;
 
-        if ((m_mcu_lines[0] = static_cast<uint8*>(jpge_malloc(m_image_bpl_mcu * m_mcu_y))) == NULL) {
+        m_progressive = m_params.m_progressive;
+        if (m_progressive && !store_open(m_mcus_per_row, m_image_y_mcu / m_mcu_y)) {
+            return false;
+        }
+
+        m_own_mcu_lines = !pMCU_buf;
+        if (pMCU_buf) {
+            m_mcu_lines[0] = pMCU_buf;
+        } else if ((m_mcu_lines[0] = static_cast<uint8*>(jpge_malloc(m_image_bpl_mcu * m_mcu_y))) == NULL) {
             return false;
         }
         for (int i = 1; i < m_mcu_y; i++)
@@ -624,9 +1114,13 @@ namespace jpge {
             compute_quant_table(m_quantization_tables[1], s_std_croma_quant);
         }
 
-        if(!m_huff_initialized){
-            m_huff_initialized = true;
+        return emit_headers();
+    }
 
+    // Resets the coder state and emits all markers at beginning of image file.
+    bool jpeg_encoder::emit_headers()
+    {
+        if(!m_huff_initialized){
             memcpy(m_huff_bits[0+0], s_dc_lum_bits, 17);    memcpy(m_huff_val[0+0], s_dc_lum_val, DC_LUM_CODES);
             memcpy(m_huff_bits[2+0], s_ac_lum_bits, 17);    memcpy(m_huff_val[2+0], s_ac_lum_val, AC_LUM_CODES);
             memcpy(m_huff_bits[0+1], s_dc_chroma_bits, 17); memcpy(m_huff_val[0+1], s_dc_chroma_val, DC_CHROMA_CODES);
@@ -636,6 +1130,8 @@ namespace jpge {
             compute_huffman_table(&m_huff_codes[2+0][0], &m_huff_code_sizes[2+0][0], m_huff_bits[2+0], m_huff_val[2+0]);
             compute_huffman_table(&m_huff_codes[0+1][0], &m_huff_code_sizes[0+1][0], m_huff_bits[0+1], m_huff_val[0+1]);
             compute_huffman_table(&m_huff_codes[2+1][0], &m_huff_code_sizes[2+1][0], m_huff_bits[2+1], m_huff_val[2+1]);
+            // set last, a concurrent encoder may only skip the identical setup once it is complete
+            m_huff_initialized = true;
         }
 
         m_out_buf_left = JPGE_OUT_BUF_SIZE;
@@ -646,13 +1142,15 @@ namespace jpge {
         m_pass_num = 2;
         memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
 
-        // Emit all markers at beginning of image file.
         emit_marker(M_SOI);
         emit_jfif_app0();
         emit_dqt();
         emit_sof();
-        emit_dhts();
-        emit_sos();
+        // progressive scans come with their own tables
+        if (!m_progressive) {
+            emit_dhts();
+            emit_sos(0, m_num_components, 0, 63, 0, 0);
+        }
 
         return m_all_stream_writes_succeeded;
     }
@@ -665,10 +1163,16 @@ namespace jpge {
                     memcpy(m_mcu_lines[i], m_mcu_lines[m_mcu_y_ofs - 1], m_image_bpl_mcu);
                 }
             }
-            process_mcu_row();
+            (this->*m_process_mcu_row)();
         }
 
-        put_bits(0x7F, 7);
+        if (m_progressive) {
+            if (m_all_stream_writes_succeeded)
+                emit_scans();
+            store_free();
+        } else {
+            flush_bits();
+        }
         emit_marker(M_EOI);
         flush_output_buffer();
         m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(NULL, 0);
@@ -679,12 +1183,20 @@ namespace jpge {
     void jpeg_encoder::clear()
     {
         m_mcu_lines[0] = NULL;
+        m_own_mcu_lines = false;
+        m_coef_qt[0] = m_coef_qt[1] = NULL;
+        m_progressive = false;
+        m_store_chunks = NULL;
+        m_store_mcu_ofs = NULL;
+        m_prog = NULL;
+        m_store_num_chunks = 0;
         m_pass_num = 0;
         m_all_stream_writes_succeeded = true;
     }
 
     jpeg_encoder::jpeg_encoder()
     {
+        m_last_quality = 0;
         clear();
     }
 
@@ -694,23 +1206,40 @@ namespace jpge {
     }
 
     bool jpeg_encoder::init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params)
+    {
+        return init(pStream, width, height, src_channels, comp_params, NULL);
+    }
+
+    bool jpeg_encoder::init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params, uint8 *pMCU_buf)
     {
         deinit();
         if (((!pStream) || (width < 1) || (height < 1)) || ((src_channels != 1) && (src_channels != 3) && (src_channels != 4)) || (!comp_params.check())) return false;
         m_pStream = pStream;
         m_params = comp_params;
-        return jpg_open(width, height, src_channels);
+        return jpg_open(width, height, src_channels, pMCU_buf);
     }
 
     void jpeg_encoder::deinit()
     {
-        jpge_free(m_mcu_lines[0]);
+        if (m_own_mcu_lines)
+            jpge_free(m_mcu_lines[0]);
+        store_free();
         clear();
     }
 
     bool jpeg_encoder::process_scanline(const void* pScanline)
     {
-        if ((m_pass_num < 1) || (m_pass_num > 2)) {
+        return process_line(pScanline, false);
+    }
+
+    bool jpeg_encoder::process_ycc_scanline(const void* pScanline)
+    {
+        return process_line(pScanline, true);
+    }
+
+    bool jpeg_encoder::process_line(const void* pScanline, bool ycc)
+    {
+        if ((m_pass_num < 1) || (m_pass_num > 2) || (m_coef_qt[0])) {
             return false;
         }
         if (m_all_stream_writes_succeeded) {
@@ -719,10 +1248,59 @@ namespace jpge {
                     return false;
                 }
             } else {
-                load_mcu(pScanline);
+                load_mcu(pScanline, ycc);
             }
         }
         return m_all_stream_writes_succeeded;
     }
 
+    bool jpeg_encoder::init_coefficients(output_stream *pStream, int width, int height, int num_components, int luma_h_samp, int luma_v_samp,
+                                         const uint8 *luma_qt, const uint8 *chroma_qt, bool progressive)
+    {
+        deinit();
+        if ((!pStream) || (width < 1) || (height < 1) || (width > 0xFFFF) || (height > 0xFFFF) || ((num_components != 1) && (num_components != 3))
+            || (luma_h_samp < 1) || (luma_h_samp > 2) || (luma_v_samp < 1) || (luma_v_samp > 2) || (!luma_qt) || ((num_components == 3) && (!chroma_qt))) {
+            return false;
+        }
+        m_pStream = pStream;
+        m_num_components = num_components;
+        m_comp_h_samp[0] = (num_components == 1) ? 1 : luma_h_samp;
+        m_comp_v_samp[0] = (num_components == 1) ? 1 : luma_v_samp;
+        m_comp_h_samp[1] = m_comp_v_samp[1] = 1;
+        m_comp_h_samp[2] = m_comp_v_samp[2] = 1;
+        m_image_x = width;
+        m_image_y = height;
+        m_coef_qt[0] = luma_qt;
+        m_coef_qt[1] = (num_components == 3) ? chroma_qt : luma_qt;
+        m_progressive = progressive;
+        if (progressive && !store_open((width + 8 * m_comp_h_samp[0] - 1) / (8 * m_comp_h_samp[0]), (height + 8 * m_comp_v_samp[0] - 1) / (8 * m_comp_v_samp[0]))) {
+            return false;
+        }
+        return emit_headers();
+    }
+
+    bool jpeg_encoder::code_coefficients(int component_num, const int16 *pCoefficients)
+    {
+        if ((m_pass_num != 2) || (!m_coef_qt[0]) || ((uint)component_num >= m_num_components)) {
+            return false;
+        }
+        memcpy(m_coefficient_array, pCoefficients, sizeof(m_coefficient_array));
+        if (m_progressive)
+            store_block();
+        else if (component_num)
+            code_coefficients_pass_two<1>(component_num);
+        else
+            code_coefficients_pass_two<0>(component_num);
+        return m_all_stream_writes_succeeded;
+    }
+
+    bool jpeg_encoder::finish_coefficients()
+    {
+        if ((m_pass_num != 2) || (!m_coef_qt[0])) {
+            return false;
+        }
+        process_end_of_image();
+        return m_all_stream_writes_succeeded;
+    }
+
 } // namespace jpge
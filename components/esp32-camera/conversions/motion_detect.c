@@ -0,0 +1,423 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "motion_detect.h"
+#include "jpeg_coef.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#define TAG ""
+#else
+#include "esp_log.h"
+static const char* TAG = "motion";
+#endif
+
+// raw frames are sampled on every other row and column
+#define RAW_SAMPLE_STEP     2
+
+#define MASK_CHANGED        1
+#define MASK_LABELED        2
+
+struct motion_detect {
+    motion_detect_config_t config;
+    uint16_t width, height;
+    uint16_t tiles_x, tiles_y;
+    uint32_t frames;
+    uint16_t *background;   // Q8 mean luma per tile
+    uint8_t *luma;          // mean luma per tile of the current frame
+    uint8_t *reference;     // tile luma of the frame set by motion_detect_set_reference()
+    bool has_reference;
+    bool has_luma;          // luma holds a complete frame
+    uint8_t *mask;
+    uint16_t *stack;        // flood fill work list
+    uint32_t *sums;
+    uint8_t *dc_map;        // 1/8 scale luma of JPEG frames
+    jpeg_coef_dec_t *jpeg;
+    QueueHandle_t queue;
+};
+
+static void free_tiles(motion_detect_handle_t md)
+{
+    free(md->background);
+    free(md->luma);
+    free(md->reference);
+    free(md->mask);
+    free(md->stack);
+    free(md->sums);
+    free(md->dc_map);
+    md->background = NULL;
+    md->luma = NULL;
+    md->reference = NULL;
+    md->has_reference = false;
+    md->has_luma = false;
+    md->mask = NULL;
+    md->stack = NULL;
+    md->sums = NULL;
+    md->dc_map = NULL;
+    md->width = md->height = 0;
+}
+
+static esp_err_t set_geometry(motion_detect_handle_t md, uint16_t width, uint16_t height)
+{
+    if (md->width == width && md->height == height) {
+        return ESP_OK;
+    }
+    free_tiles(md);
+    md->frames = 0;
+    md->tiles_x = (width + md->config.tile_size - 1) / md->config.tile_size;
+    md->tiles_y = (height + md->config.tile_size - 1) / md->config.tile_size;
+    size_t n = md->tiles_x * md->tiles_y;
+    md->background = calloc(n, sizeof(uint16_t));
+    md->luma = calloc(n, 1);
+    md->reference = calloc(n, 1);
+    md->mask = calloc(n, 1);
+    md->stack = calloc(n, sizeof(uint16_t));
+    md->sums = calloc(n, sizeof(uint32_t));
+    md->dc_map = calloc(((width + 7) / 8) * ((height + 7) / 8), 1);
+    if (!md->background || !md->luma || !md->reference || !md->mask || !md->stack || !md->sums || !md->dc_map) {
+        ESP_LOGE(TAG, "No memory for %u tiles", (unsigned)n);
+        free_tiles(md);
+        return ESP_ERR_NO_MEM;
+    }
+    md->width = width;
+    md->height = height;
+    return ESP_OK;
+}
+
+static inline uint8_t rgb_luma(uint8_t r, uint8_t g, uint8_t b)
+{
+    return (r * 77 + g * 150 + b * 29) >> 8;
+}
+
+static inline uint8_t sample_luma(const uint8_t *row, int x, pixformat_t format)
+{
+    switch (format) {
+    case PIXFORMAT_GRAYSCALE:
+        return row[x];
+    case PIXFORMAT_YUV422:
+        return row[2 * x];
+    case PIXFORMAT_RGB565: {
+        uint8_t hb = row[2 * x], lb = row[2 * x + 1];
+        return rgb_luma(hb & 0xF8, (hb & 0x07) << 5 | (lb & 0xE0) >> 3, (lb & 0x1F) << 3);
+    }
+    default: // PIXFORMAT_RGB888, stored as BGR
+        return rgb_luma(row[3 * x + 2], row[3 * x + 1], row[3 * x]);
+    }
+}
+
+/*
+ * Average a luma plane (sampled every `step` pixels) into the tile grid. For
+ * JPEG frames the plane is the DC map, where one sample covers 8x8 pixels.
+ */
+static void tile_means(motion_detect_handle_t md, const uint8_t *src, size_t stride,
+                       int plane_w, int plane_h, int step, int scale, pixformat_t format)
+{
+    int tile = md->config.tile_size / scale;
+    memset(md->sums, 0, md->tiles_x * md->tiles_y * sizeof(uint32_t));
+    for (int y = 0; y < plane_h; y += step) {
+        const uint8_t *row = src + y * stride;
+        uint32_t *sums = md->sums + (y / tile) * md->tiles_x;
+        for (int tx = 0; tx < md->tiles_x; tx++) {
+            int xe = (tx + 1) * tile < plane_w ? (tx + 1) * tile : plane_w;
+            uint32_t sum = 0;
+            for (int x = tx * tile; x < xe; x += step) {
+                sum += sample_luma(row, x, format);
+            }
+            sums[tx] += sum;
+        }
+    }
+    for (int ty = 0; ty < md->tiles_y; ty++) {
+        int th = (ty + 1) * tile < plane_h ? tile : plane_h - ty * tile;
+        for (int tx = 0; tx < md->tiles_x; tx++) {
+            int tw = (tx + 1) * tile < plane_w ? tile : plane_w - tx * tile;
+            uint32_t count = ((tw + step - 1) / step) * ((th + step - 1) / step);
+            md->luma[ty * md->tiles_x + tx] = md->sums[ty * md->tiles_x + tx] / count;
+        }
+    }
+}
+
+static esp_err_t frame_luma(motion_detect_handle_t md, const camera_fb_t *fb)
+{
+    // a partly written tile map must not become the reference
+    md->has_luma = false;
+    if (fb->format == PIXFORMAT_JPEG) {
+        if (!md->jpeg) {
+            md->jpeg = malloc(sizeof(jpeg_coef_dec_t));
+            if (!md->jpeg) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
+        if (!jpeg_coef_start(md->jpeg, fb->buf, fb->len)) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        if (md->jpeg->width != md->width || md->jpeg->height != md->height) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        int map_w = (md->width + 7) / 8;
+        int map_h = (md->height + 7) / 8;
+        if (!jpeg_coef_luma(md->jpeg, 3, md->dc_map, map_w)) {
+            ESP_LOGW(TAG, "Corrupt JPEG frame");
+            return ESP_ERR_INVALID_SIZE;
+        }
+        tile_means(md, md->dc_map, map_w, map_w, map_h, 1, 8, PIXFORMAT_GRAYSCALE);
+        md->has_luma = true;
+        return ESP_OK;
+    }
+
+    size_t bpp;
+    switch (fb->format) {
+    case PIXFORMAT_GRAYSCALE:
+        bpp = 1;
+        break;
+    case PIXFORMAT_YUV422:
+    case PIXFORMAT_RGB565:
+        bpp = 2;
+        break;
+    case PIXFORMAT_RGB888:
+        bpp = 3;
+        break;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (fb->len < (size_t)md->width * md->height * bpp) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    tile_means(md, fb->buf, md->width * bpp, md->width, md->height, RAW_SAMPLE_STEP, 1, fb->format);
+    md->has_luma = true;
+    return ESP_OK;
+}
+
+static void add_region(motion_event_t *event, const motion_region_t *region)
+{
+    int slot = event->region_count;
+    if (slot == MOTION_DETECT_MAX_REGIONS) {
+        // replace the smallest region if this one is larger
+        slot = MOTION_DETECT_MAX_REGIONS - 1;
+        if (event->regions[slot].tiles >= region->tiles) {
+            return;
+        }
+    } else {
+        event->region_count++;
+    }
+    // keep the list sorted by size, largest first
+    while (slot > 0 && event->regions[slot - 1].tiles < region->tiles) {
+        event->regions[slot] = event->regions[slot - 1];
+        slot--;
+    }
+    event->regions[slot] = *region;
+}
+
+static void find_regions(motion_detect_handle_t md, motion_event_t *event)
+{
+    int tile = md->config.tile_size;
+    int n = md->tiles_x * md->tiles_y;
+    for (int start = 0; start < n; start++) {
+        if (md->mask[start] != MASK_CHANGED) {
+            continue;
+        }
+        int x0 = md->tiles_x, y0 = md->tiles_y, x1 = 0, y1 = 0, count = 0;
+        int sp = 0;
+        md->stack[sp++] = start;
+        md->mask[start] = MASK_LABELED;
+        while (sp) {
+            int t = md->stack[--sp];
+            int tx = t % md->tiles_x, ty = t / md->tiles_x;
+            count++;
+            x0 = tx < x0 ? tx : x0;
+            x1 = tx > x1 ? tx : x1;
+            y0 = ty < y0 ? ty : y0;
+            y1 = ty > y1 ? ty : y1;
+            int neighbours[4] = {
+                tx > 0 ? t - 1 : -1,
+                tx < md->tiles_x - 1 ? t + 1 : -1,
+                ty > 0 ? t - md->tiles_x : -1,
+                ty < md->tiles_y - 1 ? t + md->tiles_x : -1,
+            };
+            for (int i = 0; i < 4; i++) {
+                if (neighbours[i] >= 0 && md->mask[neighbours[i]] == MASK_CHANGED) {
+                    md->mask[neighbours[i]] = MASK_LABELED;
+                    md->stack[sp++] = neighbours[i];
+                }
+            }
+        }
+        if (count < md->config.min_region_tiles) {
+            continue;
+        }
+        motion_region_t region = {
+            .x = x0 * tile,
+            .y = y0 * tile,
+            .w = ((x1 + 1) * tile < md->width ? (x1 + 1) * tile : md->width) - x0 * tile,
+            .h = ((y1 + 1) * tile < md->height ? (y1 + 1) * tile : md->height) - y0 * tile,
+            .tiles = count,
+        };
+        add_region(event, &region);
+    }
+}
+
+esp_err_t motion_detect_create(const motion_detect_config_t *config, motion_detect_handle_t *handle)
+{
+    if (!config || !handle || !config->tile_size || (config->tile_size % 8) || config->learn_shift > 8) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    motion_detect_handle_t md = calloc(1, sizeof(struct motion_detect));
+    if (!md) {
+        return ESP_ERR_NO_MEM;
+    }
+    md->config = *config;
+    if (config->queue_len) {
+        md->queue = xQueueCreate(config->queue_len, sizeof(motion_event_t));
+        if (!md->queue) {
+            free(md);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    *handle = md;
+    return ESP_OK;
+}
+
+void motion_detect_delete(motion_detect_handle_t handle)
+{
+    if (!handle) {
+        return;
+    }
+    free_tiles(handle);
+    free(handle->jpeg);
+    if (handle->queue) {
+        vQueueDelete(handle->queue);
+    }
+    free(handle);
+}
+
+void motion_detect_reset(motion_detect_handle_t handle)
+{
+    handle->frames = 0;
+}
+
+esp_err_t motion_detect_process(motion_detect_handle_t md, const camera_fb_t *fb, motion_event_t *event)
+{
+    motion_event_t ev = {0};
+    if (event) {
+        event->region_count = 0;
+    }
+    esp_err_t err = set_geometry(md, fb->width, fb->height);
+    if (err == ESP_OK) {
+        err = frame_luma(md, fb);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    int n = md->tiles_x * md->tiles_y;
+    ev.timestamp = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    ev.frame = md->frames;
+    ev.width = md->width;
+    ev.height = md->height;
+    ev.total_tiles = n;
+    if (md->frames++ == 0) {
+        for (int t = 0; t < n; t++) {
+            md->background[t] = md->luma[t] << 8;
+        }
+        if (event) {
+            *event = ev;
+        }
+        return ESP_OK;
+    }
+
+    // compensate global brightness changes (auto exposure) before thresholding
+    int offset = 0;
+    for (int t = 0; t < n; t++) {
+        offset += md->luma[t] - (md->background[t] >> 8);
+    }
+    offset /= n;
+
+    uint8_t shift = md->config.learn_shift;
+    for (int t = 0; t < n; t++) {
+        int diff = md->luma[t] - (md->background[t] >> 8) - offset;
+        bool changed = diff > md->config.threshold || -diff > md->config.threshold;
+        md->mask[t] = changed ? MASK_CHANGED : 0;
+        ev.changed_tiles += changed;
+        // changed tiles are learned at half the rate so objects are not absorbed at once
+        int delta = (md->luma[t] << 8) - md->background[t];
+        md->background[t] += delta >> (changed ? shift + 1 : shift);
+    }
+    if (ev.changed_tiles) {
+        find_regions(md, &ev);
+    }
+    if (event) {
+        *event = ev;
+    }
+    if (ev.region_count) {
+        if (md->config.cb) {
+            md->config.cb(&ev, md->config.cb_arg);
+        }
+        if (md->queue && xQueueSend(md->queue, &ev, 0) != pdTRUE) {
+            // keep the most recent events
+            motion_event_t dropped;
+            xQueueReceive(md->queue, &dropped, 0);
+            xQueueSend(md->queue, &ev, 0);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t motion_detect_compare(motion_detect_handle_t md, const camera_fb_t *fb, motion_compare_t *result)
+{
+    esp_err_t err = set_geometry(md, fb->width, fb->height);
+    if (err == ESP_OK) {
+        err = frame_luma(md, fb);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    int n = md->tiles_x * md->tiles_y;
+    result->total_tiles = n;
+    if (!md->has_reference) {
+        result->changed_tiles = n;
+        result->max_diff = 255;
+        return ESP_OK;
+    }
+    uint16_t changed = 0;
+    uint8_t max_diff = 0;
+    for (int t = 0; t < n; t++) {
+        int diff = md->luma[t] - md->reference[t];
+        uint8_t d = diff < 0 ? -diff : diff;
+        changed += d > md->config.threshold;
+        max_diff = d > max_diff ? d : max_diff;
+    }
+    result->changed_tiles = changed;
+    result->max_diff = max_diff;
+    return ESP_OK;
+}
+
+void motion_detect_set_reference(motion_detect_handle_t md)
+{
+    if (!md->has_luma) {
+        return;
+    }
+    memcpy(md->reference, md->luma, md->tiles_x * md->tiles_y);
+    md->has_reference = true;
+}
+
+esp_err_t motion_detect_get_event(motion_detect_handle_t handle, motion_event_t *event, TickType_t timeout)
+{
+    if (!handle->queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return xQueueReceive(handle->queue, event, timeout) == pdTRUE ? ESP_OK : ESP_ERR_TIMEOUT;
+}
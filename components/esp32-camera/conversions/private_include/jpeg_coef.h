@@ -0,0 +1,167 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef _CONVERSIONS_JPEG_COEF_H_
+#define _CONVERSIONS_JPEG_COEF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Baseline JPEG entropy decoder.
+ *
+ * Gives access to the quantized DCT coefficients of a sequential Huffman
+ * coded JPEG (as produced by the sensors and by jpge) without running an
+ * IDCT. All state lives in the caller-owned jpeg_coef_dec_t, so several
+ * frames can be parsed concurrently.
+ */
+
+#define JPEG_COEF_MAX_COMPONENTS    3
+#define JPEG_COEF_HUFF_FAST_BITS    9
+
+typedef struct {
+    uint16_t fast[1 << JPEG_COEF_HUFF_FAST_BITS];  // (length << 8) | symbol, 0 for longer codes
+    int32_t maxcode[17];                            // largest code of each length, -1 if none
+    int32_t valoffset[17];                          // index of the first symbol of each length minus its code
+    uint8_t vals[256];
+    bool present;
+} jpeg_coef_huff_t;
+
+typedef struct {
+    uint8_t id;
+    uint8_t h, v;           // sampling factors
+    uint8_t tq;             // quantization table
+    uint8_t td, ta;         // DC and AC Huffman tables
+    int16_t dc_pred;
+} jpeg_coef_comp_t;
+
+typedef struct {
+    uint16_t width, height;
+    uint8_t num_components;
+    uint8_t max_h, max_v;
+    uint16_t mcus_x, mcus_y;
+    uint16_t restart_interval;
+    jpeg_coef_comp_t comp[JPEG_COEF_MAX_COMPONENTS];
+    uint16_t qt[4][64];     // quantization tables in zigzag order
+    jpeg_coef_huff_t dc[2];
+    jpeg_coef_huff_t ac[2];
+
+    // entropy coded segment reader
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    size_t scan_start;      // first byte of the entropy coded data
+    uint32_t bit_buf;       // MSB aligned
+    int bit_count;
+    bool marker_hit;
+    uint32_t mcu_count;
+} jpeg_coef_dec_t;
+
+/**
+ * @brief Reader position at the start of an MCU, for decoding MCUs out of order
+ */
+typedef struct {
+    uint32_t pos;
+    uint32_t bit_buf;
+    int8_t bit_count;
+    bool marker_hit;
+    int16_t dc_pred[JPEG_COEF_MAX_COMPONENTS];
+} jpeg_coef_mark_t;
+
+/**
+ * @brief Zigzag index to natural (row major) coefficient index
+ */
+extern const uint8_t jpeg_coef_zigzag[64];
+
+/**
+ * @brief Parse the headers up to the start of the scan
+ *
+ * @param dec       Decoder context
+ * @param src       JPEG data
+ * @param src_len   Length of the JPEG data
+ *
+ * @return true if the image is a supported baseline/extended sequential JPEG
+ */
+bool jpeg_coef_start(jpeg_coef_dec_t *dec, const uint8_t *src, size_t src_len);
+
+/**
+ * @brief Handle restart markers, must be called before each MCU
+ *
+ * @return false if an expected restart marker is missing
+ */
+bool jpeg_coef_next_mcu(jpeg_coef_dec_t *dec);
+
+/**
+ * @brief Entropy decode the next block of a component
+ *
+ * @param dec       Decoder context
+ * @param ci        Component index
+ * @param zz        64 quantized coefficients in zigzag order, or NULL to only track DC
+ *
+ * @return false on corrupt data
+ */
+bool jpeg_coef_decode_block(jpeg_coef_dec_t *dec, uint8_t ci, int16_t *zz);
+
+/**
+ * @brief Remember the reader position, after jpeg_coef_next_mcu()
+ */
+void jpeg_coef_mark(const jpeg_coef_dec_t *dec, jpeg_coef_mark_t *mark);
+
+/**
+ * @brief Return to a position saved by jpeg_coef_mark()
+ *
+ * The blocks of the marked MCU can then be decoded again without calling
+ * jpeg_coef_next_mcu(), restart markers are already accounted for.
+ */
+void jpeg_coef_seek(jpeg_coef_dec_t *dec, const jpeg_coef_mark_t *mark);
+
+/**
+ * @brief Dequantize and inverse transform one block at 1/2^shift scale
+ *
+ * Shift 0 is the full 8x8 IDCT, 1 and 2 give the means of the 2x2 or 4x4
+ * pixel groups and 3 the block mean from the DC coefficient alone.
+ *
+ * @param zz        Quantized coefficients in zigzag order, from jpeg_coef_decode_block()
+ * @param qt        Quantization table of the component
+ * @param shift     Scale, 0 to 3
+ * @param out       (8 >> shift) x (8 >> shift) pixels, row major
+ */
+void jpeg_coef_idct(const int16_t *zz, const uint16_t *qt, uint8_t shift, uint8_t *out);
+
+/**
+ * @brief Decode the luma (component 0) of the image at 1/2^shift scale
+ *
+ * Chroma blocks are only entropy decoded. Scale 1:1 runs an 8x8 integer
+ * IDCT per luma block, 1/2 and 1/4 compute the means of its 2x2 or 4x4 pixel
+ * groups straight from the coefficients and 1/8 uses the DC coefficient alone. The output is ((width + 2^shift - 1) >> shift) x
+ * ((height + 2^shift - 1) >> shift) pixels.
+ *
+ * @param dec       Decoder context, after jpeg_coef_start()
+ * @param shift     Scale, 0 to 3
+ * @param out       Output buffer
+ * @param stride    Bytes per output row
+ *
+ * @return false on corrupt data or an invalid scale
+ */
+bool jpeg_coef_luma(jpeg_coef_dec_t *dec, uint8_t shift, uint8_t *out, size_t stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CONVERSIONS_JPEG_COEF_H_ */
@@ -18,7 +18,7 @@ namespace jpge
 
     // JPEG compression parameters structure.
     struct params {
-            inline params() : m_quality(85), m_subsampling(H2V2) { }
+            inline params() : m_quality(85), m_subsampling(H2V2), m_progressive(false) { }
 
             inline bool check() const {
                 if ((m_quality < 1) || (m_quality > 100)) {
@@ -39,8 +39,18 @@ namespace jpge
             // 2 = H2V1 subsampling (YCbCr 2x1x1, 4 blocks per MCU)
             // 3 = H2V2 subsampling (YCbCr 4x1x1, 6 blocks per MCU-- very common)
             subsampling_t m_subsampling;
+
+            // Progressive JPEG (SOF2) instead of baseline. The quantized blocks of the whole image are kept in a
+            // compact store until the end of the image, then sent in several scans: the first one is the DC of
+            // every block, a full frame preview at 1/8 scale, later ones refine it. The store takes about three times
+            // the size of the compressed image (PSRAM when available), each scan is entropy coded twice to build
+            // its Huffman tables.
+            bool m_progressive;
     };
     
+    // Computes the luma and chroma quantization tables jpeg_encoder uses for a quality (1-100), in zigzag order.
+    void get_quantization_tables(int quality, uint8 *pLuma, uint8 *pChroma);
+
     // Output stream abstract class - used by the jpeg_encoder class to write to the output stream.
     // put_buf() is generally called with len==JPGE_OUT_BUF_SIZE bytes, but for headers it'll be called with smaller amounts.
     class output_stream {
@@ -64,21 +74,51 @@ namespace jpge
             // Returns false on out of memory or if a stream write fails.
             bool init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params = params());
 
+            // Same as above, with a caller owned MCU line buffer of at least mcu_buffer_size() bytes instead of a heap allocation.
+            // The buffer must stay valid until deinit().
+            bool init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params, uint8 *pMCU_buf);
+
+            // Size of the MCU line buffer init() needs for an image width and subsampling.
+            static uint mcu_buffer_size(int width, subsampling_t subsampling);
+
             // Call this method with each source scanline.
             // width * src_channels bytes per scanline is expected (RGB or Y format).
             // You must call with NULL after all scanlines are processed to finish compression.
             // Returns false on out of memory or if a stream write fails.
             bool process_scanline(const void* pScanline);
 
+            // Same as process_scanline(), for source data that is already in the JPEG color space:
+            // width * 3 bytes of interleaved Y, Cb, Cr per scanline, or width bytes of Y when subsampling is Y_ONLY.
+            bool process_ycc_scanline(const void* pScanline);
+
             // Deinitializes the compressor, freeing any allocated memory. May be called at any time.
             void deinit();
 
+            // Initializes the compressor for already quantized DCT coefficients (transcoding), no DCT is run.
+            // num_components - 1 or 3, luma_h_samp/luma_v_samp - 1 or 2, chroma is always sampled 1x1.
+            // luma_qt/chroma_qt - Quantization tables in zigzag order, written to the header as is. Must stay valid until finish_coefficients().
+            // progressive - Write a progressive JPEG, see params::m_progressive.
+            // Returns false if a parameter is invalid or a stream write fails.
+            bool init_coefficients(output_stream *pStream, int width, int height, int num_components, int luma_h_samp, int luma_v_samp,
+                                   const uint8 *luma_qt, const uint8 *chroma_qt, bool progressive = false);
+
+            // Entropy codes one block of quantized coefficients in zigzag order, DC not differenced.
+            // Blocks must be passed in MCU order: all luma blocks of the MCU, then Cb, then Cr.
+            bool code_coefficients(int component_num, const int16 *pCoefficients);
+
+            // Flushes the last bits and writes the end of image marker, in progressive mode after all the scans.
+            bool finish_coefficients();
+
         private:
             jpeg_encoder(const jpeg_encoder &);
             jpeg_encoder &operator =(const jpeg_encoder &);
 
             typedef int32 sample_array_t;
+            typedef void (jpeg_encoder::*mcu_row_func_t)();
+            typedef void (*line_func_t)(uint8 *pDst, const uint8 *pSrc, int num_pixels);
             enum { JPGE_OUT_BUF_SIZE = 512 };
+            // progressive store: chunks of variable size block records, a record never crosses a chunk
+            enum { STORE_CHUNK_SIZE = 16384, STORE_MAX_RECORD = 3 + 63 * 3 };
 
             output_stream *m_pStream;
             params m_params;
@@ -90,6 +130,7 @@ namespace jpge
             int m_mcus_per_row;
             int m_mcu_x, m_mcu_y;
             uint8 *m_mcu_lines[16];
+            bool m_own_mcu_lines;
             uint8 m_mcu_y_ofs;
             sample_array_t m_sample_array[64];
             int16 m_coefficient_array[64];
@@ -102,8 +143,25 @@ namespace jpge
             uint m_bits_in;
             uint8 m_pass_num;
             bool m_all_stream_writes_succeeded;
-
-            bool jpg_open(int p_x_res, int p_y_res, int src_channels);
+            const uint8 *m_coef_qt[2];
+            int32 m_last_quality;
+            int32 m_quantization_tables[2][64];
+            mcu_row_func_t m_process_mcu_row;
+            line_func_t m_load_line;
+
+            struct progressive_state;
+
+            bool m_progressive;
+            progressive_state *m_prog;      // Huffman tables and EOB run of the current scan
+            uint8 m_blocks_per_mcu;
+            int m_store_mcus_x, m_store_mcus_y;
+            uint m_store_blocks;            // blocks stored so far
+            uint8 **m_store_chunks;         // NULL terminated
+            uint m_store_num_chunks, m_store_max_chunks, m_store_pos;
+            uint32 *m_store_mcu_ofs;        // first block of every MCU, chunk << 16 | position
+
+            bool jpg_open(int p_x_res, int p_y_res, int src_channels, uint8 *pMCU_buf);
+            bool emit_headers();
 
             void flush_output_buffer();
             void put_bits(uint bits, uint len);
@@ -117,22 +175,41 @@ namespace jpge
             void emit_sof();
             void emit_dht(uint8 *bits, uint8 *val, int index, bool ac_flag);
             void emit_dhts();
-            void emit_sos();
+            void emit_sos(int first_comp, int num_comps, int ss, int se, int ah, int al);
+            void flush_bits();
 
             void compute_quant_table(int32 *dst, const int16 *src);
-            void load_quantized_coefficients(int component_num);
+            template<int table> void load_quantized_coefficients();
 
             void load_block_8_8_grey(int x);
             void load_block_8_8(int x, int y, int c);
             void load_block_16_8(int x, int c);
             void load_block_16_8_8(int x, int c);
 
-            void code_coefficients_pass_two(int component_num);
-            void code_block(int component_num);
-
-            void process_mcu_row();
+            // table - 0 for luma, 1 for chroma; component_num selects the DC predictor.
+            template<int table> void code_coefficients_pass_two(int component_num);
+            template<int table> void code_block(int component_num);
+
+            bool store_open(int mcus_x, int mcus_y);
+            void store_free();
+            void store_block();
+            const uint8 *store_seek(int mcu, int index) const;
+            void load_stored_block(const uint8 *pRecord);
+            void put_symbol(int table, uint symbol);
+            void put_scan_bits(uint bits, uint len);
+            void put_eobrun(int table);
+            void code_dc_first(int component_num, int al);
+            void code_dc_refine(int al);
+            void code_ac_first(int table, int ss, int se, int al);
+            void code_ac_refine(int table, int ss, int se, int al);
+            void code_scan(int comp, int ss, int se, int ah, int al);
+            void emit_scans();
+
+            // One instantiation per subsampling, selected by jpg_open().
+            template<subsampling_t subsampling> void process_mcu_row();
             bool process_end_of_image();
-            void load_mcu(const void* src);
+            bool process_line(const void* pScanline, bool ycc);
+            void load_mcu(const void* src, bool ycc);
             void clear();
             void init();
     };
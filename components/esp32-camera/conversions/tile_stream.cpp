@@ -0,0 +1,396 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include "esp_heap_caps.h"
+#include "tile_stream.h"
+#include "jpeg_coef.h"
+#include "jpge.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#define TAG ""
+#else
+#include "esp_log.h"
+static const char* TAG = "tile_stream";
+#endif
+
+#define TILE                TILE_STREAM_TILE_SIZE
+// 4x4 pixel means per tile, from the 1/4 scale IDCT of its luma blocks
+#define TILE_SIG            ((TILE / 4) * (TILE / 4))
+// mosaic buffer beyond the frame length, for the jpge headers
+#define MOSAIC_SLACK        1024
+
+struct tile_stream {
+    tile_stream_config_t config;
+    bool keyframe;              // the next frame is sent whole
+    uint32_t seq;
+    uint16_t width, height;
+    uint16_t tiles_x, tiles_y;
+    uint8_t *reference;         // signatures of the tiles as last sent
+    uint8_t *current;           // signatures of the tiles of this frame
+    uint16_t *list;             // changed tiles
+    uint8_t *header;
+    jpeg_coef_mark_t *marks;
+    size_t marks_count;
+    uint8_t *mosaic;
+    size_t mosaic_size;
+    jpeg_coef_dec_t *dec;
+};
+
+static void *_malloc(size_t size)
+{
+    void * res = malloc(size);
+    if(res) {
+        return res;
+    }
+
+    // check if SPIRAM is enabled and is allocatable
+#if ((CONFIG_SPIRAM || CONFIG_SPIRAM_SUPPORT) && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
+    return heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#endif
+    return NULL;
+}
+
+// fixed size output buffer, fails instead of truncating the mosaic
+class buffer_stream : public jpge::output_stream {
+protected:
+    uint8_t *out_buf;
+    size_t max_len, index;
+
+public:
+    buffer_stream(uint8_t *buf, size_t buf_size) : out_buf(buf), max_len(buf_size), index(0) { }
+    virtual ~buffer_stream() { }
+
+    virtual bool put_buf(const void* pBuf, int len)
+    {
+        if (!pBuf) {
+            return true;
+        }
+        if ((size_t)len > max_len - index) {
+            return false;
+        }
+        memcpy(out_buf + index, pBuf, len);
+        index += len;
+        return true;
+    }
+
+    virtual jpge::uint get_size() const
+    {
+        return index;
+    }
+};
+
+static inline void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v);
+    put_le16(p + 2, v >> 16);
+}
+
+static void free_tiles(tile_stream_handle_t ts)
+{
+    free(ts->reference);
+    free(ts->current);
+    free(ts->list);
+    free(ts->header);
+    ts->reference = NULL;
+    ts->current = NULL;
+    ts->list = NULL;
+    ts->header = NULL;
+    ts->width = ts->height = 0;
+}
+
+static esp_err_t set_geometry(tile_stream_handle_t ts, const jpeg_coef_dec_t *dec)
+{
+    size_t mcus = (size_t)dec->mcus_x * dec->mcus_y;
+    if (mcus > ts->marks_count) {
+        free(ts->marks);
+        ts->marks = (jpeg_coef_mark_t *)_malloc(mcus * sizeof(jpeg_coef_mark_t));
+        ts->marks_count = ts->marks ? mcus : 0;
+        if (!ts->marks) {
+            ESP_LOGE(TAG, "MCU index malloc failed");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (ts->width == dec->width && ts->height == dec->height) {
+        return ESP_OK;
+    }
+    free_tiles(ts);
+    ts->keyframe = true;
+    ts->tiles_x = (dec->width + TILE - 1) / TILE;
+    ts->tiles_y = (dec->height + TILE - 1) / TILE;
+    size_t n = (size_t)ts->tiles_x * ts->tiles_y;
+    ts->reference = (uint8_t *)_malloc(n * TILE_SIG);
+    ts->current = (uint8_t *)_malloc(n * TILE_SIG);
+    ts->list = (uint16_t *)_malloc(n * sizeof(uint16_t));
+    ts->header = (uint8_t *)_malloc(TILE_STREAM_HEADER_LEN + 2 * n);
+    if (!ts->reference || !ts->current || !ts->list || !ts->header) {
+        ESP_LOGE(TAG, "No memory for %u tiles", (unsigned)n);
+        free_tiles(ts);
+        return ESP_ERR_NO_MEM;
+    }
+    ts->width = dec->width;
+    ts->height = dec->height;
+    return ESP_OK;
+}
+
+// jpge writes one luma table and one chroma table, with 1x1 sampled chroma;
+// the MCUs must also tile the 16x16 grid
+static bool source_supported(const jpeg_coef_dec_t *dec)
+{
+    if (dec->num_components == 3) {
+        if (dec->comp[1].h != 1 || dec->comp[1].v != 1 || dec->comp[2].h != 1 || dec->comp[2].v != 1
+            || dec->comp[1].tq != dec->comp[2].tq) {
+            return false;
+        }
+    }
+    if (TILE % (8 * dec->max_h) || TILE % (8 * dec->max_v)) {
+        return false;
+    }
+    for (int c = 0; c < dec->num_components; c++) {
+        for (int k = 0; k < 64; k++) {
+            if (dec->qt[dec->comp[c].tq][k] > 255) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// index every MCU and compute the tile signatures of the frame
+static bool scan_frame(tile_stream_handle_t ts, jpeg_coef_dec_t *dec)
+{
+    const uint16_t *qt = dec->qt[dec->comp[0].tq];
+    const int h = dec->comp[0].h, v = dec->comp[0].v;
+    int16_t zz[64];
+    uint8_t means[4];
+    for (int my = 0; my < dec->mcus_y; my++) {
+        for (int mx = 0; mx < dec->mcus_x; mx++) {
+            if (!jpeg_coef_next_mcu(dec)) {
+                return false;
+            }
+            jpeg_coef_mark(dec, &ts->marks[my * dec->mcus_x + mx]);
+            for (int b = 0; b < h * v; b++) {
+                if (!jpeg_coef_decode_block(dec, 0, zz)) {
+                    return false;
+                }
+                int x = (mx * h + b % h) * 8;
+                int y = (my * v + b / h) * 8;
+                jpeg_coef_idct(zz, qt, 2, means);
+                uint8_t *sig = ts->current + ((y / TILE) * ts->tiles_x + x / TILE) * TILE_SIG
+                               + (y % TILE / 4) * (TILE / 4) + x % TILE / 4;
+                sig[0] = means[0];
+                sig[1] = means[1];
+                sig[TILE / 4] = means[2];
+                sig[TILE / 4 + 1] = means[3];
+            }
+            for (int c = 1; c < dec->num_components; c++) {
+                if (!jpeg_coef_decode_block(dec, c, NULL)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static uint16_t changed_tiles(tile_stream_handle_t ts)
+{
+    uint16_t n = 0;
+    size_t count = (size_t)ts->tiles_x * ts->tiles_y;
+    for (size_t t = 0; t < count; t++) {
+        const uint8_t *cur = ts->current + t * TILE_SIG;
+        const uint8_t *ref = ts->reference + t * TILE_SIG;
+        for (int i = 0; i < TILE_SIG; i++) {
+            int diff = cur[i] - ref[i];
+            if (diff > ts->config.threshold || -diff > ts->config.threshold) {
+                ts->list[n++] = t;
+                break;
+            }
+        }
+    }
+    return n;
+}
+
+// copy the MCUs of the changed tiles into a mosaic, tile by tile in list order
+static bool encode_mosaic(tile_stream_handle_t ts, jpeg_coef_dec_t *dec, uint16_t n, jpge::output_stream *stream)
+{
+    uint8_t qt[2][64];
+    for (int t = 0; t < 2; t++) {
+        const uint16_t *src_qt = dec->qt[dec->comp[dec->num_components == 3 ? t : 0].tq];
+        for (int k = 0; k < 64; k++) {
+            qt[t][k] = src_qt[k];
+        }
+    }
+    const int sub_x = TILE / (8 * dec->max_h);
+    const int sub_y = TILE / (8 * dec->max_v);
+    const int per_row = ts->tiles_x;
+    const int cols = n < per_row ? n : per_row;
+    const int rows = (n + per_row - 1) / per_row;
+
+    jpge::jpeg_encoder enc;
+    if (!enc.init_coefficients(stream, cols * TILE, rows * TILE, dec->num_components, dec->max_h, dec->max_v, qt[0], qt[1])) {
+        return false;
+    }
+    int16_t blocks[6][64];
+    for (int oy = 0; oy < rows * sub_y; oy++) {
+        for (int ox = 0; ox < cols * sub_x; ox++) {
+            int i = (oy / sub_y) * per_row + ox / sub_x;
+            int count = 0;
+            if (i < n) {
+                int tx = ts->list[i] % ts->tiles_x, ty = ts->list[i] / ts->tiles_x;
+                // MCUs beyond a partial edge MCU do not exist, the client clips them anyway
+                int sx = tx * sub_x + ox % sub_x;
+                int sy = ty * sub_y + oy % sub_y;
+                sx = sx < dec->mcus_x ? sx : dec->mcus_x - 1;
+                sy = sy < dec->mcus_y ? sy : dec->mcus_y - 1;
+                jpeg_coef_seek(dec, &ts->marks[sy * dec->mcus_x + sx]);
+            }
+            for (int c = 0; c < dec->num_components; c++) {
+                for (int b = 0; b < dec->comp[c].h * dec->comp[c].v; b++, count++) {
+                    if (i < n) {
+                        if (!jpeg_coef_decode_block(dec, c, blocks[count])) {
+                            return false;
+                        }
+                    } else {
+                        // padding of the last mosaic row, flat gray
+                        memset(blocks[count], 0, sizeof(blocks[count]));
+                    }
+                    if (!enc.code_coefficients(c, blocks[count])) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return enc.finish_coefficients();
+}
+
+static void write_header(tile_stream_handle_t ts, tile_stream_type_t type, uint16_t n, size_t jpg_len, tile_stream_msg_t *msg)
+{
+    uint8_t *p = ts->header;
+    p[0] = type;
+    p[1] = TILE;
+    put_le16(p + 2, ts->width);
+    put_le16(p + 4, ts->height);
+    put_le16(p + 6, n);
+    put_le32(p + 8, ts->seq);
+    put_le32(p + 12, jpg_len);
+    for (int i = 0; i < n; i++) {
+        p[TILE_STREAM_HEADER_LEN + 2 * i] = ts->list[i] % ts->tiles_x;
+        p[TILE_STREAM_HEADER_LEN + 2 * i + 1] = ts->list[i] / ts->tiles_x;
+    }
+    msg->type = type;
+    msg->tiles = n;
+    msg->header = ts->header;
+    msg->header_len = TILE_STREAM_HEADER_LEN + 2 * n;
+    msg->jpg_len = jpg_len;
+}
+
+esp_err_t tile_stream_create(const tile_stream_config_t *config, tile_stream_handle_t *handle)
+{
+    if (!config || !handle || config->keyframe_percent > 100) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    tile_stream_handle_t ts = (tile_stream_handle_t)calloc(1, sizeof(struct tile_stream));
+    if (!ts) {
+        return ESP_ERR_NO_MEM;
+    }
+    ts->dec = (jpeg_coef_dec_t *)malloc(sizeof(jpeg_coef_dec_t));
+    if (!ts->dec) {
+        free(ts);
+        return ESP_ERR_NO_MEM;
+    }
+    ts->config = *config;
+    ts->keyframe = true;
+    *handle = ts;
+    return ESP_OK;
+}
+
+void tile_stream_delete(tile_stream_handle_t handle)
+{
+    if (!handle) {
+        return;
+    }
+    free_tiles(handle);
+    free(handle->marks);
+    free(handle->mosaic);
+    free(handle->dec);
+    free(handle);
+}
+
+void tile_stream_request_keyframe(tile_stream_handle_t handle)
+{
+    handle->keyframe = true;
+}
+
+esp_err_t tile_stream_encode(tile_stream_handle_t ts, const camera_fb_t *fb, tile_stream_msg_t *msg)
+{
+    jpeg_coef_dec_t *dec = ts->dec;
+    if (fb->format != PIXFORMAT_JPEG || !jpeg_coef_start(dec, fb->buf, fb->len) || !source_supported(dec)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    esp_err_t err = set_geometry(ts, dec);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (!scan_frame(ts, dec)) {
+        ESP_LOGW(TAG, "Corrupt JPEG frame");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t total = (size_t)ts->tiles_x * ts->tiles_y;
+    uint16_t n = ts->keyframe ? 0 : changed_tiles(ts);
+    bool keyframe = ts->keyframe || n * 100 > total * ts->config.keyframe_percent;
+    if (!keyframe && n) {
+        if (ts->mosaic_size < fb->len + MOSAIC_SLACK) {
+            free(ts->mosaic);
+            ts->mosaic_size = fb->len + MOSAIC_SLACK;
+            ts->mosaic = (uint8_t *)_malloc(ts->mosaic_size);
+            if (!ts->mosaic) {
+                ESP_LOGE(TAG, "Mosaic malloc failed");
+                ts->mosaic_size = 0;
+                return ESP_ERR_NO_MEM;
+            }
+        }
+        buffer_stream stream(ts->mosaic, ts->mosaic_size);
+        // a mosaic that does not fit is larger than the frame itself
+        keyframe = !encode_mosaic(ts, dec, n, &stream);
+        if (!keyframe) {
+            write_header(ts, TILE_STREAM_DELTA, n, stream.get_size(), msg);
+            msg->jpg = ts->mosaic;
+            for (int i = 0; i < n; i++) {
+                memcpy(ts->reference + ts->list[i] * TILE_SIG, ts->current + ts->list[i] * TILE_SIG, TILE_SIG);
+            }
+        }
+    } else if (!keyframe) {
+        write_header(ts, TILE_STREAM_DELTA, 0, 0, msg);
+        msg->jpg = NULL;
+    }
+    if (keyframe) {
+        write_header(ts, TILE_STREAM_KEYFRAME, 0, fb->len, msg);
+        msg->jpg = fb->buf;
+        memcpy(ts->reference, ts->current, total * TILE_SIG);
+        ts->keyframe = false;
+    }
+    ts->seq++;
+    return ESP_OK;
+}
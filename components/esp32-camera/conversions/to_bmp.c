@@ -22,6 +22,7 @@
 #include "jpeg_decoder.h"
 
 #include "esp_system.h"
+#include "freertos/FreeRTOS.h"
 
 #if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
 #include "esp32-hal-log.h"
@@ -31,8 +32,21 @@
 static const char* TAG = "to_bmp";
 #endif
 
+#define JPG_WORK_SIZE 3100
+
 static const int BMP_HEADER_LEN = 54;
-static uint8_t work[3100]; // 3.1kB for JPEG decoder, static for legacy reasons
+static uint8_t work[JPG_WORK_SIZE]; // 3.1kB for JPEG decoder, static for legacy reasons
+static bool work_used;
+static portMUX_TYPE work_lock = portMUX_INITIALIZER_UNLOCKED;
+
+struct jpg_dec_ctx {
+    uint8_t *work;
+    size_t work_size;
+    bool own_work;
+    uint8_t *out;           // BMP output reused across frames
+    size_t out_size;
+    size_t sof_pos;         // SOF offset of the last frame
+};
 
 typedef struct {
     uint32_t filesize;
@@ -61,18 +75,19 @@ static void *_malloc(size_t size)
     return malloc(size);
 }
 
-static bool jpg2rgb888(const uint8_t *src, size_t src_len, uint8_t * out, esp_jpeg_image_scale_t scale)
+static bool jpg_decode(uint8_t *work, size_t work_size, const uint8_t *src, size_t src_len,
+                       uint8_t *out, size_t out_size, esp_jpeg_image_format_t format, esp_jpeg_image_scale_t scale)
 {
     esp_jpeg_image_cfg_t jpeg_cfg = {
         .indata = (uint8_t *)src,
         .indata_size = src_len,
         .outbuf = out,
-        .outbuf_size = UINT32_MAX, // @todo: this is very bold assumption, keeping this like this for now, not to break existing code
-        .out_format = JPEG_IMAGE_FORMAT_RGB888,
+        .outbuf_size = out_size,
+        .out_format = format,
         .out_scale = scale,
         .flags.swap_color_bytes = 0,
         .advanced.working_buffer = work,
-        .advanced.working_buffer_size = sizeof(work),
+        .advanced.working_buffer_size = work_size,
     };
     esp_jpeg_image_output_t output_img = {};
 
@@ -82,66 +97,132 @@ static bool jpg2rgb888(const uint8_t *src, size_t src_len, uint8_t * out, esp_jp
     return true;
 }
 
-bool jpg2rgb565(const uint8_t *src, size_t src_len, uint8_t * out, esp_jpeg_image_scale_t scale)
+/*
+ * The legacy entry points take their work buffer from a small pool: the
+ * static buffer when it is free, a heap buffer when another decode holds it.
+ */
+static uint8_t *work_get(void)
 {
-    esp_jpeg_image_cfg_t jpeg_cfg = {
-        .indata = (uint8_t *)src,
-        .indata_size = src_len,
-        .outbuf = out,
-        .outbuf_size = UINT32_MAX, // @todo: this is very bold assumption, keeping this like this for now, not to break existing code
-        .out_format = JPEG_IMAGE_FORMAT_RGB565,
-        .out_scale = scale,
-        .flags.swap_color_bytes = 0,
-        .advanced.working_buffer = work,
-        .advanced.working_buffer_size = sizeof(work),
-    };
+    uint8_t *w = NULL;
+    portENTER_CRITICAL(&work_lock);
+    if (!work_used) {
+        work_used = true;
+        w = work;
+    }
+    portEXIT_CRITICAL(&work_lock);
+    return w ? w : (uint8_t *)malloc(JPG_WORK_SIZE);
+}
 
-    esp_jpeg_image_output_t output_img = {};
+static void work_put(uint8_t *w)
+{
+    if (w == work) {
+        portENTER_CRITICAL(&work_lock);
+        work_used = false;
+        portEXIT_CRITICAL(&work_lock);
+    } else {
+        free(w);
+    }
+}
 
-    if(esp_jpeg_decode(&jpeg_cfg, &output_img) != ESP_OK){
+static bool jpg2rgb888(const uint8_t *src, size_t src_len, uint8_t * out, esp_jpeg_image_scale_t scale)
+{
+    uint8_t *w = work_get();
+    if (!w) {
         return false;
     }
-    return true;
+    // @todo: UINT32_MAX is a very bold assumption, keeping this like this for now, not to break existing code
+    bool ret = jpg_decode(w, JPG_WORK_SIZE, src, src_len, out, UINT32_MAX, JPEG_IMAGE_FORMAT_RGB888, scale);
+    work_put(w);
+    return ret;
 }
 
-bool jpg2bmp(const uint8_t *src, size_t src_len, uint8_t ** out, size_t * out_len)
+bool jpg2rgb565(const uint8_t *src, size_t src_len, uint8_t * out, esp_jpeg_image_scale_t scale)
 {
-    esp_jpeg_image_cfg_t jpeg_cfg = {
-        .indata = (uint8_t *)src,
-        .indata_size = src_len,
-        .out_format = JPEG_IMAGE_FORMAT_RGB888,
-        .out_scale = JPEG_IMAGE_SCALE_0,
-        .flags.swap_color_bytes = 0,
-        .advanced.working_buffer = work,
-        .advanced.working_buffer_size = sizeof(work),
-    };
+    uint8_t *w = work_get();
+    if (!w) {
+        return false;
+    }
+    // @todo: UINT32_MAX is a very bold assumption, keeping this like this for now, not to break existing code
+    bool ret = jpg_decode(w, JPG_WORK_SIZE, src, src_len, out, UINT32_MAX, JPEG_IMAGE_FORMAT_RGB565, scale);
+    work_put(w);
+    return ret;
+}
 
-    bool ret = false;
-    uint8_t *output = NULL;
-    esp_jpeg_image_output_t output_img = {};
-    if (esp_jpeg_get_image_info(&jpeg_cfg, &output_img) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get image info");
-        goto fail;
+/*
+ * Find the frame dimensions. Sensor frames of one resolution share the same
+ * header layout, so the SOF offset of the previous frame is tried first and
+ * the full marker walk only happens when the layout changes.
+ */
+static bool jpg_dec_dims(jpg_dec_ctx_t *ctx, const uint8_t *src, size_t src_len, uint16_t *width, uint16_t *height)
+{
+    size_t pos = ctx->sof_pos;
+    if (!pos || pos + 9 > src_len || src[pos] != 0xFF || (src[pos + 1] != 0xC0 && src[pos + 1] != 0xC1)) {
+        pos = 2;
+        while (pos + 9 <= src_len && src[pos] == 0xFF && src[pos + 1] != 0xC0 && src[pos + 1] != 0xC1) {
+            if (src[pos + 1] == 0xDA || src[pos + 1] == 0xD9) {
+                return false;
+            }
+            pos += 2 + ((src[pos + 2] << 8) | src[pos + 3]);
+        }
+        if (pos + 9 > src_len || src[pos] != 0xFF) {
+            return false;
+        }
+        ctx->sof_pos = pos;
     }
+    *height = (src[pos + 5] << 8) | src[pos + 6];
+    *width = (src[pos + 7] << 8) | src[pos + 8];
+    return *width && *height;
+}
 
-    // @todo here we allocate memory and we assume that the user will free it
-    // this is not the best way to do it, but we need to keep the API
-    // compatible with the previous version
-    const size_t output_size = output_img.output_len + BMP_HEADER_LEN;
-    output = _malloc(output_size);
-    if (!output) {
-        ESP_LOGE(TAG, "Failed to allocate output buffer");
-        goto fail;
+jpg_dec_ctx_t *jpg_dec_ctx_create(uint8_t *work_buf, size_t work_size)
+{
+    if (work_buf && work_size < JPG_WORK_SIZE) {
+        ESP_LOGE(TAG, "Work buffer must be at least %u bytes", JPG_WORK_SIZE);
+        return NULL;
+    }
+    jpg_dec_ctx_t *ctx = calloc(1, sizeof(jpg_dec_ctx_t));
+    if (!ctx) {
+        return NULL;
     }
+    if (work_buf) {
+        ctx->work = work_buf;
+        ctx->work_size = work_size;
+    } else {
+        ctx->work = heap_caps_malloc(JPG_WORK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        ctx->work_size = JPG_WORK_SIZE;
+        ctx->own_work = true;
+        if (!ctx->work) {
+            free(ctx);
+            return NULL;
+        }
+    }
+    return ctx;
+}
 
-    // Start writing decoded data after the BMP header
-    jpeg_cfg.outbuf = output + BMP_HEADER_LEN;
-    jpeg_cfg.outbuf_size = output_img.output_len;
-    if(esp_jpeg_decode(&jpeg_cfg, &output_img) != ESP_OK){
-        ESP_LOGE(TAG, "JPEG decode failed");
-        goto fail;
+void jpg_dec_ctx_free(jpg_dec_ctx_t *ctx)
+{
+    if (!ctx) {
+        return;
+    }
+    if (ctx->own_work) {
+        free(ctx->work);
     }
+    free(ctx->out);
+    free(ctx);
+}
+
+bool jpg2rgb565_ctx(jpg_dec_ctx_t *ctx, const uint8_t *src, size_t src_len, uint8_t *out, size_t out_len, esp_jpeg_image_scale_t scale)
+{
+    return jpg_decode(ctx->work, ctx->work_size, src, src_len, out, out_len, JPEG_IMAGE_FORMAT_RGB565, scale);
+}
+
+bool jpg2rgb888_ctx(jpg_dec_ctx_t *ctx, const uint8_t *src, size_t src_len, uint8_t *out, size_t out_len, esp_jpeg_image_scale_t scale)
+{
+    return jpg_decode(ctx->work, ctx->work_size, src, src_len, out, out_len, JPEG_IMAGE_FORMAT_RGB888, scale);
+}
 
+static void bmp_fill_header(uint8_t *output, size_t output_size, int width, int height)
+{
     output[0] = 'B';
     output[1] = 'M';
     bmp_header_t * bitmap  = (bmp_header_t*)&output[2];
@@ -149,24 +230,62 @@ bool jpg2bmp(const uint8_t *src, size_t src_len, uint8_t ** out, size_t * out_le
     bitmap->filesize = output_size;
     bitmap->fileoffset_to_pixelarray = BMP_HEADER_LEN;
     bitmap->dibheadersize = 40;
-    bitmap->width  =  output_img.width;
-    bitmap->height = -output_img.height; //set negative for top to bottom
+    bitmap->width  =  width;
+    bitmap->height = -height; //set negative for top to bottom
     bitmap->planes = 1;
     bitmap->bitsperpixel = 24;
     bitmap->compression = 0;
-    bitmap->imagesize = output_img.output_len;
+    bitmap->imagesize = output_size - BMP_HEADER_LEN;
     bitmap->ypixelpermeter = 0x0B13 ; //2835 , 72 DPI
     bitmap->xpixelpermeter = 0x0B13 ; //2835 , 72 DPI
     bitmap->numcolorspallette = 0;
     bitmap->mostimpcolor = 0;
+}
 
-    *out = output;
+bool jpg2bmp_ctx(jpg_dec_ctx_t *ctx, const uint8_t *src, size_t src_len, uint8_t ** out, size_t * out_len)
+{
+    uint16_t width, height;
+    if (!jpg_dec_dims(ctx, src, src_len, &width, &height)) {
+        ESP_LOGE(TAG, "Failed to get image info");
+        return false;
+    }
+    const size_t output_size = (size_t)width * height * 3 + BMP_HEADER_LEN;
+    if (ctx->out_size < output_size) {
+        free(ctx->out);
+        ctx->out = _malloc(output_size);
+        ctx->out_size = ctx->out ? output_size : 0;
+        if (!ctx->out) {
+            ESP_LOGE(TAG, "Failed to allocate output buffer");
+            return false;
+        }
+    }
+    // Start writing decoded data after the BMP header
+    if (!jpg_decode(ctx->work, ctx->work_size, src, src_len, ctx->out + BMP_HEADER_LEN, output_size - BMP_HEADER_LEN,
+                    JPEG_IMAGE_FORMAT_RGB888, JPEG_IMAGE_SCALE_0)) {
+        ESP_LOGE(TAG, "JPEG decode failed");
+        return false;
+    }
+    bmp_fill_header(ctx->out, output_size, width, height);
+    *out = ctx->out;
     *out_len = output_size;
-    ret = true;
+    return true;
+}
 
-fail:
-    if (!ret && output) {
-        free(output);
+bool jpg2bmp(const uint8_t *src, size_t src_len, uint8_t ** out, size_t * out_len)
+{
+    jpg_dec_ctx_t ctx = {
+        .work = work_get(),
+        .work_size = JPG_WORK_SIZE,
+    };
+    if (!ctx.work) {
+        return false;
+    }
+    // @todo the caller owns and frees the returned buffer, keeping the API
+    // compatible with the previous version
+    bool ret = jpg2bmp_ctx(&ctx, src, src_len, out, out_len);
+    work_put(ctx.work);
+    if (!ret) {
+        free(ctx.out);
     }
     return ret;
 }
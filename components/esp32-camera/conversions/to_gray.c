@@ -0,0 +1,76 @@
+// Copyright 2015-2025 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include "img_converters.h"
+#include "jpeg_coef.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#define TAG ""
+#else
+#include "esp_log.h"
+static const char* TAG = "to_gray";
+#endif
+
+bool jpg2gray(const uint8_t *src, size_t src_len, uint8_t *out, size_t out_len, esp_jpeg_image_scale_t scale,
+              uint16_t *width, uint16_t *height)
+{
+    uint8_t shift;
+    switch (scale) {
+    case JPEG_IMAGE_SCALE_0:   shift = 0; break;
+    case JPEG_IMAGE_SCALE_1_2: shift = 1; break;
+    case JPEG_IMAGE_SCALE_1_4: shift = 2; break;
+    case JPEG_IMAGE_SCALE_1_8: shift = 3; break;
+    default:
+        ESP_LOGE(TAG, "Unsupported scale %d", (int)scale);
+        return false;
+    }
+
+    jpeg_coef_dec_t *dec = malloc(sizeof(jpeg_coef_dec_t));
+    if (!dec) {
+        ESP_LOGE(TAG, "dec malloc failed");
+        return false;
+    }
+    bool ret = false;
+    if (!jpeg_coef_start(dec, src, src_len)) {
+        ESP_LOGE(TAG, "Unsupported JPEG");
+        goto done;
+    }
+    size_t w = (dec->width + (1 << shift) - 1) >> shift;
+    size_t h = (dec->height + (1 << shift) - 1) >> shift;
+    if (width) {
+        *width = w;
+    }
+    if (height) {
+        *height = h;
+    }
+    if (!out) {
+        // size query
+        ret = true;
+        goto done;
+    }
+    if (out_len < w * h) {
+        ESP_LOGE(TAG, "Output buffer too small: %u < %u", (unsigned)out_len, (unsigned)(w * h));
+        goto done;
+    }
+    ret = jpeg_coef_luma(dec, shift, out, w);
+    if (!ret) {
+        ESP_LOGE(TAG, "Corrupt JPEG data");
+    }
+done:
+    free(dec);
+    return ret;
+}
@@ -13,6 +13,7 @@
 // limitations under the License.
 #include <stddef.h>
 #include <string.h>
+#include <new>
 #include "esp_attr.h"
 #include "soc/efuse_reg.h"
 #include "esp_heap_caps.h"
@@ -43,7 +44,11 @@ static void *_malloc(size_t size)
     return NULL;
 }
 
-static IRAM_ATTR void convert_line_format(uint8_t * src, pixformat_t format, uint8_t * dst, size_t width, size_t in_channels, size_t line)
+typedef void (*line_converter_t)(const uint8_t *src, uint8_t *dst, size_t width, size_t line);
+
+// One instantiation per source format, the format test folds away at compile time
+template<pixformat_t format>
+static IRAM_ATTR void convert_line(const uint8_t * src, uint8_t * dst, size_t width, size_t line)
 {
     int i=0, o=0, l=0;
     if(format == PIXFORMAT_GRAYSCALE) {
@@ -88,7 +93,20 @@ static IRAM_ATTR void convert_line_format(uint8_t * src, pixformat_t format, uin
     }
 }
 
-bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge::output_stream *dst_stream)
+static line_converter_t line_converter(pixformat_t format)
+{
+    switch (format) {
+    case PIXFORMAT_GRAYSCALE: return convert_line<PIXFORMAT_GRAYSCALE>;
+    case PIXFORMAT_RGB888:    return convert_line<PIXFORMAT_RGB888>;
+    case PIXFORMAT_RGB565:    return convert_line<PIXFORMAT_RGB565>;
+    case PIXFORMAT_YUV422:    return convert_line<PIXFORMAT_YUV422>;
+    default:                  return NULL;
+    }
+}
+
+// scratch buffers come from the internal region of arena, or from the heap when arena is NULL
+static bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge::output_stream *dst_stream,
+                          img_arena_t *arena)
 {
     int num_channels = 3;
     jpge::subsampling_t subsampling = jpge::H2V2;
@@ -104,32 +122,49 @@ bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t fo
         quality = 100;
     }
 
+    line_converter_t convert = line_converter(format);
+    if (!convert) {
+        ESP_LOGE(TAG, "Unsupported format %d", (int)format);
+        return false;
+    }
+
     jpge::params comp_params = jpge::params();
     comp_params.m_subsampling = subsampling;
     comp_params.m_quality = quality;
 
     jpge::jpeg_encoder dst_image;
+    uint8_t *mcu_buf = NULL;
+    if (arena) {
+        mcu_buf = (uint8_t *)img_arena_alloc(arena, IMG_ARENA_INTERNAL, jpge::jpeg_encoder::mcu_buffer_size(width, subsampling));
+        if (!mcu_buf) {
+            return false;
+        }
+    }
 
-    if (!dst_image.init(dst_stream, width, height, num_channels, comp_params)) {
+    if (!dst_image.init(dst_stream, width, height, num_channels, comp_params, mcu_buf)) {
         ESP_LOGE(TAG, "JPG encoder init failed");
         return false;
     }
 
-    uint8_t* line = (uint8_t*)_malloc(width * num_channels);
+    uint8_t* line = (uint8_t*)(arena ? img_arena_alloc(arena, IMG_ARENA_INTERNAL, width * num_channels) : _malloc(width * num_channels));
     if(!line) {
         ESP_LOGE(TAG, "Scan line malloc failed");
         return false;
     }
 
     for (int i = 0; i < height; i++) {
-        convert_line_format(src, format, line, width, num_channels, i);
+        convert(src, line, width, i);
         if (!dst_image.process_scanline(line)) {
             ESP_LOGE(TAG, "JPG process line %u failed", i);
-            free(line);
+            if (!arena) {
+                free(line);
+            }
             return false;
         }
     }
-    free(line);
+    if (!arena) {
+        free(line);
+    }
 
     if (!dst_image.process_scanline(NULL)) {
         ESP_LOGE(TAG, "JPG image finish failed");
@@ -162,7 +197,7 @@ public:
 bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void * arg)
 {
     callback_stream dst_stream(cb, arg);
-    return convert_image(src, width, height, format, quality, &dst_stream);
+    return convert_image(src, width, height, format, quality, &dst_stream, NULL);
 }
 
 bool frame2jpg_cb(camera_fb_t * fb, uint8_t quality, jpg_out_cb cb, void * arg)
@@ -219,7 +254,7 @@ bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixf
     }
     memory_stream dst_stream(jpg_buf, jpg_buf_len);
 
-    if(!convert_image(src, width, height, format, quality, &dst_stream)) {
+    if(!convert_image(src, width, height, format, quality, &dst_stream, NULL)) {
         free(jpg_buf);
         return false;
     }
@@ -233,3 +268,193 @@ bool frame2jpg(camera_fb_t * fb, uint8_t quality, uint8_t ** out, size_t * out_l
 {
     return fmt2jpg(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, out, out_len);
 }
+
+// memory_stream that can be pointed at the next frame and fails instead of truncating
+class frame_stream : public memory_stream {
+public:
+    frame_stream() : memory_stream(NULL, 0) { }
+
+    void reset(uint8_t *pBuf, size_t buf_size)
+    {
+        out_buf = pBuf;
+        max_len = buf_size;
+        index = 0;
+    }
+
+    virtual bool put_buf(const void* pBuf, int len)
+    {
+        if (pBuf && (size_t)len > (max_len - index)) {
+            return false;
+        }
+        return memory_stream::put_buf(pBuf, len);
+    }
+};
+
+bool fmt2jpg_arena(img_arena_t *arena, uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality,
+                   uint8_t ** out, size_t * out_len)
+{
+    // the output takes the rest of the bulk region, scratch comes from the internal one
+    size_t jpg_buf_len = img_arena_available(arena, IMG_ARENA_BULK);
+    uint8_t *jpg_buf = (uint8_t *)img_arena_alloc(arena, IMG_ARENA_BULK, jpg_buf_len);
+    if (!jpg_buf) {
+        return false;
+    }
+    frame_stream dst_stream;
+    dst_stream.reset(jpg_buf, jpg_buf_len);
+    if(!convert_image(src, width, height, format, quality, &dst_stream, arena)) {
+        return false;
+    }
+
+    *out = jpg_buf;
+    *out_len = dst_stream.get_size();
+    return true;
+}
+
+bool frame2jpg_arena(img_arena_t *arena, camera_fb_t * fb, uint8_t quality, uint8_t ** out, size_t * out_len)
+{
+    return fmt2jpg_arena(arena, fb->buf, fb->len, fb->width, fb->height, fb->format, quality, out, out_len);
+}
+
+struct jpg_stream {
+    jpge::jpeg_encoder encoder;
+    jpge::params params;
+    frame_stream out;
+    pixformat_t format;
+    line_converter_t convert;
+    uint16_t width;
+    uint16_t height;
+    int num_channels;
+    size_t line_len;        // source bytes per line
+    size_t partial;         // bytes of a line split between two writes
+    uint16_t lines;         // lines encoded in the current frame
+    bool ok;
+    uint8_t *line_in;       // one source line, for lines split between writes
+    uint8_t *line_out;      // one line in the encoder input format
+};
+
+jpg_stream_t *jpg_stream_create(uint16_t width, uint16_t height, pixformat_t format, uint8_t quality)
+{
+    size_t bpp;
+    switch (format) {
+    case PIXFORMAT_GRAYSCALE: bpp = 1; break;
+    case PIXFORMAT_RGB565:
+    case PIXFORMAT_YUV422:    bpp = 2; break;
+    case PIXFORMAT_RGB888:    bpp = 3; break;
+    default:
+        ESP_LOGE(TAG, "Unsupported format %d", (int)format);
+        return NULL;
+    }
+    if (!width || !height || (format == PIXFORMAT_YUV422 && (width & 1))) {
+        ESP_LOGE(TAG, "Invalid size %ux%u", width, height);
+        return NULL;
+    }
+
+    void *mem = _malloc(sizeof(jpg_stream_t));
+    if (!mem) {
+        ESP_LOGE(TAG, "Stream malloc failed");
+        return NULL;
+    }
+    jpg_stream_t *stream = new (mem) jpg_stream_t();
+    stream->format = format;
+    stream->convert = line_converter(format);
+    stream->width = width;
+    stream->height = height;
+    stream->line_len = width * bpp;
+    stream->ok = false;
+
+    // same line converters and subsampling as fmt2jpg(), so both give the same bytes
+    stream->params.m_quality = quality ? (quality > 100 ? 100 : quality) : 1;
+    stream->params.m_subsampling = jpge::H2V2;
+    stream->num_channels = 3;
+    if (format == PIXFORMAT_GRAYSCALE) {
+        stream->params.m_subsampling = jpge::Y_ONLY;
+        stream->num_channels = 1;
+    }
+
+    stream->line_in = (uint8_t *)_malloc(stream->line_len);
+    stream->line_out = (uint8_t *)_malloc(width * stream->num_channels);
+    if (!stream->line_in || !stream->line_out) {
+        ESP_LOGE(TAG, "Scan line malloc failed");
+        jpg_stream_free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+void jpg_stream_free(jpg_stream_t *stream)
+{
+    if (!stream) {
+        return;
+    }
+    free(stream->line_in);
+    free(stream->line_out);
+    stream->~jpg_stream_t();
+    free(stream);
+}
+
+bool jpg_stream_begin(jpg_stream_t *stream, uint8_t *out, size_t out_len)
+{
+    stream->out.reset(out, out_len);
+    stream->partial = 0;
+    stream->lines = 0;
+    stream->ok = stream->encoder.init(&stream->out, stream->width, stream->height, stream->num_channels, stream->params);
+    return stream->ok;
+}
+
+static bool encode_line(jpg_stream_t *stream, const uint8_t *src)
+{
+    uint8_t *dst = stream->line_out;
+    switch (stream->format) {
+    case PIXFORMAT_GRAYSCALE:
+        return stream->encoder.process_scanline(src);
+    default:
+        stream->convert(src, dst, stream->width, 0);
+        return stream->encoder.process_scanline(dst);
+    }
+}
+
+bool jpg_stream_write(jpg_stream_t *stream, const uint8_t *src, size_t len)
+{
+    while (stream->ok && len) {
+        const uint8_t *line = src;
+        size_t take = stream->line_len;
+        if (stream->partial || len < stream->line_len) {
+            take = stream->line_len - stream->partial;
+            if (take > len) {
+                take = len;
+            }
+            memcpy(stream->line_in + stream->partial, src, take);
+            stream->partial += take;
+            src += take;
+            len -= take;
+            if (stream->partial < stream->line_len) {
+                break;
+            }
+            line = stream->line_in;
+            stream->partial = 0;
+        } else {
+            src += take;
+            len -= take;
+        }
+        if (stream->lines == stream->height) {
+            ESP_LOGE(TAG, "More data than %u lines", stream->height);
+            stream->ok = false;
+            break;
+        }
+        stream->ok = encode_line(stream, line);
+        stream->lines++;
+    }
+    return stream->ok;
+}
+
+bool jpg_stream_end(jpg_stream_t *stream, size_t *out_len)
+{
+    bool ok = stream->ok && stream->lines == stream->height && !stream->partial
+              && stream->encoder.process_scanline(NULL);
+    // further writes fail until the next jpg_stream_begin()
+    stream->ok = false;
+    if (ok && out_len) {
+        *out_len = stream->out.get_size();
+    }
+    return ok;
+}
@@ -20,6 +20,8 @@
 #include "freertos/task.h"
 #include "ll_cam.h"
 #include "cam_hal.h"
+#include "cam_mailbox.h"
+#include "cam_event_ring.h"
 
 #if (ESP_IDF_VERSION_MAJOR == 3) && (ESP_IDF_VERSION_MINOR == 3)
 #include "rom/ets_sys.h"
@@ -29,6 +31,11 @@
 #include "hal/cache_hal.h"
 #include "hal/cache_ll.h"
 #include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+#include <unistd.h>
+#include "esp_vfs_eventfd.h"
+#define CAM_FRAME_FD 1
+#endif
 #ifndef ESP_CACHE_MSYNC_FLAG_DIR_M2C
 #define ESP_CACHE_MSYNC_FLAG_DIR_M2C 0
 #endif
@@ -64,6 +71,28 @@ static cam_obj_t *cam_obj = NULL;
 static volatile bool g_psram_dma_mode = CAMERA_PSRAM_DMA_ENABLED;
 static portMUX_TYPE g_psram_dma_lock = portMUX_INITIALIZER_UNLOCKED;
 
+/* Frame-ready notification, kept across cam_deinit() */
+static camera_frame_cb_t frame_cb = NULL;
+static void *frame_cb_arg = NULL;
+static portMUX_TYPE frame_cb_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile int frame_fd = -1;
+
+/* Newest frame in CAMERA_GRAB_LATEST mode */
+static cam_mailbox_t latest_frame;
+
+/* Events of the camera interrupts for cam_task. Each carries the number of
+ * DMA EOFs so far, see CAM_EVENT(), and the VSYNC count and time. */
+static cam_event_ring_t cam_events;
+static volatile uint32_t eof_seq;
+/* The VSYNC GPIO and DMA EOF interrupts may run on different cores, each
+ * push is one producer at a time */
+static portMUX_TYPE cam_events_lock = portMUX_INITIALIZER_UNLOCKED;
+#define CAM_EVENT(event, eofs) (((uint32_t)(eofs) << 1) | (event))
+
+/* Frames captured into DRAM and PSRAM buffers, for the DRAM hit rate */
+static volatile uint32_t fb_dram_frames;
+static volatile uint32_t fb_psram_frames;
+
 /* At top of cam_hal.c – one switch for noisy ISR prints */
 #ifndef CAM_LOG_SPAM_EVERY_FRAME
 #define CAM_LOG_SPAM_EVERY_FRAME 0   /* set to 1 to restore old behaviour */
@@ -219,6 +248,16 @@ static int cam_verify_jpeg_eoi(const uint8_t *inbuf, uint32_t length, bool searc
 
 static bool cam_get_next_frame(int * frame_pos)
 {
+    // the DRAM frames come first in the pool and are faster to send and
+    // analyse, take a free one over the current frame if that is in PSRAM
+    if (!cam_obj->frames[*frame_pos].en || !cam_obj->frames[*frame_pos].dram) {
+        for (int x = 0; x < cam_obj->dram_frame_cnt; x++) {
+            if (cam_obj->frames[x].en) {
+                *frame_pos = x;
+                return true;
+            }
+        }
+    }
     if(!cam_obj->frames[*frame_pos].en){
         for (int x = 0; x < cam_obj->frame_cnt; x++) {
             if (cam_obj->frames[x].en) {
@@ -232,33 +271,160 @@ static bool cam_get_next_frame(int * frame_pos)
     return false;
 }
 
-static bool cam_start_frame(int * frame_pos)
+// vsync is the VSYNC event being handled, the frame starts there
+static bool cam_start_frame(int * frame_pos, const cam_ring_event_t *vsync)
 {
     if (cam_get_next_frame(frame_pos)) {
         if(ll_cam_start(cam_obj, *frame_pos)){
             // Vsync the frame manually
             ll_cam_do_vsync(cam_obj);
-            uint64_t us = (uint64_t)esp_timer_get_time();
+            uint64_t us = (uint64_t)vsync->vsync_us;
             cam_obj->frames[*frame_pos].fb.timestamp.tv_sec = us / 1000000UL;
             cam_obj->frames[*frame_pos].fb.timestamp.tv_usec = us % 1000000UL;
+            cam_obj->frames[*frame_pos].fb.seq = vsync->vsync_seq;
             return true;
         }
     }
     return false;
 }
 
+#if CONFIG_CAMERA_FB_STATS
+// statistics are gathered where cam_task copies the frame, PSRAM DMA mode has no copy to hook into
+static void cam_stats_frame_begin(int frame_pos)
+{
+    cam_obj->stats_active = false;
+    if (cam_obj->jpeg_mode || cam_obj->psram_mode) {
+        return;
+    }
+#if CONFIG_CAMERA_CONVERTER_ENABLED
+    if (cam_obj->conv_mode != CONV_DISABLE) {
+        return;
+    }
+#endif
+    cam_obj->stats_active = cam_stats_begin(&cam_obj->stats, &cam_obj->frames[frame_pos].stats,
+                                            cam_obj->pix_format, cam_obj->width, cam_obj->height);
+}
+#endif
+
+static void cam_frame_begin(int frame_pos)
+{
+    cam_obj->frames[frame_pos].fb.len = 0;
+    cam_obj->frames[frame_pos].fb.stats = NULL;
+#if CONFIG_CAMERA_FB_STATS
+    cam_stats_frame_begin(frame_pos);
+#endif
+    if (cam_obj->jpg_stream) {
+        // a failure here makes the frame fail at jpg_stream_end()
+        jpg_stream_begin(cam_obj->jpg_stream, cam_obj->frames[frame_pos].fb.buf, cam_obj->fb_size);
+    }
+}
+
 void IRAM_ATTR ll_cam_send_event(cam_obj_t *cam, cam_event_t cam_event, BaseType_t * HPTaskAwoken)
 {
-    if (xQueueSendFromISR(cam->event_queue, (void *)&cam_event, HPTaskAwoken) != pdTRUE) {
-        ll_cam_stop(cam);
-        cam->state = CAM_STATE_IDLE;
-#if CAM_LOG_SPAM_EVERY_FRAME
-        ESP_DRAM_LOGD(TAG, "EV-%s-OVF", cam_event==CAM_IN_SUC_EOF_EVENT ? "EOF" : "VSYNC");
-#else
-        static uint16_t ovf_cnt = 0;
-        CAM_WARN_THROTTLE(ovf_cnt,
-                          cam_event==CAM_IN_SUC_EOF_EVENT ? "EV-EOF-OVF" : "EV-VSYNC-OVF");
+    portENTER_CRITICAL_ISR(&cam_events_lock);
+    if (cam_event == CAM_VSYNC_EVENT) {
+        // stamped in the interrupt, cam_task may get to the event much later
+        cam->vsync_us = esp_timer_get_time();
+        cam->vsync_seq++;
+    } else {
+        eof_seq++;
+    }
+    // a full ring drops the event, cam_task sees the gap and drops the frame
+    cam_ring_event_t event = {
+        .event = CAM_EVENT(cam_event, eof_seq),
+        .vsync_seq = cam->vsync_seq,
+        .vsync_us = cam->vsync_us,
+    };
+    cam_event_ring_push(&cam_events, &event);
+    portEXIT_CRITICAL_ISR(&cam_events_lock);
+    if (cam->task_handle) {
+        vTaskNotifyGiveFromISR(cam->task_handle, HPTaskAwoken);
+    }
+}
+
+// true if events were lost or, copying from the DMA buffer, the half of it an
+// EOF names was overwritten since; the frame is broken either way
+static bool cam_events_behind(uint32_t event, unsigned *lost)
+{
+    unsigned now = cam_event_ring_lost(&cam_events);
+    if (now != *lost) {
+        *lost = now;
+        return true;
+    }
+    if ((event & 1) != CAM_IN_SUC_EOF_EVENT || cam_obj->psram_mode || cam_obj->dma_half_buffer_cnt < 2) {
+        return false;
+    }
+    uint32_t eofs_since = (CAM_EVENT(0, eof_seq) - (event & ~1u)) >> 1;
+    return eofs_since >= cam_obj->dma_half_buffer_cnt - 1;
+}
+
+static void cam_frame_ready(void)
+{
+    camera_frame_cb_t cb;
+    void *arg;
+    portENTER_CRITICAL(&frame_cb_lock);
+    cb = frame_cb;
+    arg = frame_cb_arg;
+    portEXIT_CRITICAL(&frame_cb_lock);
+    if (cb) {
+        cb(arg);
+    }
+#ifdef CAM_FRAME_FD
+    if (frame_fd >= 0) {
+        uint64_t one = 1;
+        write(frame_fd, &one, sizeof(one));
+    }
 #endif
+}
+
+static void cam_send_frame(int frame_pos)
+{
+    camera_fb_t *frame_buffer_event = &cam_obj->frames[frame_pos].fb;
+    if (cam_obj->grab_latest) {
+        // never blocks or fails, an unread older frame is recycled
+        int replaced = cam_mailbox_publish(&latest_frame, frame_pos);
+        if (replaced != CAM_MAILBOX_EMPTY) {
+            cam_obj->frames[replaced].en = 1;
+        }
+        xSemaphoreGive(cam_obj->latest_sem);
+        return;
+    }
+    if (xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
+        //pop frame buffer from the queue
+        camera_fb_t * fb2 = NULL;
+        if (xQueueReceive(cam_obj->frame_buffer_queue, &fb2, 0) == pdTRUE) {
+            //push the new frame to the end of the queue
+            if (xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
+                cam_obj->frames[frame_pos].en = 1;
+                ESP_CAMERA_ETS_PRINTF(DRAM_STR("cam_hal: FBQ-SND\r\n"));
+            }
+            //free the popped buffer
+            cam_give(fb2);
+        } else {
+            //queue is full and we could not pop a frame from it
+            cam_obj->frames[frame_pos].en = 1;
+            ESP_CAMERA_ETS_PRINTF(DRAM_STR("cam_hal: FBQ-RCV\r\n"));
+        }
+    }
+}
+
+static bool cam_receive(camera_fb_t **fb, TickType_t timeout)
+{
+    if (!cam_obj->grab_latest) {
+        return xQueueReceive(cam_obj->frame_buffer_queue, (void *)fb, timeout) == pdTRUE;
+    }
+    const TickType_t start = xTaskGetTickCount();
+    for (;;) {
+        int frame = cam_mailbox_take(&latest_frame);
+        if (frame != CAM_MAILBOX_EMPTY) {
+            *fb = &cam_obj->frames[frame].fb;
+            return true;
+        }
+        // the semaphore may be left from a frame that was already taken
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout || xSemaphoreTake(cam_obj->latest_sem, timeout - elapsed) != pdTRUE) {
+            return false;
+        }
     }
 }
 
@@ -269,19 +435,46 @@ static void cam_task(void *arg)
     int frame_pos = 0;
     cam_obj->state = CAM_STATE_IDLE;
     cam_event_t cam_event = 0;
+    cam_ring_event_t event;
+    unsigned lost = cam_event_ring_lost(&cam_events);
 
-    xQueueReset(cam_obj->event_queue);
+    cam_event_ring_flush(&cam_events);
 
     while (1) {
-        xQueueReceive(cam_obj->event_queue, (void *)&cam_event, portMAX_DELAY);
+        if (cam_obj->park) {
+            // cam_resize() changes the capture layout. A VSYNC handled since
+            // its cam_stop() may have restarted the DMA, and the queued events
+            // are for the old layout; dropping them is up to this task
+            ll_cam_stop(cam_obj);
+            cam_event_ring_flush(&cam_events);
+            lost = cam_event_ring_lost(&cam_events);
+            cam_obj->state = CAM_STATE_IDLE;
+            xSemaphoreGive(cam_obj->park_sem);
+            while (cam_obj->park) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+            continue;
+        }
+        if (!cam_event_ring_pop(&cam_events, &event)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        cam_event = (cam_event_t)(event.event & 1);
+        if (cam_events_behind(event.event, &lost) && cam_obj->state == CAM_STATE_READ_BUF) {
+            // drop the frame rather than stopping capture, a VSYNC starts the next one
+            static uint16_t behind_cnt = 0;
+            CAM_WARN_THROTTLE(behind_cnt, "EV-OVF - events late, frame dropped");
+            ll_cam_stop(cam_obj);
+            cam_obj->state = CAM_STATE_IDLE;
+        }
         DBG_PIN_SET(1);
         switch (cam_obj->state) {
 
             case CAM_STATE_IDLE: {
                 if (cam_event == CAM_VSYNC_EVENT) {
                     //DBG_PIN_SET(1);
-                    if(cam_start_frame(&frame_pos)){
-                        cam_obj->frames[frame_pos].fb.len = 0;
+                    if(cam_start_frame(&frame_pos, &event)){
+                        cam_frame_begin(frame_pos);
                         cam_obj->state = CAM_STATE_READ_BUF;
                     }
                     cnt = 0;
@@ -294,16 +487,35 @@ static void cam_task(void *arg)
                 size_t pixels_per_dma = (cam_obj->dma_half_buffer_size * cam_obj->fb_bytes_per_pixel) / (cam_obj->dma_bytes_per_item * cam_obj->in_bytes_per_pixel);
 
                 if (cam_event == CAM_IN_SUC_EOF_EVENT) {
-                    if(!cam_obj->psram_mode){
+                    if (cam_obj->jpg_stream) {
+                        // encodes every MCU row this transfer completes, a
+                        // failed frame is dropped at VSYNC
+                        size_t len = ll_cam_memcpy(cam_obj, cam_obj->jpg_line_buf,
+                            &cam_obj->dma_buffer[(cnt % cam_obj->dma_half_buffer_cnt) * cam_obj->dma_half_buffer_size],
+                            cam_obj->dma_half_buffer_size);
+                        jpg_stream_write(cam_obj->jpg_stream, cam_obj->jpg_line_buf, len);
+#if CONFIG_CAMERA_FB_STATS
+                        if (cam_obj->stats_active) {
+                            cam_stats_update(&cam_obj->stats, cam_obj->jpg_line_buf, len);
+                        }
+#endif
+                    } else if(!cam_obj->psram_mode){
                         if (cam_obj->fb_size < (frame_buffer_event->len + pixels_per_dma)) {
                             ESP_CAMERA_ETS_PRINTF(DRAM_STR("cam_hal: FB-OVF\r\n"));
                             ll_cam_stop(cam_obj);
                             continue;
                         }
-                        frame_buffer_event->len += ll_cam_memcpy(cam_obj,
+                        size_t len = ll_cam_memcpy(cam_obj,
                             &frame_buffer_event->buf[frame_buffer_event->len],
                             &cam_obj->dma_buffer[(cnt % cam_obj->dma_half_buffer_cnt) * cam_obj->dma_half_buffer_size],
                             cam_obj->dma_half_buffer_size);
+#if CONFIG_CAMERA_FB_STATS
+                        // the transfer just written is still in cache
+                        if (cam_obj->stats_active) {
+                            cam_stats_update(&cam_obj->stats, &frame_buffer_event->buf[frame_buffer_event->len], len);
+                        }
+#endif
+                        frame_buffer_event->len += len;
                     } else {
                         // stop if the next DMA copy would exceed the framebuffer slot
                         // size, since we're called only after the copy occurs
@@ -394,36 +606,41 @@ static void cam_task(void *arg)
                             } else {
                                 frame_buffer_event->len = cam_obj->recv_size;
                             }
+                        } else if (cam_obj->jpg_stream) {
+                            if (!jpg_stream_end(cam_obj->jpg_stream, &frame_buffer_event->len)) {
+                                cam_obj->frames[frame_pos].en = 1;
+                                ESP_CAMERA_ETS_PRINTF(DRAM_STR("cam_hal: JPG-ENC failed\r\n"));
+                            }
                         } else if (!cam_obj->jpeg_mode) {
                             if (frame_buffer_event->len != cam_obj->fb_size) {
                                 cam_obj->frames[frame_pos].en = 1;
                                 ESP_CAMERA_ETS_PRINTF(DRAM_STR("cam_hal: FB-SIZE: %u != %u\r\n"), frame_buffer_event->len, (unsigned) cam_obj->fb_size);
                             }
                         }
+#if CONFIG_CAMERA_FB_STATS
+                        if (!cam_obj->frames[frame_pos].en && cam_obj->stats_active) {
+                            cam_stats_end(&cam_obj->stats);
+                            frame_buffer_event->stats = &cam_obj->frames[frame_pos].stats;
+                        }
+#endif
                         //send frame
-                        if(!cam_obj->frames[frame_pos].en && xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
-                            //pop frame buffer from the queue
-                            camera_fb_t * fb2 = NULL;
-                            if(xQueueReceive(cam_obj->frame_buffer_queue, &fb2, 0) == pdTRUE) {
-                                //push the new frame to the end of the queue
-                                if (xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
-                                    cam_obj->frames[frame_pos].en = 1;
-                                    ESP_CAMERA_ETS_PRINTF(DRAM_STR("cam_hal: FBQ-SND\r\n"));
-                                }
-                                //free the popped buffer
-                                cam_give(fb2);
+                        if (!cam_obj->frames[frame_pos].en) {
+                            if (cam_obj->frames[frame_pos].dram) {
+                                fb_dram_frames++;
                             } else {
-                                //queue is full and we could not pop a frame from it
-                                cam_obj->frames[frame_pos].en = 1;
-                                ESP_CAMERA_ETS_PRINTF(DRAM_STR("cam_hal: FBQ-RCV\r\n"));
+                                fb_psram_frames++;
                             }
+                            cam_send_frame(frame_pos);
+                        }
+                        if (!cam_obj->frames[frame_pos].en) {
+                            cam_frame_ready();
                         }
                     }
 
-                    if(!cam_start_frame(&frame_pos)){
+                    if(!cam_start_frame(&frame_pos, &event)){
                         cam_obj->state = CAM_STATE_IDLE;
                     } else {
-                        cam_obj->frames[frame_pos].fb.len = 0;
+                        cam_frame_begin(frame_pos);
                     }
                     cnt = 0;
                 }
@@ -453,22 +670,108 @@ static lldesc_t * allocate_dma_descriptors(uint32_t count, uint16_t size, uint8_
     return dma;
 }
 
-static esp_err_t cam_dma_config(const camera_config_t *config)
+static size_t cam_jpeg_frame_size(const cam_layout_t *layout)
 {
-    bool ret = ll_cam_dma_sizes(cam_obj);
-    if (0 == ret) {
-        return ESP_FAIL;
+#ifdef CONFIG_CAMERA_JPEG_MODE_FRAME_SIZE_AUTO
+    return layout->width * layout->height / 5;
+#else
+    return CONFIG_CAMERA_JPEG_MODE_FRAME_SIZE;
+#endif
+}
+
+static void cam_calc_frame_sizes(const cam_obj_t *cam, framesize_t frame_size, cam_layout_t *layout)
+{
+    layout->width = resolution[frame_size].width;
+    layout->height = resolution[frame_size].height;
+
+    if(cam->jpeg_mode){
+        layout->recv_size = cam_jpeg_frame_size(layout);
+        layout->fb_size = layout->recv_size;
+    } else {
+        layout->recv_size = layout->width * layout->height * cam->in_bytes_per_pixel;
+        layout->fb_size = layout->width * layout->height * cam->fb_bytes_per_pixel;
+        if (layout->jpeg_encode_quality) {
+            // frames only hold the encoded JPEG
+            layout->fb_size = cam_jpeg_frame_size(layout);
+        }
     }
+}
 
-    cam_obj->dma_node_cnt = (cam_obj->dma_buffer_size) / cam_obj->dma_node_buffer_size; // Number of DMA nodes
-    cam_obj->frame_copy_cnt = cam_obj->recv_size / cam_obj->dma_half_buffer_size; // Number of interrupted copies, ping-pong copy
-    if (cam_obj->psram_mode) {
-        cam_obj->frame_copy_cnt++;
+static size_t cam_frame_alloc_size(cam_obj_t *cam, const cam_layout_t *layout, uint8_t *dma_align)
+{
+    size_t fb_size = layout->fb_size;
+    *dma_align = 0;
+    if (cam->psram_mode) {
+        *dma_align = ll_cam_get_dma_align(cam);
+        if (layout->fb_size < layout->recv_size) {
+            fb_size = layout->recv_size;
+        }
+        fb_size += layout->dma_half_buffer_size;
+    }
+    return fb_size * sizeof(uint8_t) + *dma_align;
+}
+
+static bool cam_calc_dma_sizes(const cam_obj_t *cam, cam_layout_t *layout)
+{
+    if (!ll_cam_dma_sizes(cam, layout)) {
+        return false;
+    }
+    if (cam->jpeg_mode && !cam->psram_mode && cam->dma_ring_size > layout->dma_buffer_size) {
+        // more halves of the same size, the interrupt rate stays the same.
+        // Each half is one event, cam_task cannot lag more than the event ring
+        layout->dma_half_buffer_cnt = cam->dma_ring_size / layout->dma_half_buffer_size;
+        if (layout->dma_half_buffer_cnt > CAM_EVENT_RING_SIZE) {
+            ESP_LOGW(TAG, "dma_buffer_size capped at %u bytes", (unsigned)(CAM_EVENT_RING_SIZE * layout->dma_half_buffer_size));
+            layout->dma_half_buffer_cnt = CAM_EVENT_RING_SIZE;
+        }
+        layout->dma_buffer_size = layout->dma_half_buffer_cnt * layout->dma_half_buffer_size;
+    }
+
+    layout->dma_node_cnt = (layout->dma_buffer_size) / layout->dma_node_buffer_size; // Number of DMA nodes
+    layout->frame_copy_cnt = layout->recv_size / layout->dma_half_buffer_size; // Number of interrupted copies, ping-pong copy
+    if (cam->psram_mode) {
+        layout->frame_copy_cnt++;
     }
 
     ESP_LOGI(TAG, "buffer_size: %d, half_buffer_size: %d, node_buffer_size: %d, node_cnt: %d, total_cnt: %d",
-             (int) cam_obj->dma_buffer_size, (int) cam_obj->dma_half_buffer_size, (int) cam_obj->dma_node_buffer_size,
-             (int) cam_obj->dma_node_cnt, (int) cam_obj->frame_copy_cnt);
+             (int) layout->dma_buffer_size, (int) layout->dma_half_buffer_size, (int) layout->dma_node_buffer_size,
+             (int) layout->dma_node_cnt, (int) layout->frame_copy_cnt);
+    return true;
+}
+
+static void cam_apply_layout(const cam_layout_t *layout)
+{
+    cam_obj->jpeg_encode_quality = layout->jpeg_encode_quality;
+    cam_obj->width = layout->width;
+    cam_obj->height = layout->height;
+    cam_obj->recv_size = layout->recv_size;
+    cam_obj->fb_size = layout->fb_size;
+    cam_obj->dma_bytes_per_item = layout->dma_bytes_per_item;
+    cam_obj->dma_buffer_size = layout->dma_buffer_size;
+    cam_obj->dma_half_buffer_size = layout->dma_half_buffer_size;
+    cam_obj->dma_half_buffer_cnt = layout->dma_half_buffer_cnt;
+    cam_obj->dma_node_buffer_size = layout->dma_node_buffer_size;
+    cam_obj->dma_node_cnt = layout->dma_node_cnt;
+    cam_obj->frame_copy_cnt = layout->frame_copy_cnt;
+}
+
+static uint8_t *cam_alloc_frame_buf(size_t size, uint32_t caps)
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+    // In IDF v4.2 and earlier, memory returned by heap_caps_aligned_alloc must be freed using heap_caps_aligned_free.
+    // And heap_caps_aligned_free is deprecated on v4.3.
+    return (uint8_t *)heap_caps_aligned_alloc(16, size, caps);
+#else
+    return (uint8_t *)heap_caps_malloc(size, caps);
+#endif
+}
+
+static esp_err_t cam_dma_config(const camera_config_t *config, cam_layout_t *layout)
+{
+    if (!cam_calc_dma_sizes(cam_obj, layout)) {
+        return ESP_FAIL;
+    }
+    cam_apply_layout(layout);
 
     cam_obj->dma_buffer = NULL;
     cam_obj->dma = NULL;
@@ -477,36 +780,49 @@ static esp_err_t cam_dma_config(const camera_config_t *config)
     CAM_CHECK(cam_obj->frames != NULL, "frames malloc failed", ESP_FAIL);
 
     uint8_t dma_align = 0;
-    size_t fb_size = cam_obj->fb_size;
-    if (cam_obj->psram_mode) {
-        dma_align = ll_cam_get_dma_align(cam_obj);
-        if (cam_obj->fb_size < cam_obj->recv_size) {
-            fb_size = cam_obj->recv_size;
-        }
-        fb_size += cam_obj->dma_half_buffer_size;
-    }
+    size_t alloc_size = cam_frame_alloc_size(cam_obj, layout, &dma_align);
+    cam_obj->fb_alloc_size = alloc_size;
 
     /* Allocate memory for frame buffer */
-    size_t alloc_size = fb_size * sizeof(uint8_t) + dma_align;
     uint32_t _caps = MALLOC_CAP_8BIT;
+    size_t dram_budget = 0;
     if (CAMERA_FB_IN_DRAM == config->fb_location) {
         _caps |= MALLOC_CAP_INTERNAL;
     } else {
         _caps |= MALLOC_CAP_SPIRAM;
+        // the first frames go to DRAM as far as the budget reaches. Not in
+        // PSRAM DMA mode, where the DMA writes the frames aligned for PSRAM
+        if (cam_obj->psram_mode && config->fb_dram_budget) {
+            ESP_LOGW(TAG, "fb_dram_budget is not used in PSRAM DMA mode");
+        } else {
+            dram_budget = config->fb_dram_budget;
+        }
     }
+    cam_obj->dram_frame_cnt = 0;
     for (int x = 0; x < cam_obj->frame_cnt; x++) {
         cam_obj->frames[x].dma = NULL;
         cam_obj->frames[x].fb_offset = 0;
         cam_obj->frames[x].en = 0;
-        ESP_LOGI(TAG, "Allocating %d Byte frame buffer in %s", alloc_size, _caps & MALLOC_CAP_SPIRAM ? "PSRAM" : "OnBoard RAM");
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
-        // In IDF v4.2 and earlier, memory returned by heap_caps_aligned_alloc must be freed using heap_caps_aligned_free.
-        // And heap_caps_aligned_free is deprecated on v4.3.
-        cam_obj->frames[x].fb.buf = (uint8_t *)heap_caps_aligned_alloc(16, alloc_size, _caps);
-#else
-        cam_obj->frames[x].fb.buf = (uint8_t *)heap_caps_malloc(alloc_size, _caps);
-#endif
+        uint32_t caps = _caps;
+        if (alloc_size <= dram_budget) {
+            caps = MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL;
+            dram_budget -= alloc_size;
+        }
+        ESP_LOGI(TAG, "Allocating %d Byte frame buffer in %s", alloc_size, caps & MALLOC_CAP_SPIRAM ? "PSRAM" : "OnBoard RAM");
+        cam_obj->frames[x].fb.buf = cam_alloc_frame_buf(alloc_size, caps);
+        if (cam_obj->frames[x].fb.buf == NULL && caps != _caps) {
+            // DRAM is short of the budget, this and the remaining frames go to PSRAM
+            ESP_LOGW(TAG, "Frame buffer does not fit in DRAM, the largest free block: %d Byte",
+                     (int) heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+            dram_budget = 0;
+            caps = _caps;
+            cam_obj->frames[x].fb.buf = cam_alloc_frame_buf(alloc_size, caps);
+        }
         CAM_CHECK(cam_obj->frames[x].fb.buf != NULL, "frame buffer malloc failed", ESP_FAIL);
+        cam_obj->frames[x].dram = !(caps & MALLOC_CAP_SPIRAM);
+        if (cam_obj->frames[x].dram) {
+            cam_obj->dram_frame_cnt++;
+        }
         if (cam_obj->psram_mode) {
             //align PSRAM buffer. TODO: save the offset so proper address can be freed later
             cam_obj->frames[x].fb_offset = dma_align - ((uint32_t)cam_obj->frames[x].fb.buf & (dma_align - 1));
@@ -517,6 +833,10 @@ static esp_err_t cam_dma_config(const camera_config_t *config)
         }
         cam_obj->frames[x].en = 1;
     }
+    if (cam_obj->dram_frame_cnt && cam_obj->dram_frame_cnt < cam_obj->frame_cnt) {
+        ESP_LOGI(TAG, "Frame buffers: %u in DRAM, %u in PSRAM", (unsigned) cam_obj->dram_frame_cnt,
+                 (unsigned) (cam_obj->frame_cnt - cam_obj->dram_frame_cnt));
+    }
 
     if (!cam_obj->psram_mode) {
         cam_obj->dma_buffer = (uint8_t *)heap_caps_malloc(cam_obj->dma_buffer_size * sizeof(uint8_t), MALLOC_CAP_DMA);
@@ -525,6 +845,7 @@ static esp_err_t cam_dma_config(const camera_config_t *config)
                      (int) cam_obj->dma_buffer_size, (int) heap_caps_get_largest_free_block(MALLOC_CAP_DMA));
             return ESP_FAIL;
         }
+        cam_obj->dma_buffer_alloc_size = cam_obj->dma_buffer_size;
 
         cam_obj->dma = allocate_dma_descriptors(cam_obj->dma_node_cnt, cam_obj->dma_node_buffer_size, cam_obj->dma_buffer);
         CAM_CHECK(cam_obj->dma != NULL, "dma malloc failed", ESP_FAIL);
@@ -533,6 +854,34 @@ static esp_err_t cam_dma_config(const camera_config_t *config)
     return ESP_OK;
 }
 
+// software JPEG encoder for the current size, sized to one DMA transfer of input
+static esp_err_t cam_jpeg_encode_config(void)
+{
+    jpg_stream_free(cam_obj->jpg_stream);
+    cam_obj->jpg_stream = NULL;
+    if (!cam_obj->jpeg_encode_quality) {
+        return ESP_OK;
+    }
+    cam_obj->jpg_stream = jpg_stream_create(cam_obj->width, cam_obj->height, cam_obj->pix_format, cam_obj->jpeg_encode_quality);
+    CAM_CHECK(cam_obj->jpg_stream != NULL, "jpg stream create failed", ESP_ERR_NO_MEM);
+
+    size_t len = (cam_obj->dma_half_buffer_size * cam_obj->fb_bytes_per_pixel) / (cam_obj->dma_bytes_per_item * cam_obj->in_bytes_per_pixel);
+    if (len > cam_obj->jpg_line_buf_size) {
+        free(cam_obj->jpg_line_buf);
+        cam_obj->jpg_line_buf_size = 0;
+        cam_obj->jpg_line_buf = (uint8_t *)heap_caps_malloc(len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        CAM_CHECK(cam_obj->jpg_line_buf != NULL, "jpg line buffer malloc failed", ESP_ERR_NO_MEM);
+        cam_obj->jpg_line_buf_size = len;
+    }
+    ESP_LOGI(TAG, "Encoding %ux%u frames to JPEG with quality %u", cam_obj->width, cam_obj->height, cam_obj->jpeg_encode_quality);
+    return ESP_OK;
+}
+
+void cam_set_jpeg_encode(uint8_t quality)
+{
+    cam_obj->jpeg_encode_quality = quality > 100 ? 100 : quality;
+}
+
 esp_err_t cam_init(const camera_config_t *config)
 {
     CAM_CHECK(NULL != config, "config pointer is invalid", ESP_ERR_INVALID_ARG);
@@ -564,6 +913,17 @@ err:
     return ESP_FAIL;
 }
 
+// PSRAM DMA mode cam_config() applies to the capture
+static bool cam_psram_mode_wanted(void)
+{
+#if CONFIG_IDF_TARGET_ESP32S2 || CONFIG_IDF_TARGET_ESP32S3
+    // the encoder needs cam_task to see every DMA transfer
+    return g_psram_dma_mode && !cam_obj->jpeg_encode_quality;
+#else
+    return false;
+#endif
+}
+
 esp_err_t cam_config(const camera_config_t *config, framesize_t frame_size, uint16_t sensor_pid)
 {
     CAM_CHECK(NULL != config, "config pointer is invalid", ESP_ERR_INVALID_ARG);
@@ -573,44 +933,36 @@ esp_err_t cam_config(const camera_config_t *config, framesize_t frame_size, uint
     CAM_CHECK_GOTO(ret == ESP_OK, "ll_cam_set_sample_mode failed", err);
     
     cam_obj->jpeg_mode = config->pixel_format == PIXFORMAT_JPEG;
-#if CONFIG_IDF_TARGET_ESP32S2 || CONFIG_IDF_TARGET_ESP32S3
-    cam_obj->psram_mode = g_psram_dma_mode;
-#else
-    cam_obj->psram_mode = false;
-#endif
+    cam_obj->pix_format = config->pixel_format;
+    cam_obj->psram_mode = cam_psram_mode_wanted();
     ESP_LOGI(TAG, "PSRAM DMA mode %s", cam_obj->psram_mode ? "enabled" : "disabled");
     cam_obj->frame_cnt = config->fb_count;
-    cam_obj->width = resolution[frame_size].width;
-    cam_obj->height = resolution[frame_size].height;
-
-    if(cam_obj->jpeg_mode){
-#ifdef CONFIG_CAMERA_JPEG_MODE_FRAME_SIZE_AUTO
-        cam_obj->recv_size = cam_obj->width * cam_obj->height / 5;
-#else
-        cam_obj->recv_size = CONFIG_CAMERA_JPEG_MODE_FRAME_SIZE;
-#endif
-        cam_obj->fb_size = cam_obj->recv_size;
-    } else {
-        cam_obj->recv_size = cam_obj->width * cam_obj->height * cam_obj->in_bytes_per_pixel;
-        cam_obj->fb_size = cam_obj->width * cam_obj->height * cam_obj->fb_bytes_per_pixel;
-    }
+    cam_obj->dma_ring_size = config->dma_buffer_size;
+    cam_layout_t layout;
+    layout.jpeg_encode_quality = cam_obj->jpeg_encode_quality;
+    cam_calc_frame_sizes(cam_obj, frame_size, &layout);
 
-    ret = cam_dma_config(config);
+    ret = cam_dma_config(config, &layout);
     CAM_CHECK_GOTO(ret == ESP_OK, "cam_dma_config failed", err);
+    fb_dram_frames = 0;
+    fb_psram_frames = 0;
 
-    size_t queue_size = cam_obj->dma_half_buffer_cnt - 1;
-    if (queue_size == 0) {
-        queue_size = 1;
-    }
-    cam_obj->event_queue = xQueueCreate(queue_size, sizeof(cam_event_t));
-    CAM_CHECK_GOTO(cam_obj->event_queue != NULL, "event_queue create failed", err);
+    ret = cam_jpeg_encode_config();
+    CAM_CHECK_GOTO(ret == ESP_OK, "cam_jpeg_encode_config failed", err);
 
-    size_t frame_buffer_queue_len = cam_obj->frame_cnt;
-    if (config->grab_mode == CAMERA_GRAB_LATEST && cam_obj->frame_cnt > 1) {
-        frame_buffer_queue_len = cam_obj->frame_cnt - 1;
+    cam_event_ring_init(&cam_events);
+    cam_obj->park_sem = xSemaphoreCreateBinary();
+    CAM_CHECK_GOTO(cam_obj->park_sem != NULL, "park_sem create failed", err);
+
+    cam_obj->grab_latest = config->grab_mode == CAMERA_GRAB_LATEST;
+    if (cam_obj->grab_latest) {
+        cam_mailbox_init(&latest_frame);
+        cam_obj->latest_sem = xSemaphoreCreateBinary();
+        CAM_CHECK_GOTO(cam_obj->latest_sem != NULL, "latest_sem create failed", err);
+    } else {
+        cam_obj->frame_buffer_queue = xQueueCreate(cam_obj->frame_cnt, sizeof(camera_fb_t*));
+        CAM_CHECK_GOTO(cam_obj->frame_buffer_queue != NULL, "frame_buffer_queue create failed", err);
     }
-    cam_obj->frame_buffer_queue = xQueueCreate(frame_buffer_queue_len, sizeof(camera_fb_t*));
-    CAM_CHECK_GOTO(cam_obj->frame_buffer_queue != NULL, "frame_buffer_queue create failed", err);
 
     ret = ll_cam_init_isr(cam_obj);
     CAM_CHECK_GOTO(ret == ESP_OK, "cam intr alloc failed", err);
@@ -640,14 +992,20 @@ esp_err_t cam_deinit(void)
 
     cam_stop();
     if (cam_obj->task_handle) {
-        vTaskDelete(cam_obj->task_handle);
-    }
-    if (cam_obj->event_queue) {
-        vQueueDelete(cam_obj->event_queue);
+        // the interrupts stop notifying it
+        TaskHandle_t task = cam_obj->task_handle;
+        cam_obj->task_handle = NULL;
+        vTaskDelete(task);
     }
     if (cam_obj->frame_buffer_queue) {
         vQueueDelete(cam_obj->frame_buffer_queue);
     }
+    if (cam_obj->latest_sem) {
+        vSemaphoreDelete(cam_obj->latest_sem);
+    }
+    if (cam_obj->park_sem) {
+        vSemaphoreDelete(cam_obj->park_sem);
+    }
 
     ll_cam_deinit(cam_obj);
 
@@ -657,6 +1015,8 @@ esp_err_t cam_deinit(void)
     if (cam_obj->dma_buffer) {
         free(cam_obj->dma_buffer);
     }
+    jpg_stream_free(cam_obj->jpg_stream);
+    free(cam_obj->jpg_line_buf);
     if (cam_obj->frames) {
         for (int x = 0; x < cam_obj->frame_cnt; x++) {
             free(cam_obj->frames[x].fb.buf - cam_obj->frames[x].fb_offset);
@@ -672,6 +1032,86 @@ esp_err_t cam_deinit(void)
     return ESP_OK;
 }
 
+// hold cam_task between two events until cam_task_resume()
+static void cam_task_park(void)
+{
+    cam_obj->park = true;
+    xTaskNotifyGive(cam_obj->task_handle);
+    xSemaphoreTake(cam_obj->park_sem, portMAX_DELAY);
+}
+
+static void cam_task_resume(void)
+{
+    cam_obj->park = false;
+    xTaskNotifyGive(cam_obj->task_handle);
+}
+
+esp_err_t cam_resize(framesize_t frame_size, uint8_t jpeg_quality)
+{
+    CAM_CHECK(NULL != cam_obj, "camera is not initialized", ESP_ERR_INVALID_STATE);
+
+    // work the new layout out aside, cam_task and the interrupts use the live one
+    cam_layout_t next;
+    next.jpeg_encode_quality = cam_obj->jpeg_encode_quality;
+    if (cam_obj->jpeg_encode_quality && jpeg_quality) {
+        next.jpeg_encode_quality = jpeg_quality > 100 ? 100 : jpeg_quality;
+    }
+    cam_calc_frame_sizes(cam_obj, frame_size, &next);
+    uint8_t dma_align = 0;
+    if (!cam_calc_dma_sizes(cam_obj, &next) || cam_frame_alloc_size(cam_obj, &next, &dma_align) > cam_obj->fb_alloc_size) {
+        // the frame pool is too small for the new size, a full reinit is needed
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    cam_stop();
+    cam_task_park();
+
+    // frames still queued for the application hold old-size data, recycle them
+    camera_fb_t *fb = NULL;
+    while (cam_receive(&fb, 0)) {
+        cam_give(fb);
+    }
+
+    cam_apply_layout(&next);
+
+    esp_err_t ret = ESP_OK;
+    if (cam_obj->psram_mode) {
+        for (int x = 0; x < cam_obj->frame_cnt && ret == ESP_OK; x++) {
+            free(cam_obj->frames[x].dma);
+            cam_obj->frames[x].dma = allocate_dma_descriptors(cam_obj->dma_node_cnt, cam_obj->dma_node_buffer_size, cam_obj->frames[x].fb.buf);
+            if (cam_obj->frames[x].dma == NULL) {
+                ret = ESP_ERR_NO_MEM;
+            }
+        }
+    } else {
+        if (cam_obj->dma_buffer_size > cam_obj->dma_buffer_alloc_size) {
+            free(cam_obj->dma_buffer);
+            cam_obj->dma_buffer_alloc_size = 0;
+            cam_obj->dma_buffer = (uint8_t *)heap_caps_malloc(cam_obj->dma_buffer_size * sizeof(uint8_t), MALLOC_CAP_DMA);
+            if (cam_obj->dma_buffer) {
+                cam_obj->dma_buffer_alloc_size = cam_obj->dma_buffer_size;
+            }
+        }
+        free(cam_obj->dma);
+        cam_obj->dma = NULL;
+        if (cam_obj->dma_buffer) {
+            cam_obj->dma = allocate_dma_descriptors(cam_obj->dma_node_cnt, cam_obj->dma_node_buffer_size, cam_obj->dma_buffer);
+        }
+        if (cam_obj->dma == NULL) {
+            ret = ESP_ERR_NO_MEM;
+        }
+    }
+    CAM_CHECK_GOTO(ret == ESP_OK, "dma resize failed", out);
+    ret = cam_jpeg_encode_config();
+    CAM_CHECK_GOTO(ret == ESP_OK, "jpeg encoder resize failed", out);
+
+    ESP_LOGI(TAG, "cam resized to %ux%u", cam_obj->width, cam_obj->height);
+out:
+    // capture stays stopped until cam_start()
+    cam_task_resume();
+    return ret;
+}
+
 void cam_stop(void)
 {
     ll_cam_vsync_intr_enable(cam_obj, false);
@@ -700,13 +1140,16 @@ camera_fb_t *cam_take(TickType_t timeout)
     for (;;)
     {
         TickType_t elapsed = xTaskGetTickCount() - start; /* TickType_t is unsigned so rollover is safe */
-        if (elapsed >= timeout) {
-            ESP_LOGW(TAG, "Failed to get frame: timeout");
-            return NULL;
-        }
-        TickType_t remaining = timeout - elapsed;
+        /* poll once more when the time is up, a timeout of 0 takes a queued frame */
+        TickType_t remaining = elapsed < timeout ? timeout - elapsed : 0;
 
-        if (xQueueReceive(cam_obj->frame_buffer_queue, (void *)&dma_buffer, remaining) == pdFALSE) {
+        if (!cam_receive(&dma_buffer, remaining)) {
+            if (remaining == 0) {
+                if (timeout != 0) {
+                    ESP_LOGW(TAG, "Failed to get frame: timeout");
+                }
+                return NULL;
+            }
             continue;
         }
 
@@ -796,6 +1239,9 @@ void cam_give(camera_fb_t *dma_buffer)
 }
 
 void cam_give_all(void) {
+    if (cam_obj->grab_latest) {
+        cam_mailbox_take(&latest_frame);
+    }
     for (int x = 0; x < cam_obj->frame_cnt; x++) {
         cam_obj->frames[x].en = 1;
     }
@@ -803,9 +1249,55 @@ void cam_give_all(void) {
 
 bool cam_get_available_frames(void)
 {
+    if (cam_obj->grab_latest) {
+        return cam_mailbox_ready(&latest_frame);
+    }
     return 0 < uxQueueMessagesWaiting(cam_obj->frame_buffer_queue);
 }
 
+void cam_get_fb_pool_stats(camera_fb_pool_stats_t *stats)
+{
+    stats->dram_slots = cam_obj->dram_frame_cnt;
+    stats->psram_slots = cam_obj->frame_cnt - cam_obj->dram_frame_cnt;
+    stats->dram_frames = fb_dram_frames;
+    stats->psram_frames = fb_psram_frames;
+}
+
+void cam_set_frame_cb(camera_frame_cb_t cb, void *arg)
+{
+    portENTER_CRITICAL(&frame_cb_lock);
+    frame_cb = cb;
+    frame_cb_arg = arg;
+    portEXIT_CRITICAL(&frame_cb_lock);
+}
+
+int cam_get_frame_fd(void)
+{
+#ifdef CAM_FRAME_FD
+    if (frame_fd < 0) {
+        int fd = eventfd(0, 0);
+        if (fd < 0) {
+            ESP_LOGE(TAG, "eventfd failed, is esp_vfs_eventfd_register() called?");
+            return -1;
+        }
+        bool set = false;
+        portENTER_CRITICAL(&frame_cb_lock);
+        if (frame_fd < 0) {
+            frame_fd = fd;
+            set = true;
+        }
+        portEXIT_CRITICAL(&frame_cb_lock);
+        if (!set) {
+            /* another task created it first */
+            close(fd);
+        }
+    }
+    return frame_fd;
+#else
+    return -1;
+#endif
+}
+
 void cam_set_psram_mode(bool enable)
 {
     portENTER_CRITICAL(&g_psram_dma_lock);
@@ -817,3 +1309,13 @@ bool cam_get_psram_mode(void)
 {
     return g_psram_dma_mode;
 }
+
+bool cam_get_active_psram_mode(void)
+{
+    return cam_obj && cam_obj->psram_mode;
+}
+
+bool cam_psram_mode_changed(void)
+{
+    return cam_obj && cam_obj->psram_mode != cam_psram_mode_wanted();
+}
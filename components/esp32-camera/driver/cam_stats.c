@@ -0,0 +1,154 @@
+// Copyright 2010-2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include "cam_stats.h"
+
+#define TILES CAMERA_FB_STATS_TILES
+
+// luma of RGB565 stored high byte first, BT.601 weights
+#define RGB565_LUMA(hi, lo) \
+    ((((hi) & 0xF8) * 77 + ((((hi) << 5) | ((lo) >> 3)) & 0xFC) * 150 + (((lo) << 3) & 0xF8) * 29) >> 8)
+
+#define STATS_SPAN(luma) \
+    for (size_t i = 0; i < n; i++) { \
+        const uint8_t v = (luma); \
+        hist[v]++; \
+        sum += v; \
+        if (v < mn) mn = v; \
+        if (v > mx) mx = v; \
+        gradient += v > prev ? v - prev : prev - v; \
+        prev = v; \
+    }
+
+bool cam_stats_begin(cam_stats_t *st, camera_fb_stats_t *out, pixformat_t format, uint16_t width, uint16_t height)
+{
+    switch (format) {
+    case PIXFORMAT_GRAYSCALE:
+        st->bytes_per_pixel = 1;
+        break;
+    case PIXFORMAT_YUV422:
+    case PIXFORMAT_RGB565:
+        st->bytes_per_pixel = 2;
+        break;
+    default:
+        return false;
+    }
+    if (width < TILES || height < TILES) {
+        return false;
+    }
+    st->out = out;
+    st->format = format;
+    st->width = width;
+    st->height = height;
+    st->x = 0;
+    st->y = 0;
+    st->prev = 0;
+    st->sum = 0;
+    st->pixels = 0;
+    st->pairs = 0;
+    st->gradient = 0;
+    for (int i = 0; i < TILES; i++) {
+        st->tile_end[i] = (i + 1) * width / TILES;
+    }
+    memset(st->tile_sum, 0, sizeof(st->tile_sum));
+    memset(st->tile_pixels, 0, sizeof(st->tile_pixels));
+    memset(st->tile_min, 0xFF, sizeof(st->tile_min));
+    memset(st->tile_max, 0, sizeof(st->tile_max));
+    memset(st->histogram, 0, sizeof(st->histogram));
+    return true;
+}
+
+// n pixels of one line that all fall into tile (ty, tx)
+static void stats_span(cam_stats_t *st, const uint8_t *p, size_t n, int ty, int tx)
+{
+    uint32_t *hist = st->histogram;
+    uint32_t sum = 0;
+    uint32_t gradient = 0;
+    uint8_t mn = st->tile_min[ty][tx];
+    uint8_t mx = st->tile_max[ty][tx];
+    // the first pixel of a line has no left neighbour
+    uint8_t prev = st->x ? st->prev : (st->format == PIXFORMAT_RGB565 ? RGB565_LUMA(p[0], p[1]) : p[0]);
+
+    switch (st->format) {
+    case PIXFORMAT_GRAYSCALE:
+        STATS_SPAN(p[i]);
+        break;
+    case PIXFORMAT_YUV422:
+        STATS_SPAN(p[2 * i]);
+        break;
+    default:
+        STATS_SPAN(RGB565_LUMA(p[2 * i], p[2 * i + 1]));
+        break;
+    }
+
+    st->prev = prev;
+    st->sum += sum;
+    st->gradient += gradient;
+    st->pairs += st->x ? n : n - 1;
+    st->pixels += n;
+    st->tile_sum[ty][tx] += sum;
+    st->tile_pixels[ty][tx] += n;
+    st->tile_min[ty][tx] = mn;
+    st->tile_max[ty][tx] = mx;
+}
+
+void cam_stats_update(cam_stats_t *st, const uint8_t *data, size_t len)
+{
+    size_t n = len / st->bytes_per_pixel;
+    while (n && st->y < st->height) {
+        const int ty = st->y * TILES / st->height;
+        int tx = 0;
+        while (st->tile_end[tx] <= st->x) {
+            tx++;
+        }
+        while (n && st->x < st->width) {
+            size_t count = st->tile_end[tx] - st->x;
+            if (count > n) {
+                count = n;
+            }
+            stats_span(st, data, count, ty, tx);
+            data += count * st->bytes_per_pixel;
+            n -= count;
+            st->x += count;
+            if (st->x == st->tile_end[tx]) {
+                tx++;
+            }
+        }
+        if (st->x == st->width) {
+            st->x = 0;
+            st->y++;
+        }
+    }
+}
+
+void cam_stats_end(cam_stats_t *st)
+{
+    camera_fb_stats_t *out = st->out;
+    memcpy(out->histogram, st->histogram, sizeof(out->histogram));
+    out->mean = st->pixels ? st->sum / st->pixels : 0;
+    out->focus = st->pairs ? (st->gradient * 256) / st->pairs : 0;
+    for (int ty = 0; ty < TILES; ty++) {
+        for (int tx = 0; tx < TILES; tx++) {
+            camera_fb_tile_stats_t *t = &out->tiles[ty][tx];
+            if (st->tile_pixels[ty][tx]) {
+                t->mean = st->tile_sum[ty][tx] / st->tile_pixels[ty][tx];
+                t->min = st->tile_min[ty][tx];
+                t->max = st->tile_max[ty][tx];
+            } else {
+                t->mean = t->min = t->max = 0;
+            }
+        }
+    }
+}
@@ -90,6 +90,7 @@ static const char *TAG = "camera";
 typedef struct {
     sensor_t sensor;
     camera_fb_t fb;
+    bool soft_jpeg;             // JPEG frames are encoded by the driver
 } camera_state_t;
 
 static const char *CAMERA_SENSOR_NVS_KEY = "sensor";
@@ -296,6 +297,15 @@ static pixformat_t get_output_data_format(camera_conv_mode_t conv_mode)
 }
 #endif
 
+#if CONFIG_CAMERA_SOFT_JPEG
+// sensor quality scale (0-63, lower is better) to jpge quality (1-100)
+static uint8_t soft_jpeg_quality(int jpeg_quality)
+{
+    int quality = 100 - jpeg_quality * 3 / 2;
+    return quality < 1 ? 1 : (quality > 100 ? 100 : quality);
+}
+#endif
+
 esp_err_t esp_camera_init(const camera_config_t *config)
 {
     esp_err_t err;
@@ -315,11 +325,21 @@ esp_err_t esp_camera_init(const camera_config_t *config)
 
     framesize_t frame_size = (framesize_t) config->frame_size;
     pixformat_t pix_format = (pixformat_t) config->pixel_format;
+    camera_config_t cam_config_in = *config;
 
     if (PIXFORMAT_JPEG == pix_format && (!camera_sensor[camera_model].support_jpeg)) {
+#if CONFIG_CAMERA_SOFT_JPEG
+        // capture raw frames and let cam_task encode them
+        pix_format = (camera_model == CAMERA_SC031GS || camera_model == CAMERA_HM0360) ? PIXFORMAT_GRAYSCALE : PIXFORMAT_YUV422;
+        cam_config_in.pixel_format = pix_format;
+        cam_set_jpeg_encode(soft_jpeg_quality(config->jpeg_quality));
+        s_state->soft_jpeg = true;
+        ESP_LOGI(TAG, "JPEG is not supported on this sensor, encoding in software");
+#else
         ESP_LOGE(TAG, "JPEG format is not supported on this sensor");
         err = ESP_ERR_NOT_SUPPORTED;
         goto fail;
+#endif
     }
 
     if (frame_size > camera_sensor[camera_model].max_size) {
@@ -327,7 +347,7 @@ esp_err_t esp_camera_init(const camera_config_t *config)
         frame_size = camera_sensor[camera_model].max_size;
     }
 
-    err = cam_config(config, frame_size, s_state->sensor.id.PID);
+    err = cam_config(&cam_config_in, frame_size, s_state->sensor.id.PID);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Camera config failed with error 0x%x", err);
         goto fail;
@@ -387,16 +407,21 @@ esp_err_t esp_camera_deinit()
 #define FB_GET_TIMEOUT (4000 / portTICK_PERIOD_MS)
 
 camera_fb_t *esp_camera_fb_get()
+{
+    return esp_camera_fb_get_timeout(FB_GET_TIMEOUT);
+}
+
+camera_fb_t *esp_camera_fb_get_timeout(TickType_t timeout)
 {
     if (s_state == NULL) {
         return NULL;
     }
-    camera_fb_t *fb = cam_take(FB_GET_TIMEOUT);
+    camera_fb_t *fb = cam_take(timeout);
     //set the frame properties
     if (fb) {
         fb->width = resolution[s_state->sensor.status.framesize].width;
         fb->height = resolution[s_state->sensor.status.framesize].height;
-        fb->format = s_state->sensor.pixformat;
+        fb->format = s_state->soft_jpeg ? PIXFORMAT_JPEG : s_state->sensor.pixformat;
     }
     return fb;
 }
@@ -520,11 +545,113 @@ bool esp_camera_available_frames(void)
     return cam_get_available_frames();
 }
 
+esp_err_t esp_camera_get_fb_pool_stats(camera_fb_pool_stats_t *stats)
+{
+    if (stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_state == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    cam_get_fb_pool_stats(stats);
+    return ESP_OK;
+}
+
+void esp_camera_set_frame_cb(camera_frame_cb_t cb, void *arg)
+{
+    cam_set_frame_cb(cb, arg);
+}
+
+int esp_camera_get_frame_fd(void)
+{
+    return cam_get_frame_fd();
+}
+
+static bool camera_can_resize(const camera_config_t *config)
+{
+    const camera_config_t *cur = &s_saved_config;
+    return config->pin_pwdn == cur->pin_pwdn
+           && config->pin_reset == cur->pin_reset
+           && config->pin_xclk == cur->pin_xclk
+           && config->pin_sccb_sda == cur->pin_sccb_sda
+           && config->pin_sccb_scl == cur->pin_sccb_scl
+           && config->pin_d7 == cur->pin_d7
+           && config->pin_d6 == cur->pin_d6
+           && config->pin_d5 == cur->pin_d5
+           && config->pin_d4 == cur->pin_d4
+           && config->pin_d3 == cur->pin_d3
+           && config->pin_d2 == cur->pin_d2
+           && config->pin_d1 == cur->pin_d1
+           && config->pin_d0 == cur->pin_d0
+           && config->pin_vsync == cur->pin_vsync
+           && config->pin_href == cur->pin_href
+           && config->pin_pclk == cur->pin_pclk
+           && config->xclk_freq_hz == cur->xclk_freq_hz
+           && config->ledc_timer == cur->ledc_timer
+           && config->ledc_channel == cur->ledc_channel
+           && config->pixel_format == cur->pixel_format
+           && config->fb_count == cur->fb_count
+           && config->fb_location == cur->fb_location
+           && config->fb_dram_budget == cur->fb_dram_budget
+           && config->grab_mode == cur->grab_mode
+           && config->dma_buffer_size == cur->dma_buffer_size
+#if CONFIG_CAMERA_CONVERTER_ENABLED
+           && config->conv_mode == cur->conv_mode
+#endif
+           && config->sccb_i2c_port == cur->sccb_i2c_port
+           && !cam_psram_mode_changed();
+}
+
+/*
+ * Change frame size (and JPEG quality) while keeping the sensor session,
+ * cam_task and the frame pool. Fails without side effects if the frame
+ * buffers are too small for the new size.
+ */
+static esp_err_t camera_resize(const camera_config_t *config)
+{
+    framesize_t frame_size = config->frame_size;
+    camera_sensor_info_t *info = esp_camera_sensor_get_info(&s_state->sensor.id);
+    if (info && frame_size > info->max_size) {
+        frame_size = info->max_size;
+    }
+
+    uint8_t soft_quality = 0;
+#if CONFIG_CAMERA_SOFT_JPEG
+    if (s_state->soft_jpeg) {
+        soft_quality = soft_jpeg_quality(config->jpeg_quality);
+    }
+#endif
+    // the encoder quality changes together with the size, or not at all
+    esp_err_t err = cam_resize(frame_size, soft_quality);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    s_state->sensor.status.framesize = frame_size;
+    if (s_state->sensor.set_framesize(&s_state->sensor, frame_size) != 0) {
+        ESP_LOGE(TAG, "Failed to set frame size");
+        return ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE;
+    }
+    if (!s_state->soft_jpeg && config->pixel_format == PIXFORMAT_JPEG && config->jpeg_quality != s_saved_config.jpeg_quality) {
+        s_state->sensor.set_quality(&s_state->sensor, config->jpeg_quality);
+    }
+    s_saved_config = *config;
+    cam_start();
+    return ESP_OK;
+}
+
 esp_err_t esp_camera_reconfigure(const camera_config_t *config)
 {
     if (!config) {
         return ESP_ERR_INVALID_ARG;
     }
+    if (s_state && camera_can_resize(config)) {
+        esp_err_t err = camera_resize(config);
+        if (err == ESP_OK) {
+            return ESP_OK;
+        }
+        ESP_LOGI(TAG, "In-place resize not possible (0x%x), reinitializing", err);
+    }
     if (s_state) {
         esp_err_t err = esp_camera_deinit();
         if (err != ESP_OK) {
@@ -535,8 +662,21 @@ esp_err_t esp_camera_reconfigure(const camera_config_t *config)
     return esp_camera_init(&s_saved_config);
 }
 
+esp_err_t esp_camera_set_framesize(framesize_t frame_size)
+{
+    if (!s_state) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    camera_config_t config = s_saved_config;
+    config.frame_size = frame_size;
+    return esp_camera_reconfigure(&config);
+}
+
 esp_err_t esp_camera_set_psram_mode(bool enable)
 {
+    if (s_state && enable == cam_get_psram_mode()) {
+        return ESP_OK;
+    }
     cam_set_psram_mode(enable);
     if (!s_state) {
         return ESP_ERR_INVALID_STATE;
@@ -71,6 +71,7 @@
 #include "sensor.h"
 #include "sys/time.h"
 #include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
 
 /**
  * @brief define for if chip supports camera
@@ -155,8 +156,31 @@ typedef struct {
 #endif
 
     int sccb_i2c_port;              /*!< If pin_sccb_sda is -1, use the already configured I2C bus by number */
+    size_t fb_dram_budget;          /*!< With CAMERA_FB_IN_PSRAM, bytes of internal DRAM for frame buffers. As many as fit are placed there and filled first, the rest in PSRAM. 0 for none */
+    size_t dma_buffer_size;         /*!< JPEG mode without PSRAM DMA, bytes of the DMA ring the frames are copied from. A longer ring lets cam_task fall further behind without losing data. 0 or less than the driver default keeps the default, at most 32 DMA transfers are used */
 } camera_config_t;
 
+#define CAMERA_FB_STATS_TILES 8     /*!< Tiles per row and per column of camera_fb_stats_t */
+
+/**
+ * @brief Luma statistics of one tile of the frame
+ */
+typedef struct {
+    uint8_t mean;
+    uint8_t min;
+    uint8_t max;
+} camera_fb_tile_stats_t;
+
+/**
+ * @brief Luma statistics gathered while the frame was copied from DMA, see CONFIG_CAMERA_FB_STATS
+ */
+typedef struct {
+    uint32_t histogram[256];    /*!< Number of pixels per luma value */
+    uint8_t mean;               /*!< Mean luma of the frame */
+    uint32_t focus;             /*!< Mean absolute luma difference of horizontal neighbours in 1/256, higher is sharper */
+    camera_fb_tile_stats_t tiles[CAMERA_FB_STATS_TILES][CAMERA_FB_STATS_TILES]; /*!< Tiles, [row][column] */
+} camera_fb_stats_t;
+
 /**
  * @brief Data structure of camera frame buffer
  */
@@ -166,9 +190,21 @@ typedef struct {
     size_t width;               /*!< Width of the buffer in pixels */
     size_t height;              /*!< Height of the buffer in pixels */
     pixformat_t format;         /*!< Format of the pixel data */
-    struct timeval timestamp;   /*!< Timestamp since boot of the first DMA buffer of the frame */
+    struct timeval timestamp;   /*!< Time since boot of the VSYNC interrupt that started the frame */
+    const camera_fb_stats_t *stats; /*!< Luma statistics of the frame, NULL if not gathered */
+    uint32_t seq;               /*!< Number of the VSYNC that started the frame, gaps are frames that were dropped */
 } camera_fb_t;
 
+/**
+ * @brief Frame buffer pool usage, see fb_dram_budget
+ */
+typedef struct {
+    uint8_t dram_slots;         /*!< Frame buffers in internal DRAM */
+    uint8_t psram_slots;        /*!< Frame buffers in PSRAM */
+    uint32_t dram_frames;       /*!< Frames captured into a DRAM buffer */
+    uint32_t psram_frames;      /*!< Frames captured into a PSRAM buffer */
+} camera_fb_pool_stats_t;
+
 #define ESP_ERR_CAMERA_BASE 0x20000
 #define ESP_ERR_CAMERA_NOT_DETECTED             (ESP_ERR_CAMERA_BASE + 1)
 #define ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE (ESP_ERR_CAMERA_BASE + 2)
@@ -203,10 +239,53 @@ esp_err_t esp_camera_deinit(void);
 /**
  * @brief Obtain pointer to a frame buffer.
  *
+ * Waits up to 4 seconds for a frame, see esp_camera_fb_get_timeout().
+ *
  * @return pointer to the frame buffer
  */
 camera_fb_t* esp_camera_fb_get(void);
 
+/**
+ * @brief Obtain pointer to a frame buffer, waiting at most the given time
+ *
+ * @param timeout  Ticks to wait for a frame, 0 to return at once and
+ *                 portMAX_DELAY to wait until one arrives
+ *
+ * @return pointer to the frame buffer, NULL if none arrived in time
+ */
+camera_fb_t* esp_camera_fb_get_timeout(TickType_t timeout);
+
+/**
+ * @brief Function called for each frame that becomes available
+ *
+ * Runs in the camera task right after the frame was queued, it must return
+ * quickly and never block, e.g. xTaskNotifyGive() or xEventGroupSetBits()
+ * to wake the consumer, which then takes the frame with a timeout of 0.
+ */
+typedef void (*camera_frame_cb_t)(void *arg);
+
+/**
+ * @brief Set the function called for each frame that becomes available
+ *
+ * The callback is kept across esp_camera_deinit() and esp_camera_init().
+ *
+ * @param cb   Callback, NULL to remove it
+ * @param arg  Argument passed to the callback
+ */
+void esp_camera_set_frame_cb(camera_frame_cb_t cb, void *arg);
+
+/**
+ * @brief Get an eventfd that becomes readable when frames are available
+ *
+ * For a task that waits on frames and sockets together with select(). Each
+ * queued frame adds 1 to the counter, reading the descriptor resets it; read
+ * it when select() reports it, then take frames with a timeout of 0 until
+ * none is left. Needs esp_vfs_eventfd_register() to have been called.
+ *
+ * @return the descriptor, -1 if the eventfd could not be created
+ */
+int esp_camera_get_frame_fd(void);
+
 /**
  * @brief Return the frame buffer to be reused again.
  *
@@ -245,6 +324,17 @@ void esp_camera_return_all(void);
  */
 bool esp_camera_available_frames(void);
 
+/**
+ * @brief Read how many frames were captured into DRAM and PSRAM buffers
+ *
+ * @param stats  Returned pool usage since the camera was initialized
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_ARG if stats is NULL
+ * - ESP_ERR_INVALID_STATE if the camera is not initialized
+ */
+esp_err_t esp_camera_get_fb_pool_stats(camera_fb_pool_stats_t *stats);
+
 /**
  * @brief Enable or disable PSRAM DMA mode at runtime.
  *
@@ -259,6 +349,11 @@ esp_err_t esp_camera_set_psram_mode(bool enable);
 /**
  * @brief Reinitialize the camera with a new configuration.
  *
+ * If only frame_size and/or jpeg_quality differ from the current configuration and
+ * the allocated frame buffers are large enough, the sensor session and frame pool are
+ * kept and only the DMA layout and sensor window are reprogrammed. Otherwise the
+ * driver is fully deinitialized and initialized again.
+ *
  * @param config  Updated camera configuration structure
  * @return
  * - ESP_OK on success
@@ -267,6 +362,17 @@ esp_err_t esp_camera_set_psram_mode(bool enable);
  */
 esp_err_t esp_camera_reconfigure(const camera_config_t *config);
 
+/**
+ * @brief Change the capture frame size, reusing the frame pool when it fits.
+ *
+ * @param frame_size  New frame size
+ * @return
+ * - ESP_OK on success
+ * - ESP_ERR_INVALID_STATE if the camera is not initialized
+ * - Propagated error from esp_camera_reconfigure()
+ */
+esp_err_t esp_camera_set_framesize(framesize_t frame_size);
+
 /**
  * @brief Get current PSRAM DMA mode state.
  *
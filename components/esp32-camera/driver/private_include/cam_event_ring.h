@@ -0,0 +1,119 @@
+// Copyright 2010-2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Event ring from the camera interrupts to cam_task.
+ *
+ * One producer, the camera interrupts, and one consumer, cam_task. Interrupts
+ * that can run on different cores must serialize their pushes. Head and
+ * tail are free running sequence numbers, each written by one side only, so
+ * pushing and popping are a few loads and stores with no lock, critical
+ * section or read-modify-write, which also keeps it lock free on chips
+ * without atomic instructions. A push to a full ring drops the event and
+ * counts it in lost, which the consumer compares to notice the gap. The
+ * push is forced inline for IRAM interrupt handlers.
+ *
+ * Each event carries the VSYNC count and time as the interrupt saw them, so
+ * cam_task stamps a frame with its own VSYNC however late it gets to it.
+ */
+
+#define CAM_EVENT_RING_SIZE 32     // power of 2
+
+typedef struct {
+    uint32_t event;         // see CAM_EVENT() in cam_hal.c
+    uint32_t vsync_seq;     // VSYNC interrupts up to this event
+    int64_t vsync_us;       // time of the last of them
+} cam_ring_event_t;
+
+typedef struct {
+    atomic_uint head;       // events pushed, written by the producer
+    atomic_uint tail;       // events popped, written by the consumer
+    atomic_uint lost;       // events dropped on a full ring, written by the producer
+    cam_ring_event_t events[CAM_EVENT_RING_SIZE];
+} cam_event_ring_t;
+
+static inline void cam_event_ring_init(cam_event_ring_t *r)
+{
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->lost, 0);
+}
+
+/**
+ * @brief Push an event, producer side
+ *
+ * @return false if the ring was full and the event was dropped
+ */
+static inline __attribute__((always_inline)) bool cam_event_ring_push(cam_event_ring_t *r, const cam_ring_event_t *event)
+{
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) >= CAM_EVENT_RING_SIZE) {
+        atomic_store_explicit(&r->lost, atomic_load_explicit(&r->lost, memory_order_relaxed) + 1, memory_order_release);
+        return false;
+    }
+    r->events[head % CAM_EVENT_RING_SIZE] = *event;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Pop the oldest event, consumer side
+ *
+ * @return false if the ring is empty
+ */
+static inline bool cam_event_ring_pop(cam_event_ring_t *r, cam_ring_event_t *event)
+{
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&r->head, memory_order_acquire)) {
+        return false;
+    }
+    *event = r->events[tail % CAM_EVENT_RING_SIZE];
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Drop all pending events, consumer side
+ */
+static inline void cam_event_ring_flush(cam_event_ring_t *r)
+{
+    atomic_store_explicit(&r->tail, atomic_load_explicit(&r->head, memory_order_acquire), memory_order_release);
+}
+
+static inline unsigned cam_event_ring_count(cam_event_ring_t *r)
+{
+    return atomic_load_explicit(&r->head, memory_order_acquire) - atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+/**
+ * @brief Events dropped so far, a change since the last call means a gap
+ */
+static inline unsigned cam_event_ring_lost(cam_event_ring_t *r)
+{
+    return atomic_load_explicit(&r->lost, memory_order_acquire);
+}
+
+#ifdef __cplusplus
+}
+#endif
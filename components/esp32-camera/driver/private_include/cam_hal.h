@@ -47,6 +47,36 @@ esp_err_t cam_init(const camera_config_t *config);
 
 esp_err_t cam_config(const camera_config_t *config, framesize_t frame_size, uint16_t sensor_pid);
 
+/**
+ * @brief Encode frames to JPEG in cam_task while they are captured
+ *
+ * For sensors without a JPEG encoder. Call between cam_init() and
+ * cam_config() with the sensor output format in config->pixel_format,
+ * cam_resize() changes the quality later. Frames then only have to hold
+ * the JPEG, the raw lines pass through a buffer of one DMA transfer.
+ *
+ * @param quality JPEG quality 1-100, 0 to capture raw frames
+ */
+void cam_set_jpeg_encode(uint8_t quality);
+
+/**
+ * @brief Switch the capture size without releasing the frame pool
+ *
+ * Recomputes the DMA layout for the new size and reuses the allocated frame
+ * buffers. Capture is left stopped, call cam_start() once the sensor has been
+ * reprogrammed.
+ *
+ * @param frame_size New frame size
+ * @param jpeg_quality New quality of the software JPEG encoder, 0 keeps the
+ *                     current one. Ignored when frames are not encoded.
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_SIZE The frame buffers are too small, nothing was changed
+ *     - ESP_ERR_NO_MEM DMA descriptors could not be reallocated, a full reinit is needed
+ */
+esp_err_t cam_resize(framesize_t frame_size, uint8_t jpeg_quality);
+
 void cam_stop(void);
 
 void cam_start(void);
@@ -59,9 +89,28 @@ void cam_give_all(void);
 
 bool cam_get_available_frames(void);
 
+void cam_get_fb_pool_stats(camera_fb_pool_stats_t *stats);
+
+void cam_set_frame_cb(camera_frame_cb_t cb, void *arg);
+
+int cam_get_frame_fd(void);
+
 void cam_set_psram_mode(bool enable);
 bool cam_get_psram_mode(void);
 
+/**
+ * @brief PSRAM DMA mode of the running capture, false without a camera
+ */
+bool cam_get_active_psram_mode(void);
+
+/**
+ * @brief Whether cam_config() would now pick another PSRAM DMA mode
+ *
+ * The mode is only applied by cam_config(), cam_resize() keeps the DMA layout
+ * of the running mode.
+ */
+bool cam_psram_mode_changed(void);
+
 #ifdef __cplusplus
 }
 #endif
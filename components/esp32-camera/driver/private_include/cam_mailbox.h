@@ -0,0 +1,75 @@
+// Copyright 2010-2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Latest-frame mailbox for CAMERA_GRAB_LATEST.
+ *
+ * A single slot holding the index of the newest complete frame. The capture
+ * task publishes a frame by exchanging it into the slot and recycles the
+ * unread frame it replaced, readers exchange the slot for empty. Each side is
+ * one atomic exchange, so neither blocks, retries or sees a stale frame, and
+ * every frame index is owned by exactly one of them at any time. With a frame
+ * being captured, one in the slot and one held by the application, three
+ * buffers never wait for each other.
+ */
+
+#define CAM_MAILBOX_EMPTY (-1)
+
+typedef struct {
+    atomic_int slot;
+} cam_mailbox_t;
+
+static inline void cam_mailbox_init(cam_mailbox_t *mb)
+{
+    atomic_init(&mb->slot, CAM_MAILBOX_EMPTY);
+}
+
+/**
+ * @brief Publish a complete frame
+ *
+ * @return The unread frame it replaced, for the caller to recycle, or
+ *         CAM_MAILBOX_EMPTY
+ */
+static inline int cam_mailbox_publish(cam_mailbox_t *mb, int frame)
+{
+    return atomic_exchange_explicit(&mb->slot, frame, memory_order_acq_rel);
+}
+
+/**
+ * @brief Take the newest frame, the caller owns it until it recycles it
+ *
+ * @return The frame or CAM_MAILBOX_EMPTY
+ */
+static inline int cam_mailbox_take(cam_mailbox_t *mb)
+{
+    return atomic_exchange_explicit(&mb->slot, CAM_MAILBOX_EMPTY, memory_order_acq_rel);
+}
+
+static inline bool cam_mailbox_ready(cam_mailbox_t *mb)
+{
+    return atomic_load_explicit(&mb->slot, memory_order_acquire) != CAM_MAILBOX_EMPTY;
+}
+
+#ifdef __cplusplus
+}
+#endif
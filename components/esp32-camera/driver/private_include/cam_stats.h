@@ -0,0 +1,77 @@
+// Copyright 2010-2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Frame statistics accumulated piece by piece, right after each DMA transfer
+ * is copied into the frame buffer and is still in internal RAM or cache, so
+ * they never cost a second pass over the frame in PSRAM.
+ */
+
+typedef struct {
+    camera_fb_stats_t *out;
+    pixformat_t format;
+    uint8_t bytes_per_pixel;
+    uint16_t width;
+    uint16_t height;
+    uint16_t x;                 // next pixel
+    uint16_t y;
+    uint8_t prev;               // luma left of the next pixel
+    uint32_t sum;
+    uint32_t pixels;
+    uint32_t pairs;             // horizontal neighbours in the gradient sum
+    uint64_t gradient;
+    uint16_t tile_end[CAMERA_FB_STATS_TILES];   // first x of the next tile column
+    uint32_t tile_sum[CAMERA_FB_STATS_TILES][CAMERA_FB_STATS_TILES];
+    uint32_t tile_pixels[CAMERA_FB_STATS_TILES][CAMERA_FB_STATS_TILES];
+    uint8_t tile_min[CAMERA_FB_STATS_TILES][CAMERA_FB_STATS_TILES];
+    uint8_t tile_max[CAMERA_FB_STATS_TILES][CAMERA_FB_STATS_TILES];
+    uint32_t histogram[256];
+} cam_stats_t;
+
+/**
+ * @brief Start the statistics of a frame
+ *
+ * @param st     Accumulator
+ * @param out    Where cam_stats_end() stores the result
+ * @param format GRAYSCALE, YUV422 or RGB565 frame buffer format
+ * @param width  Frame width in pixels
+ * @param height Frame height in pixels
+ * @return false if the format or size is not supported
+ */
+bool cam_stats_begin(cam_stats_t *st, camera_fb_stats_t *out, pixformat_t format, uint16_t width, uint16_t height);
+
+/**
+ * @brief Add the next piece of the frame, it must end on a pixel boundary
+ */
+void cam_stats_update(cam_stats_t *st, const uint8_t *data, size_t len);
+
+/**
+ * @brief Finish the frame and store the statistics
+ */
+void cam_stats_end(cam_stats_t *st);
+
+#ifdef __cplusplus
+}
+#endif
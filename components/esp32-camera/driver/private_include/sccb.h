@@ -9,6 +9,39 @@
 #ifndef __SCCB_H__
 #define __SCCB_H__
 #include <stdint.h>
+#include <stddef.h>
+
+#define SCCB_SHADOW_NO_BANK     (-1)    /*!< Device has no bank/page select register */
+#define SCCB_SHADOW_ANY_BANK    0xFFFF  /*!< Range applies to every bank */
+
+#define SCCB_SHADOW_VOLATILE    0x01    /*!< Never cached: status, self-clearing or hardware-updated registers */
+#define SCCB_SHADOW_UNBANKED    0x02    /*!< Same register in every bank, cached independently of the bank select */
+
+typedef struct {
+    uint16_t bank;      /*!< Bank the range applies to, or SCCB_SHADOW_ANY_BANK */
+    uint16_t first;     /*!< First register of the range */
+    uint16_t last;      /*!< Last register of the range (inclusive) */
+    uint8_t flags;      /*!< SCCB_SHADOW_VOLATILE and/or SCCB_SHADOW_UNBANKED */
+} sccb_shadow_range_t;
+
+typedef struct {
+    int bank_reg;                       /*!< Bank select register, or SCCB_SHADOW_NO_BANK */
+    uint8_t bank_mask;                  /*!< Bits of bank_reg that select the bank; writing any other bit set is treated as a reset */
+    const sccb_shadow_range_t *ranges;  /*!< Register ranges with special handling, must stay valid while enabled */
+    size_t range_count;                 /*!< Number of entries in ranges */
+} sccb_shadow_config_t;
+
+#define SCCB_BATCH_ADDR16       0x01    /*!< Table uses 16-bit register addresses */
+#define SCCB_BATCH_AUTO_INC     0x02    /*!< Sensor auto-increments the register address on multi-byte writes */
+
+typedef struct {
+    uint32_t reads;         /*!< Register reads that went to the bus */
+    uint32_t writes;        /*!< Register writes that went to the bus */
+    uint32_t read_hits;     /*!< Register reads served from the shadow */
+    uint32_t write_skips;   /*!< Register writes skipped because the value was unchanged */
+    uint32_t transactions;  /*!< Bus transactions: one per register access that reached the bus, one per burst of a batch */
+} sccb_stats_t;
+
 int SCCB_Init(int pin_sda, int pin_scl);
 int SCCB_Use_Port(int sccb_i2c_port);
 int SCCB_Deinit(void);
@@ -19,4 +52,41 @@ uint8_t SCCB_Read16(uint8_t slv_addr, uint16_t reg);
 int SCCB_Write16(uint8_t slv_addr, uint16_t reg, uint8_t data);
 uint16_t SCCB_Read_Addr16_Val16(uint8_t slv_addr, uint16_t reg);
 int SCCB_Write_Addr16_Val16(uint8_t slv_addr, uint16_t reg, uint16_t data);
+
+/**
+ * @brief Write a table of {reg, value} pairs with as few bus transactions as possible
+ *
+ * Writes are queued into one I2C command link where the driver allows it, and
+ * consecutive registers are merged into a single burst if SCCB_BATCH_AUTO_INC
+ * is set. The table is written as is: delay and end markers must be handled
+ * by the caller.
+ *
+ * @param slv_addr SCCB address
+ * @param regs Register/value pairs
+ * @param count Number of pairs to write
+ * @param flags SCCB_BATCH_* flags (SCCB_Write_Regs16 only)
+ * @return 0 on success, -1 on bus error
+ */
+int SCCB_Write_Regs(uint8_t slv_addr, const uint8_t (*regs)[2], size_t count);
+int SCCB_Write_Regs16(uint8_t slv_addr, const uint16_t (*regs)[2], size_t count, uint8_t flags);
+
+/**
+ * @brief Enable the register shadow for a device
+ *
+ * Reads of cached registers are served from memory, writes of unchanged
+ * values and repeated bank selects are skipped. Registers the sensor itself
+ * modifies must be listed as SCCB_SHADOW_VOLATILE.
+ *
+ * @param slv_addr SCCB address
+ * @param config Bank and volatile register description of the sensor
+ * @return 0 on success, -1 if the shadow is disabled in menuconfig or out of memory
+ */
+int SCCB_Shadow_Enable(uint8_t slv_addr, const sccb_shadow_config_t *config);
+void SCCB_Shadow_Disable(uint8_t slv_addr);
+/**
+ * @brief Forget every cached register of a device, e.g. after a software reset
+ */
+void SCCB_Shadow_Invalidate(uint8_t slv_addr);
+void SCCB_Get_Stats(sccb_stats_t *stats);
+void SCCB_Reset_Stats(void);
 #endif // __SCCB_H__
@@ -0,0 +1,64 @@
+/*
+ * SCCB register shadow.
+ *
+ * Internal hooks used by the SCCB bus implementations (sccb.c / sccb-ng.c)
+ * to serve reads from, and skip unchanged writes against, the per-device
+ * register shadow configured with SCCB_Shadow_Enable().
+ *
+ */
+#ifndef __SCCB_SHADOW_H__
+#define __SCCB_SHADOW_H__
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Look up a register before reading it from the bus
+ *
+ * @param slv_addr SCCB address
+ * @param reg Register address
+ * @param data Cached value, valid only if true is returned
+ * @return true if the read was served from the shadow
+ */
+bool sccb_shadow_read(uint8_t slv_addr, uint16_t reg, uint8_t *data);
+
+/**
+ * @brief Check whether a register write has to reach the bus
+ *
+ * @param slv_addr SCCB address
+ * @param reg Register address
+ * @param data Value about to be written
+ * @return false if the shadow already holds this value and the write can be skipped
+ */
+bool sccb_shadow_write_needed(uint8_t slv_addr, uint16_t reg, uint8_t data);
+
+/**
+ * @brief Record the outcome of a bus read or write of one register
+ *
+ * @param slv_addr SCCB address
+ * @param reg Register address
+ * @param data Value read or written
+ * @param ok Whether the bus transaction succeeded; failed transactions drop the entry
+ */
+void sccb_shadow_update(uint8_t slv_addr, uint16_t reg, uint8_t data, bool ok);
+
+/**
+ * @brief Account for a transaction that bypasses the shadow (16-bit values)
+ *
+ * @param slv_addr SCCB address
+ * @param reg First register address touched
+ * @param len Number of registers touched
+ * @param write Whether this is a write, which drops the touched entries
+ */
+void sccb_shadow_bypass(uint8_t slv_addr, uint16_t reg, uint8_t len, bool write);
+
+/**
+ * @brief Count a transaction about to be started on the bus
+ */
+void sccb_shadow_transaction(void);
+
+/**
+ * @brief Release every device shadow, called from SCCB_Deinit()
+ */
+void sccb_shadow_deinit(void);
+
+#endif // __SCCB_SHADOW_H__
@@ -11,6 +11,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include "sccb.h"
+#include "sccb_shadow.h"
 #include "sensor.h"
 #include <stdio.h>
 #include "sdkconfig.h"
@@ -41,6 +42,7 @@ const int SCCB_I2C_PORT_DEFAULT = 0;
 #endif
 
 #define MAX_DEVICES UINT8_MAX-1
+#define SCCB_BURST_MAX 32 /*!< Register values sent in one auto-increment burst */
 
 /*
  The legacy I2C driver used addresses to differentiate between devices, whereas the new driver uses
@@ -160,6 +162,7 @@ int SCCB_Deinit(void)
 {
     esp_err_t ret;
 
+    sccb_shadow_deinit();
     for (uint8_t i = 0; i < device_count; i++)
     {
         ret = i2c_master_bus_rm_device(devices[i].dev_handle);
@@ -222,62 +225,88 @@ int SCCB_Probe(uint8_t slv_addr)
 
 uint8_t SCCB_Read(uint8_t slv_addr, uint8_t reg)
 {
-    i2c_master_dev_handle_t dev_handle = *(get_handle_from_address(slv_addr));
-
     uint8_t tx_buffer[1];
     uint8_t rx_buffer[1];
 
+    if (sccb_shadow_read(slv_addr, reg, &rx_buffer[0]))
+    {
+        return rx_buffer[0];
+    }
+
+    i2c_master_dev_handle_t dev_handle = *(get_handle_from_address(slv_addr));
+
     tx_buffer[0] = reg;
 
+    sccb_shadow_transaction();
     esp_err_t ret = i2c_master_transmit_receive(dev_handle, tx_buffer, 1, rx_buffer, 1, TIMEOUT_MS);
 
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "SCCB_Read Failed addr:0x%02x, reg:0x%02x, data:0x%02x, ret:%d", slv_addr, reg, rx_buffer[0], ret);
     }
+    sccb_shadow_update(slv_addr, reg, rx_buffer[0], ret == ESP_OK);
 
     return rx_buffer[0];
 }
 
 int SCCB_Write(uint8_t slv_addr, uint8_t reg, uint8_t data)
 {
+    if (!sccb_shadow_write_needed(slv_addr, reg, data))
+    {
+        return 0;
+    }
+
     i2c_master_dev_handle_t dev_handle = *(get_handle_from_address(slv_addr));
 
     uint8_t tx_buffer[2];
     tx_buffer[0] = reg;
     tx_buffer[1] = data;
 
+    sccb_shadow_transaction();
     esp_err_t ret = i2c_master_transmit(dev_handle, tx_buffer, 2, TIMEOUT_MS);
 
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "SCCB_Write Failed addr:0x%02x, reg:0x%02x, data:0x%02x, ret:%d", slv_addr, reg, data, ret);
     }
+    sccb_shadow_update(slv_addr, reg, data, ret == ESP_OK);
 
     return ret == ESP_OK ? 0 : -1;
 }
 
 uint8_t SCCB_Read16(uint8_t slv_addr, uint16_t reg)
 {
-    i2c_master_dev_handle_t dev_handle = *(get_handle_from_address(slv_addr));
-
     uint8_t rx_buffer[1];
 
+    if (sccb_shadow_read(slv_addr, reg, &rx_buffer[0]))
+    {
+        return rx_buffer[0];
+    }
+
+    i2c_master_dev_handle_t dev_handle = *(get_handle_from_address(slv_addr));
+
     uint16_t reg_htons = LITTLETOBIG(reg);
     uint8_t *reg_u8 = (uint8_t *)&reg_htons;
 
+    sccb_shadow_transaction();
     esp_err_t ret = i2c_master_transmit_receive(dev_handle, reg_u8, 2, rx_buffer, 1, TIMEOUT_MS);
 
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "W [%04x]=%02x fail\n", reg, rx_buffer[0]);
     }
+    sccb_shadow_update(slv_addr, reg, rx_buffer[0], ret == ESP_OK);
 
     return rx_buffer[0];
 }
 
 int SCCB_Write16(uint8_t slv_addr, uint16_t reg, uint8_t data)
 {
+    if (!sccb_shadow_write_needed(slv_addr, reg, data))
+    {
+        return 0;
+    }
+
     i2c_master_dev_handle_t dev_handle = *(get_handle_from_address(slv_addr));
 
     uint8_t tx_buffer[3];
@@ -285,17 +314,20 @@ int SCCB_Write16(uint8_t slv_addr, uint16_t reg, uint8_t data)
     tx_buffer[1] = reg & 0x00ff;
     tx_buffer[2] = data;
 
+    sccb_shadow_transaction();
     esp_err_t ret = i2c_master_transmit(dev_handle, tx_buffer, 3, TIMEOUT_MS);
 
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "W [%04x]=%02x fail\n", reg, data);
     }
+    sccb_shadow_update(slv_addr, reg, data, ret == ESP_OK);
     return ret == ESP_OK ? 0 : -1;
 }
 
 uint16_t SCCB_Read_Addr16_Val16(uint8_t slv_addr, uint16_t reg)
 {
+    sccb_shadow_bypass(slv_addr, reg, 2, false);
     i2c_master_dev_handle_t dev_handle = *(get_handle_from_address(slv_addr));
 
     uint8_t rx_buffer[2];
@@ -303,6 +335,7 @@ uint16_t SCCB_Read_Addr16_Val16(uint8_t slv_addr, uint16_t reg)
     uint16_t reg_htons = LITTLETOBIG(reg);
     uint8_t *reg_u8 = (uint8_t *)&reg_htons;
 
+    sccb_shadow_transaction();
     esp_err_t ret = i2c_master_transmit_receive(dev_handle, reg_u8, 2, rx_buffer, 2, TIMEOUT_MS);
     uint16_t data = ((uint16_t)rx_buffer[0] << 8) | (uint16_t)rx_buffer[1];
 
@@ -316,6 +349,7 @@ uint16_t SCCB_Read_Addr16_Val16(uint8_t slv_addr, uint16_t reg)
 
 int SCCB_Write_Addr16_Val16(uint8_t slv_addr, uint16_t reg, uint16_t data)
 {
+    sccb_shadow_bypass(slv_addr, reg, 2, true);
     i2c_master_dev_handle_t dev_handle = *(get_handle_from_address(slv_addr));
 
     uint8_t tx_buffer[4];
@@ -324,6 +358,7 @@ int SCCB_Write_Addr16_Val16(uint8_t slv_addr, uint16_t reg, uint16_t data)
     tx_buffer[2] = data >> 8;
     tx_buffer[3] = data & 0x00ff;
 
+    sccb_shadow_transaction();
     esp_err_t ret = i2c_master_transmit(dev_handle, tx_buffer, 4, TIMEOUT_MS);
 
     if (ret != ESP_OK)
@@ -332,3 +367,83 @@ int SCCB_Write_Addr16_Val16(uint8_t slv_addr, uint16_t reg, uint16_t data)
     }
     return ret == ESP_OK ? 0 : -1;
 }
+
+/*
+ The i2c_master API cannot chain independent transactions into one call, so
+ without auto-increment every pair is still its own transfer. Unchanged values
+ are skipped through the shadow and consecutive registers are merged into one
+ transfer when the sensor supports it.
+*/
+static int sccb_write_batch(uint8_t slv_addr, const uint8_t (*regs8)[2], const uint16_t (*regs16)[2], size_t count, uint8_t flags)
+{
+    i2c_master_dev_handle_t *handle = get_handle_from_address(slv_addr);
+    if (handle == NULL)
+    {
+        return -1;
+    }
+
+    uint8_t tx_buffer[2 + SCCB_BURST_MAX];
+    size_t i = 0;
+    while (i < count)
+    {
+        size_t len = 0;
+        uint16_t next_reg = 0;
+        while (i < count && len < SCCB_BURST_MAX)
+        {
+            uint16_t reg = regs16 ? regs16[i][0] : regs8[i][0];
+            uint8_t data = regs16 ? regs16[i][1] : regs8[i][1];
+            if (len && reg != next_reg)
+            {
+                break;
+            }
+            i++;
+            if (!sccb_shadow_write_needed(slv_addr, reg, data))
+            {
+                if (len)
+                {
+                    break;
+                }
+                continue;
+            }
+            sccb_shadow_update(slv_addr, reg, data, true);
+            if (len == 0)
+            {
+                if (flags & SCCB_BATCH_ADDR16)
+                {
+                    tx_buffer[len++] = reg >> 8;
+                }
+                tx_buffer[len++] = reg & 0x00ff;
+            }
+            tx_buffer[len++] = data;
+            next_reg = reg + 1;
+            if (!(flags & SCCB_BATCH_AUTO_INC))
+            {
+                break;
+            }
+        }
+        if (len == 0)
+        {
+            continue;
+        }
+
+        sccb_shadow_transaction();
+        esp_err_t ret = i2c_master_transmit(*handle, tx_buffer, len, TIMEOUT_MS);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "SCCB batch write failed addr:0x%02x, ret:%d", slv_addr, ret);
+            SCCB_Shadow_Invalidate(slv_addr);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int SCCB_Write_Regs(uint8_t slv_addr, const uint8_t (*regs)[2], size_t count)
+{
+    return sccb_write_batch(slv_addr, regs, NULL, count, 0);
+}
+
+int SCCB_Write_Regs16(uint8_t slv_addr, const uint16_t (*regs)[2], size_t count, uint8_t flags)
+{
+    return sccb_write_batch(slv_addr, NULL, regs, count, flags);
+}
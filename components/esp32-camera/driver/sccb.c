@@ -12,6 +12,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include "sccb.h"
+#include "sccb_shadow.h"
 #include "sensor.h"
 #include <stdio.h>
 #include "sdkconfig.h"
@@ -38,6 +39,7 @@ static const char* TAG = "sccb";
 #define ACK_CHECK_DIS           0x0                   /*!< I2C master will not check ack from slave */
 #define ACK_VAL                 0x0                   /*!< I2C ack value */
 #define NACK_VAL                0x1                   /*!< I2C nack value */
+#define SCCB_BATCH_MAX          32                    /*!< Register writes queued in one command link */
 #if CONFIG_SCCB_HARDWARE_I2C_PORT1
 const int SCCB_I2C_PORT_DEFAULT = 1;
 #else
@@ -86,6 +88,7 @@ int SCCB_Use_Port(int i2c_num) { // sccb use an already initialized I2C port
 
 int SCCB_Deinit(void)
 {
+    sccb_shadow_deinit();
     if (!sccb_owns_i2c_port) {
         return ESP_OK;
     }
@@ -108,6 +111,10 @@ uint8_t SCCB_Read(uint8_t slv_addr, uint8_t reg)
 {
     uint8_t data=0;
     esp_err_t ret = ESP_FAIL;
+    if (sccb_shadow_read(slv_addr, reg, &data)) {
+        return data;
+    }
+    sccb_shadow_transaction();
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, ( slv_addr << 1 ) | WRITE_BIT, ACK_CHECK_EN);
@@ -126,12 +133,17 @@ uint8_t SCCB_Read(uint8_t slv_addr, uint8_t reg)
     if(ret != ESP_OK) {
         ESP_LOGE(TAG, "SCCB_Read Failed addr:0x%02x, reg:0x%02x, data:0x%02x, ret:%d", slv_addr, reg, data, ret);
     }
+    sccb_shadow_update(slv_addr, reg, data, ret == ESP_OK);
     return data;
 }
 
 int SCCB_Write(uint8_t slv_addr, uint8_t reg, uint8_t data)
 {
     esp_err_t ret = ESP_FAIL;
+    if (!sccb_shadow_write_needed(slv_addr, reg, data)) {
+        return 0;
+    }
+    sccb_shadow_transaction();
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, ( slv_addr << 1 ) | WRITE_BIT, ACK_CHECK_EN);
@@ -143,6 +155,7 @@ int SCCB_Write(uint8_t slv_addr, uint8_t reg, uint8_t data)
     if(ret != ESP_OK) {
         ESP_LOGE(TAG, "SCCB_Write Failed addr:0x%02x, reg:0x%02x, data:0x%02x, ret:%d", slv_addr, reg, data, ret);
     }
+    sccb_shadow_update(slv_addr, reg, data, ret == ESP_OK);
     return ret == ESP_OK ? 0 : -1;
 }
 
@@ -150,8 +163,12 @@ uint8_t SCCB_Read16(uint8_t slv_addr, uint16_t reg)
 {
     uint8_t data=0;
     esp_err_t ret = ESP_FAIL;
+    if (sccb_shadow_read(slv_addr, reg, &data)) {
+        return data;
+    }
     uint16_t reg_htons = LITTLETOBIG(reg);
     uint8_t *reg_u8 = (uint8_t *)&reg_htons;
+    sccb_shadow_transaction();
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, ( slv_addr << 1 ) | WRITE_BIT, ACK_CHECK_EN);
@@ -171,6 +188,7 @@ uint8_t SCCB_Read16(uint8_t slv_addr, uint16_t reg)
     if(ret != ESP_OK) {
         ESP_LOGE(TAG, "W [%04x]=%02x fail\n", reg, data);
     }
+    sccb_shadow_update(slv_addr, reg, data, ret == ESP_OK);
     return data;
 }
 
@@ -178,8 +196,12 @@ int SCCB_Write16(uint8_t slv_addr, uint16_t reg, uint8_t data)
 {
     static uint16_t i = 0;
     esp_err_t ret = ESP_FAIL;
+    if (!sccb_shadow_write_needed(slv_addr, reg, data)) {
+        return 0;
+    }
     uint16_t reg_htons = LITTLETOBIG(reg);
     uint8_t *reg_u8 = (uint8_t *)&reg_htons;
+    sccb_shadow_transaction();
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, ( slv_addr << 1 ) | WRITE_BIT, ACK_CHECK_EN);
@@ -192,6 +214,7 @@ int SCCB_Write16(uint8_t slv_addr, uint16_t reg, uint8_t data)
     if(ret != ESP_OK) {
         ESP_LOGE(TAG, "W [%04x]=%02x %d fail\n", reg, data, i++);
     }
+    sccb_shadow_update(slv_addr, reg, data, ret == ESP_OK);
     return ret == ESP_OK ? 0 : -1;
 }
 
@@ -200,8 +223,10 @@ uint16_t SCCB_Read_Addr16_Val16(uint8_t slv_addr, uint16_t reg)
     uint16_t data = 0;
     uint8_t *data_u8 = (uint8_t *)&data;
     esp_err_t ret = ESP_FAIL;
+    sccb_shadow_bypass(slv_addr, reg, 2, false);
     uint16_t reg_htons = LITTLETOBIG(reg);
     uint8_t *reg_u8 = (uint8_t *)&reg_htons;
+    sccb_shadow_transaction();
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, ( slv_addr << 1 ) | WRITE_BIT, ACK_CHECK_EN);
@@ -229,10 +254,12 @@ uint16_t SCCB_Read_Addr16_Val16(uint8_t slv_addr, uint16_t reg)
 int SCCB_Write_Addr16_Val16(uint8_t slv_addr, uint16_t reg, uint16_t data)
 {
     esp_err_t ret = ESP_FAIL;
+    sccb_shadow_bypass(slv_addr, reg, 2, true);
     uint16_t reg_htons = LITTLETOBIG(reg);
     uint8_t *reg_u8 = (uint8_t *)&reg_htons;
     uint16_t data_htons = LITTLETOBIG(data);
     uint8_t *data_u8 = (uint8_t *)&data_htons;
+    sccb_shadow_transaction();
     i2c_cmd_handle_t cmd = i2c_cmd_link_create();
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, ( slv_addr << 1 ) | WRITE_BIT, ACK_CHECK_EN);
@@ -248,3 +275,62 @@ int SCCB_Write_Addr16_Val16(uint8_t slv_addr, uint16_t reg, uint16_t data)
     }
     return ret == ESP_OK ? 0 : -1;
 }
+
+static int sccb_write_batch(uint8_t slv_addr, const uint8_t (*regs8)[2], const uint16_t (*regs16)[2], size_t count, uint8_t flags)
+{
+    esp_err_t ret = ESP_OK;
+    size_t i = 0;
+    while (i < count) {
+        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+        bool open = false;
+        uint16_t next_reg = 0;
+        int queued = 0;
+        while (i < count && queued < SCCB_BATCH_MAX) {
+            uint16_t reg = regs16 ? regs16[i][0] : regs8[i][0];
+            uint8_t data = regs16 ? regs16[i][1] : regs8[i][1];
+            i++;
+            if (!sccb_shadow_write_needed(slv_addr, reg, data)) {
+                continue;
+            }
+            // assume success so that bank selects inside the batch are tracked, undone below on error
+            sccb_shadow_update(slv_addr, reg, data, true);
+            if (!open || !(flags & SCCB_BATCH_AUTO_INC) || reg != next_reg) {
+                if (open) {
+                    i2c_master_stop(cmd);
+                }
+                sccb_shadow_transaction();
+                i2c_master_start(cmd);
+                i2c_master_write_byte(cmd, ( slv_addr << 1 ) | WRITE_BIT, ACK_CHECK_EN);
+                if (flags & SCCB_BATCH_ADDR16) {
+                    i2c_master_write_byte(cmd, reg >> 8, ACK_CHECK_EN);
+                }
+                i2c_master_write_byte(cmd, reg & 0xFF, ACK_CHECK_EN);
+                open = true;
+            }
+            i2c_master_write_byte(cmd, data, ACK_CHECK_EN);
+            next_reg = reg + 1;
+            queued++;
+        }
+        if (open) {
+            i2c_master_stop(cmd);
+            ret = i2c_master_cmd_begin(sccb_i2c_port, cmd, 1000 / portTICK_RATE_MS);
+        }
+        i2c_cmd_link_delete(cmd);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "SCCB batch write failed addr:0x%02x, ret:%d", slv_addr, ret);
+            SCCB_Shadow_Invalidate(slv_addr);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int SCCB_Write_Regs(uint8_t slv_addr, const uint8_t (*regs)[2], size_t count)
+{
+    return sccb_write_batch(slv_addr, regs, NULL, count, 0);
+}
+
+int SCCB_Write_Regs16(uint8_t slv_addr, const uint16_t (*regs)[2], size_t count, uint8_t flags)
+{
+    return sccb_write_batch(slv_addr, NULL, regs, count, flags);
+}
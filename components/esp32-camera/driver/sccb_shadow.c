@@ -0,0 +1,285 @@
+/*
+ * SCCB register shadow.
+ *
+ * Keeps a small direct-mapped copy of the registers written to or read from
+ * each sensor, so that read-modify-write helpers and repeated setting tables
+ * do not have to go to the (100 kHz) bus for values that are already known.
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "sccb.h"
+#include "sccb_shadow.h"
+#include "sdkconfig.h"
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#else
+#include "esp_log.h"
+static const char *TAG = "sccb-shadow";
+#endif
+
+#ifndef CONFIG_SCCB_REG_SHADOW_ENTRIES
+#define CONFIG_SCCB_REG_SHADOW_ENTRIES 512
+#endif
+
+#define SHADOW_MAX_DEVICES      2
+#define SHADOW_ENTRIES          CONFIG_SCCB_REG_SHADOW_ENTRIES
+
+// entry layout: valid[31] | bank[30:24] | reg[23:8] | value[7:0]
+#define SHADOW_VALID            0x80000000U
+#define SHADOW_TAG_MASK         0xFFFFFF00U
+#define SHADOW_BANK_MAX         0x3F
+#define SHADOW_BANK_UNBANKED    0x7F
+#define SHADOW_BANK_UNKNOWN     0xFFFF
+
+typedef struct {
+    uint8_t slv_addr;
+    int bank_reg;
+    uint8_t bank_mask;
+    uint16_t bank;
+    const sccb_shadow_range_t *ranges;
+    size_t range_count;
+    uint32_t entries[SHADOW_ENTRIES];
+} sccb_shadow_t;
+
+static sccb_shadow_t *s_shadows[SHADOW_MAX_DEVICES];
+static sccb_stats_t s_stats;
+static portMUX_TYPE s_shadow_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static sccb_shadow_t *find_shadow(uint8_t slv_addr)
+{
+    for (int i = 0; i < SHADOW_MAX_DEVICES; i++) {
+        if (s_shadows[i] && s_shadows[i]->slv_addr == slv_addr) {
+            return s_shadows[i];
+        }
+    }
+    return NULL;
+}
+
+static uint8_t range_flags(const sccb_shadow_t *sh, uint16_t reg)
+{
+    uint8_t flags = 0;
+    for (size_t i = 0; i < sh->range_count; i++) {
+        const sccb_shadow_range_t *r = &sh->ranges[i];
+        if (reg >= r->first && reg <= r->last
+            && (r->bank == SCCB_SHADOW_ANY_BANK || r->bank == sh->bank)) {
+            flags |= r->flags;
+        }
+    }
+    return flags;
+}
+
+/*
+ * Resolve a register to its shadow slot and tag. Returns false for registers
+ * that must always go to the bus: volatile ones, the bank select register
+ * itself, and banked registers while the current bank is not known.
+ */
+static bool shadow_slot(const sccb_shadow_t *sh, uint16_t reg, uint32_t **slot, uint32_t *tag)
+{
+    if (sh->bank_reg == reg) {
+        return false;
+    }
+    uint8_t flags = range_flags(sh, reg);
+    if (flags & SCCB_SHADOW_VOLATILE) {
+        return false;
+    }
+    uint32_t bank = 0;
+    if (flags & SCCB_SHADOW_UNBANKED) {
+        bank = SHADOW_BANK_UNBANKED;
+    } else if (sh->bank_reg != SCCB_SHADOW_NO_BANK) {
+        if (sh->bank == SHADOW_BANK_UNKNOWN) {
+            return false;
+        }
+        bank = sh->bank;
+    }
+    *tag = SHADOW_VALID | (bank << 24) | ((uint32_t)reg << 8);
+    *slot = (uint32_t *)&sh->entries[(reg ^ (reg >> 9) ^ (bank << 8)) % SHADOW_ENTRIES];
+    return true;
+}
+
+bool sccb_shadow_read(uint8_t slv_addr, uint16_t reg, uint8_t *data)
+{
+    bool hit = false;
+    portENTER_CRITICAL(&s_shadow_lock);
+    sccb_shadow_t *sh = find_shadow(slv_addr);
+    uint32_t *slot, tag;
+    if (sh && shadow_slot(sh, reg, &slot, &tag) && (*slot & SHADOW_TAG_MASK) == tag) {
+        *data = *slot & 0xFF;
+        hit = true;
+    }
+    if (hit) {
+        s_stats.read_hits++;
+    } else {
+        s_stats.reads++;
+    }
+    portEXIT_CRITICAL(&s_shadow_lock);
+    return hit;
+}
+
+bool sccb_shadow_write_needed(uint8_t slv_addr, uint16_t reg, uint8_t data)
+{
+    bool needed = true;
+    portENTER_CRITICAL(&s_shadow_lock);
+    sccb_shadow_t *sh = find_shadow(slv_addr);
+    uint32_t *slot, tag;
+    if (sh) {
+        if (sh->bank_reg == reg) {
+            // a bank select is redundant only if it carries no reset/restart bits
+            needed = (data & ~sh->bank_mask) || sh->bank != (data & sh->bank_mask);
+        } else if (shadow_slot(sh, reg, &slot, &tag)) {
+            needed = *slot != (tag | data);
+        }
+    }
+    if (needed) {
+        s_stats.writes++;
+    } else {
+        s_stats.write_skips++;
+    }
+    portEXIT_CRITICAL(&s_shadow_lock);
+    return needed;
+}
+
+void sccb_shadow_update(uint8_t slv_addr, uint16_t reg, uint8_t data, bool ok)
+{
+    portENTER_CRITICAL(&s_shadow_lock);
+    sccb_shadow_t *sh = find_shadow(slv_addr);
+    uint32_t *slot, tag;
+    if (sh) {
+        if (sh->bank_reg == reg) {
+            if (!ok) {
+                sh->bank = SHADOW_BANK_UNKNOWN;
+            } else if (data & ~sh->bank_mask) {
+                // software reset through the bank register: everything is back to defaults
+                memset(sh->entries, 0, sizeof(sh->entries));
+                sh->bank = SHADOW_BANK_UNKNOWN;
+            } else {
+                sh->bank = data & sh->bank_mask;
+            }
+        } else if (shadow_slot(sh, reg, &slot, &tag)) {
+            if (ok) {
+                *slot = tag | data;
+            } else if ((*slot & SHADOW_TAG_MASK) == tag) {
+                *slot = 0;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&s_shadow_lock);
+}
+
+void sccb_shadow_bypass(uint8_t slv_addr, uint16_t reg, uint8_t len, bool write)
+{
+    portENTER_CRITICAL(&s_shadow_lock);
+    sccb_shadow_t *sh = find_shadow(slv_addr);
+    uint32_t *slot, tag;
+    for (uint8_t i = 0; sh && write && i < len; i++) {
+        if (shadow_slot(sh, reg + i, &slot, &tag) && (*slot & SHADOW_TAG_MASK) == tag) {
+            *slot = 0;
+        }
+    }
+    if (write) {
+        s_stats.writes++;
+    } else {
+        s_stats.reads++;
+    }
+    portEXIT_CRITICAL(&s_shadow_lock);
+}
+
+void sccb_shadow_transaction(void)
+{
+    portENTER_CRITICAL(&s_shadow_lock);
+    s_stats.transactions++;
+    portEXIT_CRITICAL(&s_shadow_lock);
+}
+
+void sccb_shadow_deinit(void)
+{
+    for (int i = 0; i < SHADOW_MAX_DEVICES; i++) {
+        portENTER_CRITICAL(&s_shadow_lock);
+        sccb_shadow_t *sh = s_shadows[i];
+        s_shadows[i] = NULL;
+        portEXIT_CRITICAL(&s_shadow_lock);
+        free(sh);
+    }
+}
+
+int SCCB_Shadow_Enable(uint8_t slv_addr, const sccb_shadow_config_t *config)
+{
+#if CONFIG_SCCB_REG_SHADOW
+    if (config == NULL || config->bank_mask > SHADOW_BANK_MAX) {
+        return -1;
+    }
+    SCCB_Shadow_Disable(slv_addr);
+    sccb_shadow_t *sh = calloc(1, sizeof(sccb_shadow_t));
+    if (sh == NULL) {
+        ESP_LOGW(TAG, "No memory for the register shadow of 0x%02x", slv_addr);
+        return -1;
+    }
+    sh->slv_addr = slv_addr;
+    sh->bank_reg = config->bank_reg;
+    sh->bank_mask = config->bank_mask;
+    sh->bank = config->bank_reg == SCCB_SHADOW_NO_BANK ? 0 : SHADOW_BANK_UNKNOWN;
+    sh->ranges = config->ranges;
+    sh->range_count = config->range_count;
+
+    portENTER_CRITICAL(&s_shadow_lock);
+    for (int i = 0; i < SHADOW_MAX_DEVICES; i++) {
+        if (s_shadows[i] == NULL) {
+            s_shadows[i] = sh;
+            sh = NULL;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_shadow_lock);
+    if (sh) {
+        ESP_LOGW(TAG, "No free register shadow slot for 0x%02x", slv_addr);
+        free(sh);
+        return -1;
+    }
+    ESP_LOGD(TAG, "Register shadow enabled for 0x%02x", slv_addr);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void SCCB_Shadow_Disable(uint8_t slv_addr)
+{
+    sccb_shadow_t *sh = NULL;
+    portENTER_CRITICAL(&s_shadow_lock);
+    for (int i = 0; i < SHADOW_MAX_DEVICES; i++) {
+        if (s_shadows[i] && s_shadows[i]->slv_addr == slv_addr) {
+            sh = s_shadows[i];
+            s_shadows[i] = NULL;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_shadow_lock);
+    free(sh);
+}
+
+void SCCB_Shadow_Invalidate(uint8_t slv_addr)
+{
+    portENTER_CRITICAL(&s_shadow_lock);
+    sccb_shadow_t *sh = find_shadow(slv_addr);
+    if (sh) {
+        memset(sh->entries, 0, sizeof(sh->entries));
+        sh->bank = sh->bank_reg == SCCB_SHADOW_NO_BANK ? 0 : SHADOW_BANK_UNKNOWN;
+    }
+    portEXIT_CRITICAL(&s_shadow_lock);
+}
+
+void SCCB_Get_Stats(sccb_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_shadow_lock);
+    *stats = s_stats;
+    portEXIT_CRITICAL(&s_shadow_lock);
+}
+
+void SCCB_Reset_Stats(void)
+{
+    portENTER_CRITICAL(&s_shadow_lock);
+    memset(&s_stats, 0, sizeof(s_stats));
+    portEXIT_CRITICAL(&s_shadow_lock);
+}
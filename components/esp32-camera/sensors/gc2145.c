@@ -32,6 +32,21 @@ static const char *TAG = "gc2145";
 #define H8(v) ((v)>>8)
 #define L8(v) ((v)&0xff)
 
+// Registers the sensor updates on its own (exposure, gains, AEC/AWB page).
+static const sccb_shadow_range_t shadow_ranges[] = {
+    {SCCB_SHADOW_ANY_BANK, 0xf0, 0xfd, SCCB_SHADOW_UNBANKED},
+    {0, 0x00, P0_EXPOSURE_LOW, SCCB_SHADOW_VOLATILE},
+    {0, 0xb0, 0xb6, SCCB_SHADOW_VOLATILE},
+    {1, 0x00, 0xff, SCCB_SHADOW_VOLATILE},
+};
+
+static const sccb_shadow_config_t shadow_config = {
+    .bank_reg = RESET_RELATED,
+    .bank_mask = 0x07,
+    .ranges = shadow_ranges,
+    .range_count = sizeof(shadow_ranges) / sizeof(shadow_ranges[0]),
+};
+
 //#define REG_DEBUG_ON
 
 static int read_reg(uint8_t slv_addr, const uint16_t reg)
@@ -94,10 +109,21 @@ static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
     while (!ret && regs[i][0] != REGLIST_TAIL) {
         if (regs[i][0] == REG_DLY) {
             vTaskDelay(regs[i][1] / portTICK_PERIOD_MS);
-        } else {
-            ret = write_reg(slv_addr, regs[i][0], regs[i][1]);
+            i++;
+            continue;
+        }
+#ifndef REG_DEBUG_ON
+        // write everything up to the next delay or the end as one batch
+        int n = 0;
+        while (regs[i + n][0] != REGLIST_TAIL && regs[i + n][0] != REG_DLY) {
+            n++;
         }
+        ret = SCCB_Write_Regs16(slv_addr, &regs[i], n, 0);
+        i += n;
+#else
+        ret = write_reg(slv_addr, regs[i][0], regs[i][1]);
         i++;
+#endif
     }
     return ret;
 }
@@ -472,6 +498,7 @@ int esp32_camera_gc2145_init(sensor_t *sensor)
     sensor->set_pll = NULL;
     sensor->set_xclk = NULL;
 
+    SCCB_Shadow_Enable(sensor->slv_addr, &shadow_config);
     ESP_LOGD(TAG, "GC2145 Attached");
     return 0;
 }
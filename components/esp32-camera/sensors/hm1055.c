@@ -114,12 +114,22 @@ static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
         if (regs[i][0] == REG_DLY)
         {
             vTaskDelay(regs[i][1] / portTICK_PERIOD_MS);
+            i++;
+            continue;
         }
-        else
+#ifndef REG_DEBUG_ON
+        // write everything up to the next delay or the end as one batch
+        int n = 0;
+        while (regs[i + n][0] != REGLIST_TAIL && regs[i + n][0] != REG_DLY)
         {
-            ret = write_reg(slv_addr, regs[i][0], regs[i][1]);
+            n++;
         }
+        ret = SCCB_Write_Regs16(slv_addr, &regs[i], n, SCCB_BATCH_ADDR16);
+        i += n;
+#else
+        ret = write_reg(slv_addr, regs[i][0], regs[i][1]);
         i++;
+#endif
     }
     return ret;
 }
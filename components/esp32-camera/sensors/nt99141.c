@@ -111,17 +111,25 @@ static int set_reg_bits(uint8_t slv_addr, uint16_t reg, uint8_t offset, uint8_t
 static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
 {
     int i = 0, ret = 0;
-
     while (!ret && regs[i][0] != REGLIST_TAIL) {
         if (regs[i][0] == REG_DLY) {
             vTaskDelay(regs[i][1] / portTICK_PERIOD_MS);
-        } else {
-            ret = write_reg(slv_addr, regs[i][0], regs[i][1]);
+            i++;
+            continue;
         }
-
+#ifndef REG_DEBUG_ON
+        // write everything up to the next delay or the end as one batch
+        int n = 0;
+        while (regs[i + n][0] != REGLIST_TAIL && regs[i + n][0] != REG_DLY) {
+            n++;
+        }
+        ret = SCCB_Write_Regs16(slv_addr, &regs[i], n, SCCB_BATCH_ADDR16);
+        i += n;
+#else
+        ret = write_reg(slv_addr, regs[i][0], regs[i][1]);
         i++;
+#endif
     }
-
     return ret;
 }
 
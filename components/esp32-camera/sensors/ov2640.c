@@ -25,6 +25,26 @@ static const char* TAG = "ov2640";
 #endif
 
 static volatile ov2640_bank_t reg_bank = BANK_MAX;
+
+// Registers the sensor updates on its own or that are indirect/self-clearing.
+static const sccb_shadow_range_t shadow_ranges[] = {
+    {BANK_SENSOR, GAIN, REG04, SCCB_SHADOW_VOLATILE},       // AGC gain, AWB gains, AEC LSBs
+    {BANK_SENSOR, AEC, AEC, SCCB_SHADOW_VOLATILE},
+    {BANK_SENSOR, COM7, COM7, SCCB_SHADOW_VOLATILE},        // SRST self-clears
+    {BANK_SENSOR, YAVG, YAVG, SCCB_SHADOW_VOLATILE},
+    {BANK_SENSOR, REG45, REG45, SCCB_SHADOW_VOLATILE},
+    {BANK_DSP, BPADDR, BPDATA, SCCB_SHADOW_VOLATILE},       // SDE indirect access, auto-increments
+    {BANK_DSP, RESET, RESET, SCCB_SHADOW_VOLATILE},
+    {BANK_DSP, MC_BIST, P_STATUS, SCCB_SHADOW_VOLATILE},    // microcontroller access and status
+};
+
+static const sccb_shadow_config_t shadow_config = {
+    .bank_reg = BANK_SEL,
+    .bank_mask = 0x01,
+    .ranges = shadow_ranges,
+    .range_count = sizeof(shadow_ranges) / sizeof(shadow_ranges[0]),
+};
+
 static int set_bank(sensor_t *sensor, ov2640_bank_t bank)
 {
     int res = 0;
@@ -38,17 +58,16 @@ static int set_bank(sensor_t *sensor, ov2640_bank_t bank)
 static int write_regs(sensor_t *sensor, const uint8_t (*regs)[2])
 {
     int i=0, res = 0;
+    ov2640_bank_t bank = reg_bank;
     while (regs[i][0]) {
         if (regs[i][0] == BANK_SEL) {
-            res = set_bank(sensor, regs[i][1]);
-        } else {
-            res = SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
-        }
-        if (res) {
-            return res;
+            bank = regs[i][1];
         }
         i++;
     }
+    // the whole table goes out as one batch, repeated bank selects are dropped by the SCCB shadow
+    res = SCCB_Write_Regs(sensor->slv_addr, regs, i);
+    reg_bank = res ? BANK_MAX : bank;
     return res;
 }
 
@@ -102,6 +121,8 @@ static int reset(sensor_t *sensor)
 {
     int ret = 0;
     WRITE_REG_OR_RETURN(BANK_SENSOR, COM7, COM7_SRST);
+    SCCB_Shadow_Invalidate(sensor->slv_addr);
+    reg_bank = BANK_MAX;
     vTaskDelay(10 / portTICK_PERIOD_MS);
     WRITE_REGS_OR_RETURN(ov2640_settings_cif);
     return ret;
@@ -607,6 +628,9 @@ int esp32_camera_ov2640_init(sensor_t *sensor)
     sensor->set_res_raw = set_res_raw;
     sensor->set_pll = _set_pll;
     sensor->set_xclk = set_xclk;
+
+    reg_bank = BANK_MAX;
+    SCCB_Shadow_Enable(sensor->slv_addr, &shadow_config);
     ESP_LOGD(TAG, "OV2640 Attached");
     return 0;
 }
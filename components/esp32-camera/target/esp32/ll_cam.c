@@ -33,6 +33,7 @@ static inline int gpio_ll_get_level(gpio_dev_t *hw, int gpio_num)
 #include "ll_cam.h"
 #include "xclk.h"
 #include "cam_hal.h"
+#include "ll_cam_dma_filter.h"
 
 #if (ESP_IDF_VERSION_MAJOR >= 4) && (ESP_IDF_VERSION_MINOR >= 3)
 #include "esp_rom_gpio.h"
@@ -59,156 +60,8 @@ static const char *TAG = "esp32 ll_cam";
 #define I2S_ISR_ENABLE(i) {I2S0.int_clr.i = 1;I2S0.int_ena.i = 1;}
 #define I2S_ISR_DISABLE(i) {I2S0.int_ena.i = 0;I2S0.int_clr.i = 1;}
 
-typedef union {
-    struct {
-        uint32_t sample2:8;
-        uint32_t unused2:8;
-        uint32_t sample1:8;
-        uint32_t unused1:8;
-    };
-    uint32_t val;
-} dma_elem_t;
-
-typedef enum {
-    /* camera sends byte sequence: s1, s2, s3, s4, ...
-     * fifo receives: 00 s1 00 s2, 00 s2 00 s3, 00 s3 00 s4, ...
-     */
-    SM_0A0B_0B0C = 0,
-    /* camera sends byte sequence: s1, s2, s3, s4, ...
-     * fifo receives: 00 s1 00 s2, 00 s3 00 s4, ...
-     */
-    SM_0A0B_0C0D = 1,
-    /* camera sends byte sequence: s1, s2, s3, s4, ...
-     * fifo receives: 00 s1 00 00, 00 s2 00 00, 00 s3 00 00, ...
-     */
-    SM_0A00_0B00 = 3,
-} i2s_sampling_mode_t;
-
-typedef size_t (*dma_filter_t)(uint8_t* dst, const uint8_t* src, size_t len);
-
 static i2s_sampling_mode_t sampling_mode = SM_0A00_0B00;
 
-static size_t ll_cam_bytes_per_sample(i2s_sampling_mode_t mode)
-{
-    switch(mode) {
-    case SM_0A00_0B00:
-        return 4;
-    case SM_0A0B_0B0C:
-        return 4;
-    case SM_0A0B_0C0D:
-        return 2;
-    default:
-        assert(0 && "invalid sampling mode");
-        return 0;
-    }
-}
-
-static size_t IRAM_ATTR ll_cam_dma_filter_jpeg(uint8_t* dst, const uint8_t* src, size_t len)
-{
-    const dma_elem_t* dma_el = (const dma_elem_t*)src;
-    size_t elements = len / sizeof(dma_elem_t);
-    size_t end = elements / 4;
-    // manually unrolling 4 iterations of the loop here
-    for (size_t i = 0; i < end; ++i) {
-        dst[0] = dma_el[0].sample1;
-        dst[1] = dma_el[1].sample1;
-        dst[2] = dma_el[2].sample1;
-        dst[3] = dma_el[3].sample1;
-        dma_el += 4;
-        dst += 4;
-    }
-    return elements;
-}
-
-static size_t IRAM_ATTR ll_cam_dma_filter_grayscale(uint8_t* dst, const uint8_t* src, size_t len)
-{
-    const dma_elem_t* dma_el = (const dma_elem_t*)src;
-    size_t elements = len / sizeof(dma_elem_t);
-    size_t end = elements / 4;
-    for (size_t i = 0; i < end; ++i) {
-        // manually unrolling 4 iterations of the loop here
-        dst[0] = dma_el[0].sample1;
-        dst[1] = dma_el[1].sample1;
-        dst[2] = dma_el[2].sample1;
-        dst[3] = dma_el[3].sample1;
-        dma_el += 4;
-        dst += 4;
-    }
-    return elements;
-}
-
-static size_t IRAM_ATTR ll_cam_dma_filter_grayscale_highspeed(uint8_t* dst, const uint8_t* src, size_t len)
-{
-    const dma_elem_t* dma_el = (const dma_elem_t*)src;
-    size_t elements = len / sizeof(dma_elem_t);
-    size_t end = elements / 8;
-    for (size_t i = 0; i < end; ++i) {
-        // manually unrolling 4 iterations of the loop here
-        dst[0] = dma_el[0].sample1;
-        dst[1] = dma_el[2].sample1;
-        dst[2] = dma_el[4].sample1;
-        dst[3] = dma_el[6].sample1;
-        dma_el += 8;
-        dst += 4;
-    }
-    // the final sample of a line in SM_0A0B_0B0C sampling mode needs special handling
-    if ((elements & 0x7) != 0) {
-        dst[0] = dma_el[0].sample1;
-        dst[1] = dma_el[2].sample1;
-        elements += 1;
-    }
-    return elements / 2;
-}
-
-static size_t IRAM_ATTR ll_cam_dma_filter_yuyv(uint8_t* dst, const uint8_t* src, size_t len)
-{
-    const dma_elem_t* dma_el = (const dma_elem_t*)src;
-    size_t elements = len / sizeof(dma_elem_t);
-    size_t end = elements / 4;
-    for (size_t i = 0; i < end; ++i) {
-        dst[0] = dma_el[0].sample1;//y0
-        dst[1] = dma_el[0].sample2;//u
-        dst[2] = dma_el[1].sample1;//y1
-        dst[3] = dma_el[1].sample2;//v
-
-        dst[4] = dma_el[2].sample1;//y0
-        dst[5] = dma_el[2].sample2;//u
-        dst[6] = dma_el[3].sample1;//y1
-        dst[7] = dma_el[3].sample2;//v
-        dma_el += 4;
-        dst += 8;
-    }
-    return elements * 2;
-}
-
-static size_t IRAM_ATTR ll_cam_dma_filter_yuyv_highspeed(uint8_t* dst, const uint8_t* src, size_t len)
-{
-    const dma_elem_t* dma_el = (const dma_elem_t*)src;
-    size_t elements = len / sizeof(dma_elem_t);
-    size_t end = elements / 8;
-    for (size_t i = 0; i < end; ++i) {
-        dst[0] = dma_el[0].sample1;//y0
-        dst[1] = dma_el[1].sample1;//u
-        dst[2] = dma_el[2].sample1;//y1
-        dst[3] = dma_el[3].sample1;//v
-
-        dst[4] = dma_el[4].sample1;//y0
-        dst[5] = dma_el[5].sample1;//u
-        dst[6] = dma_el[6].sample1;//y1
-        dst[7] = dma_el[7].sample1;//v
-        dma_el += 8;
-        dst += 8;
-    }
-    if ((elements & 0x7) != 0) {
-        dst[0] = dma_el[0].sample1;//y0
-        dst[1] = dma_el[1].sample1;//u
-        dst[2] = dma_el[2].sample1;//y1
-        dst[3] = dma_el[2].sample2;//v
-        elements += 4;
-    }
-    return elements;
-}
-
 static void IRAM_ATTR ll_cam_vsync_isr(void *arg)
 {
     //DBG_PIN_SET(1);
@@ -404,13 +257,13 @@ uint8_t ll_cam_get_dma_align(cam_obj_t *cam)
     return 0;
 }
 
-static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
-    size_t dma_half_buffer_max = CONFIG_CAMERA_DMA_BUFFER_SIZE_MAX / 2 / cam->dma_bytes_per_item;
+static bool ll_cam_calc_rgb_dma(const cam_obj_t *cam, cam_layout_t *layout){
+    size_t dma_half_buffer_max = CONFIG_CAMERA_DMA_BUFFER_SIZE_MAX / 2 / layout->dma_bytes_per_item;
     size_t dma_buffer_max = 2 * dma_half_buffer_max;
-    size_t node_max = LCD_CAM_DMA_NODE_BUFFER_MAX_SIZE / cam->dma_bytes_per_item;
+    size_t node_max = LCD_CAM_DMA_NODE_BUFFER_MAX_SIZE / layout->dma_bytes_per_item;
 
-    size_t line_width = cam->width * cam->in_bytes_per_pixel;
-    size_t image_size = cam->height * line_width;
+    size_t line_width = layout->width * cam->in_bytes_per_pixel;
+    size_t image_size = layout->height * line_width;
     if (image_size > (4 * 1024 * 1024) || (line_width > dma_half_buffer_max)) {
         ESP_LOGE(TAG, "Resolution too high");
         return 0;
@@ -440,7 +293,7 @@ static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
             if ((i % line_width) == 0) {
                 node_size = i;
                 lines_per_node = node_size / line_width;
-                while((cam->height % lines_per_node) != 0){
+                while((layout->height % lines_per_node) != 0){
                     lines_per_node = lines_per_node - 1;
                     node_size = lines_per_node * line_width;
                 }
@@ -454,7 +307,7 @@ static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
     dma_half_buffer = (dma_half_buffer_max / dma_half_buffer_min) * dma_half_buffer_min;
     // Adjust EOF size so that height will be divisable by the number of lines in each EOF
     lines_per_half_buffer = dma_half_buffer / line_width;
-    while((cam->height % lines_per_half_buffer) != 0){
+    while((layout->height % lines_per_half_buffer) != 0){
         dma_half_buffer = dma_half_buffer - dma_half_buffer_min;
         lines_per_half_buffer = dma_half_buffer / line_width;
     }
@@ -463,32 +316,32 @@ static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
 
     ESP_LOGI(TAG, "node_size: %4u, nodes_per_line: %u, lines_per_node: %u, dma_half_buffer_min: %5u, dma_half_buffer: %5u,"
             "lines_per_half_buffer: %2u, dma_buffer_size: %5u, image_size: %u",
-            (unsigned) (node_size * cam->dma_bytes_per_item), (unsigned) nodes_per_line, (unsigned) lines_per_node,
-            (unsigned) (dma_half_buffer_min * cam->dma_bytes_per_item), (unsigned) (dma_half_buffer * cam->dma_bytes_per_item),
-            (unsigned) (lines_per_half_buffer), (unsigned) (dma_buffer_size * cam->dma_bytes_per_item), (unsigned) image_size);
-
-    cam->dma_buffer_size = dma_buffer_size * cam->dma_bytes_per_item;
-    cam->dma_half_buffer_size = dma_half_buffer * cam->dma_bytes_per_item;
-    cam->dma_node_buffer_size = node_size * cam->dma_bytes_per_item;
-    cam->dma_half_buffer_cnt = cam->dma_buffer_size / cam->dma_half_buffer_size;
+            (unsigned) (node_size * layout->dma_bytes_per_item), (unsigned) nodes_per_line, (unsigned) lines_per_node,
+            (unsigned) (dma_half_buffer_min * layout->dma_bytes_per_item), (unsigned) (dma_half_buffer * layout->dma_bytes_per_item),
+            (unsigned) (lines_per_half_buffer), (unsigned) (dma_buffer_size * layout->dma_bytes_per_item), (unsigned) image_size);
+
+    layout->dma_buffer_size = dma_buffer_size * layout->dma_bytes_per_item;
+    layout->dma_half_buffer_size = dma_half_buffer * layout->dma_bytes_per_item;
+    layout->dma_node_buffer_size = node_size * layout->dma_bytes_per_item;
+    layout->dma_half_buffer_cnt = layout->dma_buffer_size / layout->dma_half_buffer_size;
     return 1;
 }
 
-bool ll_cam_dma_sizes(cam_obj_t *cam)
+bool ll_cam_dma_sizes(const cam_obj_t *cam, cam_layout_t *layout)
 {
-    cam->dma_bytes_per_item = ll_cam_bytes_per_sample(sampling_mode);
+    layout->dma_bytes_per_item = ll_cam_bytes_per_sample(sampling_mode);
     if (cam->jpeg_mode) {
-        cam->dma_half_buffer_cnt = 8;
-        cam->dma_node_buffer_size = 2048;
-        cam->dma_half_buffer_size = cam->dma_node_buffer_size * 2;
-        cam->dma_buffer_size = cam->dma_half_buffer_cnt * cam->dma_half_buffer_size;
+        layout->dma_half_buffer_cnt = 8;
+        layout->dma_node_buffer_size = 2048;
+        layout->dma_half_buffer_size = layout->dma_node_buffer_size * 2;
+        layout->dma_buffer_size = layout->dma_half_buffer_cnt * layout->dma_half_buffer_size;
     } else {
-        return ll_cam_calc_rgb_dma(cam);
+        return ll_cam_calc_rgb_dma(cam, layout);
     }
     return 1;
 }
 
-static dma_filter_t dma_filter = ll_cam_dma_filter_jpeg;
+static dma_filter_t dma_filter; // selected in ll_cam_set_sample_mode()
 
 size_t IRAM_ATTR ll_cam_memcpy(cam_obj_t *cam, uint8_t *out, const uint8_t *in, size_t len)
 {
@@ -504,19 +357,19 @@ esp_err_t ll_cam_set_sample_mode(cam_obj_t *cam, pixformat_t pix_format, uint32_
         if (sensor_pid == OV3660_PID || sensor_pid == OV5640_PID || sensor_pid == NT99141_PID || sensor_pid == SC031GS_PID || sensor_pid == BF20A6_PID || sensor_pid == GC0308_PID) {
             if (xclk_freq_hz > 10000000) {
                 sampling_mode = SM_0A00_0B00;
-                dma_filter = ll_cam_dma_filter_yuyv_highspeed;
+                dma_filter = ll_cam_dma_filters[CAM_DMA_FILTER_YUYV_HIGHSPEED];
             } else {
                 sampling_mode = SM_0A0B_0C0D;
-                dma_filter = ll_cam_dma_filter_yuyv;
+                dma_filter = ll_cam_dma_filters[CAM_DMA_FILTER_YUYV];
             }
             cam->in_bytes_per_pixel = 1;       // camera sends Y8
         } else {
             if (xclk_freq_hz > 10000000 && sensor_pid != OV7725_PID) {
                 sampling_mode = SM_0A00_0B00;
-                dma_filter = ll_cam_dma_filter_grayscale_highspeed;
+                dma_filter = ll_cam_dma_filters[CAM_DMA_FILTER_GRAYSCALE_HIGHSPEED];
             } else {
                 sampling_mode = SM_0A0B_0C0D;
-                dma_filter = ll_cam_dma_filter_grayscale;
+                dma_filter = ll_cam_dma_filters[CAM_DMA_FILTER_GRAYSCALE];
             }
             cam->in_bytes_per_pixel = 2;       // camera sends YU/YV
         }
@@ -528,17 +381,17 @@ esp_err_t ll_cam_set_sample_mode(cam_obj_t *cam, pixformat_t pix_format, uint32_
                 } else {
                     sampling_mode = SM_0A00_0B00;
                 }
-                dma_filter = ll_cam_dma_filter_yuyv_highspeed;
+                dma_filter = ll_cam_dma_filters[CAM_DMA_FILTER_YUYV_HIGHSPEED];
             } else {
                 sampling_mode = SM_0A0B_0C0D;
-                dma_filter = ll_cam_dma_filter_yuyv;
+                dma_filter = ll_cam_dma_filters[CAM_DMA_FILTER_YUYV];
             }
             cam->in_bytes_per_pixel = 2;       // camera sends YU/YV
             cam->fb_bytes_per_pixel = 2;       // frame buffer stores YU/YV/RGB565
     } else if (pix_format == PIXFORMAT_JPEG) {
         cam->in_bytes_per_pixel = 1;
         cam->fb_bytes_per_pixel = 1;
-        dma_filter = ll_cam_dma_filter_jpeg;
+        dma_filter = ll_cam_dma_filters[CAM_DMA_FILTER_JPEG];
         sampling_mode = SM_0A00_0B00;
     } else {
         ESP_LOGE(TAG, "Requested format is not supported");
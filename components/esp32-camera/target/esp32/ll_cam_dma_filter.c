@@ -0,0 +1,178 @@
+// Copyright 2010-2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <assert.h>
+#include "ll_cam_dma_filter.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#endif
+
+/*
+ * The filters read whole DMA elements as words and build four output bytes
+ * per store. Byte order is little endian on the ESP32, so output byte n of a
+ * group is placed at bits 8n..8n+7.
+ */
+#define SAMPLE1_TO_BYTE0(w)     (((w) >> 16) & 0x000000FF)
+#define SAMPLE1_TO_BYTE1(w)     (((w) >> 8)  & 0x0000FF00)
+#define SAMPLE1_TO_BYTE2(w)     ((w)         & 0x00FF0000)
+#define SAMPLE1_TO_BYTE3(w)     (((w) << 8)  & 0xFF000000)
+#define SAMPLE2_TO_BYTE1(w)     (((w) << 8)  & 0x0000FF00)
+#define SAMPLE2_TO_BYTE3(w)     ((w) << 24)
+
+#define IS_WORD_ALIGNED(p)      ((((uintptr_t)(p)) & 3) == 0)
+
+size_t ll_cam_bytes_per_sample(i2s_sampling_mode_t mode)
+{
+    switch(mode) {
+    case SM_0A00_0B00:
+        return 4;
+    case SM_0A0B_0B0C:
+        return 4;
+    case SM_0A0B_0C0D:
+        return 2;
+    default:
+        assert(0 && "invalid sampling mode");
+        return 0;
+    }
+}
+
+// one output byte (sample1) per element, used for JPEG and YU/YV grayscale
+static size_t IRAM_ATTR ll_cam_dma_filter_sample1(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    const uint32_t* w = (const uint32_t*)src;
+    size_t elements = len / sizeof(dma_elem_t);
+    size_t end = elements / 4;
+    if (IS_WORD_ALIGNED(dst)) {
+        uint32_t* out = (uint32_t*)dst;
+        for (size_t i = 0; i < end; ++i) {
+            out[i] = SAMPLE1_TO_BYTE0(w[0]) | SAMPLE1_TO_BYTE1(w[1])
+                   | SAMPLE1_TO_BYTE2(w[2]) | SAMPLE1_TO_BYTE3(w[3]);
+            w += 4;
+        }
+    } else {
+        const dma_elem_t* dma_el = (const dma_elem_t*)src;
+        for (size_t i = 0; i < end; ++i) {
+            dst[0] = dma_el[0].sample1;
+            dst[1] = dma_el[1].sample1;
+            dst[2] = dma_el[2].sample1;
+            dst[3] = dma_el[3].sample1;
+            dma_el += 4;
+            dst += 4;
+        }
+    }
+    return elements;
+}
+
+static size_t IRAM_ATTR ll_cam_dma_filter_grayscale_highspeed(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    const uint32_t* w = (const uint32_t*)src;
+    size_t elements = len / sizeof(dma_elem_t);
+    size_t end = elements / 8;
+    if (IS_WORD_ALIGNED(dst)) {
+        uint32_t* out = (uint32_t*)dst;
+        for (size_t i = 0; i < end; ++i) {
+            out[i] = SAMPLE1_TO_BYTE0(w[0]) | SAMPLE1_TO_BYTE1(w[2])
+                   | SAMPLE1_TO_BYTE2(w[4]) | SAMPLE1_TO_BYTE3(w[6]);
+            w += 8;
+        }
+    } else {
+        for (size_t i = 0; i < end; ++i) {
+            dst[4 * i + 0] = SAMPLE1_TO_BYTE0(w[0]);
+            dst[4 * i + 1] = SAMPLE1_TO_BYTE0(w[2]);
+            dst[4 * i + 2] = SAMPLE1_TO_BYTE0(w[4]);
+            dst[4 * i + 3] = SAMPLE1_TO_BYTE0(w[6]);
+            w += 8;
+        }
+    }
+    dst += 4 * end;
+    // the final sample of a line in SM_0A0B_0B0C sampling mode needs special handling
+    if ((elements & 0x7) != 0) {
+        dst[0] = SAMPLE1_TO_BYTE0(w[0]);
+        dst[1] = SAMPLE1_TO_BYTE0(w[2]);
+        elements += 1;
+    }
+    return elements / 2;
+}
+
+static size_t IRAM_ATTR ll_cam_dma_filter_yuyv(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    const uint32_t* w = (const uint32_t*)src;
+    size_t elements = len / sizeof(dma_elem_t);
+    size_t end = elements / 4;
+    if (IS_WORD_ALIGNED(dst)) {
+        uint32_t* out = (uint32_t*)dst;
+        for (size_t i = 0; i < end; ++i) {
+            out[0] = SAMPLE1_TO_BYTE0(w[0]) | SAMPLE2_TO_BYTE1(w[0])   // y0 u
+                   | SAMPLE1_TO_BYTE2(w[1]) | SAMPLE2_TO_BYTE3(w[1]);  // y1 v
+            out[1] = SAMPLE1_TO_BYTE0(w[2]) | SAMPLE2_TO_BYTE1(w[2])
+                   | SAMPLE1_TO_BYTE2(w[3]) | SAMPLE2_TO_BYTE3(w[3]);
+            w += 4;
+            out += 2;
+        }
+    } else {
+        const dma_elem_t* dma_el = (const dma_elem_t*)src;
+        for (size_t i = 0; i < end; ++i) {
+            for (int j = 0; j < 4; j++) {
+                dst[2 * j] = dma_el[j].sample1;
+                dst[2 * j + 1] = dma_el[j].sample2;
+            }
+            dma_el += 4;
+            dst += 8;
+        }
+    }
+    return elements * 2;
+}
+
+static size_t IRAM_ATTR ll_cam_dma_filter_yuyv_highspeed(uint8_t* dst, const uint8_t* src, size_t len)
+{
+    const uint32_t* w = (const uint32_t*)src;
+    size_t elements = len / sizeof(dma_elem_t);
+    size_t end = elements / 8;
+    if (IS_WORD_ALIGNED(dst)) {
+        uint32_t* out = (uint32_t*)dst;
+        for (size_t i = 0; i < end; ++i) {
+            out[0] = SAMPLE1_TO_BYTE0(w[0]) | SAMPLE1_TO_BYTE1(w[1])
+                   | SAMPLE1_TO_BYTE2(w[2]) | SAMPLE1_TO_BYTE3(w[3]);
+            out[1] = SAMPLE1_TO_BYTE0(w[4]) | SAMPLE1_TO_BYTE1(w[5])
+                   | SAMPLE1_TO_BYTE2(w[6]) | SAMPLE1_TO_BYTE3(w[7]);
+            w += 8;
+            out += 2;
+        }
+    } else {
+        for (size_t i = 0; i < 8 * end; ++i) {
+            dst[i] = SAMPLE1_TO_BYTE0(w[i]);
+        }
+        w += 8 * end;
+    }
+    dst += 8 * end;
+    if ((elements & 0x7) != 0) {
+        dst[0] = SAMPLE1_TO_BYTE0(w[0]);//y0
+        dst[1] = SAMPLE1_TO_BYTE0(w[1]);//u
+        dst[2] = SAMPLE1_TO_BYTE0(w[2]);//y1
+        dst[3] = w[2] & 0xFF;//v
+        elements += 4;
+    }
+    return elements;
+}
+
+const dma_filter_t ll_cam_dma_filters[CAM_DMA_FILTER_MAX] = {
+    [CAM_DMA_FILTER_JPEG] = ll_cam_dma_filter_sample1,
+    [CAM_DMA_FILTER_GRAYSCALE] = ll_cam_dma_filter_sample1,
+    [CAM_DMA_FILTER_GRAYSCALE_HIGHSPEED] = ll_cam_dma_filter_grayscale_highspeed,
+    [CAM_DMA_FILTER_YUYV] = ll_cam_dma_filter_yuyv,
+    [CAM_DMA_FILTER_YUYV_HIGHSPEED] = ll_cam_dma_filter_yuyv_highspeed,
+};
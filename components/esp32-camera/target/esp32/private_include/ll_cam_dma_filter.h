@@ -0,0 +1,88 @@
+// Copyright 2010-2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * ESP32 I2S camera DMA sample filters.
+ *
+ * Each 32-bit DMA element carries up to two samples: sample1 in bits 16..23
+ * and sample2 in bits 0..7 (dma_elem_t layout). The filters pack the samples
+ * of a DMA half buffer into the frame buffer.
+ */
+
+typedef union {
+    struct {
+        uint32_t sample2:8;
+        uint32_t unused2:8;
+        uint32_t sample1:8;
+        uint32_t unused1:8;
+    };
+    uint32_t val;
+} dma_elem_t;
+
+typedef enum {
+    /* camera sends byte sequence: s1, s2, s3, s4, ...
+     * fifo receives: 00 s1 00 s2, 00 s2 00 s3, 00 s3 00 s4, ...
+     */
+    SM_0A0B_0B0C = 0,
+    /* camera sends byte sequence: s1, s2, s3, s4, ...
+     * fifo receives: 00 s1 00 s2, 00 s3 00 s4, ...
+     */
+    SM_0A0B_0C0D = 1,
+    /* camera sends byte sequence: s1, s2, s3, s4, ...
+     * fifo receives: 00 s1 00 00, 00 s2 00 00, 00 s3 00 00, ...
+     */
+    SM_0A00_0B00 = 3,
+} i2s_sampling_mode_t;
+
+typedef enum {
+    CAM_DMA_FILTER_JPEG,
+    CAM_DMA_FILTER_GRAYSCALE,
+    CAM_DMA_FILTER_GRAYSCALE_HIGHSPEED,
+    CAM_DMA_FILTER_YUYV,
+    CAM_DMA_FILTER_YUYV_HIGHSPEED,
+    CAM_DMA_FILTER_MAX,
+} cam_dma_filter_id_t;
+
+/**
+ * @brief Copy the samples of a DMA buffer into a frame buffer
+ *
+ * @param dst Frame buffer position, word-aligned destinations take the fast path
+ * @param src DMA buffer, must be 4-byte aligned
+ * @param len Length of src in bytes
+ * @return Number of bytes produced in dst
+ */
+typedef size_t (*dma_filter_t)(uint8_t* dst, const uint8_t* src, size_t len);
+
+/**
+ * @brief Filters indexed by cam_dma_filter_id_t
+ */
+extern const dma_filter_t ll_cam_dma_filters[CAM_DMA_FILTER_MAX];
+
+/**
+ * @brief Bytes of DMA buffer used per received sample in a sampling mode
+ */
+size_t ll_cam_bytes_per_sample(i2s_sampling_mode_t mode);
+
+#ifdef __cplusplus
+}
+#endif
@@ -452,9 +452,9 @@ uint8_t ll_cam_get_dma_align(cam_obj_t *cam)
     return 16 << GDMA.channel[cam->dma_num].in.conf1.in_ext_mem_bk_size;
 }
 
-static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
-    size_t node_max = LCD_CAM_DMA_NODE_BUFFER_MAX_SIZE / cam->dma_bytes_per_item;
-    size_t line_width = cam->width * cam->in_bytes_per_pixel;
+static bool ll_cam_calc_rgb_dma(const cam_obj_t *cam, cam_layout_t *layout){
+    size_t node_max = LCD_CAM_DMA_NODE_BUFFER_MAX_SIZE / layout->dma_bytes_per_item;
+    size_t line_width = layout->width * cam->in_bytes_per_pixel;
     size_t node_size = node_max;
     size_t nodes_per_line = 1;
     size_t lines_per_node = 1;
@@ -475,7 +475,7 @@ static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
             if ((i % line_width) == 0) {
                 node_size = i;
                 lines_per_node = node_size / line_width;
-                while((cam->height % lines_per_node) != 0){
+                while((layout->height % lines_per_node) != 0){
                     lines_per_node = lines_per_node - 1;
                     node_size = lines_per_node * line_width;
                 }
@@ -485,11 +485,11 @@ static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
     }
 
     ESP_LOGI(TAG, "node_size: %4u, nodes_per_line: %u, lines_per_node: %u",
-            (unsigned) (node_size * cam->dma_bytes_per_item), (unsigned) nodes_per_line, (unsigned) lines_per_node);
+            (unsigned) (node_size * layout->dma_bytes_per_item), (unsigned) nodes_per_line, (unsigned) lines_per_node);
 
-    cam->dma_node_buffer_size = node_size * cam->dma_bytes_per_item;
+    layout->dma_node_buffer_size = node_size * layout->dma_bytes_per_item;
 
-    size_t dma_half_buffer_max = CONFIG_CAMERA_DMA_BUFFER_SIZE_MAX / 2 / cam->dma_bytes_per_item;
+    size_t dma_half_buffer_max = CONFIG_CAMERA_DMA_BUFFER_SIZE_MAX / 2 / layout->dma_bytes_per_item;
     if (line_width > dma_half_buffer_max) {
         ESP_LOGE(TAG, "Resolution too high");
         return 0;
@@ -503,7 +503,7 @@ static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
 
     // Adjust EOF size so that height will be divisable by the number of lines in each EOF
     size_t lines_per_half_buffer = dma_half_buffer / line_width;
-    while((cam->height % lines_per_half_buffer) != 0){
+    while((layout->height % lines_per_half_buffer) != 0){
         dma_half_buffer = dma_half_buffer - dma_half_buffer_min;
         lines_per_half_buffer = dma_half_buffer / line_width;
     }
@@ -511,7 +511,7 @@ static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
     // Calculate DMA size
     size_t dma_buffer_max = 2 * dma_half_buffer_max;
     if (cam->psram_mode) {
-        dma_buffer_max = cam->recv_size / cam->dma_bytes_per_item;
+        dma_buffer_max = layout->recv_size / layout->dma_bytes_per_item;
     }
     size_t dma_buffer_size = dma_buffer_max;
     if (!cam->psram_mode) {
@@ -519,32 +519,32 @@ static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
     }
 
     ESP_LOGI(TAG, "dma_half_buffer_min: %5u, dma_half_buffer: %5u, lines_per_half_buffer: %2u, dma_buffer_size: %5u",
-            (unsigned) (dma_half_buffer_min * cam->dma_bytes_per_item), (unsigned) (dma_half_buffer * cam->dma_bytes_per_item),
-            (unsigned) lines_per_half_buffer, (unsigned) (dma_buffer_size * cam->dma_bytes_per_item));
+            (unsigned) (dma_half_buffer_min * layout->dma_bytes_per_item), (unsigned) (dma_half_buffer * layout->dma_bytes_per_item),
+            (unsigned) lines_per_half_buffer, (unsigned) (dma_buffer_size * layout->dma_bytes_per_item));
 
-    cam->dma_buffer_size = dma_buffer_size * cam->dma_bytes_per_item;
-    cam->dma_half_buffer_size = dma_half_buffer * cam->dma_bytes_per_item;
-    cam->dma_half_buffer_cnt = cam->dma_buffer_size / cam->dma_half_buffer_size;
+    layout->dma_buffer_size = dma_buffer_size * layout->dma_bytes_per_item;
+    layout->dma_half_buffer_size = dma_half_buffer * layout->dma_bytes_per_item;
+    layout->dma_half_buffer_cnt = layout->dma_buffer_size / layout->dma_half_buffer_size;
     return 1;
 }
 
-bool ll_cam_dma_sizes(cam_obj_t *cam)
+bool ll_cam_dma_sizes(const cam_obj_t *cam, cam_layout_t *layout)
 {
-    cam->dma_bytes_per_item = 1;
+    layout->dma_bytes_per_item = 1;
     if (cam->jpeg_mode) {
         if (cam->psram_mode) {
-            cam->dma_buffer_size = cam->recv_size;
-            cam->dma_half_buffer_size = 1024;
-            cam->dma_half_buffer_cnt = cam->dma_buffer_size / cam->dma_half_buffer_size;
-            cam->dma_node_buffer_size = cam->dma_half_buffer_size;
+            layout->dma_buffer_size = layout->recv_size;
+            layout->dma_half_buffer_size = 1024;
+            layout->dma_half_buffer_cnt = layout->dma_buffer_size / layout->dma_half_buffer_size;
+            layout->dma_node_buffer_size = layout->dma_half_buffer_size;
         } else {
-            cam->dma_half_buffer_cnt = 16;
-            cam->dma_buffer_size = cam->dma_half_buffer_cnt * 1024;
-            cam->dma_half_buffer_size = cam->dma_buffer_size / cam->dma_half_buffer_cnt;
-            cam->dma_node_buffer_size = cam->dma_half_buffer_size;
+            layout->dma_half_buffer_cnt = 16;
+            layout->dma_buffer_size = layout->dma_half_buffer_cnt * 1024;
+            layout->dma_half_buffer_size = layout->dma_buffer_size / layout->dma_half_buffer_cnt;
+            layout->dma_node_buffer_size = layout->dma_half_buffer_size;
         }
     } else {
-        return ll_cam_calc_rgb_dma(cam);
+        return ll_cam_calc_rgb_dma(cam, layout);
     }
     return 1;
 }
@@ -30,6 +30,7 @@
 #endif
 #include "esp_log.h"
 #include "esp_camera.h"
+#include "cam_stats.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
@@ -88,9 +89,13 @@ typedef enum {
 typedef struct {
     camera_fb_t fb;
     uint8_t en;
+    bool dram;              // in internal DRAM, see fb_dram_budget
     //for RGB/YUV modes
     lldesc_t *dma;
     size_t fb_offset;
+#if CONFIG_CAMERA_FB_STATS
+    camera_fb_stats_t stats;
+#endif
 } cam_frame_t;
 
 typedef struct {
@@ -108,9 +113,16 @@ typedef struct {
 
     cam_frame_t *frames;
 
-    QueueHandle_t event_queue;
-    QueueHandle_t frame_buffer_queue;
+    QueueHandle_t frame_buffer_queue;   // CAMERA_GRAB_WHEN_EMPTY
+    // CAMERA_GRAB_LATEST: frames go through the latest-frame mailbox, the
+    // semaphore wakes cam_take()
+    bool grab_latest;
+    SemaphoreHandle_t latest_sem;
     TaskHandle_t task_handle;
+    // cam_resize() sets park and waits for park_sem, cam_task then waits
+    // for park to clear
+    volatile bool park;
+    SemaphoreHandle_t park_sem;
     intr_handle_t cam_intr_handle;
 
     uint8_t dma_num;//ESP32-S3
@@ -123,7 +135,12 @@ typedef struct {
     uint8_t vsync_pin;
     uint8_t vsync_invert;
     uint32_t frame_cnt;
+    uint32_t dram_frame_cnt;        // frames[0..dram_frame_cnt) are in internal DRAM
     uint32_t recv_size;
+    // time of the last VSYNC interrupt and their count since the driver
+    // started, kept by the interrupt, cam_task gets them with the events
+    int64_t vsync_us;
+    uint32_t vsync_seq;
     bool swap_data;
     bool psram_mode;
 
@@ -139,10 +156,42 @@ typedef struct {
     uint8_t fb_bytes_per_pixel;
 #endif
     uint32_t fb_size;
+    size_t fb_alloc_size;       // bytes allocated per frame, including DMA alignment
+    size_t dma_buffer_alloc_size;
+    size_t dma_ring_size;       // dma_buffer_size of the config, JPEG copy mode only
+
+    // software JPEG: frames are encoded by cam_task while they are captured
+    uint8_t jpeg_encode_quality;    // 0 when off
+    pixformat_t pix_format;         // sensor output format
+    jpg_stream_t *jpg_stream;
+    uint8_t *jpg_line_buf;          // one DMA half buffer of converted lines
+    size_t jpg_line_buf_size;
+
+#if CONFIG_CAMERA_FB_STATS
+    cam_stats_t stats;              // statistics of the frame being captured
+    bool stats_active;
+#endif
 
     cam_state_t state;
 } cam_obj_t;
 
+// frame and DMA sizes of one frame size and encoder quality, computed before
+// they are applied to cam_obj_t so that a failed resize leaves the object untouched
+typedef struct {
+    uint8_t jpeg_encode_quality;
+    uint16_t width;
+    uint16_t height;
+    uint32_t recv_size;
+    uint32_t fb_size;
+    uint32_t dma_bytes_per_item;
+    uint32_t dma_buffer_size;
+    uint32_t dma_half_buffer_size;
+    uint32_t dma_half_buffer_cnt;
+    uint32_t dma_node_buffer_size;
+    uint32_t dma_node_cnt;
+    uint32_t frame_copy_cnt;
+} cam_layout_t;
+
 
 bool ll_cam_stop(cam_obj_t *cam);
 bool ll_cam_start(cam_obj_t *cam, int frame_pos);
@@ -153,7 +202,7 @@ esp_err_t ll_cam_set_pin(cam_obj_t *cam, const camera_config_t *config);
 esp_err_t ll_cam_init_isr(cam_obj_t *cam);
 void ll_cam_do_vsync(cam_obj_t *cam);
 uint8_t ll_cam_get_dma_align(cam_obj_t *cam);
-bool ll_cam_dma_sizes(cam_obj_t *cam);
+bool ll_cam_dma_sizes(const cam_obj_t *cam, cam_layout_t *layout);
 size_t ll_cam_memcpy(cam_obj_t *cam, uint8_t *out, const uint8_t *in, size_t len);
 esp_err_t ll_cam_set_sample_mode(cam_obj_t *cam, pixformat_t pix_format, uint32_t xclk_freq_hz, uint16_t sensor_pid);
 #if CONFIG_IDF_TARGET_ESP32S3
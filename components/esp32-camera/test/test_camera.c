@@ -1,15 +1,31 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <math.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "unity.h"
 #include <mbedtls/base64.h>
 #include "esp_log.h"
 #include "driver/i2c.h"
 #include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "esp_random.h"
 
 #include "esp_camera.h"
+#include "cam_hal.h"
+#include "sccb.h"
+#include "motion_detect.h"
+#include "tile_stream.h"
+#include "frame_ring.h"
+#include "cam_stats.h"
+#include "cam_mailbox.h"
+#include "cam_event_ring.h"
+#ifdef CONFIG_IDF_TARGET_ESP32
+#include "ll_cam_dma_filter.h"
+#endif
 
 #ifdef CONFIG_IDF_TARGET_ESP32
 #define BOARD_WROVER_KIT 1
@@ -118,6 +134,9 @@ static const char *TAG = "test camera";
 
 typedef void (*decode_func_t)(uint8_t *jpegbuffer, uint32_t size, uint8_t *outbuffer);
 
+// DRAM for the frame buffers of the next init_camera(), see fb_dram_budget
+static size_t test_fb_dram_budget;
+
 static esp_err_t init_camera(uint32_t xclk_freq_hz, pixformat_t pixel_format, framesize_t frame_size, uint8_t fb_count, int sccb_sda_gpio_num, int sccb_port)
 {
     framesize_t size_bak = frame_size;
@@ -153,6 +172,7 @@ static esp_err_t init_camera(uint32_t xclk_freq_hz, pixformat_t pixel_format, fr
 
         .jpeg_quality = 12, //0-63, for OV series camera sensors, lower number means higher quality
         .fb_count = fb_count,       //When jpeg mode is used, if fb_count more than one, the driver will work in continuous mode.
+        .fb_dram_budget = test_fb_dram_budget,
         .grab_mode = CAMERA_GRAB_WHEN_EMPTY
     };
 
@@ -340,11 +360,637 @@ TEST_CASE("Camera driver take JPEG picture test", "[camera]")
     TEST_ASSERT_NOT_NULL(pic);
 }
 
+TEST_CASE("Camera driver frame sequence test", "[camera]")
+{
+    TEST_ESP_OK(init_camera(20000000, PIXFORMAT_JPEG, FRAMESIZE_QVGA, 2, SIOD_GPIO_NUM, -1));
+    vTaskDelay(500 / portTICK_RATE_MS);
+    uint32_t last_seq = 0;
+    int64_t last_ts = 0;
+    for (int i = 0; i < 10; i++) {
+        camera_fb_t *pic = esp_camera_fb_get();
+        TEST_ASSERT_NOT_NULL(pic);
+        int64_t ts = (int64_t)pic->timestamp.tv_sec * 1000000 + pic->timestamp.tv_usec;
+        // stamped at VSYNC, before the frame was read out and handed over
+        TEST_ASSERT_TRUE(ts < esp_timer_get_time());
+        if (i) {
+            TEST_ASSERT_TRUE(pic->seq > last_seq);
+            TEST_ASSERT_TRUE(ts > last_ts);
+        }
+        last_seq = pic->seq;
+        last_ts = ts;
+        esp_camera_fb_return(pic);
+    }
+    TEST_ESP_OK(esp_camera_deinit());
+}
+
+static void frame_ready_cb(void *arg)
+{
+    xTaskNotifyGive((TaskHandle_t)arg);
+}
+
+TEST_CASE("Camera driver frame ready callback test", "[camera]")
+{
+    TEST_ESP_OK(init_camera(20000000, PIXFORMAT_JPEG, FRAMESIZE_QVGA, 2, SIOD_GPIO_NUM, -1));
+    esp_camera_set_frame_cb(frame_ready_cb, xTaskGetCurrentTaskHandle());
+    ulTaskNotifyTake(pdTRUE, 0);
+    int frames = 0;
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_TRUE(ulTaskNotifyTake(pdTRUE, 1000 / portTICK_RATE_MS) > 0);
+        camera_fb_t *pic;
+        while ((pic = esp_camera_fb_get_timeout(0)) != NULL) {
+            esp_camera_fb_return(pic);
+            frames++;
+        }
+    }
+    esp_camera_set_frame_cb(NULL, NULL);
+    TEST_ASSERT_TRUE(frames >= 9);
+    // a timeout of 0 never waits for a frame
+    uint64_t t = esp_timer_get_time();
+    camera_fb_t *pic = esp_camera_fb_get_timeout(0);
+    t = esp_timer_get_time() - t;
+    if (pic) {
+        esp_camera_fb_return(pic);
+    }
+    TEST_ASSERT_TRUE(t < 1000);
+    TEST_ESP_OK(esp_camera_deinit());
+}
+
+#define MAILBOX_FRAMES 3
+#define MAILBOX_ROUNDS 200000
+
+// the frame pool of cam_task: en marks a free frame, seq stands for its data
+typedef struct {
+    cam_mailbox_t mb;
+    volatile uint8_t en[MAILBOX_FRAMES];
+    volatile uint32_t seq[MAILBOX_FRAMES];
+    volatile uint32_t published;
+    volatile bool started;
+    volatile bool stop;
+    uint32_t taken;
+    uint32_t errors;
+    SemaphoreHandle_t done;
+} mailbox_job_t;
+
+static void mailbox_producer_task(void *arg)
+{
+    mailbox_job_t *job = (mailbox_job_t *)arg;
+    while (!job->started) {
+    }
+    for (uint32_t n = 1; n <= MAILBOX_ROUNDS; n++) {
+        int frame = -1;
+        while (frame < 0) {
+            for (int i = 0; i < MAILBOX_FRAMES; i++) {
+                if (job->en[i]) {
+                    frame = i;
+                    break;
+                }
+            }
+        }
+        job->en[frame] = 0;
+        job->seq[frame] = n;
+        int replaced = cam_mailbox_publish(&job->mb, frame);
+        if (replaced != CAM_MAILBOX_EMPTY) {
+            job->en[replaced] = 1;
+        }
+        job->published = n;
+        if (n % 64 == 0) {
+            // interleave with the consumer on single core chips
+            taskYIELD();
+        }
+    }
+    job->stop = true;
+    xSemaphoreGive(job->done);
+    vTaskDelete(NULL);
+}
+
+static void mailbox_consumer_task(void *arg)
+{
+    mailbox_job_t *job = (mailbox_job_t *)arg;
+    uint32_t last = 0;
+    job->started = true;
+    while (!job->stop || cam_mailbox_ready(&job->mb)) {
+        uint32_t newest = job->published;
+        int frame = cam_mailbox_take(&job->mb);
+        if (frame == CAM_MAILBOX_EMPTY) {
+            taskYIELD();
+            continue;
+        }
+        uint32_t seq = job->seq[frame];
+        // newer than anything taken before and at least as new as the
+        // frame published before the take
+        if (seq <= last || seq < newest) {
+            job->errors++;
+        }
+        last = seq;
+        job->taken++;
+        // hold the frame, the producer must not write it meanwhile
+        esp_rom_delay_us(job->taken % 4);
+        if (job->seq[frame] != seq) {
+            job->errors++;
+        }
+        job->en[frame] = 1;
+    }
+    xSemaphoreGive(job->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("Camera driver latest frame mailbox test", "[camera]")
+{
+    mailbox_job_t job = { .done = xSemaphoreCreateCounting(2, 0) };
+    cam_mailbox_init(&job.mb);
+    for (int i = 0; i < MAILBOX_FRAMES; i++) {
+        job.en[i] = 1;
+    }
+    uint64_t t = esp_timer_get_time();
+    xTaskCreatePinnedToCore(mailbox_consumer_task, "mb_take", 2048, &job, 5, NULL, 1 % portNUM_PROCESSORS);
+    xTaskCreatePinnedToCore(mailbox_producer_task, "mb_publish", 2048, &job, 5, NULL, 0);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_TRUE(xSemaphoreTake(job.done, pdMS_TO_TICKS(20000)));
+    }
+    t = esp_timer_get_time() - t;
+    vSemaphoreDelete(job.done);
+    ESP_LOGI(TAG, "%d frames published in %llu us, %u taken", MAILBOX_ROUNDS, t, (unsigned)job.taken);
+    TEST_ASSERT_EQUAL(0, job.errors);
+    TEST_ASSERT_TRUE(job.taken > 0);
+
+    // cost per frame of the capture side: publish here, and for the queue it
+    // replaces a failed send, popping the oldest frame and sending again
+    const int rounds = 10000;
+    QueueHandle_t queue = xQueueCreate(MAILBOX_FRAMES - 1, sizeof(camera_fb_t *));
+    camera_fb_t fb, *p = &fb;
+    while (xQueueSend(queue, &p, 0) == pdTRUE) {
+    }
+    t = esp_timer_get_time();
+    for (int i = 0; i < rounds; i++) {
+        if (xQueueSend(queue, &p, 0) != pdTRUE) {
+            xQueueReceive(queue, &p, 0);
+            xQueueSend(queue, &p, 0);
+        }
+    }
+    uint64_t queue_ns = (esp_timer_get_time() - t) * 1000 / rounds;
+    vQueueDelete(queue);
+    t = esp_timer_get_time();
+    for (int i = 0; i < rounds; i++) {
+        cam_mailbox_publish(&job.mb, i % MAILBOX_FRAMES);
+    }
+    uint64_t mailbox_ns = (esp_timer_get_time() - t) * 1000 / rounds;
+    ESP_LOGI(TAG, "publish latest frame: queue %llu ns, mailbox %llu ns", queue_ns, mailbox_ns);
+    TEST_ASSERT_TRUE(mailbox_ns < queue_ns);
+}
+
+#define EVENT_RING_EVENTS 100000
+
+typedef struct {
+    cam_event_ring_t ring;
+    TaskHandle_t consumer;
+    volatile bool stop;
+    uint32_t pushed;
+    uint32_t received;
+    uint32_t last;          // last event popped
+    uint32_t gaps;          // events missing from the sequence popped
+    uint32_t errors;        // out of order, or torn from the VSYNC stamps pushed with them
+    SemaphoreHandle_t done;
+} event_ring_job_t;
+
+// bursts of events as interrupts would push them, each with a notification
+static void event_ring_producer_task(void *arg)
+{
+    event_ring_job_t *job = (event_ring_job_t *)arg;
+    uint32_t n = 0;
+    while (n < EVENT_RING_EVENTS) {
+        int burst = 1 + esp_random() % 48;
+        for (int i = 0; i < burst && n < EVENT_RING_EVENTS; i++) {
+            n++;
+            cam_ring_event_t event = { .event = n, .vsync_seq = n, .vsync_us = (int64_t)n * 33333 };
+            cam_event_ring_push(&job->ring, &event);
+            xTaskNotifyGive(job->consumer);
+        }
+        esp_rom_delay_us(esp_random() % 50);
+        if (n % 1024 < 48) {
+            taskYIELD();
+        }
+    }
+    job->pushed = n;
+    job->stop = true;
+    xTaskNotifyGive(job->consumer);
+    xSemaphoreGive(job->done);
+    vTaskDelete(NULL);
+}
+
+static void event_ring_consumer_task(void *arg)
+{
+    event_ring_job_t *job = (event_ring_job_t *)arg;
+    uint32_t last = 0;
+    while (true) {
+        cam_ring_event_t event;
+        if (!cam_event_ring_pop(&job->ring, &event)) {
+            if (job->stop && !cam_event_ring_count(&job->ring)) {
+                break;
+            }
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+            continue;
+        }
+        if (event.event <= last || event.vsync_seq != event.event || event.vsync_us != (int64_t)event.event * 33333) {
+            job->errors++;
+        }
+        job->gaps += event.event - last - 1;
+        last = event.event;
+        job->received++;
+        job->last = event.event;
+        // a slow cam_task now and then, the ring fills up
+        if (esp_random() % 64 == 0) {
+            esp_rom_delay_us(200);
+        }
+    }
+    xSemaphoreGive(job->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("Camera driver event ring test", "[camera]")
+{
+    event_ring_job_t job = { .done = xSemaphoreCreateCounting(2, 0) };
+    cam_event_ring_init(&job.ring);
+    xTaskCreatePinnedToCore(event_ring_consumer_task, "ev_pop", 2048, &job, 5, &job.consumer, 1 % portNUM_PROCESSORS);
+    xTaskCreatePinnedToCore(event_ring_producer_task, "ev_push", 2048, &job, 6, NULL, 0);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_TRUE(xSemaphoreTake(job.done, pdMS_TO_TICKS(30000)));
+    }
+    vSemaphoreDelete(job.done);
+    unsigned lost = cam_event_ring_lost(&job.ring);
+    ESP_LOGI(TAG, "%u events pushed, %u received, %u lost", (unsigned)job.pushed, (unsigned)job.received, lost);
+    TEST_ASSERT_EQUAL(0, job.errors);
+    // every event is either popped in order or counted as lost
+    TEST_ASSERT_EQUAL(job.pushed, job.received + lost);
+    TEST_ASSERT_EQUAL(lost, job.gaps + job.pushed - job.last);
+
+    // cost of an interrupt handing an event to cam_task and of taking it
+    const int rounds = 10000;
+    QueueHandle_t queue = xQueueCreate(CAM_EVENT_RING_SIZE, sizeof(cam_ring_event_t));
+    cam_ring_event_t event = { 0 };
+    uint64_t t = esp_timer_get_time();
+    for (int i = 0; i < rounds; i++) {
+        BaseType_t woken = pdFALSE;
+        xQueueSendFromISR(queue, &event, &woken);
+        xQueueReceive(queue, &event, 0);
+    }
+    uint64_t queue_ns = (esp_timer_get_time() - t) * 1000 / rounds;
+    vQueueDelete(queue);
+    cam_event_ring_init(&job.ring);
+    t = esp_timer_get_time();
+    for (int i = 0; i < rounds; i++) {
+        cam_event_ring_push(&job.ring, &event);
+        cam_event_ring_pop(&job.ring, &event);
+    }
+    uint64_t ring_ns = (esp_timer_get_time() - t) * 1000 / rounds;
+    ESP_LOGI(TAG, "event push and pop: queue %llu ns, ring %llu ns", queue_ns, ring_ns);
+    TEST_ASSERT_TRUE(ring_ns < queue_ns);
+}
+
+static uint64_t apply_sensor_settings(sensor_t *s)
+{
+    uint64_t t = esp_timer_get_time();
+    s->set_brightness(s, 1);
+    s->set_contrast(s, 1);
+    s->set_saturation(s, -1);
+    s->set_whitebal(s, 1);
+    s->set_awb_gain(s, 1);
+    s->set_gain_ctrl(s, 1);
+    s->set_exposure_ctrl(s, 1);
+    s->set_hmirror(s, 1);
+    s->set_vflip(s, 1);
+    s->set_bpc(s, 0);
+    s->set_wpc(s, 1);
+    s->set_raw_gma(s, 1);
+    s->set_lenc(s, 1);
+    s->set_dcw(s, 1);
+    s->set_colorbar(s, 0);
+    return esp_timer_get_time() - t;
+}
+
+TEST_CASE("Camera driver register shadow test", "[camera]")
+{
+#if !CONFIG_SCCB_REG_SHADOW
+    TEST_IGNORE_MESSAGE("CONFIG_SCCB_REG_SHADOW is not set");
+#endif
+    TEST_ESP_OK(init_camera(20000000, PIXFORMAT_JPEG, FRAMESIZE_QVGA, 2, SIOD_GPIO_NUM, -1));
+    sensor_t *s = esp_camera_sensor_get();
+    if (s->id.PID != OV2640_PID && s->id.PID != GC2145_PID) {
+        TEST_ESP_OK(esp_camera_deinit());
+        TEST_IGNORE_MESSAGE("the sensor does not enable the register shadow");
+    }
+    sccb_stats_t first, second;
+    SCCB_Reset_Stats();
+    uint64_t t_first = apply_sensor_settings(s);
+    SCCB_Get_Stats(&first);
+    // the second pass writes the same values, only volatile registers should reach the bus
+    SCCB_Reset_Stats();
+    uint64_t t_second = apply_sensor_settings(s);
+    SCCB_Get_Stats(&second);
+    ESP_LOGI(TAG, "Settings applied in %llu us with %u transactions, again in %llu us with %u transactions",
+             t_first, (unsigned)first.transactions, t_second, (unsigned)second.transactions);
+    // cached reads never start a transaction
+    TEST_ASSERT_GREATER_THAN_UINT32(0, second.read_hits);
+    TEST_ASSERT_EQUAL_UINT32(second.reads + second.writes, second.transactions);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, second.write_skips);
+    TEST_ASSERT_LESS_THAN_UINT32(first.transactions, second.transactions);
+
+    // the register tables of a framesize switch go out as batches, writing
+    // the same tables again collapses to the few volatile registers in them
+    TEST_ASSERT_EQUAL(0, s->set_framesize(s, FRAMESIZE_VGA));
+    SCCB_Reset_Stats();
+    TEST_ASSERT_EQUAL(0, s->set_framesize(s, FRAMESIZE_QVGA));
+    SCCB_Get_Stats(&first);
+    SCCB_Reset_Stats();
+    TEST_ASSERT_EQUAL(0, s->set_framesize(s, FRAMESIZE_QVGA));
+    SCCB_Get_Stats(&second);
+    ESP_LOGI(TAG, "Framesize switch with %u transactions, again with %u transactions",
+             (unsigned)first.transactions, (unsigned)second.transactions);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(first.reads + first.writes, first.transactions);
+    TEST_ASSERT_GREATER_THAN_UINT32(second.writes, second.write_skips);
+    TEST_ASSERT_LESS_THAN_UINT32(first.transactions / 4, second.transactions);
+    TEST_ESP_OK(esp_camera_deinit());
+}
+
+TEST_CASE("Camera driver sensor reset and framesize switch time test", "[camera]")
+{
+    TEST_ESP_OK(init_camera(20000000, PIXFORMAT_JPEG, FRAMESIZE_QVGA, 2, SIOD_GPIO_NUM, -1));
+    sensor_t *s = esp_camera_sensor_get();
+    uint64_t t = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(0, s->reset(s));
+    ESP_LOGI(TAG, "Sensor reset %llu ms", (esp_timer_get_time() - t) / 1000);
+    framesize_t sizes[] = {FRAMESIZE_VGA, FRAMESIZE_QVGA, FRAMESIZE_SVGA, FRAMESIZE_QVGA};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        t = esp_timer_get_time();
+        TEST_ASSERT_EQUAL(0, s->set_framesize(s, sizes[i]));
+        ESP_LOGI(TAG, "Switch to %d x %d in %llu ms", resolution[sizes[i]].width, resolution[sizes[i]].height, (esp_timer_get_time() - t) / 1000);
+    }
+    TEST_ESP_OK(esp_camera_deinit());
+}
+
+TEST_CASE("Camera driver in-place framesize change test", "[camera]")
+{
+    TEST_ESP_OK(init_camera(20000000, PIXFORMAT_RGB565, FRAMESIZE_QVGA, 2, SIOD_GPIO_NUM, -1));
+    framesize_t sizes[] = {FRAMESIZE_QQVGA, FRAMESIZE_HQVGA, FRAMESIZE_QVGA};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint64_t t = esp_timer_get_time();
+        TEST_ESP_OK(esp_camera_set_framesize(sizes[i]));
+        ESP_LOGI(TAG, "Resize to %d x %d in %llu ms", resolution[sizes[i]].width, resolution[sizes[i]].height, (esp_timer_get_time() - t) / 1000);
+        camera_fb_t *pic = esp_camera_fb_get();
+        TEST_ASSERT_NOT_NULL(pic);
+        TEST_ASSERT_EQUAL(resolution[sizes[i]].width, pic->width);
+        TEST_ASSERT_EQUAL(resolution[sizes[i]].width * resolution[sizes[i]].height * 2, pic->len);
+        esp_camera_fb_return(pic);
+    }
+    TEST_ESP_OK(esp_camera_deinit());
+}
+
+TEST_CASE("Camera driver runtime PSRAM DMA mode test", "[camera]")
+{
+    bool psram_mode = esp_camera_get_psram_mode();
+    TEST_ESP_OK(init_camera(20000000, PIXFORMAT_RGB565, FRAMESIZE_QVGA, 2, SIOD_GPIO_NUM, -1));
+    for (int i = 0; i < 2; i++) {
+        bool enable = !esp_camera_get_psram_mode();
+        TEST_ESP_OK(esp_camera_set_psram_mode(enable));
+        TEST_ASSERT_EQUAL(enable, esp_camera_get_psram_mode());
+        // the running capture, not just the requested mode
+#if CONFIG_IDF_TARGET_ESP32S2 || CONFIG_IDF_TARGET_ESP32S3
+        TEST_ASSERT_EQUAL(enable, cam_get_active_psram_mode());
+#else
+        TEST_ASSERT_FALSE(cam_get_active_psram_mode());
+#endif
+        TEST_ASSERT_FALSE(cam_psram_mode_changed());
+        camera_fb_t *pic = esp_camera_fb_get();
+        TEST_ASSERT_NOT_NULL(pic);
+        TEST_ASSERT_EQUAL(320 * 240 * 2, pic->len);
+        esp_camera_fb_return(pic);
+    }
+    TEST_ESP_OK(esp_camera_deinit());
+    esp_camera_set_psram_mode(psram_mode);
+}
+
+// time to read a frame buffer word by word, as sending or analysing it does
+static uint32_t read_frame_us(const uint8_t *buf, size_t len)
+{
+    volatile uint32_t sum = 0;
+    uint64_t t = esp_timer_get_time();
+    for (size_t i = 0; i + 4 <= len; i += 4) {
+        sum += *(const uint32_t *)(buf + i);
+    }
+    return esp_timer_get_time() - t;
+}
+
+TEST_CASE("Camera driver tiered frame buffer test", "[camera]")
+{
+    const size_t fb_size = 160 * 120 * 2;
+    // the tiers are only used when cam_task copies the frames from DMA
+    bool psram_mode = esp_camera_get_psram_mode();
+    esp_camera_set_psram_mode(false);
+    test_fb_dram_budget = 2 * fb_size;
+    esp_err_t ret = init_camera(20000000, PIXFORMAT_RGB565, FRAMESIZE_QQVGA, 3, SIOD_GPIO_NUM, -1);
+    test_fb_dram_budget = 0;
+    TEST_ESP_OK(ret);
+
+    camera_fb_pool_stats_t stats;
+    TEST_ESP_OK(esp_camera_get_fb_pool_stats(&stats));
+    TEST_ASSERT_EQUAL(2, stats.dram_slots);
+    TEST_ASSERT_EQUAL(1, stats.psram_slots);
+    for (int i = 0; i < 30; i++) {
+        camera_fb_t *pic = esp_camera_fb_get();
+        TEST_ASSERT_NOT_NULL(pic);
+        TEST_ASSERT_EQUAL(fb_size, pic->len);
+        esp_camera_fb_return(pic);
+    }
+    TEST_ESP_OK(esp_camera_get_fb_pool_stats(&stats));
+    TEST_ESP_OK(esp_camera_deinit());
+    esp_camera_set_psram_mode(psram_mode);
+    ESP_LOGI(TAG, "%u frames captured in DRAM, %u in PSRAM", (unsigned)stats.dram_frames, (unsigned)stats.psram_frames);
+    // a frame is returned before the next one is taken, so one DRAM frame is always free
+    TEST_ASSERT_TRUE(stats.dram_frames > 0);
+    TEST_ASSERT_TRUE(stats.dram_frames >= 4 * stats.psram_frames);
+
+    uint8_t *dram = heap_caps_malloc(fb_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    uint8_t *psram = heap_caps_malloc(fb_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(dram);
+    TEST_ASSERT_NOT_NULL(psram);
+    uint32_t dram_us = read_frame_us(dram, fb_size);
+    uint32_t psram_us = read_frame_us(psram, fb_size);
+    free(dram);
+    free(psram);
+    ESP_LOGI(TAG, "read a %u Byte frame: DRAM %u us, PSRAM %u us", (unsigned)fb_size, (unsigned)dram_us, (unsigned)psram_us);
+    TEST_ASSERT_TRUE(dram_us < psram_us);
+}
+
 TEST_CASE("Camera driver performance test", "[camera]")
 {
     camera_performance_test(20 * 1000000, 16);
 }
 
+#ifdef CONFIG_IDF_TARGET_ESP32
+// byte-wise reference for the DMA filters, as the driver used to copy samples
+static size_t dma_filter_reference(cam_dma_filter_id_t id, uint8_t *dst, const uint8_t *src, size_t len)
+{
+    const dma_elem_t *el = (const dma_elem_t *)src;
+    size_t elements = len / sizeof(dma_elem_t);
+    size_t n = 0;
+    switch (id) {
+    case CAM_DMA_FILTER_JPEG:
+    case CAM_DMA_FILTER_GRAYSCALE:
+        for (size_t i = 0; i < elements / 4 * 4; i++) {
+            dst[n++] = el[i].sample1;
+        }
+        return elements;
+    case CAM_DMA_FILTER_GRAYSCALE_HIGHSPEED:
+        for (size_t i = 0; i < elements / 8 * 8; i += 2) {
+            dst[n++] = el[i].sample1;
+        }
+        if (elements & 0x7) {
+            dst[n++] = el[elements / 8 * 8].sample1;
+            dst[n++] = el[elements / 8 * 8 + 2].sample1;
+            elements += 1;
+        }
+        return elements / 2;
+    case CAM_DMA_FILTER_YUYV:
+        for (size_t i = 0; i < elements / 4 * 4; i++) {
+            dst[n++] = el[i].sample1;
+            dst[n++] = el[i].sample2;
+        }
+        return elements * 2;
+    case CAM_DMA_FILTER_YUYV_HIGHSPEED:
+        for (size_t i = 0; i < elements / 8 * 8; i++) {
+            dst[n++] = el[i].sample1;
+        }
+        if (elements & 0x7) {
+            el += elements / 8 * 8;
+            dst[n++] = el[0].sample1;
+            dst[n++] = el[1].sample1;
+            dst[n++] = el[2].sample1;
+            dst[n++] = el[2].sample2;
+            elements += 4;
+        }
+        return elements;
+    default:
+        return 0;
+    }
+}
+
+TEST_CASE("Camera driver DMA sample filter test", "[camera]")
+{
+    const size_t src_len = 4096;
+    uint32_t *src = heap_caps_malloc(src_len + 64, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    uint8_t *out = heap_caps_malloc(src_len * 2 + 64, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    uint8_t *ref = heap_caps_malloc(src_len * 2 + 64, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    TEST_ASSERT(src && out && ref);
+    for (size_t i = 0; i < (src_len + 64) / 4; i++) {
+        src[i] = i * 2654435761u;
+    }
+
+    const size_t lens[] = {4, 16, 28, 32, 36, 60, 64, 1000, src_len};
+    for (int id = 0; id < CAM_DMA_FILTER_MAX; id++) {
+        for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+            // the unaligned destination exercises the byte path
+            for (size_t offset = 0; offset < 4; offset++) {
+                memset(out, 0xA5, src_len * 2 + 64);
+                memset(ref, 0xA5, src_len * 2 + 64);
+                size_t r = dma_filter_reference(id, ref + offset, (const uint8_t *)src, lens[l]);
+                TEST_ASSERT_EQUAL(r, ll_cam_dma_filters[id](out + offset, (const uint8_t *)src, lens[l]));
+                TEST_ASSERT_EQUAL_HEX8_ARRAY(ref, out, src_len * 2 + 64);
+            }
+        }
+    }
+
+    for (int id = 0; id < CAM_DMA_FILTER_MAX; id++) {
+        uint64_t t = esp_timer_get_time();
+        for (int i = 0; i < 100; i++) {
+            dma_filter_reference(id, ref, (const uint8_t *)src, src_len);
+        }
+        uint64_t ref_us = esp_timer_get_time() - t;
+        t = esp_timer_get_time();
+        for (int i = 0; i < 100; i++) {
+            ll_cam_dma_filters[id](out, (const uint8_t *)src, src_len);
+        }
+        ESP_LOGI(TAG, "DMA filter %d: %llu us per 100 x %u bytes (byte-wise %llu us)", id, esp_timer_get_time() - t, src_len, ref_us);
+    }
+    free(src);
+    free(out);
+    free(ref);
+}
+#endif
+
+
+TEST_CASE("Camera driver frame statistics test", "[camera]")
+{
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    const uint16_t width = 480, height = 320;
+    const size_t len = width * height * 2;
+    const size_t chunk = 4096;
+    uint8_t *raw = heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *fb = heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *dma = heap_caps_malloc(chunk, MALLOC_CAP_DMA);
+    camera_fb_stats_t *fused = calloc(1, sizeof(camera_fb_stats_t));
+    camera_fb_stats_t *separate = calloc(1, sizeof(camera_fb_stats_t));
+    cam_stats_t *st = malloc(sizeof(cam_stats_t));
+    TEST_ASSERT(raw && fb && dma && fused && separate && st);
+    TEST_ASSERT_TRUE(jpg2rgb565(img_start, img_end - img_start, raw, JPEG_IMAGE_SCALE_0));
+
+    // as cam_task does: copy each transfer into the frame buffer and analyse it right away
+    uint64_t t = esp_timer_get_time();
+    TEST_ASSERT_TRUE(cam_stats_begin(st, fused, PIXFORMAT_RGB565, width, height));
+    for (size_t pos = 0; pos < len; pos += chunk) {
+        size_t n = len - pos < chunk ? len - pos : chunk;
+        memcpy(dma, raw + pos, n);
+        memcpy(fb + pos, dma, n);
+        cam_stats_update(st, fb + pos, n);
+    }
+    cam_stats_end(st);
+    uint64_t fused_us = esp_timer_get_time() - t;
+
+    // the same copy followed by a second pass over the frame in PSRAM
+    t = esp_timer_get_time();
+    for (size_t pos = 0; pos < len; pos += chunk) {
+        size_t n = len - pos < chunk ? len - pos : chunk;
+        memcpy(dma, raw + pos, n);
+        memcpy(fb + pos, dma, n);
+    }
+    TEST_ASSERT_TRUE(cam_stats_begin(st, separate, PIXFORMAT_RGB565, width, height));
+    cam_stats_update(st, fb, len);
+    cam_stats_end(st);
+    uint64_t separate_us = esp_timer_get_time() - t;
+    ESP_LOGI(TAG, "copy + statistics: fused %llu us, separate pass %llu us, mean %u, focus %u",
+             fused_us, separate_us, fused->mean, (unsigned)fused->focus);
+    TEST_ASSERT_EQUAL_MEMORY(separate, fused, sizeof(camera_fb_stats_t));
+
+    uint32_t pixels = 0;
+    uint64_t sum = 0;
+    for (int i = 0; i < 256; i++) {
+        pixels += fused->histogram[i];
+        sum += fused->histogram[i] * i;
+    }
+    TEST_ASSERT_EQUAL(width * height, pixels);
+    TEST_ASSERT_EQUAL(sum / pixels, fused->mean);
+    for (int ty = 0; ty < CAMERA_FB_STATS_TILES; ty++) {
+        for (int tx = 0; tx < CAMERA_FB_STATS_TILES; tx++) {
+            TEST_ASSERT_LESS_OR_EQUAL(fused->tiles[ty][tx].mean, fused->tiles[ty][tx].min);
+            TEST_ASSERT_GREATER_OR_EQUAL(fused->tiles[ty][tx].mean, fused->tiles[ty][tx].max);
+        }
+    }
+
+    // a flat frame has no detail
+    memset(fb, 0x84, len);
+    TEST_ASSERT_TRUE(cam_stats_begin(st, separate, PIXFORMAT_YUV422, width, height));
+    cam_stats_update(st, fb, len);
+    cam_stats_end(st);
+    TEST_ASSERT_EQUAL(0, separate->focus);
+    TEST_ASSERT_EQUAL(0x84, separate->mean);
+    TEST_ASSERT_EQUAL(width * height, separate->histogram[0x84]);
+
+    free(st);
+    free(separate);
+    free(fused);
+    heap_caps_free(dma);
+    heap_caps_free(fb);
+    heap_caps_free(raw);
+}
 
 static void print_rgb565_img(uint8_t *img, int width, int height)
 {
@@ -527,6 +1173,752 @@ TEST_CASE("Conversions image 480x320 jpeg decode test", "[camera]")
     img_jpeg_decode_test(2, 0);
 }
 
+TEST_CASE("Conversions motion detection test", "[camera]")
+{
+    motion_detect_config_t config = MOTION_DETECT_CONFIG_DEFAULT();
+    motion_detect_handle_t md = NULL;
+    TEST_ESP_OK(motion_detect_create(&config, &md));
+
+    // a static background, then a bright square entering it
+    uint8_t *gray = malloc(320 * 240);
+    TEST_ASSERT_NOT_NULL(gray);
+    camera_fb_t fb = {
+        .buf = gray,
+        .len = 320 * 240,
+        .width = 320,
+        .height = 240,
+        .format = PIXFORMAT_GRAYSCALE,
+    };
+    motion_event_t event;
+    for (int i = 0; i < 320 * 240; i++) {
+        gray[i] = (i % 320) / 4 + 40;
+    }
+    TEST_ESP_OK(motion_detect_process(md, &fb, &event));
+    TEST_ESP_OK(motion_detect_process(md, &fb, &event));
+    TEST_ASSERT_EQUAL(0, event.region_count);
+    for (int y = 96; y < 144; y++) {
+        memset(gray + y * 320 + 160, 250, 48);
+    }
+    uint64_t t = esp_timer_get_time();
+    TEST_ESP_OK(motion_detect_process(md, &fb, &event));
+    ESP_LOGI(TAG, "Grayscale 320x240 processed in %llu us", esp_timer_get_time() - t);
+    TEST_ASSERT_EQUAL(1, event.region_count);
+    TEST_ASSERT_EQUAL(160, event.regions[0].x);
+    TEST_ASSERT_EQUAL(96, event.regions[0].y);
+    TEST_ASSERT_EQUAL(48, event.regions[0].w);
+    TEST_ASSERT_EQUAL(48, event.regions[0].h);
+    TEST_ESP_OK(motion_detect_get_event(md, &event, 0));
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, motion_detect_get_event(md, &event, 0));
+    free(gray);
+
+    // JPEG frames are analysed from their DC coefficients
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    camera_fb_t jpg = {
+        .buf = (uint8_t *)img_start,
+        .len = img_end - img_start,
+        .width = 480,
+        .height = 320,
+        .format = PIXFORMAT_JPEG,
+    };
+    TEST_ESP_OK(motion_detect_process(md, &jpg, &event));
+    t = esp_timer_get_time();
+    TEST_ESP_OK(motion_detect_process(md, &jpg, &event));
+    ESP_LOGI(TAG, "JPEG 480x320 processed in %llu us", esp_timer_get_time() - t);
+    TEST_ASSERT_EQUAL(1, event.frame);
+    TEST_ASSERT_EQUAL(0, event.region_count);
+
+    // a Huffman table with three 1-bit codes is rejected
+    uint8_t *bad = malloc(jpg.len);
+    TEST_ASSERT_NOT_NULL(bad);
+    memcpy(bad, img_start, jpg.len);
+    uint8_t *dht = NULL;
+    // walk the marker segments, the EXIF thumbnail has tables of its own
+    for (size_t i = 2; i + 21 < jpg.len && bad[i + 1] != 0xDA && !dht; i += 2 + ((bad[i + 2] << 8) | bad[i + 3])) {
+        if (bad[i + 1] == 0xC4) {
+            dht = bad + i + 5;
+        }
+    }
+    TEST_ASSERT_NOT_NULL(dht);
+    int total = 0;
+    for (int l = 0; l < 16; l++) {
+        total += dht[l];
+        dht[l] = 0;
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL(3, total);
+    dht[0] = 3;
+    dht[15] = total - 3;
+    jpg.buf = bad;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, motion_detect_process(md, &jpg, &event));
+    free(bad);
+    motion_detect_delete(md);
+}
+
+TEST_CASE("Conversions frame change test", "[camera]")
+{
+    motion_detect_config_t config = MOTION_DETECT_CONFIG_DEFAULT();
+    config.queue_len = 0;
+    motion_detect_handle_t md = NULL;
+    TEST_ESP_OK(motion_detect_create(&config, &md));
+
+    uint8_t *gray = malloc(320 * 240);
+    TEST_ASSERT_NOT_NULL(gray);
+    camera_fb_t fb = {
+        .buf = gray,
+        .len = 320 * 240,
+        .width = 320,
+        .height = 240,
+        .format = PIXFORMAT_GRAYSCALE,
+    };
+    motion_compare_t cmp;
+    for (int i = 0; i < 320 * 240; i++) {
+        gray[i] = (i % 320) / 4 + 40;
+    }
+    // everything is new until there is a reference
+    TEST_ESP_OK(motion_detect_compare(md, &fb, &cmp));
+    TEST_ASSERT_EQUAL(cmp.total_tiles, cmp.changed_tiles);
+    motion_detect_set_reference(md);
+    TEST_ESP_OK(motion_detect_compare(md, &fb, &cmp));
+    TEST_ASSERT_EQUAL(20 * 15, cmp.total_tiles);
+    TEST_ASSERT_EQUAL(0, cmp.changed_tiles);
+
+    // a change stays visible until the reference is moved on
+    for (int y = 96; y < 128; y++) {
+        memset(gray + y * 320 + 160, 250, 32);
+    }
+    TEST_ESP_OK(motion_detect_compare(md, &fb, &cmp));
+    TEST_ASSERT_EQUAL(4, cmp.changed_tiles);
+    TEST_ESP_OK(motion_detect_compare(md, &fb, &cmp));
+    TEST_ASSERT_EQUAL(4, cmp.changed_tiles);
+    motion_detect_set_reference(md);
+    TEST_ESP_OK(motion_detect_compare(md, &fb, &cmp));
+    TEST_ASSERT_EQUAL(0, cmp.changed_tiles);
+    TEST_ASSERT_EQUAL(0, cmp.max_diff);
+    free(gray);
+    motion_detect_delete(md);
+}
+
+TEST_CASE("Conversions tile stream test", "[camera]")
+{
+    tile_stream_config_t config = TILE_STREAM_CONFIG_DEFAULT();
+    tile_stream_handle_t ts = NULL;
+    TEST_ESP_OK(tile_stream_create(&config, &ts));
+
+    uint8_t *gray = malloc(320 * 240);
+    TEST_ASSERT_NOT_NULL(gray);
+    for (int i = 0; i < 320 * 240; i++) {
+        gray[i] = (i % 320) / 4 + 40;
+    }
+    camera_fb_t fb[2] = {
+        { .width = 320, .height = 240, .format = PIXFORMAT_JPEG },
+        { .width = 320, .height = 240, .format = PIXFORMAT_JPEG },
+    };
+    TEST_ASSERT_TRUE(fmt2jpg(gray, 320 * 240, 320, 240, PIXFORMAT_GRAYSCALE, 80, &fb[0].buf, &fb[0].len));
+    for (int y = 96; y < 128; y++) {
+        memset(gray + y * 320 + 160, 250, 32);
+    }
+    TEST_ASSERT_TRUE(fmt2jpg(gray, 320 * 240, 320, 240, PIXFORMAT_GRAYSCALE, 80, &fb[1].buf, &fb[1].len));
+    free(gray);
+
+    // the first frame is sent whole, an identical one not at all
+    tile_stream_msg_t msg;
+    TEST_ESP_OK(tile_stream_encode(ts, &fb[0], &msg));
+    TEST_ASSERT_EQUAL(TILE_STREAM_KEYFRAME, msg.type);
+    TEST_ASSERT_EQUAL_PTR(fb[0].buf, msg.jpg);
+    TEST_ASSERT_EQUAL(TILE_STREAM_HEADER_LEN, msg.header_len);
+    TEST_ESP_OK(tile_stream_encode(ts, &fb[0], &msg));
+    TEST_ASSERT_EQUAL(TILE_STREAM_DELTA, msg.type);
+    TEST_ASSERT_EQUAL(0, msg.tiles);
+
+    // the square covers four tiles, sent as a 64x16 mosaic
+    uint64_t t = esp_timer_get_time();
+    TEST_ESP_OK(tile_stream_encode(ts, &fb[1], &msg));
+    ESP_LOGI(TAG, "Tile stream 320x240 delta encoded in %llu us, %u bytes", esp_timer_get_time() - t, msg.jpg_len);
+    TEST_ASSERT_EQUAL(TILE_STREAM_DELTA, msg.type);
+    TEST_ASSERT_EQUAL(4, msg.tiles);
+    TEST_ASSERT_EQUAL(TILE_STREAM_HEADER_LEN + 8, msg.header_len);
+    const uint8_t tiles[] = { 10, 6, 11, 6, 10, 7, 11, 7 };
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(tiles, msg.header + TILE_STREAM_HEADER_LEN, sizeof(tiles));
+    TEST_ASSERT_EQUAL(2, msg.header[8]);
+    uint8_t *rgb = malloc(64 * 16 * 2);
+    TEST_ASSERT_NOT_NULL(rgb);
+    TEST_ASSERT_TRUE(jpg2rgb565(msg.jpg, msg.jpg_len, rgb, JPEG_IMAGE_SCALE_0));
+    free(rgb);
+    TEST_ESP_OK(tile_stream_encode(ts, &fb[1], &msg));
+    TEST_ASSERT_EQUAL(0, msg.tiles);
+
+    tile_stream_request_keyframe(ts);
+    TEST_ESP_OK(tile_stream_encode(ts, &fb[0], &msg));
+    TEST_ASSERT_EQUAL(TILE_STREAM_KEYFRAME, msg.type);
+
+    // sensor JPEGs are supported as they come
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    camera_fb_t jpg = {
+        .buf = (uint8_t *)img_start,
+        .len = img_end - img_start,
+        .width = 480,
+        .height = 320,
+        .format = PIXFORMAT_JPEG,
+    };
+    TEST_ESP_OK(tile_stream_encode(ts, &jpg, &msg));
+    TEST_ASSERT_EQUAL(TILE_STREAM_KEYFRAME, msg.type);
+    TEST_ESP_OK(tile_stream_encode(ts, &jpg, &msg));
+    TEST_ASSERT_EQUAL(0, msg.tiles);
+
+    free(fb[0].buf);
+    free(fb[1].buf);
+    tile_stream_delete(ts);
+}
+
+static void ring_frame(camera_fb_t *fb, uint8_t *buf, int i)
+{
+    // synthetic frames of varying length, filled with their number
+    fb->len = 300 + (i % 7) * 100;
+    memset(buf, i, fb->len);
+    fb->buf = buf;
+    fb->timestamp.tv_sec = i / 100;
+    fb->timestamp.tv_usec = (i % 100) * 10000;
+}
+
+TEST_CASE("Conversions frame ring test", "[camera]")
+{
+    frame_ring_config_t config = {
+        .size = 16000,
+        .max_frames = 24,
+        .pre_ms = 100,
+        .post_ms = 50,
+    };
+    frame_ring_handle_t ring = NULL;
+    TEST_ESP_OK(frame_ring_create(&config, &ring));
+    uint8_t *buf = malloc(config.size + 1);
+    TEST_ASSERT_NOT_NULL(buf);
+    camera_fb_t fb = { .width = 320, .height = 240, .format = PIXFORMAT_JPEG };
+    frame_ring_stats_t stats;
+
+    // frames every 10 ms, the oldest ones make room
+    for (int i = 0; i < 40; i++) {
+        ring_frame(&fb, buf, i);
+        TEST_ESP_OK(frame_ring_add(ring, &fb));
+    }
+    frame_ring_get_stats(ring, &stats);
+    TEST_ASSERT_EQUAL(40, stats.frames);
+    TEST_ASSERT_EQUAL(0, stats.dropped);
+    TEST_ASSERT_TRUE(stats.count > 16 && stats.count <= config.max_frames);
+    TEST_ASSERT_TRUE(stats.bytes <= config.size);
+    TEST_ASSERT_EQUAL(390000 - (stats.count - 1) * 10000, stats.oldest_us);
+
+    // 100 ms pre-roll and 50 ms post-roll around frame 39
+    TEST_ESP_OK(frame_ring_trigger(ring, 390000));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, frame_ring_trigger(ring, 390000));
+    frame_ring_clip_t clip;
+    TEST_ASSERT_EQUAL(FRAME_RING_TRIGGERED, frame_ring_get_clip(ring, &clip));
+    TEST_ASSERT_EQUAL(11, clip.frames);
+    for (int i = 40; i < 80; i++) {
+        ring_frame(&fb, buf, i);
+        frame_ring_add(ring, &fb);
+    }
+    TEST_ASSERT_EQUAL(FRAME_RING_CLIP_READY, frame_ring_get_clip(ring, &clip));
+    TEST_ASSERT_EQUAL(16, clip.frames);
+    frame_ring_get_stats(ring, &stats);
+    TEST_ASSERT_TRUE(stats.dropped > 0);
+
+    // the clip survived the frames added after it
+    frame_ring_frame_t frame;
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < clip.frames; i++) {
+        TEST_ESP_OK(frame_ring_get_clip_frame(ring, i, &frame));
+        ring_frame(&fb, buf, 29 + i);
+        TEST_ASSERT_EQUAL(fb.len, frame.len);
+        TEST_ASSERT_EQUAL(290000 + i * 10000, frame.timestamp);
+        TEST_ASSERT_EQUAL_MEMORY(buf, frame.buf, frame.len);
+        bytes += frame.len;
+    }
+    TEST_ASSERT_EQUAL(clip.bytes, bytes);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, frame_ring_get_clip_frame(ring, clip.frames, &frame));
+
+    // two readers, the clip stays until both are done
+    TEST_ESP_OK(frame_ring_hold(ring));
+    TEST_ESP_OK(frame_ring_hold(ring));
+    frame_ring_release(ring);
+    TEST_ASSERT_EQUAL(FRAME_RING_CLIP_READY, frame_ring_get_clip(ring, NULL));
+    TEST_ESP_OK(frame_ring_get_clip_frame(ring, 0, &frame));
+    frame_ring_release(ring);
+    TEST_ASSERT_EQUAL(FRAME_RING_IDLE, frame_ring_get_clip(ring, NULL));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, frame_ring_hold(ring));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, frame_ring_get_clip_frame(ring, 0, &frame));
+    ring_frame(&fb, buf, 80);
+    TEST_ESP_OK(frame_ring_add(ring, &fb));
+
+    fb.len = config.size + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, frame_ring_add(ring, &fb));
+    fb.format = PIXFORMAT_GRAYSCALE;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, frame_ring_add(ring, &fb));
+    free(buf);
+    frame_ring_delete(ring);
+}
+
+typedef struct {
+    const uint8_t *jpg;
+    size_t jpg_len;
+    uint8_t *out;
+    size_t out_len;
+    int times;
+    uint64_t us;
+    bool ok;
+    SemaphoreHandle_t done;
+} decode_job_t;
+
+static void decode_ctx_task(void *arg)
+{
+    decode_job_t *job = (decode_job_t *)arg;
+    jpg_dec_ctx_t *ctx = jpg_dec_ctx_create(NULL, 0);
+    job->ok = ctx != NULL;
+    uint64_t t = esp_timer_get_time();
+    for (int i = 0; job->ok && i < job->times; i++) {
+        job->ok = jpg2rgb565_ctx(ctx, job->jpg, job->jpg_len, job->out, job->out_len, JPEG_IMAGE_SCALE_0);
+    }
+    job->us = esp_timer_get_time() - t;
+    jpg_dec_ctx_free(ctx);
+    xSemaphoreGive(job->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("Conversions concurrent jpeg decode context test", "[camera]")
+{
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    const size_t out_len = 480 * 320 * 2;
+    uint8_t *ref = heap_caps_malloc(out_len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(ref);
+    uint64_t t = esp_timer_get_time();
+    for (int i = 0; i < 8; i++) {
+        TEST_ASSERT_TRUE(jpg2rgb565(img_start, img_end - img_start, ref, JPEG_IMAGE_SCALE_0));
+    }
+    uint64_t serial_us = esp_timer_get_time() - t;
+
+    decode_job_t jobs[2];
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(2, 0);
+    t = esp_timer_get_time();
+    for (int i = 0; i < 2; i++) {
+        jobs[i] = (decode_job_t) {
+            .jpg = img_start,
+            .jpg_len = img_end - img_start,
+            .out = heap_caps_malloc(out_len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT),
+            .out_len = out_len,
+            .times = 4,
+            .done = done,
+        };
+        TEST_ASSERT_NOT_NULL(jobs[i].out);
+        xTaskCreatePinnedToCore(decode_ctx_task, "decode", 4096, &jobs[i], 5, NULL, i % portNUM_PROCESSORS);
+    }
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_TRUE(xSemaphoreTake(done, pdMS_TO_TICKS(10000)));
+    }
+    uint64_t parallel_us = esp_timer_get_time() - t;
+    ESP_LOGI(TAG, "8 decodes: %llu us serial, %llu us on two contexts", serial_us, parallel_us);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_TRUE(jobs[i].ok);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(ref, jobs[i].out, out_len);
+        heap_caps_free(jobs[i].out);
+    }
+    vSemaphoreDelete(done);
+    heap_caps_free(ref);
+
+    // the BMP buffer is owned by the context and reused
+    jpg_dec_ctx_t *ctx = jpg_dec_ctx_create(NULL, 0);
+    TEST_ASSERT_NOT_NULL(ctx);
+    uint8_t *bmp1 = NULL, *bmp2 = NULL;
+    size_t bmp1_len = 0, bmp2_len = 0;
+    TEST_ASSERT_TRUE(jpg2bmp_ctx(ctx, img_start, img_end - img_start, &bmp1, &bmp1_len));
+    TEST_ASSERT_TRUE(jpg2bmp_ctx(ctx, img_start, img_end - img_start, &bmp2, &bmp2_len));
+    TEST_ASSERT_EQUAL_PTR(bmp1, bmp2);
+    TEST_ASSERT_EQUAL(480 * 320 * 3 + 54, bmp2_len);
+    jpg_dec_ctx_free(ctx);
+}
+
+TEST_CASE("Conversions streaming jpeg encode test", "[camera]")
+{
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    const uint16_t width = 480, height = 320;
+    const size_t raw_len = width * height * 2;
+    const size_t chunk = 4092;  // like DMA transfers, not aligned to lines
+    uint8_t *raw = heap_caps_malloc(raw_len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *out = heap_caps_malloc(raw_len / 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(raw);
+    TEST_ASSERT_NOT_NULL(out);
+    TEST_ASSERT_TRUE(jpg2rgb565(img_start, img_end - img_start, raw, JPEG_IMAGE_SCALE_0));
+
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    jpg_stream_t *stream = jpg_stream_create(width, height, PIXFORMAT_RGB565, 80);
+    TEST_ASSERT_NOT_NULL(stream);
+    TEST_ASSERT_TRUE(jpg_stream_begin(stream, out, raw_len / 2));
+    size_t encoder_mem = heap_before - heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+    // replay the frame as if it was being captured, the latency is the time
+    // from the last transfer (~VSYNC) to the finished JPEG
+    uint64_t latency = 0;
+    uint64_t t = esp_timer_get_time();
+    for (size_t pos = 0; pos < raw_len; pos += chunk) {
+        latency = esp_timer_get_time();
+        TEST_ASSERT_TRUE(jpg_stream_write(stream, raw + pos, raw_len - pos < chunk ? raw_len - pos : chunk));
+    }
+    size_t out_len = 0;
+    TEST_ASSERT_TRUE(jpg_stream_end(stream, &out_len));
+    latency = esp_timer_get_time() - latency;
+    t = esp_timer_get_time() - t;
+
+    uint8_t *ref = NULL;
+    size_t ref_len = 0;
+    uint64_t t_ref = esp_timer_get_time();
+    TEST_ASSERT_TRUE(fmt2jpg(raw, raw_len, width, height, PIXFORMAT_RGB565, 80, &ref, &ref_len));
+    t_ref = esp_timer_get_time() - t_ref;
+    printf("stream: %u bytes in %llu us, %llu us after the last transfer, encoder %u bytes\n",
+           (unsigned)out_len, t, latency, (unsigned)encoder_mem);
+    printf("fmt2jpg: %u bytes in %llu us after the whole %u byte frame\n", (unsigned)ref_len, t_ref, (unsigned)raw_len);
+    TEST_ASSERT_EQUAL(ref_len, out_len);
+    TEST_ASSERT_EQUAL_MEMORY(ref, out, out_len);
+    TEST_ASSERT_LESS_THAN(t_ref / 4, latency);
+    TEST_ASSERT_LESS_THAN(raw_len / 8, encoder_mem);
+
+    // a frame with missing lines fails
+    TEST_ASSERT_TRUE(jpg_stream_begin(stream, out, raw_len / 2));
+    TEST_ASSERT_TRUE(jpg_stream_write(stream, raw, raw_len - chunk));
+    TEST_ASSERT_FALSE(jpg_stream_end(stream, &out_len));
+    free(ref);
+    jpg_stream_free(stream);
+
+    // YUV422 is subsampled like fmt2jpg() too, same frame as Y0 U Y1 V
+    for (size_t i = 0; i < raw_len; i += 4) {
+        uint8_t y[2], u = 0, v = 0;
+        for (int p = 0; p < 2; p++) {
+            uint16_t px = raw[i + 2 * p] << 8 | raw[i + 2 * p + 1];
+            int r = (px >> 8) & 0xF8, g = (px >> 3) & 0xFC, b = (px << 3) & 0xF8;
+            y[p] = (77 * r + 150 * g + 29 * b) >> 8;
+            u = (-43 * r - 85 * g + 128 * b + 32768) >> 8;
+            v = (128 * r - 107 * g - 21 * b + 32768) >> 8;
+        }
+        raw[i] = y[0];
+        raw[i + 1] = u;
+        raw[i + 2] = y[1];
+        raw[i + 3] = v;
+    }
+    stream = jpg_stream_create(width, height, PIXFORMAT_YUV422, 80);
+    TEST_ASSERT_NOT_NULL(stream);
+    TEST_ASSERT_TRUE(jpg_stream_begin(stream, out, raw_len / 2));
+    for (size_t pos = 0; pos < raw_len; pos += chunk) {
+        TEST_ASSERT_TRUE(jpg_stream_write(stream, raw + pos, raw_len - pos < chunk ? raw_len - pos : chunk));
+    }
+    TEST_ASSERT_TRUE(jpg_stream_end(stream, &out_len));
+    TEST_ASSERT_TRUE(fmt2jpg(raw, raw_len, width, height, PIXFORMAT_YUV422, 80, &ref, &ref_len));
+    TEST_ASSERT_EQUAL(ref_len, out_len);
+    TEST_ASSERT_EQUAL_MEMORY(ref, out, out_len);
+
+    free(ref);
+    jpg_stream_free(stream);
+    heap_caps_free(raw);
+    heap_caps_free(out);
+}
+
+TEST_CASE("Conversions jpeg encode arena test", "[camera]")
+{
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    const uint16_t width = 480, height = 320;
+    const size_t raw_len = width * height * 2;
+    const int times = 10;
+    uint8_t *raw = heap_caps_malloc(raw_len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(raw);
+    TEST_ASSERT_TRUE(jpg2rgb565(img_start, img_end - img_start, raw, JPEG_IMAGE_SCALE_0));
+
+    uint8_t *ref = NULL;
+    size_t ref_len = 0;
+    uint64_t t = esp_timer_get_time();
+    for (int i = 0; i < times; i++) {
+        free(ref);
+        TEST_ASSERT_TRUE(fmt2jpg(raw, raw_len, width, height, PIXFORMAT_RGB565, 80, &ref, &ref_len));
+    }
+    uint64_t heap_us = (esp_timer_get_time() - t) / times;
+
+    img_arena_t *arena = img_arena_create(width * 3 * 17, raw_len / 4);
+    TEST_ASSERT_NOT_NULL(arena);
+    uint8_t *out = NULL;
+    size_t out_len = 0;
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    t = esp_timer_get_time();
+    for (int i = 0; i < times; i++) {
+        img_arena_reset(arena);
+        TEST_ASSERT_TRUE(fmt2jpg_arena(arena, raw, raw_len, width, height, PIXFORMAT_RGB565, 80, &out, &out_len));
+    }
+    uint64_t arena_us = (esp_timer_get_time() - t) / times;
+    ESP_LOGI(TAG, "fmt2jpg: %llu us, fmt2jpg_arena: %llu us", heap_us, arena_us);
+    TEST_ASSERT_EQUAL(heap_before, heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    TEST_ASSERT_EQUAL(ref_len, out_len);
+    TEST_ASSERT_EQUAL_MEMORY(ref, out, out_len);
+
+    // a region that is too small fails instead of falling back to the heap
+    img_arena_reset(arena);
+    TEST_ASSERT_NOT_NULL(img_arena_alloc(arena, IMG_ARENA_INTERNAL, width * 3 * 16));
+    TEST_ASSERT_FALSE(fmt2jpg_arena(arena, raw, raw_len, width, height, PIXFORMAT_RGB565, 80, &out, &out_len));
+
+    img_arena_free(arena);
+    free(ref);
+    heap_caps_free(raw);
+}
+
+TEST_CASE("Conversions luma-only jpeg decode test", "[camera]")
+{
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    const size_t jpg_len = img_end - img_start;
+    const int times = 10;
+    uint16_t w = 0, h = 0;
+
+    // colour decode at 1/8 as the baseline
+    uint8_t *rgb = heap_caps_malloc(60 * 40 * 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(rgb);
+    uint64_t t = esp_timer_get_time();
+    for (int i = 0; i < times; i++) {
+        TEST_ASSERT_TRUE(jpg2rgb565(img_start, jpg_len, rgb, JPEG_IMAGE_SCALE_1_8));
+    }
+    uint64_t rgb_us = (esp_timer_get_time() - t) / times;
+    ESP_LOGI(TAG, "jpg2rgb565 1/8: %llu us", rgb_us);
+
+    uint8_t *gray = heap_caps_malloc(480 * 320, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *dc = malloc(60 * 40);
+    TEST_ASSERT_NOT_NULL(gray);
+    TEST_ASSERT_NOT_NULL(dc);
+    const esp_jpeg_image_scale_t scales[] = {
+        JPEG_IMAGE_SCALE_0, JPEG_IMAGE_SCALE_1_2, JPEG_IMAGE_SCALE_1_4, JPEG_IMAGE_SCALE_1_8,
+    };
+    for (int s = 0; s < 4; s++) {
+        TEST_ASSERT_TRUE(jpg2gray(img_start, jpg_len, NULL, 0, scales[s], &w, &h));
+        TEST_ASSERT_EQUAL(480 >> s, w);
+        TEST_ASSERT_EQUAL(320 >> s, h);
+        t = esp_timer_get_time();
+        for (int i = 0; i < times; i++) {
+            TEST_ASSERT_TRUE(jpg2gray(img_start, jpg_len, gray, 480 * 320, scales[s], NULL, NULL));
+        }
+        ESP_LOGI(TAG, "jpg2gray 1/%d: %llu us", 1 << s, (esp_timer_get_time() - t) / times);
+    }
+    TEST_ASSERT_FALSE(jpg2gray(img_start, jpg_len, dc, 60 * 40 - 1, JPEG_IMAGE_SCALE_1_8, NULL, NULL));
+    TEST_ASSERT_TRUE(jpg2gray(img_start, jpg_len, dc, 60 * 40, JPEG_IMAGE_SCALE_1_8, NULL, NULL));
+    TEST_ASSERT_TRUE(jpg2gray(img_start, jpg_len, gray, 480 * 320, JPEG_IMAGE_SCALE_0, NULL, NULL));
+
+    // the DC map holds the block means of the full decode, and the luma of
+    // the colour decode is close to both
+    int err = 0;
+    for (int by = 0; by < 40; by++) {
+        for (int bx = 0; bx < 60; bx++) {
+            int sum = 0;
+            for (int y = 0; y < 8; y++) {
+                for (int x = 0; x < 8; x++) {
+                    sum += gray[(by * 8 + y) * 480 + bx * 8 + x];
+                }
+            }
+            TEST_ASSERT_INT_WITHIN(2, (sum + 32) / 64, dc[by * 60 + bx]);
+            const uint8_t *p = rgb + (by * 60 + bx) * 2;
+            int r = p[0] & 0xF8;
+            int g = ((p[0] & 0x07) << 5) | ((p[1] & 0xE0) >> 3);
+            int b = (p[1] & 0x1F) << 3;
+            err += abs((r * 77 + g * 150 + b * 29) / 256 - dc[by * 60 + bx]);
+        }
+    }
+    TEST_ASSERT_LESS_THAN(8 * 60 * 40, err);
+
+    heap_caps_free(rgb);
+    heap_caps_free(gray);
+    free(dc);
+}
+
+TEST_CASE("Conversions lossless jpeg transform test", "[camera]")
+{
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    const size_t jpg_len = img_end - img_start;
+    uint8_t *ref = NULL, *rot = NULL, *back = NULL;
+    size_t ref_len = 0, rot_len = 0, back_len = 0;
+    uint16_t w = 0, h = 0;
+
+    TEST_ASSERT_TRUE(jpg_transform(img_start, jpg_len, JPG_TRANSFORM_NONE, NULL, &ref, &ref_len));
+    uint64_t t = esp_timer_get_time();
+    TEST_ASSERT_TRUE(jpg_transform(img_start, jpg_len, JPG_TRANSFORM_ROT_90, NULL, &rot, &rot_len));
+    ESP_LOGI(TAG, "ROT_90 480x320: %llu us, %u -> %u bytes", esp_timer_get_time() - t, (unsigned)jpg_len, (unsigned)rot_len);
+    TEST_ASSERT_TRUE(jpg2gray(rot, rot_len, NULL, 0, JPEG_IMAGE_SCALE_0, &w, &h));
+    TEST_ASSERT_EQUAL(320, w);
+    TEST_ASSERT_EQUAL(480, h);
+
+    // rotating back gives the same coefficients, so the same bytes
+    TEST_ASSERT_TRUE(jpg_transform(rot, rot_len, JPG_TRANSFORM_ROT_270, NULL, &back, &back_len));
+    TEST_ASSERT_EQUAL(ref_len, back_len);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(ref, back, ref_len);
+    free(rot);
+    free(back);
+    TEST_ASSERT_TRUE(jpg_transform(img_start, jpg_len, JPG_TRANSFORM_HFLIP, NULL, &rot, &rot_len));
+    TEST_ASSERT_TRUE(jpg_transform(rot, rot_len, JPG_TRANSFORM_HFLIP, NULL, &back, &back_len));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(ref, back, ref_len);
+    free(rot);
+    free(back);
+
+    // the crop origin snaps to the MCU grid
+    jpg_crop_t crop = { .x = 100, .y = 50, .w = 200, .h = 100 };
+    TEST_ASSERT_TRUE(jpg_transform(img_start, jpg_len, JPG_TRANSFORM_NONE, &crop, &rot, &rot_len));
+    TEST_ASSERT_TRUE(jpg2gray(rot, rot_len, NULL, 0, JPEG_IMAGE_SCALE_0, &w, &h));
+    TEST_ASSERT_EQUAL(300 - 96, w);
+    TEST_ASSERT_EQUAL(150 - 48, h);
+    free(rot);
+    crop.x = 480;
+    TEST_ASSERT_FALSE(jpg_transform(img_start, jpg_len, JPG_TRANSFORM_NONE, &crop, &rot, &rot_len));
+    free(ref);
+}
+
+TEST_CASE("Conversions jpeg requantization test", "[camera]")
+{
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    const size_t jpg_len = img_end - img_start;
+    const size_t pixels = 480 * 320;
+    const uint8_t qualities[] = { 90, 75, 50, 30, 15, 5 };
+    uint8_t *ref = heap_caps_malloc(pixels, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *gray = heap_caps_malloc(pixels, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(ref);
+    TEST_ASSERT_NOT_NULL(gray);
+    TEST_ASSERT_TRUE(jpg2gray(img_start, jpg_len, ref, pixels, JPEG_IMAGE_SCALE_0, NULL, NULL));
+
+    size_t last_len = jpg_len;
+    printf("quality ,  bytes ,  time us , luma PSNR dB\n");
+    for (size_t i = 0; i < sizeof(qualities); i++) {
+        uint8_t *out = NULL;
+        size_t out_len = 0;
+        uint64_t t = esp_timer_get_time();
+        TEST_ASSERT_TRUE(jpg_requantize(img_start, jpg_len, qualities[i], &out, &out_len));
+        t = esp_timer_get_time() - t;
+        TEST_ASSERT_TRUE(jpg2gray(out, out_len, gray, pixels, JPEG_IMAGE_SCALE_0, NULL, NULL));
+        uint64_t sse = 0;
+        for (size_t p = 0; p < pixels; p++) {
+            int d = gray[p] - ref[p];
+            sse += d * d;
+        }
+        float psnr = sse ? 10.0f * log10f(255.0f * 255.0f * pixels / sse) : 99.0f;
+        printf("%7u , %6u , %8llu , %5.2f\n", qualities[i], (unsigned)out_len, t, psnr);
+        TEST_ASSERT_LESS_OR_EQUAL(last_len, out_len);
+        TEST_ASSERT_GREATER_THAN(18, (int)psnr);
+        last_len = out_len;
+        free(out);
+    }
+    TEST_ASSERT_LESS_THAN(jpg_len / 4, last_len);
+
+    // quality 0 keeps the coefficients, like jpg_progressive()
+    uint8_t *out = NULL;
+    size_t out_len = 0;
+    TEST_ASSERT_TRUE(jpg_requantize(img_start, jpg_len, 0, &out, &out_len));
+    TEST_ASSERT_TRUE(jpg2gray(out, out_len, gray, pixels, JPEG_IMAGE_SCALE_0, NULL, NULL));
+    TEST_ASSERT_EQUAL_MEMORY(ref, gray, pixels);
+    free(out);
+    heap_caps_free(ref);
+    heap_caps_free(gray);
+}
+
+TEST_CASE("Conversions progressive jpeg test", "[camera]")
+{
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    const size_t jpg_len = img_end - img_start;
+    uint8_t *out = NULL;
+    size_t out_len = 0;
+
+    uint64_t t = esp_timer_get_time();
+    TEST_ASSERT_TRUE(jpg_progressive(img_start, jpg_len, 0, &out, &out_len));
+    t = esp_timer_get_time() - t;
+    TEST_ASSERT_EQUAL_HEX8(0xFF, out[0]);
+    TEST_ASSERT_EQUAL_HEX8(0xD8, out[1]);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, out[out_len - 2]);
+    TEST_ASSERT_EQUAL_HEX8(0xD9, out[out_len - 1]);
+
+    // walk the segments up to the second scan, the end of the DC preview
+    bool sof2 = false;
+    size_t preview = 0;
+    int scans = 0;
+    for (size_t i = 2; i + 3 < out_len; i++) {
+        if (out[i] != 0xFF || out[i + 1] == 0x00 || out[i + 1] == 0xFF) {
+            continue;
+        }
+        sof2 = sof2 || out[i + 1] == 0xC2;
+        if (out[i + 1] == 0xDA && ++scans == 2) {
+            preview = i;
+        }
+        if (!scans || out[i + 1] == 0xDA) {
+            i += 1 + ((out[i + 2] << 8) | out[i + 3]);
+        }
+    }
+    ESP_LOGI(TAG, "progressive 480x320: %llu us, %u -> %u bytes, %d scans, preview after %u bytes",
+             t, (unsigned)jpg_len, (unsigned)out_len, scans, (unsigned)preview);
+    TEST_ASSERT_TRUE(sof2);
+    TEST_ASSERT_EQUAL(10, scans);
+    TEST_ASSERT_NOT_EQUAL(0, preview);
+    TEST_ASSERT_LESS_THAN(out_len / 4, preview);
+    // the optimized tables of each scan pay for the extra scans
+    TEST_ASSERT_LESS_THAN(jpg_len + jpg_len / 20, out_len);
+    free(out);
+
+    TEST_ASSERT_TRUE(jpg_progressive(img_start, jpg_len, 30, &out, &out_len));
+    TEST_ASSERT_LESS_THAN(jpg_len / 2, out_len);
+    free(out);
+}
+
+TEST_CASE("Conversions jpeg downscale test", "[camera]")
+{
+    extern const uint8_t img_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img_end[]   asm("_binary_test_outside_jpeg_end");
+    const size_t jpg_len = img_end - img_start;
+    const esp_jpeg_image_scale_t scales[] = { JPEG_IMAGE_SCALE_1_2, JPEG_IMAGE_SCALE_1_4, JPEG_IMAGE_SCALE_1_8 };
+    const size_t pixels = 240 * 160;
+    uint8_t *ref = heap_caps_malloc(pixels, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *gray = heap_caps_malloc(pixels, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *rgb = heap_caps_malloc(pixels * 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(ref);
+    TEST_ASSERT_NOT_NULL(gray);
+    TEST_ASSERT_NOT_NULL(rgb);
+
+    printf("scale ,  size   ,  bytes , jpg_scale us , decode+encode us , luma PSNR dB\n");
+    for (size_t i = 0; i < sizeof(scales) / sizeof(scales[0]); i++) {
+        uint8_t *out = NULL;
+        size_t out_len = 0;
+        uint16_t w, h, ref_w, ref_h;
+        uint64_t t = esp_timer_get_time();
+        TEST_ASSERT_TRUE(jpg_scale(img_start, jpg_len, scales[i], 80, &out, &out_len));
+        t = esp_timer_get_time() - t;
+
+        // the same preview through a scaled RGB565 decode and a full encode
+        uint8_t *out2 = NULL;
+        size_t out2_len = 0;
+        uint64_t t2 = esp_timer_get_time();
+        TEST_ASSERT_TRUE(jpg2rgb565(img_start, jpg_len, rgb, scales[i]));
+        TEST_ASSERT_TRUE(fmt2jpg(rgb, pixels * 2, 480 >> scales[i], 320 >> scales[i], PIXFORMAT_RGB565, 80, &out2, &out2_len));
+        t2 = esp_timer_get_time() - t2;
+        free(out2);
+
+        TEST_ASSERT_TRUE(jpg2gray(img_start, jpg_len, ref, pixels, scales[i], &ref_w, &ref_h));
+        TEST_ASSERT_TRUE(jpg2gray(out, out_len, gray, pixels, JPEG_IMAGE_SCALE_0, &w, &h));
+        TEST_ASSERT_EQUAL(ref_w, w);
+        TEST_ASSERT_EQUAL(ref_h, h);
+        uint64_t sse = 0;
+        for (size_t p = 0; p < (size_t)w * h; p++) {
+            int d = gray[p] - ref[p];
+            sse += d * d;
+        }
+        float psnr = sse ? 10.0f * log10f(255.0f * 255.0f * w * h / sse) : 99.0f;
+        printf("  1/%d , %3ux%-3u , %6u , %12llu , %16llu , %5.2f\n", 1 << scales[i], w, h, (unsigned)out_len, t, t2, psnr);
+        TEST_ASSERT_GREATER_THAN(25, (int)psnr);
+        TEST_ASSERT_LESS_THAN(jpg_len / 2, out_len);
+        free(out);
+    }
+    heap_caps_free(ref);
+    heap_caps_free(gray);
+    heap_caps_free(rgb);
+}
+
 TEST_CASE("Camera driver uses an i2c port initialized by other devices test", "[camera]")
 {
     TEST_ESP_OK(i2c_master_init(I2C_MASTER_NUM));
@@ -1,30 +1,846 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
 #include "camera_server.h"
 #include "esp_http_server.h"
 #include "esp_camera.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "motion_detect.h"
+#include "tile_stream.h"
+#include "avi_recorder.h"
+#include "frame_ring.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 
 static const char *TAG = "CamServer";
 
+#define PART_BOUNDARY "123456789000000000000987654321"
+static const char *STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
+static const char *STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
+// X-Frame-Seq and X-Frame-Ts (microseconds since boot) are the VSYNC count
+// and time of the frame, X-Timestamp is kept for existing clients
+static const char *STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %lld.%06ld\r\n"
+                                 "X-Frame-Seq: %u\r\nX-Frame-Ts: %lld\r\n\r\n";
+
+// unchanged frames are still sent this often, it doubles as the keepalive
+#define STREAM_REFRESH_SEC      10
+#define STREAM_CHANGE_THRESHOLD 6
+
+#define STREAM_PORT_OFFSET      2
+
+// as long as esp_camera_fb_get() waits
+#define FRAME_WAIT_MS           4000
+// how often a client waiting for a frame checks that it is still connected
+#define FRAME_POLL_MS           100
+
+// minimal client of /tiles, it draws the keyframes and pastes the tiles of
+// each delta mosaic onto the same canvas; the stream server is found at
+// STREAM_PORT_OFFSET from the port of the page
+static const char TILES_PAGE[] =
+    "<!DOCTYPE html><html><body style=\"margin:0;background:#000\"><canvas id=\"c\"></canvas><script>\n"
+    "const c = document.getElementById('c'), g = c.getContext('2d');\n"
+    "(async () => {\n"
+    "  const r = (await fetch(`http://${location.hostname}:${+(location.port || 80) + 2}/tiles`)).body.getReader();\n"
+    "  let b = new Uint8Array(0);\n"
+    "  for (;;) {\n"
+    "    const {value, done} = await r.read();\n"
+    "    if (done) break;\n"
+    "    const t = new Uint8Array(b.length + value.length); t.set(b); t.set(value, b.length); b = t;\n"
+    "    while (b.length >= 16) {\n"
+    "      const v = new DataView(b.buffer, b.byteOffset), n = v.getUint16(6, true);\n"
+    "      const h = 16 + 2 * n, l = v.getUint32(12, true);\n"
+    "      if (b.length < h + l) break;\n"
+    "      const s = b[1], w = v.getUint16(2, true), img = await createImageBitmap(new Blob([b.slice(h, h + l)]));\n"
+    "      if (b[0] == 0) {\n"
+    "        if (c.width != w) { c.width = w; c.height = v.getUint16(4, true); }\n"
+    "        g.drawImage(img, 0, 0);\n"
+    "      } else {\n"
+    "        const p = Math.ceil(w / s);\n"
+    "        for (let i = 0; i < n; i++) g.drawImage(img, i % p * s, Math.floor(i / p) * s, s, s, b[16 + 2 * i] * s, b[17 + 2 * i] * s, s, s);\n"
+    "      }\n"
+    "      b = b.slice(h + l);\n"
+    "    }\n"
+    "  }\n"
+    "})();\n"
+    "</script></body></html>";
+
+// recordings go to the storage partition mounted by main, which is small, so
+// the segments are kept short
+#define RECORD_SEGMENT_BYTES    (256 * 1024)
+#define RECORD_SEGMENT_SEC      60
+
+static motion_detect_handle_t motion = NULL;
+
+// owned by motion_task, the capture loop of all the servers;
+// /record only asks for a change and reads the last stats
+static avi_recorder_handle_t recorder = NULL;
+static volatile int record_request = 0;     // 1 start, -1 stop
+static avi_recorder_stats_t record_stats;
+
+// the last seconds of frames, filled by motion_task, for clips around events
+static frame_ring_handle_t clip_ring = NULL;
+static volatile bool clip_on_motion = false;
+
+// clip_task writes the clips of camera_server_trigger() and /clip?save=1 to
+// the storage partition and then releases them, so a clip nobody fetches
+// does not stop the pre-roll
+static TaskHandle_t clip_task_handle = NULL;
+static bool clip_save_pending = false;
+static portMUX_TYPE clip_save_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// motion_task is the only caller of esp_camera_fb_get(). With one or two
+// frame buffers, clients taking frames of their own would starve the clip
+// ring and the recorder, so each frame goes to all clients waiting for one
+// and the last of them to let go returns it to the driver.
+typedef struct {
+    camera_fb_t *fb;
+    int refs;
+} shared_fb_t;
+
+typedef struct frame_client {
+    SemaphoreHandle_t ready;
+    shared_fb_t *frame;         // handed over by motion_task while waiting
+    bool waiting;
+    struct frame_client *next;
+} frame_client_t;
+
+static SemaphoreHandle_t frame_lock = NULL;
+static frame_client_t *frame_clients = NULL;
+
+static int get_query_int(httpd_req_t *req, const char *key)
+{
+    char query[48];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+        || httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) {
+        return 0;
+    }
+    return atoi(value);
+}
+
+static void frame_put(shared_fb_t *sf)
+{
+    xSemaphoreTake(frame_lock, portMAX_DELAY);
+    bool last = --sf->refs == 0;
+    xSemaphoreGive(frame_lock);
+    if (last) {
+        esp_camera_fb_return(sf->fb);
+        free(sf);
+    }
+}
+
+// Hands the frame to the waiting clients, the caller keeps a reference
+static shared_fb_t *frame_share(camera_fb_t *fb)
+{
+    shared_fb_t *sf = malloc(sizeof(shared_fb_t));
+    if (!sf) {
+        return NULL;
+    }
+    sf->fb = fb;
+    sf->refs = 1;
+    xSemaphoreTake(frame_lock, portMAX_DELAY);
+    for (frame_client_t *c = frame_clients; c; c = c->next) {
+        if (c->waiting) {
+            c->waiting = false;
+            c->frame = sf;
+            sf->refs++;
+            xSemaphoreGive(c->ready);
+        }
+    }
+    xSemaphoreGive(frame_lock);
+    return sf;
+}
+
+static esp_err_t frame_client_add(frame_client_t *client)
+{
+    memset(client, 0, sizeof(frame_client_t));
+    client->ready = xSemaphoreCreateBinary();
+    if (!client->ready) {
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(frame_lock, portMAX_DELAY);
+    client->next = frame_clients;
+    frame_clients = client;
+    xSemaphoreGive(frame_lock);
+    return ESP_OK;
+}
+
+static void frame_client_remove(frame_client_t *client)
+{
+    xSemaphoreTake(frame_lock, portMAX_DELAY);
+    for (frame_client_t **c = &frame_clients; *c; c = &(*c)->next) {
+        if (*c == client) {
+            *c = client->next;
+            break;
+        }
+    }
+    xSemaphoreGive(frame_lock);
+    vSemaphoreDelete(client->ready);
+}
+
+// Stops waiting, returns the frame motion_task may have handed over meanwhile
+static shared_fb_t *frame_client_cancel(frame_client_t *client)
+{
+    xSemaphoreTake(frame_lock, portMAX_DELAY);
+    client->waiting = false;
+    shared_fb_t *sf = client->frame;
+    client->frame = NULL;
+    xSemaphoreGive(frame_lock);
+    if (sf) {
+        xSemaphoreTake(client->ready, 0);
+    }
+    return sf;
+}
+
+// Waits for the next frame of motion_task and checks the client in between,
+// so a client that went away ends the stream without a frame failing to send.
+// Returns ESP_ERR_TIMEOUT if no frame came and ESP_FAIL if the client closed.
+static esp_err_t wait_frame(httpd_req_t *req, frame_client_t *client, shared_fb_t **sf)
+{
+    int sock = httpd_req_to_sockfd(req);
+    bool watch_sock = true;
+    xSemaphoreTake(frame_lock, portMAX_DELAY);
+    client->waiting = true;
+    xSemaphoreGive(frame_lock);
+    for (int waited = 0; waited < FRAME_WAIT_MS; waited += FRAME_POLL_MS) {
+        if (xSemaphoreTake(client->ready, pdMS_TO_TICKS(FRAME_POLL_MS)) == pdTRUE) {
+            *sf = client->frame;
+            client->frame = NULL;
+            return ESP_OK;
+        }
+        if (watch_sock) {
+            char c;
+            int n = recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                ESP_LOGI(TAG, "Stream client went away");
+                *sf = frame_client_cancel(client);
+                if (*sf) {
+                    frame_put(*sf);
+                }
+                return ESP_FAIL;
+            }
+            // the client sent something, which stays readable, stop watching
+            watch_sock = n < 0;
+        }
+    }
+    *sf = frame_client_cancel(client);
+    return *sf ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+// /jpg?quality=N (1-100) lowers the quality of the frame for slow clients and
+// /jpg?scale=2|4|8 serves a downscaled preview of it, the capture itself
+// keeps the configured frame size for full resolution snapshots.
+// /jpg?progressive=1 sends the snapshot as a progressive JPEG, which browsers
+// show as a full frame preview after about a tenth of the bytes
 static esp_err_t jpg_handler(httpd_req_t *req)
 {
-    camera_fb_t *fb = esp_camera_fb_get();
-    if (!fb) {
+    frame_client_t client;
+    shared_fb_t *sf = NULL;
+    esp_err_t err = frame_client_add(&client);
+    if (err == ESP_OK) {
+        err = wait_frame(req, &client, &sf);
+        frame_client_remove(&client);
+    }
+    if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to get frame");
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
+    camera_fb_t *fb = sf->fb;
+
+    int quality = get_query_int(req, "quality");
+    quality = quality < 0 ? 1 : (quality > 100 ? 100 : quality);
+    int scale = get_query_int(req, "scale");
+    int progressive = get_query_int(req, "progressive");
+    if ((quality || scale > 1 || progressive) && fb->format == PIXFORMAT_JPEG) {
+        uint8_t *jpg = NULL;
+        size_t jpg_len = 0;
+        bool ok;
+        if (scale > 1) {
+            esp_jpeg_image_scale_t s = scale >= 8 ? JPEG_IMAGE_SCALE_1_8 : (scale >= 4 ? JPEG_IMAGE_SCALE_1_4 : JPEG_IMAGE_SCALE_1_2);
+            ok = jpg_scale(fb->buf, fb->len, s, quality ? quality : 80, &jpg, &jpg_len);
+        } else if (progressive) {
+            ok = jpg_progressive(fb->buf, fb->len, quality, &jpg, &jpg_len);
+        } else {
+            ok = jpg_requantize(fb->buf, fb->len, quality, &jpg, &jpg_len);
+        }
+        frame_put(sf);
+        if (!ok) {
+            ESP_LOGE(TAG, "Failed to convert frame");
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        httpd_resp_set_type(req, "image/jpeg");
+        httpd_resp_send(req, (const char *)jpg, jpg_len);
+        free(jpg);
+        return ESP_OK;
+    }
 
     httpd_resp_set_type(req, "image/jpeg");
     httpd_resp_send(req, (const char *)fb->buf, fb->len);
 
-    esp_camera_fb_return(fb);
+    frame_put(sf);
+    return ESP_OK;
+}
+
+// The JPEG is sent with a COM segment behind the SOI marker that repeats the
+// frame headers as "seq=N ts=T", so they survive when the frames are saved
+static esp_err_t send_part(httpd_req_t *req, const camera_fb_t *fb, const uint8_t *jpg, size_t jpg_len)
+{
+    int64_t ts = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    uint8_t head[48];
+    size_t head_len = 0;
+    if (jpg_len > 2 && jpg[0] == 0xFF && jpg[1] == 0xD8) {
+        int com_len = snprintf((char *)head + 6, sizeof(head) - 6, "seq=%u ts=%lld", (unsigned)fb->seq, (long long)ts);
+        head[0] = 0xFF;
+        head[1] = 0xD8;
+        head[2] = 0xFF;
+        head[3] = 0xFE;
+        head[4] = (com_len + 2) >> 8;
+        head[5] = (com_len + 2) & 0xFF;
+        head_len = 6 + com_len;
+        jpg += 2;
+        jpg_len -= 2;
+    }
+
+    char part[192];
+    int len = snprintf(part, sizeof(part), STREAM_PART, (unsigned)(head_len + jpg_len),
+                       (long long)fb->timestamp.tv_sec, (long)fb->timestamp.tv_usec, (unsigned)fb->seq, (long long)ts);
+    esp_err_t res = httpd_resp_send_chunk(req, part, len);
+    if (res == ESP_OK && head_len) {
+        res = httpd_resp_send_chunk(req, (const char *)head, head_len);
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, (const char *)jpg, jpg_len);
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY));
+    }
+    return res;
+}
+
+// MJPEG stream that leaves out frames which look the same as the last one
+// sent, compared by mean luma of 16x16 tiles (DC coefficients for JPEG).
+// /stream?threshold=N sets the tile difference that counts as change, 0 keeps
+// the default and threshold=255 disables the suppression,
+// /stream?refresh=N sends an unchanged frame at least every N seconds
+static esp_err_t stream_handler(httpd_req_t *req)
+{
+    motion_detect_config_t config = MOTION_DETECT_CONFIG_DEFAULT();
+    int threshold = get_query_int(req, "threshold");
+    int refresh = get_query_int(req, "refresh");
+    config.threshold = threshold > 0 ? (threshold < 255 ? threshold : 255) : STREAM_CHANGE_THRESHOLD;
+    config.queue_len = 0;
+    int64_t refresh_us = (int64_t)(refresh > 0 ? refresh : STREAM_REFRESH_SEC) * 1000000;
+
+    motion_detect_handle_t detector = NULL;
+    if (config.threshold < 255 && motion_detect_create(&config, &detector) != ESP_OK) {
+        ESP_LOGW(TAG, "Sending all frames, no memory for the change detector");
+    }
+
+    frame_client_t client;
+    esp_err_t res = frame_client_add(&client);
+    if (res != ESP_OK) {
+        motion_detect_delete(detector);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    res = httpd_resp_set_type(req, STREAM_CONTENT_TYPE);
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY));
+    }
+    int64_t last_sent = 0;
+    uint32_t sent = 0, skipped = 0;
+    while (res == ESP_OK) {
+        shared_fb_t *sf = NULL;
+        res = wait_frame(req, &client, &sf);
+        if (res != ESP_OK) {
+            if (res == ESP_ERR_TIMEOUT) {
+                ESP_LOGE(TAG, "Failed to get frame");
+            }
+            res = ESP_FAIL;
+            break;
+        }
+        camera_fb_t *fb = sf->fb;
+
+        int64_t now = esp_timer_get_time();
+        motion_compare_t cmp;
+        // frames that cannot be compared are sent
+        if (detector && motion_detect_compare(detector, fb, &cmp) == ESP_OK
+            && !cmp.changed_tiles && now - last_sent < refresh_us) {
+            frame_put(sf);
+            skipped++;
+            continue;
+        }
+
+        if (fb->format == PIXFORMAT_JPEG) {
+            res = send_part(req, fb, fb->buf, fb->len);
+        } else {
+            uint8_t *jpg = NULL;
+            size_t jpg_len = 0;
+            if (frame2jpg(fb, 80, &jpg, &jpg_len)) {
+                res = send_part(req, fb, jpg, jpg_len);
+                free(jpg);
+            } else {
+                ESP_LOGE(TAG, "JPEG compression failed");
+                res = ESP_FAIL;
+            }
+        }
+        frame_put(sf);
+        if (res == ESP_OK) {
+            if (detector) {
+                motion_detect_set_reference(detector);
+            }
+            last_sent = now;
+            sent++;
+        }
+    }
+    ESP_LOGI(TAG, "Stream closed, %u frames sent, %u unchanged frames skipped", (unsigned)sent, (unsigned)skipped);
+    frame_client_remove(&client);
+    motion_detect_delete(detector);
+    return res;
+}
+
+// Conditional replenishment for static cameras: a keyframe, then only the
+// tiles that changed, see tile_stream.h for the message format.
+// /tiles?threshold=N sets the luma change that marks a tile as changed,
+// /tiles?keyframe=N sends a whole frame at least every N seconds
+static esp_err_t tiles_handler(httpd_req_t *req)
+{
+    tile_stream_config_t config = TILE_STREAM_CONFIG_DEFAULT();
+    int threshold = get_query_int(req, "threshold");
+    int keyframe = get_query_int(req, "keyframe");
+    if (threshold > 0) {
+        config.threshold = threshold < 255 ? threshold : 255;
+    }
+    int64_t keyframe_us = (int64_t)(keyframe > 0 ? keyframe : STREAM_REFRESH_SEC) * 1000000;
+
+    tile_stream_handle_t ts = NULL;
+    if (tile_stream_create(&config, &ts) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create tile stream");
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    frame_client_t client;
+    if (frame_client_add(&client) != ESP_OK) {
+        tile_stream_delete(ts);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    esp_err_t res = ESP_OK;
+    int64_t last_keyframe = esp_timer_get_time();
+    uint32_t keyframes = 0, deltas = 0;
+    size_t sent = 0;
+    while (res == ESP_OK) {
+        shared_fb_t *sf = NULL;
+        res = wait_frame(req, &client, &sf);
+        if (res != ESP_OK) {
+            if (res == ESP_ERR_TIMEOUT) {
+                ESP_LOGE(TAG, "Failed to get frame");
+            }
+            res = ESP_FAIL;
+            break;
+        }
+        const camera_fb_t *fb = sf->fb;
+        int64_t now = esp_timer_get_time();
+        if (now - last_keyframe >= keyframe_us) {
+            tile_stream_request_keyframe(ts);
+        }
+        tile_stream_msg_t msg;
+        esp_err_t err = tile_stream_encode(ts, fb, &msg);
+        if (err == ESP_ERR_INVALID_SIZE) {
+            // a corrupt frame is dropped, the next one is compared instead
+            frame_put(sf);
+            continue;
+        } else if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Tile stream needs JPEG frames: %s", esp_err_to_name(err));
+            frame_put(sf);
+            res = err;
+            break;
+        }
+        if (msg.type == TILE_STREAM_KEYFRAME || msg.tiles) {
+            res = httpd_resp_send_chunk(req, (const char *)msg.header, msg.header_len);
+            if (res == ESP_OK) {
+                res = httpd_resp_send_chunk(req, (const char *)msg.jpg, msg.jpg_len);
+            }
+            sent += msg.header_len + msg.jpg_len;
+        }
+        if (msg.type == TILE_STREAM_KEYFRAME) {
+            last_keyframe = now;
+            keyframes++;
+        } else if (msg.tiles) {
+            deltas++;
+        }
+        frame_put(sf);
+    }
+    ESP_LOGI(TAG, "Tile stream closed, %u keyframes and %u deltas, %u bytes", (unsigned)keyframes, (unsigned)deltas, (unsigned)sent);
+    frame_client_remove(&client);
+    tile_stream_delete(ts);
+    return res;
+}
+
+static esp_err_t tiles_page_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "text/html");
+    return httpd_resp_send(req, TILES_PAGE, sizeof(TILES_PAGE) - 1);
+}
+
+static void apply_record_request(void)
+{
+    int request = record_request;
+    record_request = 0;
+    if (request > 0 && !recorder) {
+        avi_recorder_config_t config = AVI_RECORDER_CONFIG_DEFAULT();
+        config.segment_bytes = RECORD_SEGMENT_BYTES;
+        config.segment_sec = RECORD_SEGMENT_SEC;
+        if (avi_recorder_start(&config, &recorder) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to start recording");
+        }
+    } else if (request < 0 && recorder) {
+        avi_recorder_get_stats(recorder, &record_stats);
+        avi_recorder_stop(recorder);
+        recorder = NULL;
+        ESP_LOGI(TAG, "Recording stopped, %u frames, %u dropped", (unsigned)record_stats.frames, (unsigned)record_stats.dropped);
+    }
+}
+
+static void motion_task(void *arg)
+{
+    esp_err_t last_err = ESP_OK;
+    while (true) {
+        apply_record_request();
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (!fb) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        // the clients send the frame while it is analysed and stored
+        shared_fb_t *sf = frame_share(fb);
+        motion_event_t ev = { 0 };
+        esp_err_t err = motion ? motion_detect_process(motion, fb, &ev) : ESP_OK;
+        if (clip_ring) {
+            frame_ring_add(clip_ring, fb);
+            if (err == ESP_OK && ev.region_count && clip_on_motion) {
+                camera_server_trigger();
+            }
+        }
+        if (recorder) {
+            // never waits for the flash, frames are dropped while it is busy
+            avi_recorder_add_frame(recorder, fb);
+            avi_recorder_get_stats(recorder, &record_stats);
+        }
+        if (sf) {
+            frame_put(sf);
+        } else {
+            esp_camera_fb_return(fb);
+        }
+        // the clients still need the frames, so only the first failure is logged
+        if (err != ESP_OK && err != last_err) {
+            ESP_LOGW(TAG, "Motion detection failed: %s", esp_err_to_name(err));
+        }
+        last_err = err;
+    }
+}
+
+// /record?on=1 starts recording AVI segments to the storage partition,
+// /record?on=0 stops it, both return the recorder stats
+static esp_err_t record_handler(httpd_req_t *req)
+{
+    char query[16];
+    char value[4];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK
+        && httpd_query_key_value(query, "on", value, sizeof(value)) == ESP_OK) {
+        record_request = atoi(value) ? 1 : -1;
+    }
+    char buf[160];
+    int len = snprintf(buf, sizeof(buf), "{\"recording\":%s,\"frames\":%u,\"dropped\":%u,\"segments\":%u,\"bytes\":%llu,\"failed\":%s}",
+                       recorder ? "true" : "false", (unsigned)record_stats.frames, (unsigned)record_stats.dropped,
+                       (unsigned)record_stats.segments, (unsigned long long)record_stats.bytes, record_stats.failed ? "true" : "false");
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, buf, len);
+}
+
+// Takes over a hold on the clip, false if clip_task is saving it already
+static bool save_clip_async(void)
+{
+    portENTER_CRITICAL(&clip_save_lock);
+    bool queued = !clip_save_pending;
+    clip_save_pending = true;
+    portEXIT_CRITICAL(&clip_save_lock);
+    if (queued) {
+        xTaskNotifyGive(clip_task_handle);
+    } else {
+        frame_ring_release(clip_ring);
+    }
+    return queued;
+}
+
+static void trigger_clip(bool save)
+{
+    static bool failed = false;
+    if (!clip_ring) {
+        return;
+    }
+    esp_err_t err = frame_ring_trigger(clip_ring, esp_timer_get_time());
+    if (err == ESP_OK && save) {
+        err = frame_ring_hold(clip_ring);
+    }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Clip triggered");
+        failed = false;
+        if (save) {
+            save_clip_async();
+        }
+    } else if (!failed) {
+        // motion triggers every frame, so only the first failure is logged
+        ESP_LOGW(TAG, "Clip not triggered, the last one is still held: %s", esp_err_to_name(err));
+        failed = true;
+    }
+}
+
+void camera_server_trigger(void)
+{
+    trigger_clip(clip_task_handle != NULL);
+}
+
+// /trigger starts a clip of the frames around now, /trigger?motion=1|0
+// makes motion events trigger clips as well
+static esp_err_t trigger_handler(httpd_req_t *req)
+{
+    char query[16];
+    char value[4];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK
+        && httpd_query_key_value(query, "motion", value, sizeof(value)) == ESP_OK) {
+        clip_on_motion = atoi(value) != 0;
+    } else {
+        // kept for /clip
+        trigger_clip(false);
+    }
+    frame_ring_clip_t clip = { 0 };
+    if (clip_ring) {
+        frame_ring_get_clip(clip_ring, &clip);
+    }
+    static const char *states[] = { "idle", "triggered", "ready" };
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf), "{\"clip\":\"%s\",\"frames\":%u,\"bytes\":%u,\"motion\":%s}",
+                       states[clip.state], (unsigned)clip.frames, (unsigned)clip.bytes, clip_on_motion ? "true" : "false");
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, buf, len);
+}
+
+// Writes the clip to the storage partition as one AVI segment, waiting for
+// buffers instead of dropping frames
+static esp_err_t save_clip(void)
+{
+    avi_recorder_config_t config = AVI_RECORDER_CONFIG_DEFAULT();
+    config.prefix = "clip";
+    config.segment_bytes = 0;
+    config.segment_sec = 0;
+    avi_recorder_handle_t rec = NULL;
+    esp_err_t err = avi_recorder_start(&config, &rec);
+    frame_ring_frame_t frame;
+    for (uint32_t i = 0; err == ESP_OK && frame_ring_get_clip_frame(clip_ring, i, &frame) == ESP_OK; i++) {
+        camera_fb_t fb = {
+            .buf = (uint8_t *)frame.buf,
+            .len = frame.len,
+            .width = frame.width,
+            .height = frame.height,
+            .format = PIXFORMAT_JPEG,
+            .timestamp = { .tv_sec = frame.timestamp / 1000000, .tv_usec = frame.timestamp % 1000000 },
+            .seq = frame.seq,
+        };
+        while ((err = avi_recorder_add_frame(rec, &fb)) == ESP_ERR_NO_MEM) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+    if (rec) {
+        esp_err_t stop_err = avi_recorder_stop(rec);
+        err = err == ESP_OK ? stop_err : err;
+    }
+    return err;
+}
+
+static void clip_task(void *arg)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // motion_task is still adding the post-roll
+        while (frame_ring_get_clip(clip_ring, NULL) == FRAME_RING_TRIGGERED) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+        esp_err_t err = save_clip();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to save clip: %s", esp_err_to_name(err));
+        } else {
+            ESP_LOGI(TAG, "Clip saved");
+        }
+        // cleared first, a clip triggered once this one is released is saved too
+        portENTER_CRITICAL(&clip_save_lock);
+        clip_save_pending = false;
+        portEXIT_CRITICAL(&clip_save_lock);
+        frame_ring_release(clip_ring);
+    }
+}
+
+// /clip sends the clip as an MJPEG stream once it was triggered, following
+// the post-roll as it is recorded, /clip?save=1 has clip_task write it to
+// the storage partition instead. Either way the clip is released once the
+// last of the concurrent requests is done with it.
+static esp_err_t clip_handler(httpd_req_t *req)
+{
+    if (!clip_ring || frame_ring_hold(clip_ring) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No clip, see /trigger");
+        return ESP_FAIL;
+    }
+    if (get_query_int(req, "save")) {
+        if (!clip_task_handle) {
+            frame_ring_release(clip_ring);
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        save_clip_async();
+        return httpd_resp_sendstr(req, "saving");
+    }
+
+    esp_err_t res = httpd_resp_set_type(req, STREAM_CONTENT_TYPE);
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY));
+    }
+    frame_ring_frame_t frame;
+    uint32_t i = 0;
+    while (res == ESP_OK) {
+        esp_err_t err = frame_ring_get_clip_frame(clip_ring, i, &frame);
+        if (err == ESP_ERR_NOT_FOUND) {
+            if (frame_ring_get_clip(clip_ring, NULL) != FRAME_RING_TRIGGERED) {
+                break;
+            }
+            vTaskDelay(pdMS_TO_TICKS(20));
+            continue;
+        } else if (err != ESP_OK) {
+            break;
+        }
+        camera_fb_t fb = {
+            .timestamp = { .tv_sec = frame.timestamp / 1000000, .tv_usec = frame.timestamp % 1000000 },
+            .seq = frame.seq,
+        };
+        res = send_part(req, &fb, frame.buf, frame.len);
+        i++;
+    }
+    if (res == ESP_OK) {
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    ESP_LOGI(TAG, "Clip of %u frames sent", (unsigned)i);
+    frame_ring_release(clip_ring);
+    return res;
+}
+
+// Server-sent events, one JSON object per frame with motion
+static esp_err_t motion_handler(httpd_req_t *req)
+{
+    char buf[96 + MOTION_DETECT_MAX_REGIONS * 64];
+    motion_event_t ev;
+
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    while (true) {
+        int len;
+        if (motion_detect_get_event(motion, &ev, pdMS_TO_TICKS(5000)) == ESP_OK) {
+            len = snprintf(buf, sizeof(buf), "data: {\"time\":%lld,\"width\":%u,\"height\":%u,\"changed\":%u,\"regions\":[",
+                           (long long)ev.timestamp, ev.width, ev.height, ev.changed_tiles);
+            for (int i = 0; i < ev.region_count; i++) {
+                const motion_region_t *r = &ev.regions[i];
+                len += snprintf(buf + len, sizeof(buf) - len, "%s{\"x\":%u,\"y\":%u,\"w\":%u,\"h\":%u,\"tiles\":%u}",
+                                i ? "," : "", r->x, r->y, r->w, r->h, r->tiles);
+            }
+            len += snprintf(buf + len, sizeof(buf) - len, "]}\n\n");
+        } else {
+            len = snprintf(buf, sizeof(buf), ": keepalive\n\n");
+        }
+        if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) {
+            break;
+        }
+    }
     return ESP_OK;
 }
 
-void start_camera_server(void)
+static void start_motion_server(httpd_config_t *config)
 {
+    motion_detect_config_t motion_config = MOTION_DETECT_CONFIG_DEFAULT();
+    if (motion_detect_create(&motion_config, &motion) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create motion detector");
+    }
+    frame_ring_config_t ring_config = FRAME_RING_CONFIG_DEFAULT();
+    if (frame_ring_create(&ring_config, &clip_ring) != ESP_OK) {
+        ESP_LOGW(TAG, "No memory for the clip ring, clips disabled");
+    } else if (xTaskCreate(clip_task, "clip", 4096, NULL, 3, &clip_task_handle) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to start the clip task, clips are only kept for /clip");
+        clip_task_handle = NULL;
+    }
+    // captures for all the servers
+    xTaskCreatePinnedToCore(motion_task, "motion", 4096, NULL, 5, NULL, 1);
+    if (!motion) {
+        return;
+    }
+
+    // event streams block their worker, so they get a server of their own
+    httpd_handle_t server = NULL;
+    config->server_port += 1;
+    config->ctrl_port += 1;
+    if (httpd_start(&server, config) == ESP_OK) {
+        httpd_uri_t uri = {
+            .uri = "/motion",
+            .method = HTTP_GET,
+            .handler = motion_handler,
+            .user_ctx = NULL
+        };
+        httpd_register_uri_handler(server, &uri);
+        ESP_LOGI(TAG, "Motion events on port %d /motion", config->server_port);
+    }
+}
+
+static void start_stream_server(httpd_config_t *config)
+{
+    // streams block their worker as well
+    httpd_handle_t server = NULL;
+    if (httpd_start(&server, config) == ESP_OK) {
+        httpd_uri_t uri = {
+            .uri = "/stream",
+            .method = HTTP_GET,
+            .handler = stream_handler,
+            .user_ctx = NULL
+        };
+        httpd_register_uri_handler(server, &uri);
+        uri.uri = "/tiles";
+        uri.handler = tiles_handler;
+        httpd_register_uri_handler(server, &uri);
+        uri.uri = "/clip";
+        uri.handler = clip_handler;
+        httpd_register_uri_handler(server, &uri);
+        ESP_LOGI(TAG, "MJPEG stream on port %d /stream, tile stream on /tiles, clips on /clip", config->server_port);
+    }
+}
+
+void start_camera_server(size_t stack_size)
+{
+    frame_lock = xSemaphoreCreateMutex();
+    if (!frame_lock) {
+        ESP_LOGE(TAG, "Failed to create frame lock");
+        return;
+    }
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
+    if (stack_size) {
+        // the stream and motion servers encode on their workers
+        config.stack_size = stack_size;
+    }
 
     httpd_handle_t server = NULL;
     if (httpd_start(&server, &config) == ESP_OK) {
@@ -35,8 +851,23 @@ void start_camera_server(void)
             .user_ctx = NULL
         };
         httpd_register_uri_handler(server, &uri);
+        uri.uri = "/tiles.html";
+        uri.handler = tiles_page_handler;
+        httpd_register_uri_handler(server, &uri);
+        uri.uri = "/record";
+        uri.handler = record_handler;
+        httpd_register_uri_handler(server, &uri);
+        uri.uri = "/trigger";
+        uri.handler = trigger_handler;
+        httpd_register_uri_handler(server, &uri);
         ESP_LOGI(TAG, "Camera server started on /jpg");
     }
+
+    httpd_config_t stream_config = config;
+    stream_config.server_port += STREAM_PORT_OFFSET;
+    stream_config.ctrl_port += STREAM_PORT_OFFSET;
+    start_motion_server(&config);
+    start_stream_server(&stream_config);
 }
 
 
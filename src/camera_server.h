@@ -1,10 +1,16 @@
 #pragma once
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void start_camera_server(void);
+// stack_size of the server tasks, 0 for the httpd default
+void start_camera_server(size_t stack_size);
+
+// Keep the frames around now as a clip, served on /clip of the stream port
+void camera_server_trigger(void);
 
 #ifdef __cplusplus
 }
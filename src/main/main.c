@@ -8,9 +8,15 @@
 #include "esp_mac.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "esp_vfs_fat.h"
+#include "esp_vfs_eventfd.h"
+#include "driver/uart.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "camera_server.h"
+#include "socket_server.h"
+#include "mem_budget.h"
+#include "robot_uart.h"
 #include "wifi_provisioning/manager.h"
 #include "wifi_provisioning/scheme_ble.h"
 
@@ -19,6 +25,12 @@ static const char *TAG = "PinTest";
 static EventGroupHandle_t wifi_event_group;
 #define WIFI_CONNECTED_BIT BIT0
 
+// BLE provisioning ran on this boot, it ends once Wi-Fi is connected
+static bool provisioning = false;
+
+// the camera starts small, mem_budget_reclaim() grows it once BT is gone
+static camera_config_t camera_config;
+
 
 typedef struct {
     int pin_pwdn;
@@ -70,7 +82,7 @@ static bool init_camera(void) {
   
   cam_pins_t *p = &configs[0];
 
-  camera_config_t c = {
+  camera_config = (camera_config_t) {
       .pin_pwdn  = p->pin_pwdn,
       .pin_reset = p->pin_reset,
       .pin_xclk  = p->pin_xclk,
@@ -96,7 +108,7 @@ static bool init_camera(void) {
       .fb_count = 1
   };
 
-  esp_err_t err = esp_camera_init(&c);
+  esp_err_t err = esp_camera_init(&camera_config);
   return err == ESP_OK;
 }
 
@@ -117,7 +129,8 @@ static void start_ble_provisioning(void)
 
     wifi_prov_mgr_config_t prov_cfg = {
         .scheme = wifi_prov_scheme_ble,
-        .scheme_event_handler = WIFI_PROV_SCHEME_BLE_EVENT_HANDLER_FREE_BTDM
+        // the BT memory is released by mem_budget_reclaim(), on every boot
+        .scheme_event_handler = WIFI_PROV_EVENT_HANDLER_NONE
     };
 
     ESP_ERROR_CHECK(wifi_prov_mgr_init(prov_cfg));
@@ -137,6 +150,7 @@ static void start_ble_provisioning(void)
         sprintf(service_name, "RobiEye-%02X%02X", mac[4], mac[5]);
         ESP_ERROR_CHECK(wifi_prov_mgr_start_provisioning(
             security, pop, service_name, NULL));
+        provisioning = true;
     } else {
         ESP_LOGI("prov", "Already provisioned, starting WiFi");
         wifi_prov_mgr_deinit();
@@ -190,6 +204,51 @@ void wifi_init_sta(void)
 
 
 
+// FAT with wear levelling on the storage partition, it holds the recordings
+static void mount_storage(void)
+{
+  static wl_handle_t wl_handle = WL_INVALID_HANDLE;
+  const esp_vfs_fat_mount_config_t mount_cfg = {
+      .max_files = 4,
+      .format_if_mount_failed = true,
+      .allocation_unit_size = CONFIG_WL_SECTOR_SIZE,
+  };
+  esp_err_t err = esp_vfs_fat_spiflash_mount_rw_wl("/storage", "storage", &mount_cfg, &wl_handle);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Storage not mounted, recording disabled: %s", esp_err_to_name(err));
+  }
+}
+
+static void bump_task(void *arg)
+{
+  char line[32];
+  size_t len = 0;
+  while (1) {
+    uint8_t c;
+    if (uart_read_bytes(ROBOT_UART, &c, 1, portMAX_DELAY) != 1) {
+      continue;
+    }
+    if (c == '\n' || c == '\r') {
+      if (len == 4 && !strncmp(line, "BUMP", 4)) {
+        camera_server_trigger();
+      }
+      len = 0;
+    } else if (len < sizeof(line)) {
+      line[len++] = c;
+    }
+  }
+}
+
+// the robot controller reports collisions as "BUMP" lines
+static void start_bump_listener(void)
+{
+  if (robot_uart_init() != ESP_OK) {
+    ESP_LOGW(TAG, "Bump UART not available, clips only on /trigger");
+    return;
+  }
+  xTaskCreate(bump_task, "bump", 2048, NULL, 5, NULL);
+}
+
 void app_main(void)
 {
   vTaskDelay(pdMS_TO_TICKS(3000));
@@ -210,6 +269,11 @@ void app_main(void)
   ESP_LOGI(TAG, "Network initialized, waiting for IP");
   xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
   ESP_LOGI(TAG, "IP acquired");
+  if (provisioning) {
+    // the manager stops itself after the credentials worked
+    wifi_prov_mgr_wait();
+    wifi_prov_mgr_deinit();
+  }
 
   ESP_LOGI(TAG, "Initializing camera");
   bool camera_ok = init_camera();
@@ -218,12 +282,26 @@ void app_main(void)
     vTaskDelay(pdMS_TO_TICKS(1000));
     return;
   }
+  // the BT memory goes to frame buffers, the DMA ring and the server stacks
+  const mem_budget_config_t budget_cfg = MEM_BUDGET_CONFIG_DEFAULT();
+  mem_budget_result_t budget;
+  if (mem_budget_reclaim(&budget_cfg, &camera_config, &budget) != ESP_OK) {
+    ESP_LOGW(TAG, "Camera runs with %u frame buffer(s)", (unsigned)camera_config.fb_count);
+  }
   sensor_t *s = esp_camera_sensor_get();
   s->set_vflip(s, 1);
   s->set_hmirror(s, 1);
+  mount_storage();
+  // the stream handlers wait on esp_camera_get_frame_fd() and their socket
+  const esp_vfs_eventfd_config_t eventfd_cfg = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+  if (esp_vfs_eventfd_register(&eventfd_cfg) != ESP_OK) {
+    ESP_LOGW(TAG, "eventfd not registered, streams poll for frames");
+  }
   ESP_LOGI(TAG, "Camera OK, starting camera server");
   vTaskDelay(pdMS_TO_TICKS(1000));
-  start_camera_server();
+  start_camera_server(budget.httpd_stack_size);
+  start_bump_listener();
+  socket_server_init();
 
   while (1) {
       vTaskDelay(pdMS_TO_TICKS(1000));
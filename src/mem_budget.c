@@ -0,0 +1,167 @@
+/*
+ * Internal RAM budget once Wi-Fi is connected, see mem_budget.h
+ */
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_http_server.h"
+#include "sdkconfig.h"
+#if CONFIG_BT_ENABLED
+#include "esp_bt.h"
+#endif
+#include "mem_budget.h"
+
+static const char *TAG = "MemBudget";
+
+#if CONFIG_MEM_BUDGET_MEASURE_FPS
+// frames timed for the frame rate before and after
+#define FPS_FRAMES      20
+#endif
+
+void mem_budget_get_heap(mem_budget_heap_t *heap)
+{
+    heap->internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    heap->internal_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    heap->dma_free = heap_caps_get_free_size(MALLOC_CAP_DMA);
+    heap->psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+}
+
+static void log_heap(const char *when, const mem_budget_heap_t *heap)
+{
+    ESP_LOGI(TAG, "Heap %s: internal %u free, %u largest block, DMA %u, PSRAM %u", when,
+             (unsigned)heap->internal_free, (unsigned)heap->internal_largest,
+             (unsigned)heap->dma_free, (unsigned)heap->psram_free);
+}
+
+static void release_bt(void)
+{
+#if CONFIG_BT_ENABLED
+    static bool released = false;
+    if (released) {
+        return;
+    }
+    // provisioning deinitializes the controller when it ends
+    if (esp_bt_controller_get_status() != ESP_BT_CONTROLLER_STATUS_IDLE) {
+        ESP_LOGW(TAG, "BT controller still in use, its memory is kept");
+        return;
+    }
+    esp_err_t err = esp_bt_mem_release(ESP_BT_MODE_BTDM);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "BT memory not released: %s", esp_err_to_name(err));
+        return;
+    }
+    released = true;
+#endif
+}
+
+#if CONFIG_MEM_BUDGET_MEASURE_FPS
+static float camera_fps(void)
+{
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < FPS_FRAMES; i++) {
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (!fb) {
+            return 0;
+        }
+        esp_camera_fb_return(fb);
+    }
+    return FPS_FRAMES * 1e6f / (esp_timer_get_time() - start);
+}
+#endif
+
+// what runs when nothing is grown
+static void plan_defaults(const camera_config_t *camera, mem_budget_result_t *result)
+{
+    httpd_config_t httpd_default = HTTPD_DEFAULT_CONFIG();
+    result->httpd_stack_size = httpd_default.stack_size;
+    result->fb_count = camera->fb_count;
+    result->fb_dram_budget = camera->fb_dram_budget;
+    result->dma_buffer_size = camera->dma_buffer_size;
+}
+
+// spends the internal RAM above the reserve: the stacks first, the servers
+// need them, then the DMA ring, which has to be one block, then frames
+static esp_err_t plan(const mem_budget_config_t *config, const mem_budget_heap_t *heap, mem_budget_result_t *result)
+{
+    httpd_config_t httpd_default = HTTPD_DEFAULT_CONFIG();
+    result->httpd_stack_size = httpd_default.stack_size;
+    size_t spare = heap->internal_free > config->reserve ? heap->internal_free - config->reserve : 0;
+    if (!spare) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (config->httpd_stack_size > httpd_default.stack_size) {
+        size_t growth = config->httpd_servers * (config->httpd_stack_size - httpd_default.stack_size);
+        if (growth <= spare) {
+            result->httpd_stack_size = config->httpd_stack_size;
+            spare -= growth;
+        }
+    }
+
+    // the ring of the running camera is freed before the new one is allocated
+    result->dma_buffer_size = 0;
+    if (config->dma_buffer_size <= spare && config->dma_buffer_size <= heap->internal_largest) {
+        result->dma_buffer_size = config->dma_buffer_size;
+        spare -= config->dma_buffer_size;
+    }
+
+    result->fb_count = config->fb_count;
+    result->fb_dram_budget = spare < config->fb_dram_max ? spare : config->fb_dram_max;
+    return ESP_OK;
+}
+
+esp_err_t mem_budget_reclaim(const mem_budget_config_t *config, camera_config_t *camera, mem_budget_result_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    mem_budget_get_heap(&result->before);
+    log_heap("before", &result->before);
+#if CONFIG_MEM_BUDGET_MEASURE_FPS
+    float fps_before = camera_fps();
+#endif
+
+    release_bt();
+    mem_budget_get_heap(&result->released);
+    log_heap("after releasing BT", &result->released);
+    ESP_LOGI(TAG, "BT released %d bytes of internal RAM",
+             (int)(result->released.internal_free - result->before.internal_free));
+
+    esp_err_t err = plan(config, &result->released, result);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "No internal RAM above the %u byte reserve, camera not grown", (unsigned)config->reserve);
+        plan_defaults(camera, result);
+        result->grown = result->released;
+        return err;
+    }
+
+    camera_config_t grown = *camera;
+    grown.fb_count = result->fb_count;
+    grown.fb_dram_budget = result->fb_dram_budget;
+    grown.dma_buffer_size = result->dma_buffer_size;
+    err = esp_camera_reconfigure(&grown);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Camera not grown: %s", esp_err_to_name(err));
+        if (esp_camera_reconfigure(camera) != ESP_OK) {
+            ESP_LOGE(TAG, "Camera not restored either");
+        }
+        // the stacks were planned next to the grown camera, the servers
+        // start with the defaults like the camera runs with its own
+        plan_defaults(camera, result);
+        mem_budget_get_heap(&result->grown);
+        return err;
+    }
+    *camera = grown;
+    mem_budget_get_heap(&result->grown);
+    log_heap("after growing", &result->grown);
+
+    camera_fb_pool_stats_t pool = { 0 };
+    esp_camera_get_fb_pool_stats(&pool);
+    ESP_LOGI(TAG, "Camera: %u frame buffers, %u in DRAM, DMA ring %s; HTTP server stacks %u bytes",
+             (unsigned)result->fb_count, pool.dram_slots, result->dma_buffer_size ? "grown" : "default",
+             (unsigned)result->httpd_stack_size);
+#if CONFIG_MEM_BUDGET_MEASURE_FPS
+    ESP_LOGI(TAG, "Capture %.1f fps before, %.1f fps after", fps_before, camera_fps());
+#endif
+    return ESP_OK;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Internal RAM budget once Wi-Fi is connected.
+ *
+ * BLE is only used for provisioning, but the BT controller and host keep
+ * their memory reserved on every boot. mem_budget_reclaim() releases it for
+ * good and spends what is free above a reserve on the camera, through
+ * esp_camera_reconfigure(), and on the stacks of the HTTP servers, which are
+ * started afterwards.
+ */
+
+typedef struct {
+    size_t reserve;             // internal RAM left for Wi-Fi, lwIP and the other tasks
+    size_t fb_count;            // frame buffers of the grown camera
+    size_t fb_dram_max;         // at most this much DRAM for frame buffers
+    size_t dma_buffer_size;     // DMA ring of the grown camera
+    size_t httpd_servers;       // HTTP servers started with httpd_stack_size
+    size_t httpd_stack_size;
+} mem_budget_config_t;
+
+#define MEM_BUDGET_CONFIG_DEFAULT() {   \
+    .reserve = 48 * 1024,               \
+    .fb_count = 2,                      \
+    .fb_dram_max = 64 * 1024,           \
+    .dma_buffer_size = 32 * 1024,       \
+    .httpd_servers = 3,                 \
+    .httpd_stack_size = 8192,           \
+}
+
+typedef struct {
+    size_t internal_free;
+    size_t internal_largest;    // largest free block
+    size_t dma_free;
+    size_t psram_free;
+} mem_budget_heap_t;
+
+typedef struct {
+    mem_budget_heap_t before;
+    mem_budget_heap_t released; // after the BT memory was released
+    mem_budget_heap_t grown;    // after the camera was reconfigured
+    size_t fb_count;
+    size_t fb_dram_budget;
+    size_t dma_buffer_size;     // 0 for the driver default
+    size_t httpd_stack_size;    // for the HTTP servers, the httpd default if not grown
+} mem_budget_result_t;
+
+void mem_budget_get_heap(mem_budget_heap_t *heap);
+
+/**
+ * @brief Release the BT memory and grow the camera and HTTP servers into it
+ *
+ * BLE provisioning must be over, it cannot run again until reboot. The camera
+ * keeps its configuration if it cannot be grown. Growing initializes the
+ * sensor again, its settings have to be applied afterwards.
+ *
+ * @param config    Budget configuration
+ * @param camera    Configuration the camera is running with, updated to the
+ *                  grown one on success
+ * @param result    Heap before and after, and what was grown. Holds the
+ *                  running camera configuration and the httpd default stack
+ *                  size when nothing was grown
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_NO_MEM if nothing fits above the reserve
+ *     - Propagated error from esp_camera_reconfigure()
+ */
+esp_err_t mem_budget_reclaim(const mem_budget_config_t *config, camera_config_t *camera, mem_budget_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
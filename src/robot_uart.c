@@ -0,0 +1,49 @@
+#include <stdbool.h>
+#include "robot_uart.h"
+#include "esp_log.h"
+
+static const char *TAG = "RobotUart";
+
+#define ROBOT_UART_RX_BUF   256
+#define ROBOT_UART_TX_BUF   512
+
+static esp_err_t init_result = ESP_ERR_INVALID_STATE;
+static bool initialized = false;
+
+esp_err_t robot_uart_init(void)
+{
+    if (initialized) {
+        return init_result;
+    }
+    initialized = true;
+    const uart_config_t uart_cfg = {
+        .baud_rate = ROBOT_UART_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    init_result = uart_driver_install(ROBOT_UART, ROBOT_UART_RX_BUF, ROBOT_UART_TX_BUF, 0, NULL, 0);
+    if (init_result == ESP_OK) {
+        init_result = uart_param_config(ROBOT_UART, &uart_cfg);
+    }
+    if (init_result == ESP_OK) {
+        init_result = uart_set_pin(ROBOT_UART, ROBOT_UART_TX, ROBOT_UART_RX, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    }
+    if (init_result != ESP_OK) {
+        ESP_LOGE(TAG, "UART to the robot not available: %s", esp_err_to_name(init_result));
+        if (uart_is_driver_installed(ROBOT_UART)) {
+            uart_driver_delete(ROBOT_UART);
+        }
+    }
+    return init_result;
+}
+
+int robot_uart_write(const char *data, size_t len)
+{
+    if (init_result != ESP_OK) {
+        return -1;
+    }
+    return uart_write_bytes(ROBOT_UART, data, len);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+#include "driver/uart.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * UART2 to the robot controller.
+ *
+ * Commands from the socket server go out on TX, the controller reports
+ * collisions as "BUMP" lines on RX. Both sides share one driver, installed by
+ * the first robot_uart_init() call.
+ */
+
+#define ROBOT_UART          UART_NUM_2
+#define ROBOT_UART_TX       3
+#define ROBOT_UART_RX       2
+#define ROBOT_UART_BAUD     115200
+
+// Installs the driver and routes both pins, later calls return the first result.
+// Called from app_main only, it is not thread safe.
+esp_err_t robot_uart_init(void);
+
+// Queues data for the robot, -1 if the UART is not available
+int robot_uart_write(const char *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Socket Server for Robot Control
+ * Uses lwip sockets (ESP-IDF native)
+ *
+ * Messages are enclosed in braces. {Heartbeat} keeps the connection, the
+ * robot is stopped when the client misses three of them. {Clock:t1} is
+ * answered with {Clock:t1,t2,t3}, t2 and t3 being the receive and send times
+ * on the camera clock (esp_timer, the clock of the frame timestamps), so the
+ * client can compute the clock offset NTP style. Everything else is passed
+ * on to the robot over UART2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "robot_uart.h"
+#include "socket_server.h"
+
+static const char *TAG = "SocketServer";
+
+#define SOCKET_PORT 100
+
+static void handle_message(int client_fd, const char *msg, int64_t rx_us, bool *heartbeat)
+{
+    if (strcmp(msg, "{Heartbeat}") == 0) {
+        *heartbeat = true;
+    } else if (strncmp(msg, "{Clock:", 7) == 0) {
+        char reply[80];
+        long long t1 = strtoll(msg + 7, NULL, 10);
+        int len = snprintf(reply, sizeof(reply), "{Clock:%lld,%lld,%lld}", t1, (long long)rx_us, (long long)esp_timer_get_time());
+        send(client_fd, reply, len, 0);
+    } else {
+        robot_uart_write(msg, strlen(msg));
+    }
+}
+
+// Handle client connection
+static void socket_client_task(void *pvParameters)
+{
+    int client_fd = (int)pvParameters;
+    char read_buf[512];
+    char msg[512];
+    size_t msg_len = 0;
+    bool in_msg = false;
+    uint8_t heartbeat_count = 0;
+    bool heartbeat_status = false;
+    TickType_t last_heartbeat = xTaskGetTickCount();
+
+    // short timeout, the heartbeat is sent from this task as well
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    ESP_LOGI(TAG, "Client connected");
+
+    while (1) {
+        int len = recv(client_fd, read_buf, sizeof(read_buf), 0);
+        int64_t rx_us = esp_timer_get_time();
+        if (len > 0) {
+            for (int i = 0; i < len; i++) {
+                char c = read_buf[i];
+                if (c == '{') {
+                    in_msg = true;
+                    msg_len = 0;
+                }
+                if (!in_msg || c == ' ' || msg_len >= sizeof(msg) - 1) {
+                    continue;
+                }
+                msg[msg_len++] = c;
+                if (c == '}') {
+                    msg[msg_len] = '\0';
+                    in_msg = false;
+                    handle_message(client_fd, msg, rx_us, &heartbeat_status);
+                }
+            }
+        } else if (len == 0) {
+            ESP_LOGI(TAG, "Client disconnected");
+            break;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            break;
+        }
+
+        // Send heartbeat every second
+        TickType_t now = xTaskGetTickCount();
+        if (now - last_heartbeat >= pdMS_TO_TICKS(1000)) {
+            const char *heartbeat = "{Heartbeat}";
+            send(client_fd, heartbeat, strlen(heartbeat), 0);
+
+            if (heartbeat_status) {
+                heartbeat_status = false;
+                heartbeat_count = 0;
+            } else {
+                heartbeat_count++;
+            }
+
+            if (heartbeat_count > 3) {
+                ESP_LOGW(TAG, "Heartbeat timeout, disconnecting");
+                break;
+            }
+
+            last_heartbeat = now;
+        }
+    }
+
+    // Send stop command to robot
+    const char *stop_cmd = "{\"N\":100}";
+    robot_uart_write(stop_cmd, strlen(stop_cmd));
+
+    close(client_fd);
+    ESP_LOGI(TAG, "Client connection closed");
+    vTaskDelete(NULL);
+}
+
+// Socket server task
+static void socket_server_task(void *pvParameters)
+{
+    struct sockaddr_in server_addr;
+    int opt = 1;
+
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        ESP_LOGE(TAG, "Failed to create socket");
+        vTaskDelete(NULL);
+        return;
+    }
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(SOCKET_PORT);
+    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0
+        || listen(server_fd, 5) < 0) {
+        ESP_LOGE(TAG, "Failed to listen on port %d", SOCKET_PORT);
+        close(server_fd);
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Socket server started on port %d", SOCKET_PORT);
+
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
+        if (client_fd < 0) {
+            ESP_LOGE(TAG, "Failed to accept connection");
+            continue;
+        }
+        ESP_LOGI(TAG, "New client connected from %s", inet_ntoa(client_addr.sin_addr));
+        // no delay, the clock replies are timed
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        xTaskCreate(socket_client_task, "socket_client", 4096, (void *)client_fd, 5, NULL);
+    }
+}
+
+// Initialize socket server
+void socket_server_init(void)
+{
+    if (robot_uart_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Commands are not passed on to the robot");
+    }
+    xTaskCreate(socket_server_task, "socket_server", 4096, NULL, 5, NULL);
+}
@@ -0,0 +1,7 @@
+#ifndef SOCKET_SERVER_H
+#define SOCKET_SERVER_H
+
+void socket_server_init(void);
+
+#endif
+
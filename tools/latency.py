@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""Capture to client latency of the camera MJPEG stream.
+
+Reads the stream on port 82 and takes the capture time of each frame from
+its X-Frame-Ts header (the VSYNC interrupt, in microseconds since the camera
+booted) and the frame number from X-Frame-Seq. The camera clock is mapped to
+the local clock with {Clock:t1} exchanges on the robot socket, port 100,
+repeated every second, which also serve as its heartbeat.
+
+    tools/latency.py 192.168.4.1 --seconds 30
+
+Prints latency percentiles from VSYNC to the end of the JPEG arriving here,
+and the gaps in the frame numbers, i.e. frames the camera captured but that
+never reached this client. The latency includes the time the sensor takes to
+read the frame out after VSYNC, but not the exposure before it.
+"""
+
+import argparse
+import socket
+import threading
+import time
+import urllib.request
+
+
+def now_us():
+    return time.monotonic_ns() // 1000
+
+
+class CameraClock:
+    """Offset of the camera clock from the local one, NTP style."""
+
+    def __init__(self, host, port):
+        self.sock = socket.create_connection((host, port), timeout=2)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buf = b""
+        self.offset = None      # camera minus local time
+        self.rtt = None
+        self.lock = threading.Lock()
+
+    def _message(self):
+        while b"}" not in self.buf:
+            data = self.sock.recv(256)
+            if not data:
+                raise ConnectionError("camera closed the clock socket")
+            self.buf += data
+        msg, self.buf = self.buf.split(b"}", 1)
+        return msg[msg.find(b"{") + 1:].decode()
+
+    def exchange(self, rounds=8):
+        """Keeps the sample with the shortest round trip, the least skewed one."""
+        best = None
+        self.sock.sendall(b"{Heartbeat}")
+        for _ in range(rounds):
+            t1 = now_us()
+            self.sock.sendall(b"{Clock:%d}" % t1)
+            while True:
+                msg = self._message()
+                if msg.startswith("Clock:"):
+                    break
+            t4 = now_us()
+            r1, t2, t3 = (int(v) for v in msg[6:].split(","))
+            if r1 != t1:
+                continue
+            rtt = (t4 - t1) - (t3 - t2)
+            offset = ((t2 - t1) + (t3 - t4)) // 2
+            if best is None or rtt < best[0]:
+                best = (rtt, offset)
+        with self.lock:
+            self.rtt, self.offset = best
+
+    def to_local(self, camera_us):
+        with self.lock:
+            return camera_us - self.offset
+
+    def run(self, stop):
+        while not stop.wait(1.0):
+            self.exchange()
+
+
+def read_parts(stream):
+    """Yields the headers of each part, after its body was read."""
+    while True:
+        line = stream.readline()
+        if not line:
+            return
+        if not line.startswith(b"--"):
+            continue
+        headers = {}
+        while True:
+            line = stream.readline().strip()
+            if not line:
+                break
+            key, _, value = line.decode().partition(":")
+            headers[key.strip().lower()] = value.strip()
+        stream.read(int(headers.get("content-length", 0)))
+        yield headers
+
+
+def percentile(values, p):
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100
+    lo = int(k)
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (k - lo)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("--seconds", type=float, default=30)
+    parser.add_argument("--stream", default="http://{host}:82/stream?threshold=255",
+                        help="stream URL, change suppression is off by default so gaps are drops")
+    parser.add_argument("--clock-port", type=int, default=100)
+    args = parser.parse_args()
+
+    clock = CameraClock(args.host, args.clock_port)
+    clock.exchange()
+    print("clock offset %.3f s, round trip %.1f ms" % (clock.offset / 1e6, clock.rtt / 1e3))
+    stop = threading.Event()
+    threading.Thread(target=clock.run, args=(stop,), daemon=True).start()
+
+    latencies = []
+    gaps = {}
+    last_seq = None
+    end = time.monotonic() + args.seconds
+    with urllib.request.urlopen(args.stream.format(host=args.host), timeout=5) as stream:
+        for headers in read_parts(stream):
+            arrived = now_us()
+            if "x-frame-ts" not in headers:
+                raise SystemExit("the stream has no X-Frame-Ts headers, is the firmware up to date?")
+            latencies.append((arrived - clock.to_local(int(headers["x-frame-ts"]))) / 1000)
+            seq = int(headers["x-frame-seq"])
+            if last_seq is not None and seq - last_seq > 1:
+                gaps[seq - last_seq - 1] = gaps.get(seq - last_seq - 1, 0) + 1
+            last_seq = seq
+            if time.monotonic() > end:
+                break
+    stop.set()
+
+    if not latencies:
+        raise SystemExit("no frames received")
+    print("%d frames, latency ms: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f" % (
+        len(latencies), percentile(latencies, 50), percentile(latencies, 90),
+        percentile(latencies, 99), max(latencies)))
+    dropped = sum(n * count for n, count in gaps.items())
+    print("%d frames dropped in %d gaps" % (dropped, sum(gaps.values())))
+    for n in sorted(gaps):
+        print("  gap of %d: %d times" % (n, gaps[n]))
+
+
+if __name__ == "__main__":
+    main()
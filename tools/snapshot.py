@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Baseline against progressive snapshots from the camera.
+
+Fetches /jpg and /jpg?progressive=1 in turn and times each response as it
+arrives: the first byte, which comes once the camera captured and encoded the
+snapshot, the end of the first scan, where a browser can draw a full frame
+preview of a progressive JPEG, and the last byte.
+
+    tools/snapshot.py 192.168.4.1 --rounds 10 --quality 80
+
+Prints the medians. The extra time to the first byte of the progressive
+snapshots is what the encode costs on the camera.
+"""
+
+import argparse
+import time
+import urllib.request
+
+
+def first_scan_end(jpg):
+    """Offset of the marker after the first scan, the end of the image for baseline."""
+    i = 2
+    while i + 3 < len(jpg):
+        marker = jpg[i + 1]
+        i += 2 + ((jpg[i + 2] << 8) | jpg[i + 3])
+        if marker == 0xDA:
+            break
+    # entropy coded data up to the next marker that is not a restart
+    while i + 1 < len(jpg):
+        if jpg[i] == 0xFF and jpg[i + 1] != 0x00 and not 0xD0 <= jpg[i + 1] <= 0xD7:
+            return i
+        i += 1
+    return len(jpg)
+
+
+def fetch(url):
+    """Returns the JPEG and the arrival time of every chunk of it."""
+    start = time.monotonic()
+    chunks = []
+    with urllib.request.urlopen(url, timeout=10) as resp:
+        while True:
+            data = resp.read1(4096)
+            if not data:
+                break
+            chunks.append((time.monotonic() - start, data))
+    return b"".join(data for _, data in chunks), chunks
+
+
+def arrival(chunks, offset):
+    """Time the byte at offset arrived."""
+    received = 0
+    for t, data in chunks:
+        received += len(data)
+        if received > offset:
+            return t
+    return chunks[-1][0]
+
+
+def median(values):
+    values = sorted(values)
+    return values[len(values) // 2]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("--rounds", type=int, default=10)
+    parser.add_argument("--quality", type=int, default=0, help="also requantize, 0 keeps the sensor quality")
+    parser.add_argument("--url", default="http://{host}/jpg")
+    args = parser.parse_args()
+
+    modes = (("baseline", {}), ("progressive", {"progressive": 1}))
+    results = {name: [] for name, _ in modes}
+    for _ in range(args.rounds):
+        for name, query in modes:
+            if args.quality:
+                query = dict(query, quality=args.quality)
+            url = args.url.format(host=args.host)
+            if query:
+                url += "?" + "&".join("%s=%d" % kv for kv in query.items())
+            jpg, chunks = fetch(url)
+            preview = first_scan_end(jpg)
+            results[name].append((len(jpg), chunks[0][0], preview, arrival(chunks, preview - 1), chunks[-1][0]))
+
+    print("mode        ,  bytes , first byte ms , preview bytes , preview ms , last byte ms")
+    for name, _ in modes:
+        r = results[name]
+        print("%-11s , %6d , %13.1f , %13d , %10.1f , %12.1f" % (
+            name, median([x[0] for x in r]), median([x[1] for x in r]) * 1e3, median([x[2] for x in r]),
+            median([x[3] for x in r]) * 1e3, median([x[4] for x in r]) * 1e3))
+
+
+if __name__ == "__main__":
+    main()